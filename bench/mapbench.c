@@ -0,0 +1,772 @@
+/*!
+ * \ingroup game_group
+ * \file mapbench.c
+ * \brief Benchmark of the functions saving and loading
+ *        map archives.
+ *
+ * The `mapbench` program generates synthetic maps across
+ * the sizes allowed by \ref MIN_WIDTH, \ref MAX_WIDTH,
+ * \ref MIN_HEIGHT and \ref MAX_HEIGHT, and various numbers
+ * of tiles. Each map is saved with every encoding and
+ * layout, autosaved with map_save_incremental() after a
+ * few tiles change, then loaded back with map_load() and
+ * map_load_mapped(), and with map_load() on as many 
+ * threads as processors. The widest maps go beyond 
+ * \ref MAX_WIDTH.
+ *
+ * The map is held by a minimal store defined below in
+ * place of the one of the game. Hence, the tiles are
+ * never loaded as textures and only the archive I/O is
+ * measured.
+ *
+ * The program writes one line per operation on the
+ * standard output, fields being separated by tabulations:
+ *
+ * | Field         | Description                           |
+ * |:-------------:|:-------------------------------------:|
+ * | `operation`   | `save`, `autosave`, `load`,           |
+ * |               | `load_mapped` or `load_parallel`      |
+ * | `encoding`    | `raw` or `rle`                        |
+ * | `layout`      | `contiguous` or `chunked`             |
+ * | `width`       | Width of the map                      |
+ * | `height`      | Height of the map                     |
+ * | `objects`     | Number of tiles                       |
+ * | `iterations`  | Number of runs of the operation       |
+ * | `wall_ns`     | Wall time of a run, in nanoseconds    |
+ * | `read_calls`  | Read system calls of a run            |
+ * | `write_calls` | Write system calls of a run           |
+ * | `read_bytes`  | Bytes read by a run                   |
+ * | `write_bytes` | Bytes written by a run                |
+ * | `faults`      | Page faults of a run                  |
+ *
+ * System calls and bytes are taken from `/proc/self/io`,
+ * mapped archives being accounted by page faults instead.
+ * As the transfers of `io_uring` are not accounted 
+ * there, batches are submitted with `pread()` and 
+ * `pwrite()`.
+ * The messages printed by map_save() on success are
+ * discarded.
+ *
+ * Usage:
+ *
+ * ```
+ * ./bench/mapbench [iterations] > bench.tsv
+ * ```
+ *
+ * \author H. Decoudras
+ * \version 1
+ */
+
+#define _GNU_SOURCE
+
+#include <SDL.h>
+
+#include "map.h"
+#include "error.h"
+#include "iobatch.h"
+
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+
+
+/*!
+ * \brief Default number of runs of an operation.
+ */
+#define BENCH_ITERATIONS 16
+
+/*!
+ * \brief Number of tiles changed before an autosave.
+ */
+#define AUTOSAVE_CHANGES 8
+
+
+/*!
+ * \struct bench_counters
+ * \brief The \ref bench_counters structure represents the
+ *        resources consumed by the process at some point.
+ */
+struct bench_counters
+{
+    /*!
+     * \brief Monotonic time, in nanoseconds.
+     */
+    unsigned long long wall_ns;
+
+    /*!
+     * \brief Number of read system calls.
+     */
+    unsigned long long read_calls;
+
+    /*!
+     * \brief Number of write system calls.
+     */
+    unsigned long long write_calls;
+
+    /*!
+     * \brief Number of bytes read.
+     */
+    unsigned long long read_bytes;
+
+    /*!
+     * \brief Number of bytes written.
+     */
+    unsigned long long write_bytes;
+
+    /*!
+     * \brief Number of page faults.
+     */
+    unsigned long long faults;
+
+    /*!
+     * \brief Number of bytes read from `/proc/self/io`
+     *        to fill this structure.
+     */
+    unsigned long long own_bytes;
+};
+
+
+/*!
+ * \brief Type definition of the \ref bench_counters
+ *        structure.
+ *
+ * \see bench_counters
+ */
+typedef struct bench_counters BenchCounters;
+
+
+/*!
+ * \struct bench_operation
+ * \brief The \ref bench_operation structure represents an
+ *        operation on a map archive.
+ */
+struct bench_operation
+{
+    /*!
+     * \brief Name of the operation.
+     */
+    const char* name;
+
+    /*!
+     * \brief Function performing the operation.
+     */
+    void (*run)(char*);
+};
+
+
+/*!
+ * \brief Type definition of the \ref bench_operation
+ *        structure.
+ *
+ * \see bench_operation
+ */
+typedef struct bench_operation BenchOperation;
+
+
+/*!
+ * \brief The bench_map() function measures the operations
+ *        on the map with every encoding and layout.
+ *
+ * The map is saved first, so that the following loads
+ * read the archive of the current encoding and layout.
+ *
+ * \param filename Map archive.
+ * \param iterations Number of runs of an operation.
+ */
+static void bench_map(char* filename, unsigned int iterations);
+
+/*!
+ * \brief The read_counters() function reads the resources
+ *        consumed by the process.
+ *
+ * The counters are read with a single read system call,
+ * accounted by the next call of this function.
+ *
+ * \param counters Counters to fill.
+ *
+ * \return \p **0** on success, or \p **-1** if
+ *         `/proc/self/io` cannot be read.
+ */
+static int read_counters(BenchCounters* counters);
+
+/*!
+ * \brief The add_counters() function accumulates the
+ *        resources consumed between two readings.
+ *
+ * The read system call issued by the first reading is
+ * not accounted.
+ *
+ * \param total Accumulated counters.
+ * \param begin First reading.
+ * \param end Second reading.
+ */
+static void add_counters(
+    BenchCounters* total,
+    const BenchCounters* begin,
+    const BenchCounters* end
+);
+
+/*!
+ * \brief The generate_map() function fills the map with
+ *        synthetic content.
+ *
+ * The rows are made of runs of empty cells and of random
+ * tiles, so that run-length encoding is meaningful. The
+ * content only depends on the size of the map and on the
+ * number of tiles.
+ *
+ * The map is created with map_new(), which closes the
+ * archive a chunked map may still be streamed from.
+ *
+ * \param width Number of tiles on the `x` axis.
+ * \param height Number of tiles on the `y` axis.
+ * \param objects Number of tiles.
+ */
+static void generate_map(
+    unsigned int width,
+    unsigned int height,
+    unsigned int objects
+);
+
+/*!
+ * \brief The autosave_map() function changes a few tiles
+ *        of the map, then saves it with 
+ *        map_save_incremental().
+ *
+ * The changed tiles are only taken among the existing
+ * ones, so that the tiles of the map are kept.
+ *
+ * \param filename Map archive.
+ */
+static void autosave_map(char* filename);
+
+/*!
+ * \brief The load_parallel_map() function loads the map
+ *        with map_load() on as many threads as 
+ *        processors.
+ *
+ * \param filename Map archive.
+ *
+ * \see map_load_set_threads()
+ */
+static void load_parallel_map(char* filename);
+
+/*!
+ * \brief The print_result() function prints the
+ *        measurements of an operation.
+ *
+ * \param operation Name of the operation.
+ * \param encoding Encoding of the archive.
+ * \param layout Layout of the archive.
+ * \param iterations Number of runs of the operation.
+ * \param total Accumulated counters.
+ */
+static void print_result(
+    const char* operation,
+    unsigned int encoding,
+    unsigned int layout,
+    unsigned int iterations,
+    const BenchCounters* total
+);
+
+
+/*!
+ * \brief Width of the map.
+ */
+static unsigned int store_width = 0;
+
+/*!
+ * \brief Height of the map.
+ */
+static unsigned int store_height = 0;
+
+/*!
+ * \brief Cells of the map.
+ */
+static int* store_cells = NULL;
+
+/*!
+ * \brief Number of tiles of the map.
+ */
+static unsigned int store_objects = 0;
+
+/*!
+ * \brief Number of tiles registered.
+ */
+static unsigned int store_added = 0;
+
+/*!
+ * \brief Paths of the tiles.
+ */
+static char** store_names = NULL;
+
+/*!
+ * \brief Number of frames of the tiles.
+ */
+static unsigned int* store_frames = NULL;
+
+/*!
+ * \brief Properties of the tiles.
+ */
+static unsigned int* store_types = NULL;
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Main.
+ *
+ *************************************************************/
+int main(int argc, char** argv)
+{
+    unsigned int iterations = BENCH_ITERATIONS;
+    if (argc > 1)
+    {
+        iterations = (unsigned int)strtoul(argv[1], NULL, 10);
+        if (!iterations)
+        {
+            fprintf(stderr, "Invalid number of iterations!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    BenchCounters counters;
+    if (read_counters(&counters))
+    {
+        fprintf(stderr, "Cannot read [/proc/self/io]!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Transfers of the ring are missing from /proc/self/io */
+
+    io_batch_set_ring(0);
+
+    /*
+        Messages
+
+        The messages printed by map_save() are buffered,
+        then discarded once the operation succeeds. Hence,
+        they are not accounted and errors are still shown.
+     */
+
+    static char messages[BUFSIZ];
+    setvbuf(stderr, messages, _IOFBF, sizeof(messages));
+
+    /* Archive */
+
+    const char* tmpdir = getenv("TMPDIR");
+    char directory[0x100];
+    snprintf(
+        directory,
+        sizeof(directory),
+        "%s/mapbench-XXXXXX",
+        (tmpdir ? tmpdir : "/tmp")
+    );
+    exit_on_error(mkdtemp(directory) == NULL);
+
+    char filename[0x120];
+    snprintf(filename, sizeof(filename), "%s/bench.map", directory);
+
+    static const unsigned int widths[] = {
+        MIN_WIDTH, 64, 256, MAX_WIDTH, 0x10000
+    };
+    static const unsigned int heights[] = {
+        MIN_HEIGHT, 16, MAX_HEIGHT
+    };
+    static const unsigned int objects[] = {
+        4, 64, 0xfe, 0x400
+    };
+
+    fprintf(
+        stdout,
+        "# operation\tencoding\tlayout\twidth\theight\tobjects\t"
+        "iterations\twall_ns\tread_calls\twrite_calls\t"
+        "read_bytes\twrite_bytes\tfaults\n"
+    );
+
+    for (size_t w = 0; w < sizeof(widths) / sizeof(*widths); ++w)
+    {
+        for (size_t h = 0; h < sizeof(heights) / sizeof(*heights); ++h)
+        {
+            for (size_t o = 0; o < sizeof(objects) / sizeof(*objects); ++o)
+            {
+                generate_map(widths[w], heights[h], objects[o]);
+                bench_map(filename, iterations);
+            }
+        }
+    }
+
+    unlink(filename);
+    rmdir(directory);
+
+    return EXIT_SUCCESS;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Bench map.
+ *
+ *************************************************************/
+void bench_map(char* filename, unsigned int iterations)
+{
+    static const BenchOperation operations[] = {
+        {"save", map_save},
+        {"autosave", autosave_map},
+        {"load", map_load},
+        {"load_mapped", map_load_mapped},
+        {"load_parallel", load_parallel_map}
+    };
+
+    for (unsigned int layout = MAP_LAYOUT_CONTIGUOUS;
+        layout <= MAP_LAYOUT_CHUNKED; ++layout)
+    {
+        for (unsigned int encoding = MAP_ENCODING_RAW;
+            encoding <= MAP_ENCODING_RLE; ++encoding)
+        {
+            map_save_set_encoding(encoding);
+            map_save_set_layout(layout);
+
+            for (unsigned int op = 0; 
+                op < sizeof(operations) / sizeof(*operations); ++op)
+            {
+                BenchCounters total = {0};
+                for (unsigned int i = 0; i < iterations; ++i)
+                {
+                    BenchCounters begin;
+                    BenchCounters end;
+
+                    read_counters(&begin);
+                    operations[op].run(filename);
+                    read_counters(&end);
+                    __fpurge(stderr);
+
+                    add_counters(&total, &begin, &end);
+                }
+
+                print_result(
+                    operations[op].name,
+                    encoding,
+                    layout,
+                    iterations,
+                    &total
+                );
+            }
+        }
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Map store.
+ *
+ *************************************************************/
+void map_allocate(int w, int h)
+{
+    free(store_cells);
+
+    store_width = w;
+    store_height = h;
+    store_cells = (int*)malloc((size_t)w * h * sizeof(int));
+    exit_on_error(store_cells == NULL);
+
+    for (size_t i = 0; i < (size_t)w * h; ++i)
+    {
+        store_cells[i] = MAP_OBJECT_NONE;
+    }
+}
+
+void map_set(int x, int y, int object)
+{
+    store_cells[(size_t)y * store_width + x] = object;
+}
+
+int map_get(int x, int y)
+{
+    return store_cells[(size_t)y * store_width + x];
+}
+
+unsigned int map_width(void)
+{
+    return store_width;
+}
+
+unsigned int map_height(void)
+{
+    return store_height;
+}
+
+unsigned int map_objects(void)
+{
+    return store_objects;
+}
+
+void map_object_begin(unsigned int nb_objects)
+{
+    for (unsigned int i = 0; i < store_added; ++i)
+    {
+        free(store_names[i]);
+    }
+    free(store_names);
+    free(store_frames);
+    free(store_types);
+
+    store_objects = nb_objects;
+    store_added = 0;
+    store_names = (char**)calloc(nb_objects, sizeof(char*));
+    store_frames =
+        (unsigned int*)calloc(nb_objects, sizeof(unsigned int));
+    store_types =
+        (unsigned int*)calloc(nb_objects, sizeof(unsigned int));
+    exit_on_error(
+        nb_objects &&
+        (!store_names || !store_frames || !store_types)
+    );
+}
+
+void map_object_add(
+    char* png_file, unsigned int frames, unsigned int obj_type
+)
+{
+    store_names[store_added] = strdup(png_file);
+    exit_on_error(store_names[store_added] == NULL);
+    store_frames[store_added] = frames;
+    store_types[store_added] = obj_type;
+    ++store_added;
+}
+
+void map_object_end(void)
+{
+}
+
+char* map_get_name(int obj)
+{
+    return store_names[obj];
+}
+
+unsigned int map_get_frames(int obj)
+{
+    return store_frames[obj];
+}
+
+int map_get_solidity(int obj)
+{
+    return store_types[obj] & (MAP_OBJECT_SEMI_SOLID | MAP_OBJECT_SOLID);
+}
+
+int map_is_destructible(int obj)
+{
+    return (store_types[obj] & MAP_OBJECT_DESTRUCTIBLE) != 0;
+}
+
+int map_is_collectible(int obj)
+{
+    return (store_types[obj] & MAP_OBJECT_COLLECTIBLE) != 0;
+}
+
+int map_is_generator(int obj)
+{
+    return (store_types[obj] & MAP_OBJECT_GENERATOR) != 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read counters.
+ *
+ *************************************************************/
+int read_counters(BenchCounters* counters)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    counters->faults = usage.ru_minflt + usage.ru_majflt;
+
+    char buffer[0x200];
+    int fd = open("/proc/self/io", O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t size = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (size <= 0)
+    {
+        return -1;
+    }
+    buffer[size] = '\0';
+
+    counters->own_bytes = size;
+
+    static const char* fields[] = {
+        "rchar: ", "wchar: ", "syscr: ", "syscw: "
+    };
+    unsigned long long* values[] = {
+        &counters->read_bytes,
+        &counters->write_bytes,
+        &counters->read_calls,
+        &counters->write_calls
+    };
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        char* field = strstr(buffer, fields[i]);
+        *values[i] = (field ?
+            strtoull(field + strlen(fields[i]), NULL, 10) : 0);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    counters->wall_ns =
+        (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Add counters.
+ *
+ *************************************************************/
+void add_counters(
+    BenchCounters* total,
+    const BenchCounters* begin,
+    const BenchCounters* end
+)
+{
+    total->wall_ns += end->wall_ns - begin->wall_ns;
+    total->read_calls += end->read_calls - begin->read_calls - 1;
+    total->write_calls += end->write_calls - begin->write_calls;
+    total->read_bytes +=
+        end->read_bytes - begin->read_bytes - begin->own_bytes;
+    total->write_bytes += end->write_bytes - begin->write_bytes;
+    total->faults += end->faults - begin->faults;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Autosave map.
+ *
+ *************************************************************/
+void autosave_map(char* filename)
+{
+    static unsigned int seed = 1;
+    for (unsigned int i = 0; i < AUTOSAVE_CHANGES; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        int x = (int)((seed >> 8) % store_width);
+        int y = (int)((seed >> 4) % store_height);
+        map_set(x, y, (int)(seed % store_objects));
+    }
+
+    map_save_incremental(filename);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load parallel map.
+ *
+ *************************************************************/
+void load_parallel_map(char* filename)
+{
+    map_load_set_threads(MAP_LOAD_THREADS_AUTO);
+    map_load(filename);
+    map_load_set_threads(1);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Generate map.
+ *
+ *************************************************************/
+void generate_map(
+    unsigned int width,
+    unsigned int height,
+    unsigned int objects
+)
+{
+    /* Streamed chunks of the previous map are dropped */
+
+    map_new(width, height);
+
+    unsigned int seed = width * 0x10001 ^ height * 0x101 ^ objects;
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        unsigned int x = 0;
+        while (x < width)
+        {
+            seed = seed * 1103515245 + 12345;
+            unsigned int run = 1 + ((seed >> 16) & 0xf);
+            int object = (seed & 0x100 ?
+                (int)((seed >> 8) % objects) : MAP_OBJECT_NONE);
+
+            for (; run && x < width; --run, ++x)
+            {
+                map_set(x, y, object);
+            }
+        }
+    }
+
+    map_object_begin(objects);
+
+    static const unsigned int types[] = {
+        MAP_OBJECT_SOLID,
+        MAP_OBJECT_SEMI_SOLID,
+        MAP_OBJECT_SOLID | MAP_OBJECT_DESTRUCTIBLE,
+        MAP_OBJECT_AIR,
+        MAP_OBJECT_AIR | MAP_OBJECT_COLLECTIBLE,
+        MAP_OBJECT_SOLID | MAP_OBJECT_GENERATOR
+    };
+
+    char path[0x40];
+    for (unsigned int i = 0; i < objects; ++i)
+    {
+        snprintf(path, sizeof(path), "images/bench-%u.png", i);
+        map_object_add(path, 1 + i % 20, types[i % 6]);
+    }
+
+    map_object_end();
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Print result.
+ *
+ *************************************************************/
+void print_result(
+    const char* operation,
+    unsigned int encoding,
+    unsigned int layout,
+    unsigned int iterations,
+    const BenchCounters* total
+)
+{
+    fprintf(
+        stdout,
+        "%s\t%s\t%s\t%u\t%u\t%u\t%u\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+        operation,
+        (encoding == MAP_ENCODING_RLE ? "rle" : "raw"),
+        (layout == MAP_LAYOUT_CHUNKED ? "chunked" : "contiguous"),
+        store_width,
+        store_height,
+        store_objects,
+        iterations,
+        total->wall_ns / iterations,
+        total->read_calls / iterations,
+        total->write_calls / iterations,
+        total->read_bytes / iterations,
+        total->write_bytes / iterations,
+        total->faults / iterations
+    );
+    fflush(stdout);
+}
@@ -0,0 +1,60 @@
+/*!
+ * \ingroup game_group
+ * \file crc32c.h
+ * \brief Declaration of functions related to the 
+ *        checksums of map archives.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#ifndef DEF_CRC32C_H
+#define DEF_CRC32C_H
+
+#include <stddef.h>
+
+
+/*!
+ * \brief The crc32c() function computes the `CRC32C` 
+ *        (Castagnoli) checksum of data.
+ *
+ * The checksum is computed with the `SSE4.2` `crc32` 
+ * instruction when the processor supports it, and with
+ * a slicing-by-8 table otherwise. Both give the same
+ * result.
+ *
+ * The checksum of data split into several buffers is 
+ * obtained by passing the checksum of the previous 
+ * buffers as \p crc.
+ *
+ * \param crc Checksum of the previous data, or \p **0**.
+ * \param data Data to checksum.
+ * \param size Size of the data.
+ *
+ * \return The checksum of the data.
+ */
+unsigned int crc32c(unsigned int crc, const void* data, size_t size);
+
+/*!
+ * \brief The crc32c_combine() function computes the 
+ *        `CRC32C` checksum of two buffers from their own 
+ *        checksums.
+ *
+ * Hence, the checksums of consecutive parts of data can
+ * be computed separately, then combined in order.
+ *
+ * \param crc Checksum of the first buffer.
+ * \param next_crc Checksum of the second buffer.
+ * \param next_size Size of the second buffer.
+ *
+ * \return The checksum of the first buffer followed by
+ *         the second one.
+ *
+ * \see crc32c()
+ */
+unsigned int crc32c_combine(
+    unsigned int crc, unsigned int next_crc, size_t next_size
+);
+
+
+#endif // DEF_CRC32C_H
@@ -18,11 +18,79 @@
  */
 #define MARC_HEADER 0x4352414d
 
+/*!
+ * \brief MARC v2 header signature.
+ *
+ * Version `2` archives store their section offsets on
+ * `64` bits and the tiles of their maps on `1` or `2` 
+ * bytes each.
+ *
+ * \see MARC_VERSION_2
+ */
+#define MARC_V2_HEADER 0x3243524d
+
 /*!
  * \brief MAPF header signature
  */
 #define MAPF_HEADER 0x4650414d
 
+/*!
+ * \brief Run-length encoded MAPF header signature.
+ *
+ * The map data following such a header are run-length
+ * encoded and the last field of the header holds the
+ * size of the encoded data.
+ */
+#define MAPF_RLE_HEADER 0x5250414d
+
+/*!
+ * \brief Chunked MAPF header signature.
+ *
+ * The map data following such a header are split into
+ * chunks of columns and the last field of the header 
+ * holds the width of a chunk.
+ */
+#define MAPC_HEADER 0x4350414d
+
+/*!
+ * \brief Run-length encoded chunked MAPF header signature.
+ *
+ * Same as \ref MAPC_HEADER, except that each chunk is
+ * run-length encoded.
+ */
+#define MAPC_RLE_HEADER 0x5a50414d
+
+/*!
+ * \brief Checksum trailer signature.
+ *
+ * The trailer ends the archive and holds the `CRC32C` 
+ * checksums of the tile paths, of the tile properties 
+ * and of the decoded map data, followed by this 
+ * signature.
+ */
+#define MCRC_TRAILER 0x4352434d
+
+/*!
+ * \brief Level directory signature.
+ *
+ * The level directory of a \ref MARC_VERSION_2 archive
+ * references several maps sharing the tiles of the
+ * archive.
+ *
+ * \see map_load_level()
+ */
+#define MDIR_HEADER 0x5249444d
+
+/*!
+ * \brief Shared map segment signature.
+ *
+ * A shared memory segment starting with this signature
+ * holds the decoded tiles and map data of a map archive.
+ *
+ * \see map_load_shared()
+ */
+#define MSHM_HEADER 0x4d48534d
+
 /*!
  * \brief Tile properties header signature.
  */
@@ -58,6 +126,15 @@
  */
 #define MAX_WIDTH  1024
 
+/*!
+ * \brief Maximum number of tiles of a map.
+ *
+ * map_get() only keeps the `10` low bits of a cell, 
+ * hence the tiles beyond are rejected by the functions
+ * loading and saving map archives.
+ */
+#define MAX_OBJECTS 0x400
+
 /*!
  * \brief Air property of a tile.
  *
@@ -100,6 +177,151 @@
  */
 #define MAP_OBJECT_GENERATOR 16
 
+/*!
+ * \brief Raw encoding of the map data.
+ *
+ * Each tile is stored on `1` byte.
+ *
+ * \see MAPF_HEADER
+ */
+#define MAP_ENCODING_RAW 0
+
+/*!
+ * \brief Run-length encoding of the map data.
+ *
+ * Runs of identical tiles are stored as pairs of
+ * bytes holding the length of the run and the tile.
+ *
+ * \see MAPF_RLE_HEADER
+ */
+#define MAP_ENCODING_RLE 1
+
+/*!
+ * \brief Contiguous layout of the map data.
+ *
+ * The map data are stored row after row.
+ *
+ * \see MAPF_HEADER
+ * \see MAPF_RLE_HEADER
+ */
+#define MAP_LAYOUT_CONTIGUOUS 0
+
+/*!
+ * \brief Chunked layout of the map data.
+ *
+ * The map data are split into chunks of 
+ * \ref MAP_CHUNK_WIDTH columns, each chunk being 
+ * stored row after row. The chunks are all loaded by
+ * map_load(), or on demand by the map_stream() function
+ * once the map is loaded by map_load_streamed().
+ *
+ * \see MAPC_HEADER
+ * \see MAPC_RLE_HEADER
+ */
+#define MAP_LAYOUT_CHUNKED 1
+
+/*!
+ * \brief Number of columns of a chunk written by
+ *        map_save().
+ */
+#define MAP_CHUNK_WIDTH 64
+
+/*!
+ * \brief Number of columns around the camera whose
+ *        chunks are loaded by map_stream().
+ */
+#define MAP_STREAM_DISTANCE 48
+
+/*!
+ * \brief Version `1` of the map archives.
+ *
+ * The section offsets are stored on `32` bits and the 
+ * tiles of the map on `1` byte each.
+ *
+ * \see MARC_HEADER
+ */
+#define MARC_VERSION_1 1
+
+/*!
+ * \brief Version `2` of the map archives.
+ *
+ * The section offsets are stored on `64` bits and the 
+ * tiles of the map on `1` or `2` bytes each.
+ *
+ * \see MARC_V2_HEADER
+ */
+#define MARC_VERSION_2 2
+
+/*!
+ * \brief No synchronization of the archives written by
+ *        map_save().
+ *
+ * The archive is still written to a temporary file that
+ * is renamed over the original one, which protects it
+ * from a crash of the program but not of the system.
+ */
+#define MAP_SYNC_NONE 0
+
+/*!
+ * \brief Synchronization of the data of the archives 
+ *        written by map_save().
+ *
+ * The temporary file is flushed with `fdatasync()` 
+ * before being renamed over the original one.
+ */
+#define MAP_SYNC_DATA 1
+
+/*!
+ * \brief Full synchronization of the archives written by
+ *        map_save().
+ *
+ * The temporary file is flushed with `fsync()` before 
+ * being renamed over the original one, then the 
+ * directory holding the archive is flushed as well.
+ */
+#define MAP_SYNC_FULL 2
+
+/*!
+ * \brief Tile paths of the archives written by 
+ *        map_save() stored in slots of `0x40` bytes.
+ */
+#define MAP_PATHS_FIXED 0
+
+/*!
+ * \brief Tile paths of the archives written by 
+ *        map_save() stored in a packed table.
+ *
+ * Each distinct path is stored once, the tiles 
+ * referencing it by its offset.
+ *
+ * \see MSTR_HEADER
+ */
+#define MAP_PATHS_PACKED 1
+
+/*!
+ * \brief Number of threads used by the functions loading
+ *        a map matching the number of online processors.
+ *
+ * \see map_load_set_threads()
+ */
+#define MAP_LOAD_THREADS_AUTO 0
+
+/*!
+ * \brief Code of the event signalling that a map loaded
+ *        by map_load_async() is staged.
+ *
+ * \see map_event_type()
+ */
+#define MAP_EVENT_LOADED 1
+
+/*!
+ * \brief Code of the event signalling that a map saved
+ *        by map_save_async() is written.
+ *
+ * \see map_event_type()
+ */
+#define MAP_EVENT_SAVED 2
+
 /*!
  * \brief The map_init() function initialize a map.
  *
@@ -454,7 +676,8 @@ int map_is_mine(int x, int y);
  * a call to the map_object_end() function after
  * the registration of the tiles used in the map.
  *
- * \param nb_objects Number of tiles on the map.
+ * \param nb_objects Number of tiles on the map, at most
+ *                   \ref MAX_OBJECTS to be saved.
  *
  * \see map_object_add()
  * \see map_object_end()
@@ -525,6 +748,101 @@ void map_allocate(int w, int h);
  */
 void map_new(unsigned int width, unsigned int height);
 
+/*!
+ * \brief The map_save_set_encoding() function sets the
+ *        encoding of the map data written by map_save().
+ *
+ * The map data are written with the \ref MAP_ENCODING_RAW
+ * encoding by default. Both encodings are read by the
+ * map_load() function.
+ *
+ * \param encoding Encoding of the map data.
+ *
+ * \see MAP_ENCODING_RAW
+ * \see MAP_ENCODING_RLE
+ */
+void map_save_set_encoding(unsigned int encoding);
+
+/*!
+ * \brief The map_save_set_layout() function sets the
+ *        layout of the map data written by map_save().
+ *
+ * The map data are written with the 
+ * \ref MAP_LAYOUT_CONTIGUOUS layout by default. Both 
+ * layouts are read by the map_load() function.
+ *
+ * \param layout Layout of the map data.
+ *
+ * \see MAP_LAYOUT_CONTIGUOUS
+ * \see MAP_LAYOUT_CHUNKED
+ */
+void map_save_set_layout(unsigned int layout);
+
+/*!
+ * \brief The map_save_set_sync() function sets the 
+ *        synchronization policy of the archives written
+ *        by map_save().
+ *
+ * The \ref MAP_SYNC_DATA policy is used by default. 
+ * Autosaves may lower it to trade durability for 
+ * latency.
+ *
+ * \param policy Synchronization policy.
+ *
+ * \see MAP_SYNC_NONE
+ * \see MAP_SYNC_DATA
+ * \see MAP_SYNC_FULL
+ */
+void map_save_set_sync(unsigned int policy);
+
+/*!
+ * \brief The map_save_set_version() function sets the
+ *        version of the archives written by map_save().
+ *
+ * Archives are written with the \ref MARC_VERSION_1 
+ * version by default. A map referencing more tiles than
+ * a byte can index is always written with the 
+ * \ref MARC_VERSION_2 version. Both versions are read by
+ * the map_load() function.
+ *
+ * \param version Version of the archives.
+ *
+ * \see MARC_VERSION_1
+ * \see MARC_VERSION_2
+ */
+void map_save_set_version(unsigned int version);
+
+/*!
+ * \brief The map_save_set_checksums() function sets 
+ *        whether map_save() ends the archives with a 
+ *        checksum trailer.
+ *
+ * No trailer is written by default. Archives with and 
+ * without a trailer are both read by the map_load() 
+ * function.
+ *
+ * \param enabled `1` to write the trailer, `0` otherwise.
+ *
+ * \see MCRC_TRAILER
+ */
+void map_save_set_checksums(int enabled);
+
+/*!
+ * \brief The map_save_set_paths() function sets the 
+ *        encoding of the tile paths of the archives 
+ *        written by map_save().
+ *
+ * Tile paths are stored in slots of `0x40` bytes by
+ * default. Both encodings are read by the map_load()
+ * function, whatever the version of the archive.
+ *
+ * \param encoding Encoding of the tile paths.
+ *
+ * \see MAP_PATHS_FIXED
+ * \see MAP_PATHS_PACKED
+ */
+void map_save_set_paths(unsigned int encoding);
+
 /*!
  * \brief The map_save() function saves the map.
  *
@@ -622,12 +940,343 @@ void map_new(unsigned int width, unsigned int height);
  *  </tr>
  * </table> 
  *
+ * With the \ref MAP_LAYOUT_CHUNKED layout, the map data 
+ * are preceded by a chunk table:
+ *
+ * <table>
+ *  <tr>
+ *      <th>Description</th>
+ *      <th>Size</th>
+ *  </tr>
+ *  <tr>
+ *      <td>Signature of a map header (\ref MAPC_HEADER)</td>
+ *      <td rowspan="4">4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of tile on the \p x axis of the map</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of tile on the \p y axis of the map</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of columns of a chunk</td>
+ *  </tr>
+ *  <tr>
+ *      <td>
+ *          Offset of a chunk from the map header, followed
+ *          by the end of the last chunk
+ *      </td>
+ *      <td>4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Map data of a chunk, row after row</td>
+ *      <td>1 byte</td>
+ *  </tr>
+ * </table> 
+ *
+ * The chunks not loaded yet by map_stream() are loaded
+ * before saving.
+ *
+ * The tiles of the map are stored on `1` byte, the value
+ * `0xff` standing for no tile. With the 
+ * \ref MARC_VERSION_2 version, the archive header and the
+ * map header are laid out as follows:
+ *
+ * <table>
+ *  <caption>Header of a version 2 map archive</caption>
+ *  <tr>
+ *      <th>Description</th>
+ *      <th>Size</th>
+ *  </tr>
+ *  <tr>
+ *      <td>Signature of the archive header (see \ref MARC_V2_HEADER)</td>
+ *      <td rowspan="2">4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of tiles referenced in the map</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Offset of the properties of the tiles</td>
+ *      <td rowspan="3">8 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Offset of the first map</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Offset of the level directory, or zero</td>
+ *  </tr>
+ * </table>
+ *
+ * <table>
+ *  <caption>Header of a version 2 map</caption>
+ *  <tr>
+ *      <th>Description</th>
+ *      <th>Size</th>
+ *  </tr>
+ *  <tr>
+ *      <td>Signature of a map header (\ref MAPF_HEADER)</td>
+ *      <td rowspan="4">4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of tile on the \p x axis of the map</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of tile on the \p y axis of the map</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of bytes of a tile (`1` or `2`)</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Size of the map data, or number of columns of a chunk</td>
+ *      <td rowspan="2">8 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Reserved, zero</td>
+ *  </tr>
+ * </table>
+ *
+ * The tile paths follow the archive header and the chunk
+ * offsets are stored on `8` bytes. Tiles stored on `2` 
+ * bytes are split into two planes, the low bytes of all 
+ * the tiles followed by their high bytes, the value 
+ * `0xffff` standing for no tile. The width of a tile is
+ * the smallest one able to index all the tiles of the 
+ * map. The archive holds a single level, see 
+ * map_load_level().
+ *
+ * If enabled by map_save_set_checksums(), the archive 
+ * ends with a checksum trailer:
+ *
+ * <table>
+ *  <tr>
+ *      <th>Description</th>
+ *      <th>Size</th>
+ *  </tr>
+ *  <tr>
+ *      <td>`CRC32C` checksum of the tile paths</td>
+ *      <td rowspan="4">4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>`CRC32C` checksum of the tile properties</td>
+ *  </tr>
+ *  <tr>
+ *      <td>
+ *          `CRC32C` checksum of the decoded map data, 
+ *          row after row
+ *      </td>
+ *  </tr>
+ *  <tr>
+ *      <td>Signature of the trailer (\ref MCRC_TRAILER)</td>
+ *  </tr>
+ * </table> 
+ *
+ * With the \ref MAP_PATHS_PACKED encoding, set by 
+ * map_save_set_paths(), the tile paths are replaced by
+ * a packed table, which ends where the tile properties 
+ * start:
+ *
+ * <table>
+ *  <caption>Packed tile paths</caption>
+ *  <tr>
+ *      <th>Description</th>
+ *      <th>Size</th>
+ *  </tr>
+ *  <tr>
+ *      <td>Signature of the table (\ref MSTR_HEADER)</td>
+ *      <td rowspan="5">4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of distinct paths</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Size of the pool of paths</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Reserved, zero</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Offset of the path of a tile in the pool</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Pool of `NUL` terminated paths</td>
+ *      <td>Variable</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Padding to a multiple of `4` bytes</td>
+ *      <td>`0` to `3` bytes</td>
+ *  </tr>
+ * </table>
+ *
+ * The checksum of the tile paths then covers the packed
+ * table. 
+ *
+ * The offsets of all the sections are computed first,
+ * then the archive is written sequentially to a 
+ * temporary file in the same directory, which is renamed
+ * over \p filename once synchronized according to the 
+ * policy set by map_save_set_sync(). The original 
+ * archive is left untouched if the save fails.
+ *
  * \param filename Map archive.
  *
  * \see map_get()
  * \see map_load()
+ * \see map_save_set_encoding()
+ * \see map_save_set_layout()
+ * \see map_save_set_sync()
+ * \see map_save_set_checksums()
+ * \see map_save_set_version()
+ * \see map_save_set_paths()
  */
 void map_save(char* filename);
+
+/*!
+ * \brief The map_save_incremental() function saves a map
+ *        by only writing the tiles that changed since the
+ *        last save.
+ *
+ * The map module keeps the content of the last archive
+ * written by map_save() or by this function. If
+ * \p filename is still that archive, the tiles and the
+ * size of the map are unchanged and the settings of 
+ * map_save() still describe a raw contiguous archive 
+ * without checksum trailer, each row of the map is 
+ * compared with the saved one and only the dirty bytes 
+ * are written in place with
+ * [pwrite(int fd, const void\* buf, size_t count, off_t offset)](https://man7.org/linux/man-pages/man2/pwrite.2.html)
+ * system calls. Hence, the cost of an autosave depends 
+ * on what changed rather than on the size of the map. 
+ * Otherwise, the map is saved by map_save().
+ *
+ * Unlike map_save(), an incremental save is not atomic:
+ * a crash may leave some rows updated and the others not.
+ * Archives with a checksum trailer are always saved by 
+ * map_save(), since a crash between the rows and the 
+ * checksum would leave an archive failing its check.
+ *
+ * \param filename Map archive.
+ *
+ * \see map_save()
+ * \see map_set()
+ */
+void map_save_incremental(char* filename);
+
+/*!
+ * \brief Type definition of the functions called once a 
+ *        map saved by map_save_async() is committed.
+ *
+ * The first parameter is the map archive, the second one
+ * is \p **0** if the map is saved or \p **-1** if the 
+ * map archive cannot be written.
+ *
+ * \see map_save_async()
+ */
+typedef void (*MapSaveCallback)(char*, int);
+
+/*!
+ * \brief The map_save_async() function saves a map on a
+ *        worker thread.
+ *
+ * The map archive has the same layout as the one written
+ * by the map_save() function. A snapshot of the tiles and
+ * of the map data is taken on the calling thread, the 
+ * map data being copied in the buffer of the previous 
+ * snapshot when it is large enough. The snapshot is then
+ * encoded and written on a worker thread, hence the game
+ * goes on while the archive is written and later changes
+ * to the map are not saved. Unlike map_save(), an archive
+ * that cannot be written does not exit the program.
+ *
+ * Once the archive is written, the worker thread pushes
+ * an event of type map_event_type(), whose code is 
+ * \ref MAP_EVENT_SAVED and whose first data is the 
+ * request. The request must then be handed to 
+ * map_save_async_commit() on the main thread. 
+ * Alternatively, map_save_async_poll() commits the 
+ * request once written, the events being then ignored.
+ *
+ * The game loop of `libgame.a` ignores this event type 
+ * and cannot commit the request: until the caller does,
+ * map_save_async() returns `EBUSY`.
+ *
+ * A single save runs at a time. The map_save() and 
+ * map_save_incremental() functions wait for the worker 
+ * thread of a pending save before writing.
+ *
+ * \param filename Map archive.
+ * \param callback Function called once the save is 
+ *                 committed, or \p **NULL**.
+ *
+ * \return \p **0** if the worker thread is started,
+ *         \p **-1** otherwise, `errno` being set to 
+ *         `EBUSY` if a save is still pending.
+ *
+ * \see MapSaveCallback
+ * \see map_save_async_commit()
+ * \see map_save_async_poll()
+ * \see map_event_type()
+ */
+int map_save_async(char* filename, MapSaveCallback callback);
+
+/*!
+ * \brief The map_save_async_commit() function completes
+ *        a save started by map_save_async().
+ *
+ * This function must be called on the main thread with
+ * the first data of the event pushed by the worker 
+ * thread. The written archive is kept for the next
+ * map_save_incremental(), unless another save followed,
+ * then the callback of the request is called. A request
+ * already committed by map_save_async_poll() is ignored.
+ *
+ * \param request First data of the event pushed by the
+ *                worker thread.
+ *
+ * \see map_save_async()
+ */
+void map_save_async_commit(void* request);
+
+/*!
+ * \brief The map_save_async_poll() function commits the
+ *        save started by map_save_async() if its worker
+ *        thread is done.
+ *
+ * This function must be called on the main thread, for
+ * instance once per frame.
+ *
+ * \return \p **1** if a save is committed, \p **0** if no
+ *         save is pending or if it is still running.
+ *
+ * \see map_save_async_commit()
+ */
+int map_save_async_poll(void);
+
+/*!
+ * \brief The map_load_set_threads() function sets the 
+ *        number of threads decoding, verifying and 
+ *        committing the map data of the loaded maps.
+ *
+ * The map data are split into bands, each band being
+ * decoded, checked against its own checksum and 
+ * committed to map_set() on its own thread. The results 
+ * of the bands are merged in order, hence a map loads 
+ * the same whatever the number of threads. Small maps 
+ * are loaded by a single band: a band holds at least 
+ * `0x40000` bytes, hence the maps allowed by 
+ * map_allocate(), of at most \ref MAX_WIDTH * 
+ * \ref MAX_HEIGHT cells, are never split and this 
+ * setting only applies to larger maps.
+ *
+ * Maps are loaded by the calling thread only by default.
+ * This setting applies to all the functions loading a 
+ * map, chunks streamed by map_stream() excepted.
+ *
+ * \param threads Number of threads, or 
+ *                \ref MAP_LOAD_THREADS_AUTO.
+ *
+ * \see map_load()
+ */
+void map_load_set_threads(unsigned int threads);
     
 /*!
  * \brief The map_load() function loads a map.
@@ -725,8 +1374,21 @@ void map_save(char* filename);
  *  </tr>
  * </table>
  *
+ * Archives of the \ref MARC_VERSION_2 version, described
+ * by map_save(), are read as well.
+ *
+ * If the archive ends with a checksum trailer, each
+ * section is checked as soon as it is read. The map 
+ * data of a chunked map are checked once the last chunk
+ * is loaded. All the chunks of a chunked map are loaded,
+ * map_load_streamed() loading them on demand instead.
+ * The program exits if the map data reference a tile 
+ * beyond the tiles of the archive, or if the archive 
+ * holds more than \ref MAX_OBJECTS tiles.
+ *
  * \param filename Map archive.
  *
+ * \see MCRC_TRAILER
  * \see map_allocate()
  * \see map_set()
  * \see map_object_begin()
@@ -736,6 +1398,315 @@ void map_save(char* filename);
  */
 void map_load(char* filename);
 
+/*!
+ * \brief The map_load_streamed() function loads a map 
+ *        archive, the chunks of a chunked map being 
+ *        loaded on demand.
+ *
+ * This function behaves like map_load(), except that 
+ * only the chunks of a map stored with the 
+ * \ref MAP_LAYOUT_CHUNKED layout close to the left side
+ * of the map are loaded. The caller must then call 
+ * map_stream() whenever the camera moves, the other 
+ * tiles referencing the \ref MAP_OBJECT_NONE map data 
+ * until their chunk is loaded. The game loop of 
+ * `libgame.a` does not call map_stream(), hence maps 
+ * displayed by it must be loaded by map_load().
+ *
+ * \param filename Map archive.
+ *
+ * \see map_load()
+ * \see map_stream()
+ */
+void map_load_streamed(char* filename);
+
+/*!
+ * \brief The map_load_mapped() function loads a map
+ *        from a memory mapping of a map archive.
+ *
+ * The map archive has the same layout as the one
+ * read by the map_load() function. The archive is 
+ * mapped in read only mode and private, its headers 
+ * are validated in place and the map data are handed 
+ * to map_set() straight from the mapping. Hence, no
+ * intermediate buffer is allocated and only the pages
+ * of the archive that are actually touched are read
+ * from the disk. All the chunks of a chunked map are
+ * loaded.
+ *
+ * \param filename Map archive.
+ *
+ * \see map_load()
+ */
+void map_load_mapped(char* filename);
+
+/*!
+ * \brief The map_load_shared() function loads a map 
+ *        decoded once for all the processes loading the
+ *        same map archive.
+ *
+ * The map archive has the same layout as the one read
+ * by the map_load() function. The first process loading
+ * a version of the archive decodes it, the chunks of a
+ * chunked map included, into a 
+ * [POSIX shared memory](https://man7.org/linux/man-pages/man7/shm_overview.7.html)
+ * segment named after the path, the size and the 
+ * modification time of the archive. The other processes
+ * wait for the segment to be filled in, then load the 
+ * map straight from a read only mapping of it. Hence, 
+ * the archive is read, checked and decoded only once. 
+ * The map is copied into the game by map_allocate() and
+ * map_set(), so that it can be modified afterwards. 
+ *
+ * Segments outlive the processes, they are removed by
+ * map_load_shared_unlink(). A segment left incomplete by 
+ * a process that failed is ignored and the archive is 
+ * loaded as map_load() does.
+ *
+ * \param filename Map archive.
+ *
+ * \see MSHM_HEADER
+ * \see map_load()
+ * \see map_load_shared_unlink()
+ */
+void map_load_shared(char* filename);
+
+/*!
+ * \brief The map_load_shared_unlink() function removes 
+ *        the shared memory segment of the current version
+ *        of a map archive.
+ *
+ * The processes that already loaded the map are not 
+ * affected. Nothing is done if the segment does not 
+ * exist.
+ *
+ * \param filename Map archive.
+ *
+ * \see map_load_shared()
+ */
+void map_load_shared_unlink(char* filename);
+
+/*!
+ * \brief The map_load_fd() function loads a map from an
+ *        opened descriptor that cannot be seeked.
+ *
+ * The map archive has the same layout as the one read
+ * by the map_load() function, but it is read forward 
+ * only, from a pipe, a socket or the output of a 
+ * decompression process. The archive is buffered up to
+ * the end of its first map, the remaining bytes being
+ * read until the end of the stream so that the checksum
+ * trailer is found, if any. Hence, only the first level
+ * of a multi-level archive is loaded, and the writer 
+ * must close or shut down its end once the archive is
+ * sent. The chunks of a chunked map are all loaded at
+ * once.
+ *
+ * The descriptor is not closed. The map_load() function
+ * calls this function whenever its file is not a 
+ * regular file.
+ *
+ * \param fd Opened map archive.
+ *
+ * \see map_load()
+ */
+void map_load_fd(int fd);
+
+/*!
+ * \brief The map_load_level() function loads a level of
+ *        a map archive.
+ *
+ * A \ref MARC_VERSION_2 archive may hold several maps, 
+ * its levels, sharing the same tiles. The archive header
+ * then holds the offset of a level directory:
+ *
+ * <table>
+ *  <caption>Level directory</caption>
+ *  <tr>
+ *      <th>Description</th>
+ *      <th>Size</th>
+ *  </tr>
+ *  <tr>
+ *      <td>Signature of the directory (\ref MDIR_HEADER)</td>
+ *      <td rowspan="2">4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Number of levels</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Reserved, zero</td>
+ *      <td>8 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Offset of the map of a level</td>
+ *      <td>8 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>
+ *          `CRC32C` checksum of the decoded map data of 
+ *          a level
+ *      </td>
+ *      <td rowspan="2">4 bytes</td>
+ *  </tr>
+ *  <tr>
+ *      <td>Reserved, zero</td>
+ *  </tr>
+ * </table>
+ *
+ * The first level is the map referenced by the archive 
+ * header, hence the one loaded by map_load(). An archive
+ * without a level directory holds a single level. The 
+ * checksums of the directory are checked only if the 
+ * archive ends with a checksum trailer.
+ *
+ * The tiles and the level directory are read once and 
+ * kept along with the opened archive, so that switching
+ * to another level of the same archive only reads its 
+ * map. They are read again if the archive is modified.
+ * This function exits the program if the level does not
+ * exist.
+ *
+ * \param filename Map archive.
+ * \param index Index of the level, starting from `0`.
+ *
+ * \see MDIR_HEADER
+ * \see map_load()
+ */
+void map_load_level(char* filename, unsigned int index);
+
+/*!
+ * \brief Type definition of the functions called once a 
+ *        map loaded by map_load_async() is committed.
+ *
+ * The first parameter is the map archive, the second one
+ * is \p **0** if the map is loaded or \p **-1** if the
+ * map archive cannot be read or is malformed, the current
+ * map being then kept.
+ *
+ * \see map_load_async()
+ */
+typedef void (*MapLoadCallback)(char*, int);
+
+/*!
+ * \brief The map_load_async() function loads a map on a
+ *        worker thread.
+ *
+ * The map archive has the same layout as the one read
+ * by the map_load() function. It is read and decoded 
+ * on a worker thread into a staging area, the chunks 
+ * of a chunked map included, while the current map 
+ * remains untouched. Unlike map_load(), an invalid map
+ * archive does not exit the program, nor does a map
+ * whose size is out of the range allowed by 
+ * map_allocate(), which is rejected before staging.
+ *
+ * Once the map archive is staged, the worker thread 
+ * pushes an event of type map_event_type(), whose code
+ * is \ref MAP_EVENT_LOADED and whose first data is the 
+ * request. The request must then be handed to 
+ * map_load_async_commit() on the main thread. 
+ * Alternatively, map_load_async_poll() commits the 
+ * request once staged, the events being then ignored.
+ *
+ * The event type is allocated with SDL_RegisterEvents(),
+ * so the game loop of `libgame.a`, which hands every 
+ * `SDL_USEREVENT` to its timers, ignores it. That loop 
+ * cannot commit the request: the caller must handle the
+ * event in its own loop or poll the request.
+ *
+ * A single load runs at a time.
+ *
+ * \param filename Map archive.
+ * \param callback Function called once the map is 
+ *                 committed, or \p **NULL**.
+ *
+ * \return \p **0** if the worker thread is started,
+ *         \p **-1** otherwise, `errno` being set to 
+ *         `EBUSY` if a load is still pending.
+ *
+ * \see MapLoadCallback
+ * \see map_load_async_commit()
+ * \see map_load_async_poll()
+ * \see map_event_type()
+ */
+int map_load_async(char* filename, MapLoadCallback callback);
+
+/*!
+ * \brief The map_load_async_commit() function replaces 
+ *        the current map by a map staged by 
+ *        map_load_async().
+ *
+ * This function must be called on the main thread with
+ * the first data of the event pushed by the worker 
+ * thread. The map is committed with a single call to
+ * map_allocate() and to the map_object_begin(),
+ * map_object_add() and map_object_end() functions, 
+ * then the callback of the request is called. The 
+ * current map is kept if the map archive could not be
+ * read. A request already committed by 
+ * map_load_async_poll() is ignored.
+ *
+ * \param request First data of the event pushed by the
+ *                worker thread.
+ *
+ * \see map_load_async()
+ */
+void map_load_async_commit(void* request);
+
+/*!
+ * \brief The map_load_async_poll() function commits the
+ *        map staged by map_load_async() if its worker
+ *        thread is done.
+ *
+ * This function must be called on the main thread, for
+ * instance once per frame.
+ *
+ * \return \p **1** if a map is committed, \p **0** if no
+ *         load is pending or if it is still running.
+ *
+ * \see map_load_async_commit()
+ */
+int map_load_async_poll(void);
+
+/*!
+ * \brief The map_event_type() function gets the type of
+ *        the events pushed by the worker threads of the
+ *        asynchronous map operations.
+ *
+ * The type is allocated with SDL_RegisterEvents() by the
+ * first asynchronous operation.
+ *
+ * \return The type of the events, or `(Uint32)-1` if 
+ *         none is allocated yet.
+ *
+ * \see MAP_EVENT_LOADED
+ * \see MAP_EVENT_SAVED
+ */
+unsigned int map_event_type(void);
+
+/*!
+ * \brief The map_stream() function loads the chunks of
+ *        a chunked map close to a column.
+ *
+ * When a map stored with the \ref MAP_LAYOUT_CHUNKED 
+ * layout is loaded by map_load_streamed(), only the 
+ * chunks close to the left side of the map are read. The other tiles reference
+ * the \ref MAP_OBJECT_NONE map data until their chunk
+ * is loaded. This function must be called whenever the
+ * camera moves so that the chunks within
+ * \ref MAP_STREAM_DISTANCE columns of \p x are loaded
+ * before being displayed. The archive is released once
+ * all its chunks are loaded.
+ *
+ * This function does nothing if the map is not chunked.
+ *
+ * \param x Column of the map the camera is close to.
+ *
+ * \see MAP_LAYOUT_CHUNKED
+ * \see map_load_streamed()
+ */
+void map_stream(int x);
+
 
 #endif // MAP_IS_DEF
 
@@ -0,0 +1,299 @@
+/*!
+ * \ingroup game_group
+ * \file crc32c.c
+ * \brief Implementation of functions related to the
+ *        checksums of map archives.
+ *
+ * Implementation of the functions declared in the \ref
+ * crc32c.h header.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#include "crc32c.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE
+#endif
+
+
+/*!
+ * \brief Reversed `CRC32C` polynomial.
+ */
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+
+/*!
+ * \brief Slicing-by-8 tables.
+ *
+ * The first table holds the checksum of each byte, the
+ * following ones the checksum of each byte followed by
+ * `1` to `7` zero bytes.
+ */
+static unsigned int crc32c_table[0x8][0x100];
+
+/*!
+ * \brief Powers of `x` modulo the `CRC32C` polynomial.
+ *
+ * The entry `k` holds `x` raised to the power `2^k`, 
+ * bits being reversed like those of the checksums.
+ */
+static unsigned int crc32c_powers[0x20];
+
+/*!
+ * \brief Whether the `SSE4.2` `crc32` instruction is 
+ *        supported.
+ */
+static int crc32c_hardware_supported = 0;
+
+
+/*!
+ * \brief The crc32c_init() function builds the 
+ *        slicing-by-8 tables and probes the processor.
+ *
+ * This function runs before main(), hence before any
+ * thread may compute a checksum.
+ */
+static void crc32c_init(void) __attribute__((constructor));
+
+/*!
+ * \brief The crc32c_software() function computes a 
+ *        `CRC32C` checksum with the slicing-by-8 tables.
+ *
+ * \param crc Inverted checksum of the previous data.
+ * \param data Data to checksum.
+ * \param size Size of the data.
+ *
+ * \return The inverted checksum of the data.
+ */
+static unsigned int crc32c_software(
+    unsigned int crc, const unsigned char* data, size_t size
+);
+
+/*!
+ * \brief The crc32c_multiply() function multiplies two
+ *        polynomials modulo the `CRC32C` polynomial.
+ *
+ * \param a First polynomial, bits being reversed.
+ * \param b Second polynomial, bits being reversed.
+ *
+ * \return The product of the polynomials.
+ */
+static unsigned int crc32c_multiply(unsigned int a, unsigned int b);
+
+#ifdef CRC32C_HARDWARE
+/*!
+ * \brief The crc32c_hardware() function computes a 
+ *        `CRC32C` checksum with the `SSE4.2` `crc32` 
+ *        instruction, `8` bytes at a time.
+ *
+ * \param crc Inverted checksum of the previous data.
+ * \param data Data to checksum.
+ * \param size Size of the data.
+ *
+ * \return The inverted checksum of the data.
+ */
+static unsigned int crc32c_hardware(
+    unsigned int crc, const unsigned char* data, size_t size
+);
+#endif
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * CRC32C.
+ *
+ *************************************************************/
+unsigned int crc32c(unsigned int crc, const void* data, size_t size)
+{
+    crc = ~crc;
+
+#ifdef CRC32C_HARDWARE
+    if (crc32c_hardware_supported)
+    {
+        return ~crc32c_hardware(crc, (const unsigned char*)data, size);
+    }
+#endif
+
+    return ~crc32c_software(crc, (const unsigned char*)data, size);
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Combine.
+ *
+ *************************************************************/
+unsigned int crc32c_combine(
+    unsigned int crc, unsigned int next_crc, size_t next_size
+)
+{
+    /* Shift the first checksum by next_size zero bytes */
+
+    unsigned int shift = 0x80000000;
+    for (unsigned int k = 3; next_size; next_size >>= 1, ++k)
+    {
+        if (next_size & 1)
+        {
+            shift = crc32c_multiply(crc32c_powers[k & 0x1f], shift);
+        }
+    }
+
+    return crc32c_multiply(shift, crc) ^ next_crc;
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Init.
+ *
+ *************************************************************/
+void crc32c_init(void)
+{
+    for (unsigned int i = 0; i < 0x100; ++i)
+    {
+        unsigned int crc = i;
+        for (int bit = 0; bit < 0x8; ++bit)
+        {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLYNOMIAL : 0);
+        }
+        crc32c_table[0x0][i] = crc;
+    }
+
+    for (unsigned int i = 0; i < 0x100; ++i)
+    {
+        for (int slice = 1; slice < 0x8; ++slice)
+        {
+            unsigned int crc = crc32c_table[slice - 1][i];
+            crc32c_table[slice][i] = 
+                (crc >> 8) ^ crc32c_table[0x0][crc & 0xff];
+        }
+    }
+
+    /* x^1, then x^2, x^4, ... */
+
+    crc32c_powers[0x0] = 0x40000000;
+    for (int k = 1; k < 0x20; ++k)
+    {
+        crc32c_powers[k] = 
+            crc32c_multiply(crc32c_powers[k - 1], crc32c_powers[k - 1]);
+    }
+
+#ifdef CRC32C_HARDWARE
+    __builtin_cpu_init();
+    crc32c_hardware_supported = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Software.
+ *
+ *************************************************************/
+unsigned int crc32c_software(
+    unsigned int crc, const unsigned char* data, size_t size
+)
+{
+    /* Eight bytes at a time */
+
+    while (size >= 0x8)
+    {
+        unsigned int low = crc ^ 
+            ((unsigned int)data[0x0] | 
+             (unsigned int)data[0x1] << 8 | 
+             (unsigned int)data[0x2] << 16 | 
+             (unsigned int)data[0x3] << 24);
+        unsigned int high = 
+            (unsigned int)data[0x4] | 
+            (unsigned int)data[0x5] << 8 | 
+            (unsigned int)data[0x6] << 16 | 
+            (unsigned int)data[0x7] << 24;
+
+        crc = crc32c_table[0x7][low & 0xff] ^
+            crc32c_table[0x6][(low >> 8) & 0xff] ^
+            crc32c_table[0x5][(low >> 16) & 0xff] ^
+            crc32c_table[0x4][low >> 24] ^
+            crc32c_table[0x3][high & 0xff] ^
+            crc32c_table[0x2][(high >> 8) & 0xff] ^
+            crc32c_table[0x1][(high >> 16) & 0xff] ^
+            crc32c_table[0x0][high >> 24];
+
+        data += 0x8;
+        size -= 0x8;
+    }
+
+    /* Remaining bytes */
+
+    while (size--)
+    {
+        crc = (crc >> 8) ^ crc32c_table[0x0][(crc ^ *data++) & 0xff];
+    }
+
+    return crc;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Multiply.
+ *
+ *************************************************************/
+unsigned int crc32c_multiply(unsigned int a, unsigned int b)
+{
+    unsigned int product = 0;
+    for (unsigned int bit = 0x80000000; bit; bit >>= 1)
+    {
+        if (a & bit)
+        {
+            product ^= b;
+        }
+        b = (b >> 1) ^ (b & 1 ? CRC32C_POLYNOMIAL : 0);
+    }
+
+    return product;
+}
+
+#ifdef CRC32C_HARDWARE
+/*************************************************************
+ *************************************************************
+ *
+ * Hardware.
+ *
+ *************************************************************/
+__attribute__((target("sse4.2")))
+unsigned int crc32c_hardware(
+    unsigned int crc, const unsigned char* data, size_t size
+)
+{
+    /* Eight bytes at a time */
+
+    unsigned long long crc64 = crc;
+    while (size >= 0x8)
+    {
+        unsigned long long value;
+        memcpy(&value, data, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+
+        data += 0x8;
+        size -= 0x8;
+    }
+
+    /* Remaining bytes */
+
+    crc = (unsigned int)crc64;
+    while (size--)
+    {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return crc;
+}
+#endif
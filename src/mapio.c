@@ -11,9 +11,22 @@
  * \version 1
  */
 
+#define _GNU_SOURCE
+
+#include <SDL.h>
+
 #include "map.h"
 #include "error.h"
+#include "rle.h"
+#include "crc32c.h"
+#include "iobatch.h"
+#include "pathtable.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -23,411 +36,6733 @@
 #include <stdio.h>
 
 
-#ifdef PADAWAN
+#ifdef PADAWAN
+
+
+/*!
+ * \brief Minimum size of a band of map data decoded,
+ *        verified or committed by its own thread.
+ *
+ * The maps allowed by the game hold at most 
+ * \ref MAX_WIDTH * \ref MAX_HEIGHT cells of `2` bytes, 
+ * well below this size, hence they are always loaded by
+ * a single band. Only larger maps, such as the ones of
+ * the benchmark, are split.
+ *
+ * \see map_load_set_threads()
+ */
+#define MAP_BAND_MIN_SIZE 0x40000
+
+/*!
+ * \brief Maximum number of bands of map data.
+ */
+#define MAP_BAND_MAX_COUNT 0x40
+
+
+/*!
+ * \struct map_header
+ * \brief The \ref map_header structure represents the
+ *        header of a map, whatever the version of the
+ *        archive holding it.
+ *
+ * The map data are handled as a grid of bytes, row after
+ * row. Tiles stored on `2` bytes make up two planes of
+ * \p height rows each, the low bytes followed by the high
+ * bytes. Hence, chunks and run-length encoding apply to
+ * the grid whatever the width of a tile.
+ */
+struct map_header
+{
+    /*!
+     * \brief Version of the archive.
+     */
+    unsigned int version;
+
+    /*!
+     * \brief Signature of the map header.
+     */
+    unsigned int signature;
+
+    /*!
+     * \brief Width of the map.
+     */
+    unsigned int width;
+
+    /*!
+     * \brief Height of the map.
+     */
+    unsigned int height;
+
+    /*!
+     * \brief Number of bytes of a tile.
+     */
+    unsigned int cell_size;
+
+    /*!
+     * \brief Size of the stored map data, or width of a
+     *        chunk for a chunked map.
+     */
+    unsigned long long size;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_header
+ *        structure.
+ *
+ * \see map_header
+ */
+typedef struct map_header MapHeader;
+
+
+/*!
+ * \struct marc_sections
+ * \brief The \ref marc_sections structure references
+ *        the sections of a map archive once they are
+ *        in memory.
+ *
+ * The sections are kept in the layout of the archive:
+ *
+ *  - The paths of the tiles are stored on `64` bytes each;
+ *  - The properties of the tiles are stored on `32` bytes
+ *    each, signature and padding included;
+ *  - The map data are stored on `1` or `2` bytes per
+ *    tile, row after row.
+ *
+ * The checksums of the trailer, if any, are kept along.
+ */
+struct marc_sections
+{
+    /*!
+     * \brief Version of the archive.
+     */
+    unsigned int version;
+
+    /*!
+     * \brief Number of tiles.
+     */
+    unsigned int tile_count;
+
+    /*!
+     * \brief Paths of the tiles.
+     */
+    PathTable tile_paths;
+
+    /*!
+     * \brief Properties of the tiles.
+     */
+    const unsigned int* tile_attributes;
+
+    /*!
+     * \brief Offset of the map in the archive.
+     */
+    unsigned long long map_offset;
+
+    /*!
+     * \brief Offset of the level directory, or `0`.
+     */
+    unsigned long long directory_offset;
+
+    /*!
+     * \brief Header of the map.
+     */
+    MapHeader map_header;
+
+    /*!
+     * \brief Map data, or \p **NULL** if the chunks of 
+     *        a chunked map are not read yet.
+     */
+    const char* map_data;
+
+    /*!
+     * \brief Whether the archive ends with a checksum
+     *        trailer.
+     */
+    int checksummed;
+
+    /*!
+     * \brief Checksums of the tile paths, of the tile 
+     *        properties and of the map data.
+     */
+    unsigned int checksums[0x3];
+};
+
+
+/*!
+ * \brief Type definition of the \ref marc_sections 
+ *        structure.
+ *
+ * \see marc_sections
+ */
+typedef struct marc_sections MarcSections;
+
+
+/*!
+ * \struct map_stream
+ * \brief The \ref map_stream structure references the
+ *        chunks of a chunked map that are not loaded yet.
+ *
+ * The archive is either kept opened or kept mapped 
+ * until all the chunks are loaded.
+ */
+struct map_stream
+{
+    /*!
+     * \brief Opened map archive, or `-1`.
+     */
+    int fd;
+
+    /*!
+     * \brief Mapped map archive, or \p **NULL**.
+     */
+    const char* archive;
+
+    /*!
+     * \brief Size of the mapped map archive.
+     */
+    size_t archive_size;
+
+    /*!
+     * \brief Offset of the map in the archive.
+     */
+    unsigned long long map_offset;
+
+    /*!
+     * \brief Header of the map.
+     */
+    MapHeader map_header;
+
+    /*!
+     * \brief Number of chunks of the map.
+     */
+    unsigned int chunk_count;
+
+    /*!
+     * \brief Offsets of the chunks from the map header, 
+     *        followed by the end of the last chunk.
+     */
+    unsigned long long* chunk_offsets;
+
+    /*!
+     * \brief Whether each chunk is loaded.
+     */
+    char* chunk_loaded;
+
+    /*!
+     * \brief Number of chunks not loaded yet.
+     */
+    unsigned int pending_chunks;
+
+    /*!
+     * \brief Whether the map data are checked once all
+     *        the chunks are loaded.
+     */
+    int checksummed;
+
+    /*!
+     * \brief Checksum of the map data.
+     */
+    unsigned int map_checksum;
+
+    /*!
+     * \brief Number of tiles of the map.
+     */
+    unsigned int tile_count;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_stream 
+ *        structure.
+ *
+ * \see map_stream
+ */
+typedef struct map_stream MapStream;
+
+
+/*!
+ * \struct map_load_request
+ * \brief The \ref map_load_request structure represents
+ *        a map loaded by map_load_async().
+ *
+ * The sections of the map archive are staged by a 
+ * worker thread, then committed on the main thread by 
+ * map_load_async_commit().
+ */
+struct map_load_request
+{
+    /*!
+     * \brief Map archive.
+     */
+    char* filename;
+
+    /*!
+     * \brief Function called once the map is committed.
+     */
+    MapLoadCallback callback;
+
+    /*!
+     * \brief Worker thread.
+     */
+    pthread_t thread;
+
+    /*!
+     * \brief `0` if the sections are staged, `-1` 
+     *        otherwise.
+     */
+    int status;
+
+    /*!
+     * \brief Whether the worker thread is done, set 
+     *        atomically.
+     */
+    int done;
+
+    /*!
+     * \brief Staged sections of the map archive.
+     */
+    MarcSections sections;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_load_request 
+ *        structure.
+ *
+ * \see map_load_request
+ */
+typedef struct map_load_request MapLoadRequest;
+
+
+/*!
+ * \struct level_archive
+ * \brief The \ref level_archive structure keeps the
+ *        archive read by map_load_level() opened between
+ *        two levels.
+ *
+ * The tiles and the level directory are only read again
+ * if the archive is replaced or modified.
+ */
+struct level_archive
+{
+    /*!
+     * \brief Map archive, or \p **NULL** if no archive
+     *        is kept.
+     */
+    char* filename;
+
+    /*!
+     * \brief Opened map archive.
+     */
+    int fd;
+
+    /*!
+     * \brief Status of the archive when it was read.
+     */
+    struct stat archive_stat;
+
+    /*!
+     * \brief Tiles of the archive, without map data.
+     */
+    MarcSections sections;
+
+    /*!
+     * \brief Number of levels.
+     */
+    unsigned int level_count;
+
+    /*!
+     * \brief Offsets of the maps of the levels.
+     */
+    unsigned long long* level_offsets;
+
+    /*!
+     * \brief Checksums of the map data of the levels.
+     */
+    unsigned int* level_checksums;
+};
+
+
+/*!
+ * \brief Type definition of the \ref level_archive 
+ *        structure.
+ *
+ * \see level_archive
+ */
+typedef struct level_archive LevelArchive;
+
+
+/*!
+ * \struct saved_archive
+ * \brief The \ref saved_archive structure keeps the
+ *        content of the archive written by the last save,
+ *        so that the next one only writes what changed.
+ *
+ * Only raw archives with a contiguous map are kept, their
+ * map data being the only section that can be updated in
+ * place.
+ */
+struct saved_archive
+{
+    /*!
+     * \brief Map archive, or \p **NULL** if no archive
+     *        is kept.
+     */
+    char* filename;
+
+    /*!
+     * \brief Status of the archive when it was written.
+     */
+    struct stat archive_stat;
+
+    /*!
+     * \brief Header of the map.
+     */
+    MapHeader map_header;
+
+    /*!
+     * \brief Offset of the map data.
+     */
+    unsigned long long map_data_offset;
+
+    /*!
+     * \brief Whether the archive ends with a checksum 
+     *        trailer.
+     */
+    int checksummed;
+
+    /*!
+     * \brief Number of tiles.
+     */
+    unsigned int tile_count;
+
+    /*!
+     * \brief Paths of the tiles, as stored.
+     */
+    char* tile_paths;
+
+    /*!
+     * \brief Size of the stored paths of the tiles.
+     */
+    size_t tile_paths_size;
+
+    /*!
+     * \brief Properties of the tiles.
+     */
+    unsigned int* tile_attributes;
+
+    /*!
+     * \brief Map data, row after row.
+     */
+    char* map_data;
+};
+
+
+/*!
+ * \brief Type definition of the \ref saved_archive 
+ *        structure.
+ *
+ * \see saved_archive
+ */
+typedef struct saved_archive SavedArchive;
+
+
+/*!
+ * \struct map_snapshot
+ * \brief The \ref map_snapshot structure represents the
+ *        content of the current map taken by a save, 
+ *        along with the settings of map_save().
+ *
+ * A snapshot is taken on the main thread, then written
+ * by any thread, hence the map can change meanwhile.
+ */
+struct map_snapshot
+{
+    /*!
+     * \brief Number of tiles.
+     */
+    unsigned int tile_count;
+
+    /*!
+     * \brief Paths of the tiles, as stored.
+     */
+    char* tile_paths;
+
+    /*!
+     * \brief Size of the stored paths of the tiles.
+     */
+    size_t tile_paths_size;
+
+    /*!
+     * \brief Properties of the tiles.
+     */
+    unsigned int* tile_attributes;
+
+    /*!
+     * \brief Header of the raw contiguous map.
+     */
+    MapHeader map_header;
+
+    /*!
+     * \brief Map data, row after row.
+     */
+    char* map_data;
+
+    /*!
+     * \brief Number of bytes that fit in \p map_data.
+     */
+    size_t map_data_capacity;
+
+    /*!
+     * \brief Encoding of the map data.
+     */
+    unsigned int encoding;
+
+    /*!
+     * \brief Layout of the map data.
+     */
+    unsigned int layout;
+
+    /*!
+     * \brief Synchronization policy.
+     */
+    unsigned int sync;
+
+    /*!
+     * \brief Whether the archive ends with a checksum 
+     *        trailer.
+     */
+    int checksums;
+
+    /*!
+     * \brief Offset of the map data, once written.
+     */
+    unsigned long long map_data_offset;
+
+    /*!
+     * \brief Whether the written map data can be updated
+     *        in place.
+     */
+    int in_place;
+
+    /*!
+     * \brief Status of the archive once written.
+     */
+    struct stat archive_stat;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_snapshot 
+ *        structure.
+ *
+ * \see map_snapshot
+ */
+typedef struct map_snapshot MapSnapshot;
+
+
+/*!
+ * \struct map_save_request
+ * \brief The \ref map_save_request structure represents
+ *        a map saved by map_save_async().
+ *
+ * The snapshot of the map is written by a worker thread,
+ * then released on the main thread by 
+ * map_save_async_commit().
+ */
+struct map_save_request
+{
+    /*!
+     * \brief Map archive.
+     */
+    char* filename;
+
+    /*!
+     * \brief Function called once the save is committed.
+     */
+    MapSaveCallback callback;
+
+    /*!
+     * \brief Worker thread.
+     */
+    pthread_t thread;
+
+    /*!
+     * \brief Whether the worker thread is joined.
+     */
+    int joined;
+
+    /*!
+     * \brief Whether another save followed this one 
+     *        before it was committed.
+     */
+    int superseded;
+
+    /*!
+     * \brief Whether the worker thread is done, set 
+     *        atomically.
+     */
+    int done;
+
+    /*!
+     * \brief Number of bytes written, or `-1` if the 
+     *        archive cannot be written.
+     */
+    ssize_t size;
+
+    /*!
+     * \brief Snapshot of the map.
+     */
+    MapSnapshot snapshot;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_save_request 
+ *        structure.
+ *
+ * \see map_save_request
+ */
+typedef struct map_save_request MapSaveRequest;
+
+
+/*!
+ * \struct shared_map
+ * \brief The \ref shared_map structure represents the
+ *        header of a shared memory segment holding a 
+ *        decoded map.
+ *
+ * The header occupies the first `0x40` bytes of the 
+ * segment. It is followed by the packed table of the 
+ * paths of the tiles, their properties (`0x20` bytes 
+ * each) and the decoded map data, row after row. 
+ *
+ * \see map_load_shared()
+ */
+struct shared_map
+{
+    /*!
+     * \brief Signature of the segment 
+     *        (\ref MSHM_HEADER), written once the segment
+     *        is filled in.
+     */
+    unsigned int signature;
+
+    /*!
+     * \brief Number of tiles.
+     */
+    unsigned int tile_count;
+
+    /*!
+     * \brief Header of the map.
+     */
+    MapHeader map_header;
+
+    /*!
+     * \brief Size of the packed table of the paths of the
+     *        tiles.
+     */
+    unsigned long long tile_paths_size;
+
+    /*!
+     * \brief Size of the segment.
+     */
+    unsigned long long size;
+};
+
+
+/*!
+ * \brief Type definition of the \ref shared_map 
+ *        structure.
+ *
+ * \see shared_map
+ */
+typedef struct shared_map SharedMap;
+
+
+/*!
+ * \struct map_band
+ * \brief The \ref map_band structure represents a band
+ *        of the map data handled by its own thread.
+ *
+ * \see run_bands()
+ */
+struct map_band
+{
+    /*!
+     * \brief Data read by the band.
+     */
+    const char* input;
+
+    /*!
+     * \brief Size of \p input.
+     */
+    size_t input_size;
+
+    /*!
+     * \brief Data written by the band.
+     */
+    char* output;
+
+    /*!
+     * \brief Size of \p output.
+     */
+    size_t output_size;
+
+    /*!
+     * \brief Sections of the map archive committed by
+     *        the band.
+     */
+    const MarcSections* sections;
+
+    /*!
+     * \brief First column committed by the band.
+     */
+    unsigned int begin;
+
+    /*!
+     * \brief Column following the last one committed by
+     *        the band.
+     */
+    unsigned int end;
+
+    /*!
+     * \brief Checksum of \p input.
+     */
+    unsigned int checksum;
+
+    /*!
+     * \brief `0` if the band is handled, `-1` otherwise.
+     */
+    int result;
+
+    /*!
+     * \brief Thread of the band.
+     */
+    pthread_t thread;
+
+    /*!
+     * \brief Whether the band runs on \p thread rather
+     *        than on the calling thread.
+     */
+    int threaded;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_band 
+ *        structure.
+ *
+ * \see map_band
+ */
+typedef struct map_band MapBand;
+
+
+/*!
+ * \brief Encoding of the map data used by map_save().
+ */
+static unsigned int save_encoding = MAP_ENCODING_RAW;
+
+/*!
+ * \brief Layout of the map data used by map_save().
+ */
+static unsigned int save_layout = MAP_LAYOUT_CONTIGUOUS;
+
+/*!
+ * \brief Synchronization policy used by map_save().
+ */
+static unsigned int save_sync = MAP_SYNC_DATA;
+
+/*!
+ * \brief Whether map_save() writes a checksum trailer.
+ */
+static int save_checksums = 0;
+
+/*!
+ * \brief Version of the archives written by map_save().
+ */
+static unsigned int save_version = MARC_VERSION_1;
+
+/*!
+ * \brief Encoding of the tile paths used by map_save().
+ */
+static unsigned int save_paths = MAP_PATHS_FIXED;
+
+/*!
+ * \brief Number of threads handling the map data of the
+ *        loaded maps.
+ */
+static unsigned int load_threads = 1;
+
+/*!
+ * \brief Chunks of the current map that are not
+ *        loaded yet.
+ */
+static MapStream stream = {-1, NULL, 0, 0, {0}, 0, NULL, NULL, 0, 0, 0};
+
+/*!
+ * \brief Archive read by map_load_level().
+ */
+static LevelArchive levels;
+
+/*!
+ * \brief Archive written by the last save.
+ */
+static SavedArchive saved;
+
+/*!
+ * \brief Save started by map_save_async() and not 
+ *        committed yet, or \p **NULL**.
+ */
+static MapSaveRequest* pending_save = NULL;
+
+/*!
+ * \brief Load started by map_load_async() and not 
+ *        committed yet, or \p **NULL**.
+ */
+static MapLoadRequest* pending_load = NULL;
+
+/*!
+ * \brief Type of the events pushed by the worker threads,
+ *        allocated by SDL_RegisterEvents().
+ */
+static Uint32 map_event = (Uint32)-1;
+
+/*!
+ * \brief Map data buffer of a released snapshot, reused 
+ *        by the next one.
+ */
+static char* recycled_map_data = NULL;
+
+/*!
+ * \brief Number of bytes that fit in 
+ *        \ref recycled_map_data.
+ */
+static size_t recycled_map_capacity = 0;
+
+
+/*!
+ * \brief The read_section() function reads a section
+ *        of a map archive with 
+ *        [pread(int fd, void\* buf, size_t count, off_t offset)](https://man7.org/linux/man-pages/man2/pread.2.html)
+ *        system calls.
+ *
+ * The call is only repeated if the kernel performs a
+ * partial read.
+ *
+ * \param fd Opened map archive.
+ * \param buffer Destination of the section.
+ * \param size Size of the section.
+ * \param offset Offset of the section in the archive.
+ *
+ * \return \p **0** if the section is read, \p **-1** 
+ *         if a read fails or if the archive is too short.
+ */
+static int read_section(int fd, void* buffer, size_t size, off_t offset);
+
+/*!
+ * \brief The read_stream() function reads the next bytes
+ *        of a map archive with
+ *        [read(int fd, void\* buf, size_t count)](https://man7.org/linux/man-pages/man2/read.2.html)
+ *        system calls.
+ *
+ * The call is repeated if the kernel performs a partial
+ * read or if it is interrupted by a signal. Hence, the 
+ * archive may come from a pipe or a socket.
+ *
+ * \param fd Opened map archive.
+ * \param buffer Destination of the bytes.
+ * \param size Number of bytes.
+ * \param offset Offset of the bytes in the archive.
+ *
+ * \return \p **0** if the bytes are read, \p **-1** 
+ *         if a read fails or if the archive is too short.
+ */
+static int read_stream(
+    int fd, void* buffer, size_t size, unsigned long long offset
+);
+
+/*!
+ * \brief The read_batch() function reads several sections
+ *        of a map archive with a single batch.
+ *
+ * \param requests Reads of the sections.
+ * \param count Number of reads.
+ *
+ * \return \p **0** if the sections are read, \p **-1** 
+ *         if a read fails or if the archive is too short.
+ *
+ * \see io_batch_submit()
+ */
+static int read_batch(IoRequest* requests, unsigned int count);
+
+/*!
+ * \brief The validate_section_bounds() function ensures 
+ *        that a section lies within a map archive.
+ *
+ * \param archive_size Size of the map archive.
+ * \param offset Offset of the section in the archive.
+ * \param size Size of the section.
+ *
+ * \return \p **0** if the section lies within the 
+ *         archive, \p **-1** otherwise.
+ */
+static int validate_section_bounds(
+    size_t archive_size, size_t offset, size_t size
+);
+
+/*!
+ * \brief The get_header_size() function gets the size
+ *        of the archive header and of the map headers.
+ *
+ * \param version Version of the archive.
+ *
+ * \return `0x10` bytes for the \ref MARC_VERSION_1
+ *         version, `0x20` bytes otherwise.
+ */
+static size_t get_header_size(unsigned int version);
+
+/*!
+ * \brief The get_offset_size() function gets the size
+ *        of the offsets of a chunk table.
+ *
+ * \param version Version of the archive.
+ *
+ * \return `4` bytes for the \ref MARC_VERSION_1 version,
+ *         `8` bytes otherwise.
+ */
+static size_t get_offset_size(unsigned int version);
+
+/*!
+ * \brief The parse_archive_header() function reads the
+ *        header of a map archive.
+ *
+ * \param arch_header First `0x20` bytes of the archive.
+ * \param sections Sections of the map archive whose
+ *                 version, number of tiles and map
+ *                 offset are set.
+ * \param tile_attributes_offset Offset of the properties
+ *                               of the tiles.
+ *
+ * \return \p **0** if the signature is valid and the 
+ *         archive holds at most \ref MAX_OBJECTS tiles,
+ *         \p **-1** otherwise.
+ *
+ * \see MARC_HEADER
+ * \see MARC_V2_HEADER
+ */
+static int parse_archive_header(
+    const char* arch_header, MarcSections* sections,
+    unsigned long long* tile_attributes_offset
+);
+
+/*!
+ * \brief The parse_map_header() function reads the
+ *        header of a map as stored in an archive.
+ *
+ * \param version Version of the archive.
+ * \param stored_header Header as stored in the archive.
+ * \param map_header Header of the map.
+ */
+static void parse_map_header(
+    unsigned int version, const char* stored_header,
+    MapHeader* map_header
+);
+
+/*!
+ * \brief The format_map_header() function lays out the
+ *        header of a map as stored in an archive.
+ *
+ * \param map_header Header of the map.
+ * \param stored_header Header as stored in the archive.
+ *                      It must hold get_header_size()
+ *                      bytes.
+ */
+static void format_map_header(
+    const MapHeader* map_header, char* stored_header
+);
+
+/*!
+ * \brief The validate_map_header() function validates
+ *        the header of a map.
+ *
+ * The \ref MAPF_HEADER, \ref MAPF_RLE_HEADER, 
+ * \ref MAPC_HEADER and \ref MAPC_RLE_HEADER signatures 
+ * are accepted. A tile is stored on `1` byte, or on `2`
+ * bytes with the \ref MARC_VERSION_2 version.
+ *
+ * \param map_header Header of a map.
+ * \param offset Offset of the header in the archive.
+ *
+ * \return \p **0** if the header is valid, \p **-1**
+ *         otherwise.
+ */
+static int validate_map_header(
+    const MapHeader* map_header, unsigned long long offset
+);
+
+/*!
+ * \brief The is_chunked_map() function checks whether
+ *        a map is stored with the chunked layout.
+ *
+ * \param map_header Header of a map.
+ *
+ * \return \p **1** if the map is chunked, \p **0** 
+ *         otherwise.
+ *
+ * \see MAP_LAYOUT_CHUNKED
+ */
+static int is_chunked_map(const MapHeader* map_header);
+
+/*!
+ * \brief The get_map_size() function gets the size of
+ *        the decoded data of a map.
+ *
+ * \param map_header Header of a map.
+ *
+ * \return The size of the decoded map data.
+ */
+static size_t get_map_size(const MapHeader* map_header);
+
+/*!
+ * \brief The get_stored_map_size() function gets the
+ *        size of the map data as stored in an archive.
+ *
+ * \param map_header Header of a map.
+ *
+ * \return The size of the map data in the archive.
+ */
+static size_t get_stored_map_size(const MapHeader* map_header);
+
+/*!
+ * \brief The get_map_cell() function gets a tile of
+ *        map data.
+ *
+ * \param map_data Map data.
+ * \param plane_size Number of tiles of the map data.
+ * \param cell_size Number of bytes of a tile.
+ * \param index Index of the tile.
+ *
+ * \return The tile, or \ref MAP_OBJECT_NONE.
+ */
+static int get_map_cell(
+    const char* map_data, size_t plane_size,
+    unsigned int cell_size, size_t index
+);
+
+/*!
+ * \brief The set_map_cell() function sets a tile of
+ *        map data.
+ *
+ * \param map_data Map data.
+ * \param plane_size Number of tiles of the map data.
+ * \param cell_size Number of bytes of a tile.
+ * \param index Index of the tile.
+ * \param object The tile, or \ref MAP_OBJECT_NONE.
+ */
+static void set_map_cell(
+    char* map_data, size_t plane_size,
+    unsigned int cell_size, size_t index, int object
+);
+
+/*!
+ * \brief The decode_map_data() function decodes the 
+ *        data of a run-length encoded map.
+ *
+ * \param map_header Header of a map.
+ * \param stored_data Map data as stored in the archive.
+ * \param offset Offset of the header in the archive.
+ * \param map_data Decoded map data that must be freed,
+ *                 or \p **NULL** if the map data are not
+ *                 encoded.
+ *
+ * \return \p **0** if the map data are decoded, \p **-1**
+ *         if they are malformed.
+ */
+static int decode_map_data(
+    const MapHeader* map_header, const char* stored_data,
+    unsigned long long offset, char** map_data
+);
+
+/*!
+ * \brief The encode_map_chunks() function splits the data
+ *        of a map into chunks of \ref MAP_CHUNK_WIDTH 
+ *        columns.
+ *
+ * The chunks are preceded by their offsets from the map
+ * header and by the end of the last chunk. Each chunk 
+ * is run-length encoded if the signature of \p map_header
+ * is \ref MAPC_RLE_HEADER.
+ *
+ * \param map_header Header of the map.
+ * \param map_data Map data, row after row.
+ * \param stored_size Size of the chunked map data.
+ *
+ * \return The chunked map data that must be freed.
+ */
+static char* encode_map_chunks(
+    const MapHeader* map_header, const char* map_data,
+    size_t* stored_size
+);
+
+/*!
+ * \brief The validate_tile_attributes() function validates
+ *        the signatures of the properties of the tiles.
+ *
+ * \param tile_attributes Properties of the tiles.
+ * \param tile_count Number of tiles.
+ * \param offset Offset of the properties of the tiles
+ *               in the archive.
+ *
+ * \return \p **0** if the signatures are valid, \p **-1**
+ *         otherwise.
+ *
+ * \see OBJECT_PROPERTIES_HEADER
+ */
+static int validate_tile_attributes(
+    const unsigned int* tile_attributes, unsigned int tile_count,
+    unsigned long long offset
+);
+
+/*!
+ * \brief The read_checksums() function reads the 
+ *        checksum trailer of a map archive, if any.
+ *
+ * The trailer is only looked for past the end of the
+ * map, so that map data ending like a trailer are not
+ * mistaken for one. The archive is either read from 
+ * \p fd or from \p archive if it is mapped. In the
+ * former case, the last bytes of the archive are read
+ * beforehand.
+ *
+ * \param fd Opened map archive, or `-1`.
+ * \param archive Mapped map archive, or \p **NULL**.
+ * \param archive_size Size of the map archive.
+ * \param trailer Last `0x10` bytes of the archive read
+ *        from \p fd, or \p **NULL**.
+ * \param sections Sections whose map header is read.
+ *
+ * \return `0` on success, `-1` otherwise.
+ *
+ * \see MCRC_TRAILER
+ */
+static int read_checksums(
+    int fd, const char* archive, size_t archive_size, 
+    const unsigned int* trailer, MarcSections* sections
+);
+
+/*!
+ * \brief The verify_checksum() function checks a
+ *        section of a map archive against its checksum.
+ *
+ * \param checksum Checksum read from the trailer.
+ * \param data Section to check.
+ * \param size Size of the section.
+ * \param name Name of the section, for the error message.
+ *
+ * \return `0` if the checksums match, `-1` otherwise.
+ */
+static int verify_checksum(
+    unsigned int checksum, const void* data, size_t size, 
+    const char* name
+);
+
+/*!
+ * \brief The verify_map_cells() function checks that the
+ *        cells of map data reference existing tiles.
+ *
+ * \param map_data Map data.
+ * \param plane_size Number of tiles of the map data.
+ * \param cell_size Number of bytes of a tile.
+ * \param tile_count Number of tiles of the map archive.
+ *
+ * \return `0` if every cell is either 
+ *         \ref MAP_OBJECT_NONE or a tile of the archive,
+ *         `-1` otherwise.
+ */
+static int verify_map_cells(
+    const char* map_data, size_t plane_size, unsigned int cell_size,
+    unsigned int tile_count
+);
+
+/*!
+ * \brief The get_band_count() function gets the number
+ *        of bands splitting map data.
+ *
+ * \param size Size of the map data.
+ *
+ * \return The number of bands, from `1` to the number of
+ *         threads set by map_load_set_threads(), each 
+ *         band holding at least \ref MAP_BAND_MIN_SIZE 
+ *         bytes.
+ */
+static unsigned int get_band_count(size_t size);
+
+/*!
+ * \brief The run_bands() function handles bands of map
+ *        data, one thread per band.
+ *
+ * The first band is handled by the calling thread, as 
+ * well as the bands whose thread cannot be created.
+ *
+ * \param bands Bands of map data.
+ * \param band_count Number of bands.
+ * \param band_worker Function handling a band.
+ */
+static void run_bands(
+    MapBand* bands, unsigned int band_count, 
+    void* (*band_worker)(void*)
+);
+
+/*!
+ * \brief The decode_band() function decodes the runs of
+ *        a band of run-length encoded map data.
+ *
+ * \param parameters The band.
+ *
+ * \return This function always returns \p **NULL**.
+ */
+static void* decode_band(void* parameters);
+
+/*!
+ * \brief The decode_map_bands() function decodes 
+ *        run-length encoded map data by bands.
+ *
+ * The runs are split into bands decoding to about the 
+ * same size. The last runs of each band, spanning at 
+ * least \ref RLE_DECODE_PADDING bytes, are expanded once 
+ * all the bands are decoded, so that the blocks written 
+ * past a band never reach the next one.
+ *
+ * \param encoded Encoded map data.
+ * \param encoded_size Size of the encoded map data.
+ * \param data Decoded map data. The buffer must be able 
+ *             to hold \p size + \ref RLE_DECODE_PADDING 
+ *             bytes.
+ * \param size Size of the decoded map data.
+ *
+ * \return \p **0** if the map data are decoded, \p **-1**
+ *         if they are malformed.
+ *
+ * \see rle_decode()
+ */
+static int decode_map_bands(
+    const char* encoded, size_t encoded_size, char* data, size_t size
+);
+
+/*!
+ * \brief The checksum_band() function computes the
+ *        checksum of a band of data.
+ *
+ * \param parameters The band.
+ *
+ * \return This function always returns \p **NULL**.
+ */
+static void* checksum_band(void* parameters);
+
+/*!
+ * \brief The compute_checksum() function computes the
+ *        checksum of data by bands.
+ *
+ * The checksums of the bands are combined in order.
+ *
+ * \param data Data to checksum.
+ * \param size Size of the data.
+ *
+ * \return The checksum of the data.
+ *
+ * \see crc32c_combine()
+ */
+static unsigned int compute_checksum(const void* data, size_t size);
+
+/*!
+ * \brief The commit_band() function sets the tiles of a
+ *        band of columns of the map.
+ *
+ * \param parameters The band.
+ *
+ * \return This function always returns \p **NULL**.
+ *
+ * \see map_set()
+ */
+static void* commit_band(void* parameters);
+
+/*!
+ * \brief The read_sections() function reads and validates
+ *        the sections of a map archive.
+ *
+ * The map data of a chunked map are not read. Whether
+ * the sections are read or not, they must be released 
+ * with the free_sections() function.
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive.
+ *
+ * \return \p **0** if the sections are read, \p **-1**
+ *         otherwise.
+ *
+ * \see read_tiles()
+ * \see read_map()
+ * \see read_chunked_map()
+ */
+static int read_sections(int fd, MarcSections* sections);
+
+/*!
+ * \brief The read_tiles() function reads and validates
+ *        the headers and the tiles of a map archive.
+ *
+ * The header of the first map is read as well, but not
+ * its map data. All the sections following the archive
+ * header are read by a single batch. Whether the tiles 
+ * are read or not, they must be released with the 
+ * free_sections() function.
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive.
+ *
+ * \return \p **0** if the tiles are read, \p **-1**
+ *         otherwise.
+ */
+static int read_tiles(int fd, MarcSections* sections);
+
+/*!
+ * \brief The read_map_header() function reads and 
+ *        validates the header of a map.
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive, whose
+ *                 map offset is set.
+ *
+ * \return \p **0** if the map header is read, \p **-1**
+ *         otherwise.
+ */
+static int read_map_header(int fd, MarcSections* sections);
+
+/*!
+ * \brief The read_map() function reads, decodes and 
+ *        validates the map data of a contiguous map.
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive, whose
+ *                 map header is read.
+ *
+ * \return \p **0** if the map data are read, \p **-1**
+ *         otherwise.
+ */
+static int read_map(int fd, MarcSections* sections);
+
+/*!
+ * \brief The read_streamed_sections() function reads and
+ *        validates the sections of a map archive in a
+ *        single forward pass.
+ *
+ * The archive is read in file order, up to the end of 
+ * its first map, by the read_stream_prefix() function.
+ * The remaining bytes are read by the 
+ * read_stream_trailer() function. Then the sections are
+ * validated as the ones of a mapped archive, and the
+ * chunks of a chunked map are all decoded. 
+ *
+ * Whether the sections are read or not, they must be 
+ * released with the free_sections() function.
+ *
+ * \param fd Opened map archive, possibly not seekable.
+ * \param sections Sections of the map archive.
+ *
+ * \return \p **0** if the sections are read, \p **-1**
+ *         otherwise.
+ *
+ * \see parse_tiles()
+ * \see parse_map()
+ */
+static int read_streamed_sections(int fd, MarcSections* sections);
+
+/*!
+ * \brief The read_stream_prefix() function reads a map
+ *        archive in file order, up to the end of its 
+ *        first map.
+ *
+ * The headers are parsed as soon as they are read, in
+ * order to know how far the archive must be read. 
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive, whose
+ *                 headers are parsed.
+ * \param tile_attributes_offset Offset of the tile 
+ *                               properties.
+ * \param archive_size Number of bytes read.
+ *
+ * \return The bytes read, to free, or \p **NULL** if the
+ *         archive cannot be read.
+ */
+static char* read_stream_prefix(
+    int fd, MarcSections* sections,
+    unsigned long long* tile_attributes_offset, size_t* archive_size
+);
+
+/*!
+ * \brief The extend_stream_prefix() function reads the
+ *        next bytes of a map archive, up to \p size bytes
+ *        from its beginning.
+ *
+ * \param fd Opened map archive.
+ * \param archive Bytes already read, reallocated.
+ * \param archive_size Number of bytes already read.
+ * \param size Number of bytes to hold.
+ *
+ * \return \p **0** if the bytes are read, \p **-1**
+ *         otherwise.
+ */
+static int extend_stream_prefix(
+    int fd, char** archive, size_t* archive_size, 
+    unsigned long long size
+);
+
+/*!
+ * \brief The read_stream_trailer() function reads a map
+ *        archive up to its end, only keeping the last 
+ *        `16` bytes.
+ *
+ * The other levels and the level directory of an archive
+ * are skipped this way. The checksums are kept if the
+ * last bytes are a checksum trailer.
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive.
+ *
+ * \return \p **0** if the archive is read, \p **-1**
+ *         otherwise.
+ *
+ * \see MCRC_TRAILER
+ */
+static int read_stream_trailer(int fd, MarcSections* sections);
+
+/*!
+ * \brief The get_tile_paths_size() function gets the
+ *        number of bytes available to the tile paths of
+ *        a map archive.
+ *
+ * The tile paths fill the gap between the archive header
+ * and the tile properties. Archives whose tile properties
+ * come first hold tile paths of `0x40` bytes.
+ *
+ * \param sections Sections of the map archive, whose
+ *                 archive header is read.
+ * \param tile_attributes_offset Offset of the tile
+ *                               properties.
+ *
+ * \return The size of the tile paths.
+ */
+static size_t get_tile_paths_size(
+    const MarcSections* sections, 
+    unsigned long long tile_attributes_offset
+);
+
+/*!
+ * \brief The parse_tile_paths() function interns the 
+ *        tile paths of a map archive.
+ *
+ * The checksum of the tile paths is checked if the 
+ * archive ends with a checksum trailer.
+ *
+ * \param section Tile paths, as stored.
+ * \param size Number of bytes available in \p section.
+ * \param sections Sections of the map archive, whose
+ *                 headers and checksums are read.
+ *
+ * \return \p **0** if the tile paths are valid, 
+ *         \p **-1** otherwise.
+ *
+ * \see path_table_parse()
+ */
+static int parse_tile_paths(
+    const char* section, size_t size, MarcSections* sections
+);
+
+/*!
+ * \brief The parse_tiles() function validates the tiles
+ *        of a map archive held in memory.
+ *
+ * The tile properties of \p sections point into 
+ * \p archive, the tile paths are interned.
+ *
+ * \param archive Map archive.
+ * \param archive_size Size of the map archive.
+ * \param sections Sections of the map archive, whose
+ *                 headers and checksums are read.
+ * \param tile_attributes_offset Offset of the tile
+ *                               properties.
+ *
+ * \return \p **0** if the tiles are valid, \p **-1**
+ *         otherwise.
+ */
+static int parse_tiles(
+    const char* archive, size_t archive_size, MarcSections* sections,
+    unsigned long long tile_attributes_offset
+);
+
+/*!
+ * \brief The parse_map() function decodes and validates
+ *        the map data of a contiguous map held in memory.
+ *
+ * The map data of \p sections point into \p archive, 
+ * unless they are encoded.
+ *
+ * \param archive Map archive.
+ * \param archive_size Size of the map archive.
+ * \param sections Sections of the map archive, whose
+ *                 map header is read.
+ * \param map_data Decoded map data, to free, or 
+ *                 \p **NULL** if the map data are not
+ *                 encoded.
+ *
+ * \return \p **0** if the map data are valid, \p **-1**
+ *         otherwise.
+ */
+static int parse_map(
+    const char* archive, size_t archive_size, MarcSections* sections,
+    char** map_data
+);
+
+/*!
+ * \brief The read_level_directory() function reads and
+ *        validates the level directory of a map archive.
+ *
+ * An archive without a level directory holds a single 
+ * level, the map referenced by its header.
+ *
+ * \param fd Opened map archive.
+ * \param archive Archive whose tiles are read.
+ *
+ * \return \p **0** if the level directory is read, 
+ *         \p **-1** otherwise.
+ *
+ * \see MDIR_HEADER
+ */
+static int read_level_directory(int fd, LevelArchive* archive);
+
+/*!
+ * \brief The open_level_archive() function opens a map
+ *        archive and reads its tiles and its level 
+ *        directory.
+ *
+ * Whether the archive is opened or not, it must be 
+ * released with the close_level_archive() function.
+ *
+ * \param archive Archive to open.
+ * \param filename Map archive.
+ *
+ * \return \p **0** if the archive is opened, \p **-1**
+ *         otherwise.
+ */
+static int open_level_archive(LevelArchive* archive, const char* filename);
+
+/*!
+ * \brief The is_unmodified_archive() function checks 
+ *        whether a map archive is the one that was kept.
+ *
+ * Archives are renamed over the previous ones when saved,
+ * hence the inode of the archive is compared as well as
+ * its size and its modification time.
+ *
+ * \param kept_filename Kept archive, or \p **NULL**.
+ * \param kept_stat Status of the kept archive.
+ * \param filename Map archive.
+ *
+ * \return \p **1** if \p filename is the kept archive
+ *         and was not modified since, \p **0** otherwise.
+ */
+static int is_unmodified_archive(
+    const char* kept_filename, const struct stat* kept_stat,
+    const char* filename
+);
+
+/*!
+ * \brief The is_level_archive() function checks whether 
+ *        an opened archive is still the one named
+ *        \p filename.
+ *
+ * The archive is considered modified if its device, its
+ * inode, its size or its modification time differ.
+ *
+ * \param archive Opened archive.
+ * \param filename Map archive.
+ *
+ * \return \p **1** if the archive can be reused, \p **0**
+ *         otherwise.
+ */
+static int is_level_archive(
+    const LevelArchive* archive, const char* filename
+);
+
+/*!
+ * \brief The close_level_archive() function releases an
+ *        archive opened by open_level_archive().
+ *
+ * \param archive Archive to release.
+ */
+static void close_level_archive(LevelArchive* archive);
+
+/*!
+ * \brief The read_chunked_map() function reads and 
+ *        decodes all the chunks of a chunked map.
+ *
+ * The chunks are read either from an opened archive or 
+ * from an archive held in memory, as with the 
+ * stream_open() function.
+ *
+ * \param fd Opened map archive, or `-1`.
+ * \param archive Map archive held in memory, or 
+ *                \p **NULL**.
+ * \param archive_size Size of the map archive held in
+ *                     memory.
+ * \param sections Sections of the map archive, as read
+ *                 by the read_sections() function.
+ *
+ * \return \p **0** if the chunks are read, \p **-1**
+ *         otherwise.
+ */
+static int read_chunked_map(
+    int fd, const char* archive, size_t archive_size,
+    MarcSections* sections
+);
+
+/*!
+ * \brief The free_sections() function frees the sections
+ *        read by the read_sections() function.
+ *
+ * \param sections Sections of a map archive.
+ */
+static void free_sections(MarcSections* sections);
+
+/*!
+ * \brief The stream_open() function starts streaming the
+ *        chunks of a chunked map.
+ *
+ * The chunk table is read and validated. Whether the
+ * stream is opened or not, it must be released with the
+ * stream_close() function.
+ *
+ * \param chunks Chunks of the map.
+ * \param fd Opened map archive, or `-1`.
+ * \param archive Mapped map archive, or \p **NULL**.
+ * \param archive_size Size of the map archive.
+ * \param map_header Header of the map.
+ * \param map_offset Offset of the map in the archive.
+ *
+ * \return \p **0** if the chunk table is valid, \p **-1**
+ *         otherwise.
+ *
+ * \see map_stream()
+ */
+static int stream_open(
+    MapStream* chunks, int fd, const char* archive, 
+    size_t archive_size, const MapHeader* map_header,
+    unsigned long long map_offset
+);
+
+/*!
+ * \brief The stream_read_chunk() function reads and 
+ *        decodes a chunk of a chunked map.
+ *
+ * \param chunks Chunks of the map.
+ * \param chunk Index of the chunk.
+ * \param chunk_data Decoded chunk, row after row. It must
+ *                   hold \ref RLE_DECODE_PADDING more 
+ *                   bytes than the chunk.
+ *
+ * \return The number of columns of the chunk, or \p **-1**
+ *         if the chunk is malformed.
+ */
+static int stream_read_chunk(
+    const MapStream* chunks, unsigned int chunk, char* chunk_data
+);
+
+/*!
+ * \brief The stream_chunks() function loads a range of 
+ *        chunks of the current chunked map.
+ *
+ * The chunks already loaded are skipped. The archive is
+ * released once all the chunks are loaded. This function 
+ * exits the program if a chunk is malformed or references
+ * a tile beyond the tiles of the map archive.
+ *
+ * \param first First chunk.
+ * \param last Chunk after the last one.
+ *
+ * \see map_set()
+ */
+static void stream_chunks(unsigned int first, unsigned int last);
+
+/*!
+ * \brief The load_map() function loads a map from a map
+ *        archive for map_load() and map_load_streamed().
+ *
+ * Pipes and sockets are handed to map_load_fd(). The 
+ * chunks of a chunked map are either all loaded, or only
+ * the ones close to the left side of the map if 
+ * \p streamed is set, the others being loaded by 
+ * map_stream().
+ *
+ * \param filename Map archive.
+ * \param streamed Whether the chunks are streamed.
+ */
+static void load_map(char* filename, int streamed);
+
+/*!
+ * \brief The stream_close() function releases the map
+ *        archive and the chunk table of a chunked map.
+ *
+ * The chunks that are not loaded yet are dropped.
+ *
+ * \param chunks Chunks of the map.
+ */
+static void stream_close(MapStream* chunks);
+
+/*!
+ * \brief The load_worker() function stages the sections
+ *        of a map archive for map_load_async().
+ *
+ * Maps whose size map_allocate() would refuse are
+ * rejected. The chunks of a chunked map are all decoded.
+ * The completion is signalled by push_map_event().
+ *
+ * \param parameters Request of type \ref MapLoadRequest.
+ *
+ * \return This function always returns \p **NULL**.
+ *
+ * \see map_load_async_commit()
+ */
+static void* load_worker(void* parameters);
+
+/*!
+ * \brief The push_map_event() function pushes an event
+ *        of type map_event_type() signalling the end of
+ *        an asynchronous operation.
+ *
+ * The event is not pushed if no type could be allocated,
+ * the operation being then only committed by polling.
+ *
+ * \param code Code of the event.
+ * \param request Request of the operation.
+ */
+static void push_map_event(int code, void* request);
+
+/*!
+ * \brief The commit_sections() function allocates the map
+ *        and registers its tiles from the sections of a map
+ *        archive.
+ *
+ * \param sections Sections of a map archive.
+ *
+ * \see map_allocate()
+ * \see map_set()
+ * \see map_object_begin()
+ * \see map_object_add()
+ * \see map_object_end()
+ */
+static void commit_sections(const MarcSections* sections);
+
+/*!
+ * \brief The get_temporary_filename() function gets the
+ *        name of the temporary archive written by 
+ *        map_save().
+ *
+ * The temporary archive lies in the same directory as
+ * the map archive, so that it can be renamed over it.
+ * This function exits the program if the allocation
+ * fails.
+ *
+ * \param filename Map archive.
+ *
+ * \return The name of the temporary archive that must
+ *         be freed.
+ */
+static char* get_temporary_filename(const char* filename);
+
+/*!
+ * \brief The sync_directory() function flushes the 
+ *        directory of a map archive with
+ *        [fsync(int fd)](https://man7.org/linux/man-pages/man2/fsync.2.html).
+ *
+ * \param filename Map archive.
+ *
+ * \return \p **0** if the directory is flushed, \p **-1**
+ *         otherwise.
+ */
+static int sync_directory(const char* filename);
+
+/*!
+ * \brief The write_sections() function writes the sections
+ *        of a map archive, then synchronizes it.
+ *
+ * If io_batch_available(), the sections and the 
+ * synchronization are submitted as a single batch.
+ * Otherwise, the sections are written with a single 
+ * [writev(int fd, const struct iovec\* iov, int iovcnt)](https://man7.org/linux/man-pages/man2/writev.2.html)
+ * system call, which is only repeated if the kernel 
+ * performs a partial write.
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive.
+ * \param count Number of sections.
+ * \param sync Synchronization policy.
+ *
+ * \return The number of bytes written, or \p **-1** if
+ *         a write or the synchronization fails.
+ *
+ * \note The content of \p sections is modified.
+ *
+ * \see map_save_set_sync()
+ */
+static ssize_t write_sections(
+    int fd, struct iovec* sections, int count, unsigned int sync
+);
+
+/*!
+ * \brief The format_tiles() function gets the tile paths
+ *        and the tile properties of the current map, as
+ *        stored in a map archive.
+ *
+ * The tile paths are interned, then stored with the
+ * encoding set by map_save_set_paths().
+ *
+ * \param tile_count Number of tiles.
+ * \param tile_paths Paths of the tiles that must be
+ *        freed.
+ * \param tile_paths_size Size of the stored paths.
+ * \param tile_attributes Properties of the tiles that
+ *        must be freed.
+ *
+ * \return \p **0** if the tiles are formatted, \p **-1**
+ *         if an allocation fails.
+ */
+static int format_tiles(
+    unsigned int tile_count, char** tile_paths, 
+    size_t* tile_paths_size, unsigned int** tile_attributes
+);
+
+/*!
+ * \brief The format_map_data() function gets the tiles 
+ *        of the current map, row after row.
+ *
+ * \param map_header Header of the map.
+ * \param map_data Buffer able to hold the map data, or
+ *                 \p **NULL** to allocate it.
+ *
+ * \return The map data that must be freed, or 
+ *         \p **NULL** if the allocation fails.
+ */
+static char* format_map_data(const MapHeader* map_header, char* map_data);
+
+/*!
+ * \brief The take_snapshot() function takes a snapshot 
+ *        of the current map and of the settings of 
+ *        map_save().
+ *
+ * The chunks not loaded yet are loaded beforehand. The 
+ * map data are copied in the recycled buffer if it is 
+ * large enough. This function must be called on the main
+ * thread.
+ *
+ * \param snapshot Snapshot of the map.
+ *
+ * \return \p **0** if the snapshot is taken, \p **-1** 
+ *         if an allocation fails or if the map holds 
+ *         more than \ref MAX_OBJECTS tiles.
+ *
+ * \see release_snapshot()
+ */
+static int take_snapshot(MapSnapshot* snapshot);
+
+/*!
+ * \brief The write_snapshot() function writes a snapshot
+ *        as a map archive.
+ *
+ * The archive is written next to \p filename, then 
+ * renamed over it once complete. This function does not
+ * depend on the current map, hence it can be called from
+ * any thread.
+ *
+ * \param filename Map archive.
+ * \param snapshot Snapshot of the map.
+ *
+ * \return The size of the archive, or \p **-1** if it
+ *         cannot be written, `errno` being set.
+ */
+static ssize_t write_snapshot(const char* filename, MapSnapshot* snapshot);
+
+/*!
+ * \brief The keep_snapshot() function keeps a written
+ *        snapshot as the saved archive, if its map data 
+ *        can be updated in place.
+ *
+ * The kept content is moved out of the snapshot.
+ *
+ * \param filename Map archive.
+ * \param snapshot Snapshot of the map.
+ *
+ * \see map_save_incremental()
+ */
+static void keep_snapshot(const char* filename, MapSnapshot* snapshot);
+
+/*!
+ * \brief The release_snapshot() function releases a 
+ *        snapshot, its map data buffer being recycled.
+ *
+ * \param snapshot Snapshot of the map.
+ */
+static void release_snapshot(MapSnapshot* snapshot);
+
+/*!
+ * \brief The save_worker() function writes the snapshot 
+ *        of a map saved by map_save_async(), then signals
+ *        the completion by push_map_event().
+ *
+ * \param parameters Save request.
+ *
+ * \return This function always returns \p **NULL**.
+ *
+ * \see map_save_async_commit()
+ */
+static void* save_worker(void* parameters);
+
+/*!
+ * \brief The wait_pending_save() function waits for the
+ *        worker thread of the save started by 
+ *        map_save_async(), if any.
+ *
+ * Hence, a synchronous save never races with it and the
+ * archives are renamed in the order of the saves. The 
+ * pending save is still committed by 
+ * map_save_async_commit().
+ */
+static void wait_pending_save(void);
+
+/*!
+ * \brief The write_dirty_rows() function writes the bytes
+ *        of the map data that differ from the ones of the 
+ *        saved archive.
+ *
+ * The dirty bytes of a row are written as a single range,
+ * ranges close to each other being merged. The ranges and
+ * the synchronization are submitted as a single batch. 
+ * Nothing is submitted if the map is unchanged.
+ *
+ * \param fd Opened map archive.
+ * \param archive Saved archive.
+ * \param map_data Map data of the current map.
+ * \param sync Synchronization policy.
+ *
+ * \return The number of bytes written, or \p **-1** if
+ *         a write or the synchronization fails.
+ *
+ * \see io_batch_submit()
+ */
+static ssize_t write_dirty_rows(
+    int fd, const SavedArchive* archive, const char* map_data,
+    unsigned int sync
+);
+
+/*!
+ * \brief The is_saved_archive() function checks whether
+ *        a map archive is still the one written by the 
+ *        last save.
+ *
+ * \param archive Saved archive.
+ * \param filename Map archive.
+ *
+ * \return \p **1** if \p filename can be updated in
+ *         place, \p **0** otherwise.
+ */
+static int is_saved_archive(
+    const SavedArchive* archive, const char* filename
+);
+
+/*!
+ * \brief The close_saved_archive() function releases the
+ *        content of the saved archive.
+ *
+ * \param archive Saved archive.
+ */
+static void close_saved_archive(SavedArchive* archive);
+
+/*!
+ * \brief The get_shared_name() function gets the name of
+ *        the shared memory segment of a map archive.
+ *
+ * The name is made of the `CRC32C` checksum of the 
+ * canonical path of the archive, of its size and of its
+ * modification time, so that a modified archive gets a
+ * segment of its own.
+ *
+ * \param filename Map archive.
+ * \param archive_stat Status of the map archive.
+ *
+ * \return The name of the segment, which must be freed.
+ */
+static char* get_shared_name(
+    const char* filename, const struct stat* archive_stat
+);
+
+/*!
+ * \brief The get_shared_size() function gets the size of
+ *        the shared memory segment holding a map.
+ *
+ * \param tile_count Number of tiles.
+ * \param tile_paths_size Size of the packed table of the
+ *                        tile paths.
+ * \param map_header Header of the map.
+ *
+ * \return The size of the segment.
+ */
+static size_t get_shared_size(
+    unsigned int tile_count, size_t tile_paths_size,
+    const MapHeader* map_header
+);
+
+/*!
+ * \brief The read_decoded_sections() function reads the
+ *        sections of a map archive, the chunks of a 
+ *        chunked map included.
+ *
+ * \param fd Opened map archive.
+ * \param sections Sections of the map archive, to be 
+ *                 freed with the free_sections() function
+ *                 if they are read.
+ *
+ * \return \p **0** if the sections are read, \p **-1**
+ *         otherwise.
+ *
+ * \see read_sections()
+ * \see read_chunked_map()
+ */
+static int read_decoded_sections(int fd, MarcSections* sections);
+
+/*!
+ * \brief The create_shared_map() function decodes a map
+ *        archive into a shared memory segment, then 
+ *        loads the map.
+ *
+ * The chunks of a chunked map are all decoded. The 
+ * signature of the segment is written last, so that a
+ * segment left incomplete is never attached.
+ *
+ * \param fd_shared Opened shared memory segment, empty.
+ * \param fd_in Opened map archive.
+ *
+ * \return \p **0** if the map is loaded, \p **-1** 
+ *         otherwise.
+ *
+ * \see commit_sections()
+ */
+static int create_shared_map(int fd_shared, int fd_in);
+
+/*!
+ * \brief The attach_shared_map() function loads a map 
+ *        from a shared memory segment filled in by the
+ *        create_shared_map() function.
+ *
+ * \param fd_shared Opened shared memory segment.
+ *
+ * \return \p **0** if the map is loaded, \p **-1** if
+ *         the segment is incomplete.
+ *
+ * \see commit_sections()
+ */
+static int attach_shared_map(int fd_shared);
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Allocate a map object.
+ *
+ *************************************************************/
+void map_new(unsigned width, unsigned height)
+{
+    stream_close(&stream);
+
+    map_allocate(width, height);
+
+    /* Ground */
+
+    for (int x = 0; x < width; ++x)
+    {
+        map_set(x, height - 1, 0);          // Ground.
+    }
+
+    /* Walls */
+
+    for (int y = 0; y < height - 1; ++y) 
+    {
+        map_set(0, y, 1);                  
+        map_set(width - 1, y, 1);
+    }
+
+    map_object_begin(6);
+
+    map_object_add("images/ground.png", 1, MAP_OBJECT_SOLID);
+    map_object_add("images/wall.png", 1, MAP_OBJECT_SOLID);
+    map_object_add("images/grass.png", 1, MAP_OBJECT_SEMI_SOLID);
+    map_object_add(
+        "images/marble.png", 
+        1, 
+        MAP_OBJECT_SOLID | MAP_OBJECT_DESTRUCTIBLE
+    );
+    map_object_add("images/flower.png", 1, MAP_OBJECT_AIR);
+    map_object_add(
+        "images/coin.png", 
+        20, 
+        MAP_OBJECT_AIR | MAP_OBJECT_COLLECTIBLE
+    );
+    
+    map_object_end();
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set save encoding.
+ *
+ *************************************************************/
+void map_save_set_encoding(unsigned int encoding)
+{
+    save_encoding = encoding;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set save layout.
+ *
+ *************************************************************/
+void map_save_set_layout(unsigned int layout)
+{
+    save_layout = layout;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set save synchronization.
+ *
+ *************************************************************/
+void map_save_set_sync(unsigned int policy)
+{
+    save_sync = policy;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set save checksums.
+ *
+ *************************************************************/
+void map_save_set_checksums(int enabled)
+{
+    save_checksums = enabled;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set save version.
+ *
+ *************************************************************/
+void map_save_set_version(unsigned int version)
+{
+    save_version = version;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set tile path encoding.
+ *
+ *************************************************************/
+void map_save_set_paths(unsigned int encoding)
+{
+    save_paths = encoding;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set load threads.
+ *
+ *************************************************************/
+void map_load_set_threads(unsigned int threads)
+{
+    if (threads == MAP_LOAD_THREADS_AUTO)
+    {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (processors > 0 ? (unsigned int)processors : 1);
+    }
+
+    load_threads = 
+        (threads < MAP_BAND_MAX_COUNT ? threads : MAP_BAND_MAX_COUNT);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Save map.
+ *
+ *************************************************************/
+void map_save(char* filename)
+{                                 
+    /* Save started by map_save_async() */
+
+    wait_pending_save();
+
+    MapSnapshot snapshot;
+    int result = take_snapshot(&snapshot);
+    exit_on_error(result < 0);
+
+    ssize_t current_offset = write_snapshot(filename, &snapshot);
+    exit_on_error(current_offset < 0);
+
+    keep_snapshot(filename, &snapshot);
+    release_snapshot(&snapshot);
+
+    fprintf(
+        stderr, 
+        "Map successfully saved!\n"
+        "[%lx] bytes written!\n",
+        current_offset
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Save map asynchronously.
+ *
+ *************************************************************/
+int map_save_async(char* filename, MapSaveCallback callback)
+{
+    if (pending_save != NULL)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* Private event type, ignored by the game loop */
+
+    if (map_event == (Uint32)-1)
+    {
+        map_event = SDL_RegisterEvents(1);
+    }
+
+    MapSaveRequest* request = 
+        (MapSaveRequest*)calloc(1, sizeof(MapSaveRequest));
+    if (request == NULL)
+    {
+        return -1;
+    }
+
+    request->filename = strdup(filename);
+    request->callback = callback;
+    if (request->filename == NULL || take_snapshot(&request->snapshot) < 0)
+    {
+        free(request->filename);
+        free(request);
+        return -1;
+    }
+
+    /* The archive changes before the save is committed */
+
+    close_saved_archive(&saved);
+
+    /* Worker */
+
+    int result = pthread_create(
+        &request->thread, 
+        NULL, 
+        save_worker, 
+        request
+    );
+    if (result)
+    {
+        errno = result;
+        release_snapshot(&request->snapshot);
+        free(request->filename);
+        free(request);
+        return -1;
+    }
+
+    pending_save = request;
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Commit asynchronously saved map.
+ *
+ *************************************************************/
+void map_save_async_commit(void* request)
+{
+    MapSaveRequest* save_request = (MapSaveRequest*)request;
+
+    /* Already committed by map_save_async_poll() */
+
+    if (save_request != pending_save)
+    {
+        return;
+    }
+
+    /* The worker has pushed the event, it is about to end */
+
+    if (!save_request->joined)
+    {
+        int result = pthread_join(save_request->thread, NULL);
+        exit_on_error(result != 0);
+    }
+
+    if (save_request->size >= 0)
+    {
+        /* A later save has already rewritten the archive */
+
+        if (!save_request->superseded)
+        {
+            keep_snapshot(save_request->filename, &save_request->snapshot);
+        }
+
+        fprintf(
+            stderr, 
+            "Map successfully saved!\n"
+            "[%lx] bytes written!\n",
+            save_request->size
+        );
+    }
+
+    release_snapshot(&save_request->snapshot);
+    pending_save = NULL;
+
+    if (save_request->callback)
+    {
+        save_request->callback(
+            save_request->filename, 
+            (save_request->size < 0 ? -1 : 0)
+        );
+    }
+
+    free(save_request->filename);
+    free(save_request);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Poll asynchronously saved map.
+ *
+ *************************************************************/
+int map_save_async_poll(void)
+{
+    if (pending_save == NULL || 
+        !__atomic_load_n(&pending_save->done, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    map_save_async_commit(pending_save);
+
+    return 1;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Save map incrementally.
+ *
+ *************************************************************/
+void map_save_incremental(char* filename)
+{
+    /* Save started by map_save_async() */
+
+    wait_pending_save();
+
+    /* Chunks not loaded yet */
+
+    stream_chunks(0, stream.chunk_count);
+
+    unsigned int tile_count = map_objects();
+    unsigned int cell_size = (tile_count < 0xff ? 1 : 2);
+    unsigned int version =
+        (cell_size > 1 ? MARC_VERSION_2 : save_version);
+
+    /* 
+        Archive written by the last save
+
+        Any change to the tiles, to the size of the map or
+        to the settings of map_save() needs a full save. So
+        do checksummed archives, as the rows and the 
+        trailer cannot be updated at once.
+     */
+
+    char* tile_paths;
+    size_t tile_paths_size;
+    unsigned int* tile_attributes;
+    int result = format_tiles(
+        tile_count, 
+        &tile_paths, 
+        &tile_paths_size, 
+        &tile_attributes
+    );
+    exit_on_error(result < 0);
+
+    const MapHeader* map_header = &saved.map_header;
+    int in_place = is_saved_archive(&saved, filename) &&
+        save_encoding == MAP_ENCODING_RAW &&
+        save_layout == MAP_LAYOUT_CONTIGUOUS &&
+        !save_checksums && !saved.checksummed &&
+        version == map_header->version &&
+        map_width() == map_header->width &&
+        map_height() == map_header->height &&
+        tile_count == saved.tile_count &&
+        tile_paths_size == saved.tile_paths_size &&
+        !memcmp(tile_paths, saved.tile_paths, tile_paths_size) &&
+        !memcmp(tile_attributes, saved.tile_attributes, tile_count * 0x20);
+
+    free(tile_paths);
+    free(tile_attributes);
+
+    if (!in_place)
+    {
+        map_save(filename);
+        return;
+    }
+
+    /* MAPF map */
+
+    size_t map_size = get_map_size(map_header);
+    char* map_data = format_map_data(map_header, NULL);
+    exit_on_error(map_size && map_data == NULL);
+
+    /* Output file, updated in place */
+
+    int fd_out = open(filename, O_WRONLY);
+    exit_on_error(fd_out < 0);
+
+    ssize_t current_offset = 
+        write_dirty_rows(fd_out, &saved, map_data, save_sync);
+
+    result = -1;
+    if (current_offset >= 0)
+    {
+        result = fstat(fd_out, &saved.archive_stat);
+    }
+
+    if (close(fd_out) < 0)
+    {
+        result = -1;
+    }
+
+    if (current_offset < 0 || result < 0)
+    {
+        /* The content of the archive is no longer known */
+
+        int error = errno;
+        close_saved_archive(&saved);
+        free(map_data);
+        errno = error;
+        exit_on_error(1);
+    }
+
+    free(saved.map_data);
+    saved.map_data = map_data;
+
+    fprintf(
+        stderr, 
+        "Map successfully saved!\n"
+        "[%lx] bytes written!\n",
+        current_offset
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load map.
+ *
+ *************************************************************/
+void map_load(char* filename)
+{
+    load_map(filename, 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load streamed map.
+ *
+ *************************************************************/
+void map_load_streamed(char* filename)
+{
+    load_map(filename, 1);
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load map from a descriptor.
+ *
+ *************************************************************/
+void map_load_fd(int fd)
+{
+    /* Sections */
+
+    MarcSections sections;
+    int result = read_streamed_sections(fd, &sections);
+    exit_on_error(result < 0);
+
+    stream_close(&stream);
+    commit_sections(&sections);
+    free_sections(&sections);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load mapped map.
+ *
+ *************************************************************/
+void map_load_mapped(char* filename)
+{
+    /* Input file */
+
+    int fd_in = open(filename, O_RDONLY);
+    exit_on_error(fd_in < 0);
+
+    struct stat archive_stat;
+    int result = fstat(fd_in, &archive_stat);
+    exit_on_error(result < 0);
+
+    size_t archive_size = (size_t)archive_stat.st_size;
+    result = validate_section_bounds(archive_size, 0, 0x20);
+    exit_on_error(result < 0);
+
+    /* 
+        Mapping
+
+        The descriptor is no longer needed once the 
+        archive is mapped.
+     */
+
+    const char* archive = (const char*)mmap(
+        NULL, 
+        archive_size, 
+        PROT_READ, 
+        MAP_PRIVATE, 
+        fd_in, 
+        0
+    );
+    exit_on_error(archive == MAP_FAILED);
+
+    result = close(fd_in);
+    exit_on_error(result < 0);
+
+    /* MARC archive */
+
+    MarcSections sections;
+    memset(&sections, 0, sizeof(MarcSections));
+
+    unsigned long long tile_attributes_offset = 0;
+    result = parse_archive_header(
+        archive,
+        &sections,
+        &tile_attributes_offset
+    );
+    exit_on_error(result < 0);
+
+    size_t header_size = get_header_size(sections.version);
+
+    /* MAPF map header */
+
+    result = validate_section_bounds(
+        archive_size, 
+        sections.map_offset, 
+        header_size
+    );
+    exit_on_error(result < 0);
+    parse_map_header(
+        sections.version,
+        &archive[sections.map_offset], 
+        &sections.map_header
+    );
+    result = validate_map_header(
+        &sections.map_header,
+        sections.map_offset
+    );
+    exit_on_error(result < 0);
+
+    /* Checksum trailer */
+
+    result = read_checksums(-1, archive, archive_size, NULL, &sections);
+    exit_on_error(result < 0);
+
+    /* Tiles */
+
+    result = parse_tiles(
+        archive, 
+        archive_size, 
+        &sections, 
+        tile_attributes_offset
+    );
+    if (result < 0)
+    {
+        path_table_free(&sections.tile_paths);
+        munmap((void*)archive, archive_size);
+        exit_on_error(1);
+    }
+
+    stream_close(&stream);
+
+    if (is_chunked_map(&sections.map_header))
+    {
+        /* 
+            Chunks
+
+            The mapping holds the chunks while they 
+            are loaded.
+         */
+
+        sections.map_data = NULL;
+        commit_sections(&sections);
+        path_table_free(&sections.tile_paths);
+
+        result = stream_open(
+            &stream, 
+            -1, 
+            archive, 
+            archive_size, 
+            &sections.map_header,
+            sections.map_offset
+        );
+        if (result < 0)
+        {
+            stream_close(&stream);
+            exit_on_error(1);
+        }
+
+        stream.checksummed = sections.checksummed;
+        stream.map_checksum = sections.checksums[0x2];
+        stream.tile_count = sections.tile_count;
+
+        stream_chunks(0, stream.chunk_count);
+        return;
+    }
+
+    /* 
+        Map
+
+        Only encoded map data need to be copied.
+     */
+
+    char* map_data;
+    result = parse_map(archive, archive_size, &sections, &map_data);
+    if (result < 0)
+    {
+        path_table_free(&sections.tile_paths);
+        munmap((void*)archive, archive_size);
+        exit_on_error(1);
+    }
+
+    commit_sections(&sections);
+
+    path_table_free(&sections.tile_paths);
+    free(map_data);
+
+    result = munmap((void*)archive, archive_size);
+    exit_on_error(result < 0);
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load shared map.
+ *
+ *************************************************************/
+void map_load_shared(char* filename)
+{
+    /* Input file */
+
+    int fd_in = open(filename, O_RDONLY);
+    exit_on_error(fd_in < 0);
+
+    struct stat stat_in;
+    int result = fstat(fd_in, &stat_in);
+    exit_on_error(result < 0);
+
+    /* Pipes and sockets cannot be told apart across processes */
+
+    if (!S_ISREG(stat_in.st_mode))
+    {
+        result = close(fd_in);
+        exit_on_error(result < 0);
+
+        map_load(filename);
+        return;
+    }
+
+    /* 
+        Segment
+
+        The first process holds the segment locked until
+        it is filled in, the others wait for it.
+     */
+
+    char* shared_name = get_shared_name(filename, &stat_in);
+    int fd_shared = shm_open(
+        shared_name, 
+        O_RDWR | O_CREAT | O_EXCL, 
+        S_IRUSR | S_IWUSR
+    );
+    if (fd_shared >= 0)
+    {
+        result = flock(fd_shared, LOCK_EX);
+        if (!result)
+        {
+            result = create_shared_map(fd_shared, fd_in);
+        }
+
+        if (result < 0)
+        {
+            shm_unlink(shared_name);
+        }
+        exit_on_error(result < 0);
+    }
+    else
+    {
+        exit_on_error(errno != EEXIST);
+
+        fd_shared = shm_open(shared_name, O_RDONLY, 0);
+        exit_on_error(fd_shared < 0);
+
+        result = flock(fd_shared, LOCK_SH);
+        exit_on_error(result < 0);
+
+        /* Segments left incomplete are ignored */
+
+        if (attach_shared_map(fd_shared) < 0)
+        {
+            MarcSections sections;
+            result = read_decoded_sections(fd_in, &sections);
+            exit_on_error(result < 0);
+
+            stream_close(&stream);
+            commit_sections(&sections);
+            free_sections(&sections);
+        }
+    }
+
+    result = close(fd_shared);
+    exit_on_error(result < 0);
+
+    result = close(fd_in);
+    exit_on_error(result < 0);
+
+    free(shared_name);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Remove shared map.
+ *
+ *************************************************************/
+void map_load_shared_unlink(char* filename)
+{
+    struct stat archive_stat;
+    int result = stat(filename, &archive_stat);
+    exit_on_error(result < 0);
+
+    char* shared_name = get_shared_name(filename, &archive_stat);
+
+    /* The segment may have never been created */
+
+    result = shm_unlink(shared_name);
+    exit_on_error(result < 0 && errno != ENOENT);
+
+    free(shared_name);
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load level.
+ *
+ *************************************************************/
+void map_load_level(char* filename, unsigned int index)
+{
+    /* Tiles and level directory */
+
+    if (!is_level_archive(&levels, filename))
+    {
+        close_level_archive(&levels);
+
+        int result = open_level_archive(&levels, filename);
+        exit_on_error(result < 0);
+    }
+
+    if (index >= levels.level_count)
+    {
+        fprintf(stderr, "Level [%x] does not exist!\n", index);
+        exit_on_error(1);
+    }
+
+    /* The tiles are shared by all the levels */
+
+    MarcSections sections = levels.sections;
+    sections.map_offset = levels.level_offsets[index];
+    sections.checksums[0x2] = levels.level_checksums[index];
+    sections.map_data = NULL;
+
+    int result = read_map_header(levels.fd, &sections);
+    exit_on_error(result < 0);
+
+    stream_close(&stream);
+
+    if (is_chunked_map(&sections.map_header))
+    {
+        /* 
+            Chunks
+
+            The stream holds its own descriptor while
+            the chunks are loaded.
+         */
+
+        commit_sections(&sections);
+
+        int fd_in = dup(levels.fd);
+        exit_on_error(fd_in < 0);
+
+        result = stream_open(
+            &stream, 
+            fd_in, 
+            NULL, 
+            0, 
+            &sections.map_header,
+            sections.map_offset
+        );
+        exit_on_error(result < 0);
+
+        stream.checksummed = sections.checksummed;
+        stream.map_checksum = sections.checksums[0x2];
+        stream.tile_count = sections.tile_count;
+
+        stream_chunks(0, stream.chunk_count);
+        return;
+    }
+
+    /* Map */
+
+    result = read_map(levels.fd, &sections);
+    exit_on_error(result < 0);
+
+    commit_sections(&sections);
+
+    free((void*)sections.map_data);
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load map asynchronously.
+ *
+ *************************************************************/
+int map_load_async(char* filename, MapLoadCallback callback)
+{
+    if (pending_load != NULL)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* Private event type, ignored by the game loop */
+
+    if (map_event == (Uint32)-1)
+    {
+        map_event = SDL_RegisterEvents(1);
+    }
+
+    MapLoadRequest* request = 
+        (MapLoadRequest*)calloc(1, sizeof(MapLoadRequest));
+    if (request == NULL)
+    {
+        return -1;
+    }
+
+    request->filename = strdup(filename);
+    request->callback = callback;
+    if (request->filename == NULL)
+    {
+        free(request);
+        return -1;
+    }
+
+    /* Worker */
+
+    int result = pthread_create(
+        &request->thread, 
+        NULL, 
+        load_worker, 
+        request
+    );
+    if (result)
+    {
+        errno = result;
+        free(request->filename);
+        free(request);
+        return -1;
+    }
+
+    pending_load = request;
+
+    return 0;
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Commit asynchronously loaded map.
+ *
+ *************************************************************/
+void map_load_async_commit(void* request)
+{
+    MapLoadRequest* load_request = (MapLoadRequest*)request;
+
+    /* Already committed by map_load_async_poll() */
+
+    if (load_request != pending_load)
+    {
+        return;
+    }
+
+    /* The worker has pushed the event, it is about to end */
+
+    int result = pthread_join(load_request->thread, NULL);
+    exit_on_error(result != 0);
+
+    if (!load_request->status)
+    {
+        stream_close(&stream);
+        commit_sections(&load_request->sections);
+    }
+
+    free_sections(&load_request->sections);
+    pending_load = NULL;
+
+    if (load_request->callback)
+    {
+        load_request->callback(
+            load_request->filename, 
+            load_request->status
+        );
+    }
+
+    free(load_request->filename);
+    free(load_request);
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Poll asynchronously loaded map.
+ *
+ *************************************************************/
+int map_load_async_poll(void)
+{
+    if (pending_load == NULL || 
+        !__atomic_load_n(&pending_load->done, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    map_load_async_commit(pending_load);
+
+    return 1;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Map event type.
+ *
+ *************************************************************/
+unsigned int map_event_type(void)
+{
+    return map_event;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Stream map.
+ *
+ *************************************************************/
+void map_stream(int x)
+{
+    if (!stream.pending_chunks)
+    {
+        return;
+    }
+
+    /* Chunks within the distance */
+
+    unsigned int chunk_width = (unsigned int)stream.map_header.size;
+    int first_column = x - MAP_STREAM_DISTANCE;
+    int last_column = x + MAP_STREAM_DISTANCE;
+    if (last_column < 0)
+    {
+        return;
+    }
+
+    unsigned int first = 
+        (first_column < 0 ? 0 : (unsigned int)first_column / chunk_width);
+    unsigned int last = (unsigned int)last_column / chunk_width + 1;
+
+    stream_chunks(first, last);
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read section.
+ *
+ *************************************************************/
+int read_section(int fd, void* buffer, size_t size, off_t offset)
+{
+    char* cursor = (char*)buffer;
+    while (size)
+    {
+        ssize_t rw_result = pread(fd, cursor, size, offset);
+        if (rw_result < 0)
+        {
+            return -1;
+        }
+
+        if (!rw_result)
+        {
+            fprintf(
+                stderr,
+                "Unexpected end of archive at offset [%lx]!\n",
+                offset
+            );
+            return -1;
+        }
+
+        cursor += rw_result;
+        offset += rw_result;
+        size -= rw_result;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read stream.
+ *
+ *************************************************************/
+int read_stream(
+    int fd, void* buffer, size_t size, unsigned long long offset
+)
+{
+    char* cursor = (char*)buffer;
+    while (size)
+    {
+        ssize_t rw_result = read(fd, cursor, size);
+        if (rw_result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if (!rw_result)
+        {
+            fprintf(
+                stderr,
+                "Unexpected end of archive at offset [%llx]!\n",
+                offset
+            );
+            return -1;
+        }
+
+        cursor += rw_result;
+        offset += rw_result;
+        size -= rw_result;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read batch.
+ *
+ *************************************************************/
+int read_batch(IoRequest* requests, unsigned int count)
+{
+    int result = io_batch_submit(requests, count);
+    if (result < 0 && errno == ENODATA)
+    {
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            if ((size_t)requests[i].result < requests[i].size)
+            {
+                fprintf(
+                    stderr,
+                    "Unexpected end of archive at offset [%llx]!\n",
+                    requests[i].offset + requests[i].result
+                );
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Validate section bounds.
+ *
+ *************************************************************/
+int validate_section_bounds(
+    size_t archive_size, size_t offset, size_t size
+)
+{
+    if (offset > archive_size || size > archive_size - offset)
+    {
+        fprintf(
+            stderr,
+            "Unexpected end of archive at offset [%lx]!\n",
+            (offset > archive_size ? offset : archive_size)
+        );
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get header size.
+ *
+ *************************************************************/
+size_t get_header_size(unsigned int version)
+{
+    return (version == MARC_VERSION_1 ? 0x10 : 0x20);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get offset size.
+ *
+ *************************************************************/
+size_t get_offset_size(unsigned int version)
+{
+    return (version == MARC_VERSION_1 ?
+        sizeof(unsigned int) : sizeof(unsigned long long));
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse archive header.
+ *
+ *************************************************************/
+int parse_archive_header(
+    const char* arch_header, MarcSections* sections,
+    unsigned long long* tile_attributes_offset
+)
+{
+    unsigned int fields[0x4];
+    memcpy(fields, arch_header, sizeof(fields));
+
+    if (fields[0x0] == MARC_HEADER)
+    {
+        sections->version = MARC_VERSION_1;
+        sections->tile_count = fields[0x1];
+        *tile_attributes_offset = fields[0x2];
+        sections->map_offset = fields[0x3];
+        sections->directory_offset = 0;
+    }
+    else if (fields[0x0] == MARC_V2_HEADER)
+    {
+        unsigned long long offsets[0x3];
+        memcpy(offsets, &arch_header[0x8], sizeof(offsets));
+
+        sections->version = MARC_VERSION_2;
+        sections->tile_count = fields[0x1];
+        *tile_attributes_offset = offsets[0x0];
+        sections->map_offset = offsets[0x1];
+        sections->directory_offset = offsets[0x2];
+    }
+    else
+    {
+        fprintf(
+            stderr,
+            "MARC header [%x] does not match at offset [0]!\n",
+            fields[0x0]
+        );
+        return -1;
+    }
+
+    /* map_get() only keeps the 10 low bits of a cell */
+
+    if (sections->tile_count > MAX_OBJECTS)
+    {
+        fprintf(
+            stderr,
+            "Number of tiles [%x] exceeds [%x]!\n",
+            sections->tile_count,
+            MAX_OBJECTS
+        );
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse map header.
+ *
+ *************************************************************/
+void parse_map_header(
+    unsigned int version, const char* stored_header,
+    MapHeader* map_header
+)
+{
+    unsigned int fields[0x4];
+    memcpy(fields, stored_header, sizeof(fields));
+
+    map_header->version = version;
+    map_header->signature = fields[0x0];
+    map_header->width = fields[0x1];
+    map_header->height = fields[0x2];
+
+    if (version == MARC_VERSION_1)
+    {
+        map_header->cell_size = 1;
+        map_header->size = fields[0x3];
+        return;
+    }
+
+    map_header->cell_size = fields[0x3];
+    memcpy(&map_header->size, &stored_header[0x10], sizeof(map_header->size));
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Format map header.
+ *
+ *************************************************************/
+void format_map_header(
+    const MapHeader* map_header, char* stored_header
+)
+{
+    unsigned int fields[0x4] = {
+        map_header->signature,
+        map_header->width,
+        map_header->height,
+        (unsigned int)map_header->size
+    };
+
+    if (map_header->version == MARC_VERSION_1)
+    {
+        memcpy(stored_header, fields, sizeof(fields));
+        return;
+    }
+
+    unsigned long long sizes[0x2] = {map_header->size, 0};
+    fields[0x3] = map_header->cell_size;
+    memcpy(stored_header, fields, sizeof(fields));
+    memcpy(&stored_header[0x10], sizes, sizeof(sizes));
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Validate map header.
+ *
+ *************************************************************/
+int validate_map_header(
+    const MapHeader* map_header, unsigned long long offset
+)
+{
+    if (map_header->signature != MAPF_HEADER &&
+        map_header->signature != MAPF_RLE_HEADER &&
+        map_header->signature != MAPC_HEADER &&
+        map_header->signature != MAPC_RLE_HEADER)
+    {
+        fprintf(
+            stderr, 
+            "MAPF header [%x] does not match at offset [%llx]!\n",
+            map_header->signature,
+            offset
+        );
+        return -1;
+    }
+
+    if (map_header->cell_size != 1 && map_header->cell_size != 2)
+    {
+        fprintf(
+            stderr,
+            "Tile size [%x] does not match at offset [%llx]!\n",
+            map_header->cell_size,
+            offset + 0xc
+        );
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Is chunked map.
+ *
+ *************************************************************/
+int is_chunked_map(const MapHeader* map_header)
+{
+    return map_header->signature == MAPC_HEADER ||
+        map_header->signature == MAPC_RLE_HEADER;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get map size.
+ *
+ *************************************************************/
+size_t get_map_size(const MapHeader* map_header)
+{
+    return (size_t)map_header->width * map_header->height *
+        map_header->cell_size;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get stored map size.
+ *
+ *************************************************************/
+size_t get_stored_map_size(const MapHeader* map_header)
+{
+    if (map_header->signature == MAPF_RLE_HEADER)
+    {
+        return map_header->size;
+    }
+
+    return get_map_size(map_header);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get map cell.
+ *
+ *************************************************************/
+int get_map_cell(
+    const char* map_data, size_t plane_size,
+    unsigned int cell_size, size_t index
+)
+{
+    /* The high bytes are in the last plane */
+
+    unsigned int cell = 0;
+    for (unsigned int plane = cell_size; plane--; )
+    {
+        cell = (cell << 8) |
+            (unsigned char)map_data[plane * plane_size + index];
+    }
+
+    if (cell == (1u << (cell_size * 8)) - 1)
+    {
+        return MAP_OBJECT_NONE;
+    }
+
+    return (int)cell;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set map cell.
+ *
+ *************************************************************/
+void set_map_cell(
+    char* map_data, size_t plane_size,
+    unsigned int cell_size, size_t index, int object
+)
+{
+    unsigned int cell = (unsigned int)object;
+    for (unsigned int plane = 0; plane < cell_size; ++plane)
+    {
+        map_data[plane * plane_size + index] = (char)(cell & 0xff);
+        cell >>= 8;
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Decode map data.
+ *
+ *************************************************************/
+int decode_map_data(
+    const MapHeader* map_header, const char* stored_data,
+    unsigned long long offset, char** map_data
+)
+{
+    *map_data = NULL;
+    if (map_header->signature != MAPF_RLE_HEADER)
+    {
+        return 0;
+    }
+
+    size_t map_size = get_map_size(map_header);
+    char* decoded_data = (char*)malloc(
+        (map_size + RLE_DECODE_PADDING) * sizeof(char)
+    );
+    if (decoded_data == NULL)
+    {
+        return -1;
+    }
+
+    int result = decode_map_bands(
+        stored_data, 
+        map_header->size,
+        decoded_data, 
+        map_size
+    );
+    if (result < 0)
+    {
+        fprintf(
+            stderr,
+            "Malformed encoded map data at offset [%llx]!\n",
+            offset + get_header_size(map_header->version)
+        );
+        free(decoded_data);
+        return -1;
+    }
+
+    *map_data = decoded_data;
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Encode map chunks.
+ *
+ *************************************************************/
+char* encode_map_chunks(
+    const MapHeader* map_header, const char* map_data,
+    size_t* stored_size
+)
+{
+    /* Planes of wide tiles are chunked as extra rows */
+
+    unsigned int map_w = map_header->width;
+    unsigned int map_rows = map_header->height * map_header->cell_size;
+    unsigned int chunk_width = (unsigned int)map_header->size;
+    unsigned int chunk_count = (map_w + chunk_width - 1) / chunk_width;
+    int encoded = (map_header->signature == MAPC_RLE_HEADER);
+
+    /* Chunk table followed by the chunks */
+
+    size_t header_size = get_header_size(map_header->version);
+    size_t offset_size = get_offset_size(map_header->version);
+    size_t table_size = (chunk_count + 1) * offset_size;
+    size_t map_size = get_map_size(map_header);
+    char* stored_data = (char*)malloc(
+        table_size + 
+        (encoded ? RLE_MAX_ENCODED_SIZE(map_size) : map_size)
+    );
+    exit_on_error(stored_data == NULL);
+
+    char* chunk = (char*)malloc(chunk_width * map_rows * sizeof(char));
+    exit_on_error(chunk == NULL);
+
+    size_t current_offset = table_size;
+    for (unsigned int i = 0; i <= chunk_count; ++i)
+    {
+        if (i)
+        {
+            /* The chunk before is written, its end is known */
+
+            unsigned long long chunk_offset = header_size + current_offset;
+            memcpy(
+                &stored_data[i * offset_size],
+                &chunk_offset,
+                offset_size
+            );
+        }
+
+        if (i == chunk_count)
+        {
+            break;
+        }
+
+        unsigned int chunk_x = i * chunk_width;
+        unsigned int chunk_w = map_w - chunk_x;
+        if (chunk_w > chunk_width)
+        {
+            chunk_w = chunk_width;
+        }
+
+        for (unsigned int y = 0; y < map_rows; ++y)
+        {
+            memcpy(
+                &chunk[y * chunk_w], 
+                &map_data[(size_t)y * map_w + chunk_x],
+                chunk_w * sizeof(char)
+            );
+        }
+
+        if (!i)
+        {
+            unsigned long long chunk_offset = header_size + current_offset;
+            memcpy(stored_data, &chunk_offset, offset_size);
+        }
+
+        if (encoded)
+        {
+            current_offset += rle_encode(
+                chunk, 
+                chunk_w * map_rows,
+                &stored_data[current_offset]
+            );
+        }
+        else
+        {
+            memcpy(
+                &stored_data[current_offset], 
+                chunk, 
+                chunk_w * map_rows * sizeof(char)
+            );
+            current_offset += chunk_w * map_rows;
+        }
+    }
+
+    free(chunk);
+
+    *stored_size = current_offset;
+    return stored_data;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Validate tile attributes.
+ *
+ *************************************************************/
+int validate_tile_attributes(
+    const unsigned int* tile_attributes, unsigned int tile_count,
+    unsigned long long offset
+)
+{
+    for (unsigned int i = 0; i < tile_count; ++i)
+    {
+        unsigned int header = tile_attributes[i * 0x8];
+        if (header != OBJECT_PROPERTIES_HEADER)
+        {
+            fprintf(
+                stderr, 
+                "Tile properties flag [%x] "
+                "does not match at offset [%llx]!\n",
+                header,
+                offset + i * 0x20
+            );
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read checksums.
+ *
+ *************************************************************/
+int read_checksums(
+    int fd, const char* archive, size_t archive_size, 
+    const unsigned int* trailer, MarcSections* sections
+)
+{
+    sections->checksummed = 0;
+
+    /* End of the map */
+
+    const MapHeader* map_header = &sections->map_header;
+    size_t map_end =
+        sections->map_offset + get_header_size(map_header->version);
+    if (is_chunked_map(map_header))
+    {
+        /* The last entry of the chunk table */
+
+        unsigned int chunk_width = (unsigned int)map_header->size;
+        if (!chunk_width)
+        {
+            return 0;
+        }
+
+        unsigned int chunk_count = 
+            (map_header->width + chunk_width - 1) / chunk_width;
+        size_t offset_size = get_offset_size(map_header->version);
+        size_t entry_offset = map_end + chunk_count * offset_size;
+
+        unsigned long long chunks_end = 0;
+        if (archive)
+        {
+            if (archive_size < entry_offset + offset_size)
+            {
+                return 0;
+            }
+            memcpy(&chunks_end, &archive[entry_offset], offset_size);
+        }
+        else if (read_section(
+                fd, 
+                &chunks_end, 
+                offset_size,
+                entry_offset
+            ) < 0)
+        {
+            return -1;
+        }
+
+        map_end = sections->map_offset + chunks_end;
+    }
+    else
+    {
+        map_end += get_stored_map_size(map_header);
+    }
+
+    if (archive_size < map_end + 0x10)
+    {
+        return 0;
+    }
+
+    /* Trailer */
+
+    unsigned int archive_trailer[0x4];
+    if (archive)
+    {
+        memcpy(
+            archive_trailer, 
+            &archive[archive_size - 0x10], 
+            sizeof(archive_trailer)
+        );
+        trailer = archive_trailer;
+    }
+
+    if (trailer[0x3] == MCRC_TRAILER)
+    {
+        sections->checksummed = 1;
+        memcpy(sections->checksums, trailer, sizeof(sections->checksums));
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Verify checksum.
+ *
+ *************************************************************/
+int verify_checksum(
+    unsigned int checksum, const void* data, size_t size, 
+    const char* name
+)
+{
+    if (compute_checksum(data, size) != checksum)
+    {
+        fprintf(stderr, "Checksum of the %s does not match!\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Verify map cells.
+ *
+ *************************************************************/
+int verify_map_cells(
+    const char* map_data, size_t plane_size, unsigned int cell_size,
+    unsigned int tile_count
+)
+{
+    for (size_t i = 0; i < plane_size; ++i)
+    {
+        int object = get_map_cell(map_data, plane_size, cell_size, i);
+        if (object != MAP_OBJECT_NONE && (unsigned int)object >= tile_count)
+        {
+            fprintf(stderr, "Map data reference a missing tile!\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get band count.
+ *
+ *************************************************************/
+unsigned int get_band_count(size_t size)
+{
+    size_t band_count = size / MAP_BAND_MIN_SIZE;
+    if (band_count > load_threads)
+    {
+        band_count = load_threads;
+    }
+
+    return (band_count ? (unsigned int)band_count : 1);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Run bands.
+ *
+ *************************************************************/
+void run_bands(
+    MapBand* bands, unsigned int band_count, 
+    void* (*band_worker)(void*)
+)
+{
+    for (unsigned int i = 1; i < band_count; ++i)
+    {
+        bands[i].threaded = !pthread_create(
+            &bands[i].thread, 
+            NULL, 
+            band_worker, 
+            &bands[i]
+        );
+    }
+
+    band_worker(&bands[0x0]);
+
+    for (unsigned int i = 1; i < band_count; ++i)
+    {
+        if (bands[i].threaded)
+        {
+            int result = pthread_join(bands[i].thread, NULL);
+            exit_on_error(result != 0);
+        }
+        else
+        {
+            band_worker(&bands[i]);
+        }
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Decode band.
+ *
+ *************************************************************/
+void* decode_band(void* parameters)
+{
+    MapBand* band = (MapBand*)parameters;
+    band->result = rle_decode(
+        band->input, 
+        band->input_size, 
+        band->output, 
+        band->output_size
+    );
+
+    return NULL;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Decode map bands.
+ *
+ *************************************************************/
+int decode_map_bands(
+    const char* encoded, size_t encoded_size, char* data, size_t size
+)
+{
+    unsigned int band_count = get_band_count(size);
+    if (band_count == 1 || encoded_size % 2)
+    {
+        return rle_decode(encoded, encoded_size, data, size);
+    }
+
+    /* Split the runs */
+
+    MapBand bands[MAP_BAND_MAX_COUNT];
+    size_t tail_ends[MAP_BAND_MAX_COUNT];
+    size_t position = 0;
+    size_t i = 0;
+    for (unsigned int b = 0; b < band_count; ++b)
+    {
+        size_t band_end = 
+            (b + 1 < band_count ? size / band_count * (b + 1) : size);
+
+        bands[b].input = &encoded[i];
+        bands[b].output = &data[position];
+
+        size_t band_begin = i;
+        size_t output_begin = position;
+        while (i < encoded_size && position < band_end)
+        {
+            position += (unsigned char)encoded[i];
+            i += 2;
+        }
+
+        /* The tail spans at least RLE_DECODE_PADDING bytes */
+
+        size_t tail = i;
+        size_t tail_size = 0;
+        while (tail > band_begin && tail_size < RLE_DECODE_PADDING)
+        {
+            tail -= 2;
+            tail_size += (unsigned char)encoded[tail];
+        }
+
+        bands[b].input_size = tail - band_begin;
+        bands[b].output_size = position - output_begin - tail_size;
+        tail_ends[b] = i;
+    }
+
+    if (i != encoded_size || position != size)
+    {
+        return -1;
+    }
+
+    run_bands(bands, band_count, decode_band);
+
+    /* Expand the tails in order */
+
+    for (unsigned int b = 0; b < band_count; ++b)
+    {
+        if (bands[b].result < 0)
+        {
+            return -1;
+        }
+
+        char* output = &bands[b].output[bands[b].output_size];
+        size_t tail = (size_t)(bands[b].input - encoded) + 
+            bands[b].input_size;
+        for ( ; tail < tail_ends[b]; tail += 2)
+        {
+            size_t run = (unsigned char)encoded[tail];
+            if (!run)
+            {
+                return -1;
+            }
+
+            memset(output, encoded[tail + 1], run);
+            output += run;
+        }
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Checksum band.
+ *
+ *************************************************************/
+void* checksum_band(void* parameters)
+{
+    MapBand* band = (MapBand*)parameters;
+    band->checksum = crc32c(0, band->input, band->input_size);
+
+    return NULL;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Compute checksum.
+ *
+ *************************************************************/
+unsigned int compute_checksum(const void* data, size_t size)
+{
+    unsigned int band_count = get_band_count(size);
+    if (band_count == 1)
+    {
+        return crc32c(0, data, size);
+    }
+
+    MapBand bands[MAP_BAND_MAX_COUNT];
+    size_t band_size = size / band_count;
+    for (unsigned int b = 0; b < band_count; ++b)
+    {
+        bands[b].input = &((const char*)data)[b * band_size];
+        bands[b].input_size = 
+            (b + 1 < band_count ? band_size : size - b * band_size);
+    }
+
+    run_bands(bands, band_count, checksum_band);
+
+    unsigned int checksum = bands[0x0].checksum;
+    for (unsigned int b = 1; b < band_count; ++b)
+    {
+        checksum = crc32c_combine(
+            checksum, 
+            bands[b].checksum, 
+            bands[b].input_size
+        );
+    }
+
+    return checksum;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Commit band.
+ *
+ *************************************************************/
+void* commit_band(void* parameters)
+{
+    MapBand* band = (MapBand*)parameters;
+
+    const MapHeader* map_header = &band->sections->map_header;
+    unsigned int map_w = map_header->width;
+    size_t plane_size = (size_t)map_w * map_header->height;
+    for (unsigned int y = 0; y < map_header->height; ++y)
+    {
+        for (unsigned int x = band->begin; x < band->end; ++x)
+        {
+            map_set(
+                x,
+                y,
+                get_map_cell(
+                    band->input,
+                    plane_size,
+                    map_header->cell_size,
+                    (size_t)y * map_w + x
+                )
+            );
+        }
+    }
+
+    return NULL;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read sections.
+ *
+ *************************************************************/
+int read_sections(int fd, MarcSections* sections)
+{
+    int result = read_tiles(fd, sections);
+    if (result < 0 || is_chunked_map(&sections->map_header))
+    {
+        return result;
+    }
+
+    return read_map(fd, sections);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read tiles.
+ *
+ *************************************************************/
+int read_tiles(int fd, MarcSections* sections)
+{
+    memset(sections, 0, sizeof(MarcSections));
+
+    /*
+        MARC archive
+ 
+        Version 1 archives are at least as long as a
+        version 2 header.
+     */
+
+    char arch_header[0x20];
+    int result = read_section(fd, arch_header, sizeof(arch_header), 0);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    unsigned long long tile_attributes_offset = 0;
+    result = parse_archive_header(
+        arch_header,
+        sections,
+        &tile_attributes_offset
+    );
+    if (result < 0)
+    {
+        return -1;
+    } 
+
+    size_t header_size = get_header_size(sections->version);
+
+    struct stat archive_stat;
+    if (fstat(fd, &archive_stat) < 0)
+    {
+        return -1;
+    }
+    size_t archive_size = (size_t)archive_stat.st_size;
+
+    /* Tile paths and attributes */
+
+    size_t tile_paths_size = 
+        get_tile_paths_size(sections, tile_attributes_offset);
+    size_t tile_attributes_size = (size_t)sections->tile_count * 0x20;
+    if (validate_section_bounds(
+            archive_size, 
+            header_size, 
+            tile_paths_size
+        ) < 0 || validate_section_bounds(
+            archive_size, 
+            tile_attributes_offset, 
+            tile_attributes_size
+        ) < 0 || validate_section_bounds(
+            archive_size, 
+            sections->map_offset, 
+            header_size
+        ) < 0)
+    {
+        return -1;
+    }
+
+    char* tile_paths = (char*)malloc(tile_paths_size * sizeof(char));
+    unsigned int* tile_attributes = 
+        (unsigned int*)malloc(tile_attributes_size);
+    sections->tile_attributes = tile_attributes;
+    if ((tile_paths_size && tile_paths == NULL) || 
+        (tile_attributes_size && tile_attributes == NULL))
+    {
+        free(tile_paths);
+        return -1;
+    }
+
+    /* 
+        MAPF map header, tiles and checksum trailer
+
+        Their offsets are all known from the archive
+        header, hence they are read at once.
+     */
+
+    char stored_map_header[0x20];
+    unsigned int trailer[0x4] = {0};
+    size_t trailer_size = (archive_size < 0x10 ? 0 : sizeof(trailer));
+    IoRequest requests[] = {
+        {
+            IO_BATCH_READ, 
+            fd, 
+            stored_map_header, 
+            header_size, 
+            sections->map_offset, 
+            0
+        },
+        {IO_BATCH_READ, fd, tile_paths, tile_paths_size, header_size, 0},
+        {
+            IO_BATCH_READ, 
+            fd, 
+            tile_attributes, 
+            tile_attributes_size, 
+            tile_attributes_offset, 
+            0
+        },
+        {
+            IO_BATCH_READ, 
+            fd, 
+            trailer, 
+            trailer_size, 
+            archive_size - trailer_size, 
+            0
+        }
+    };
+    result = read_batch(requests, sizeof(requests) / sizeof(IoRequest));
+    if (result < 0)
+    {
+        free(tile_paths);
+        return -1;
+    }
+
+    parse_map_header(
+        sections->version,
+        stored_map_header,
+        &sections->map_header
+    );
+    result = validate_map_header(
+        &sections->map_header,
+        sections->map_offset
+    );
+
+    /* Checksum trailer */
+
+    if (!result)
+    {
+        result = read_checksums(fd, NULL, archive_size, trailer, sections);
+    }
+
+    if (!result)
+    {
+        result = parse_tile_paths(tile_paths, tile_paths_size, sections);
+    }
+
+    free(tile_paths);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    if (validate_tile_attributes(
+            tile_attributes, 
+            sections->tile_count, 
+            tile_attributes_offset
+        ) < 0 || (sections->checksummed && verify_checksum(
+            sections->checksums[0x1], 
+            tile_attributes, 
+            tile_attributes_size, 
+            "tile properties"
+        ) < 0))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read map header.
+ *
+ *************************************************************/
+int read_map_header(int fd, MarcSections* sections)
+{
+    char stored_map_header[0x20];
+    int result = read_section(
+        fd, 
+        stored_map_header,
+        get_header_size(sections->version),
+        sections->map_offset
+    );
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    parse_map_header(
+        sections->version,
+        stored_map_header,
+        &sections->map_header
+    );
+
+    return validate_map_header(
+        &sections->map_header,
+        sections->map_offset
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read map.
+ *
+ *************************************************************/
+int read_map(int fd, MarcSections* sections)
+{
+    size_t header_size = get_header_size(sections->version);
+    size_t stored_size = get_stored_map_size(&sections->map_header);
+    char* stored_data = (char*)malloc(stored_size * sizeof(char));
+    if (stored_size && stored_data == NULL)
+    {
+        return -1;
+    }
+
+    int result = read_section(
+        fd, 
+        stored_data, 
+        stored_size * sizeof(char), 
+        sections->map_offset + header_size
+    );
+
+    char* map_data = NULL;
+    if (result < 0 || decode_map_data(
+            &sections->map_header,
+            stored_data, 
+            sections->map_offset,
+            &map_data
+        ) < 0)
+    {
+        free(stored_data);
+        return -1;
+    }
+
+    if (map_data)
+    {
+        free(stored_data);
+        stored_data = map_data;
+    }
+
+    sections->map_data = stored_data;
+
+    if (sections->checksummed && verify_checksum(
+            sections->checksums[0x2], 
+            stored_data, 
+            get_map_size(&sections->map_header),
+            "map data"
+        ) < 0)
+    {
+        return -1;
+    }
+
+    return verify_map_cells(
+        stored_data,
+        (size_t)sections->map_header.width * sections->map_header.height,
+        sections->map_header.cell_size,
+        sections->tile_count
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read streamed sections.
+ *
+ *************************************************************/
+int read_streamed_sections(int fd, MarcSections* sections)
+{
+    memset(sections, 0, sizeof(MarcSections));
+
+    /* Archive up to the end of the first map */
+
+    unsigned long long tile_attributes_offset = 0;
+    size_t archive_size = 0;
+    char* archive = read_stream_prefix(
+        fd, 
+        sections, 
+        &tile_attributes_offset,
+        &archive_size
+    );
+    if (archive == NULL)
+    {
+        return -1;
+    }
+
+    /* Checksum trailer */
+
+    int result = read_stream_trailer(fd, sections);
+
+    /* Tiles, copied out of the archive */
+
+    if (!result)
+    {
+        result = parse_tiles(
+            archive, 
+            archive_size, 
+            sections, 
+            tile_attributes_offset
+        );
+    }
+
+    const unsigned int* tile_attributes = sections->tile_attributes;
+    sections->tile_attributes = NULL;
+
+    size_t tile_attributes_size = (size_t)sections->tile_count * 0x20;
+    if (!result)
+    {
+        unsigned int* attributes = 
+            (unsigned int*)malloc(tile_attributes_size);
+        sections->tile_attributes = attributes;
+        if (tile_attributes_size && attributes == NULL)
+        {
+            result = -1;
+        }
+        else
+        {
+            memcpy(attributes, tile_attributes, tile_attributes_size);
+        }
+    }
+
+    /* 
+        Map
+
+        The chunks of a chunked map are all decoded, the
+        archive not being kept.
+     */
+
+    if (!result && is_chunked_map(&sections->map_header))
+    {
+        result = read_chunked_map(-1, archive, archive_size, sections);
+    }
+    else if (!result)
+    {
+        char* map_data;
+        result = parse_map(archive, archive_size, sections, &map_data);
+
+        size_t map_size = get_map_size(&sections->map_header);
+        if (!result && map_data == NULL)
+        {
+            map_data = (char*)malloc(map_size * sizeof(char));
+            if (map_size && map_data == NULL)
+            {
+                result = -1;
+            }
+            else
+            {
+                memcpy(map_data, sections->map_data, map_size);
+            }
+        }
+
+        sections->map_data = map_data;
+    }
+
+    free(archive);
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read stream prefix.
+ *
+ *************************************************************/
+char* read_stream_prefix(
+    int fd, MarcSections* sections,
+    unsigned long long* tile_attributes_offset, size_t* archive_size
+)
+{
+    char* archive = NULL;
+    *archive_size = 0;
+
+    /* MARC archive, whose size depends on its signature */
+
+    unsigned int signature = 0;
+    int result = extend_stream_prefix(fd, &archive, archive_size, 0x10);
+    if (!result)
+    {
+        memcpy(&signature, archive, sizeof(signature));
+        result = extend_stream_prefix(
+            fd, 
+            &archive, 
+            archive_size, 
+            (signature == MARC_V2_HEADER ? 0x20 : 0x10)
+        );
+    }
+
+    if (!result)
+    {
+        result = parse_archive_header(
+            archive, 
+            sections, 
+            tile_attributes_offset
+        );
+    }
+
+    /* MAPF map header */
+
+    size_t header_size = get_header_size(sections->version);
+    unsigned long long map_offset = sections->map_offset;
+    unsigned long long map_end = map_offset + header_size;
+    if (!result)
+    {
+        result = extend_stream_prefix(fd, &archive, archive_size, map_end);
+    }
+
+    if (!result)
+    {
+        parse_map_header(
+            sections->version,
+            &archive[map_offset], 
+            &sections->map_header
+        );
+        result = validate_map_header(&sections->map_header, map_offset);
+    }
+
+    /* End of the map */
+
+    const MapHeader* map_header = &sections->map_header;
+    unsigned int chunk_width = (unsigned int)map_header->size;
+    if (!result && !is_chunked_map(map_header))
+    {
+        map_end += get_stored_map_size(map_header);
+    }
+    else if (!result && chunk_width && chunk_width == map_header->size)
+    {
+        /* 
+            Last entry of the chunk table
+
+            Malformed tables are reported by stream_open().
+         */
+
+        size_t offset_size = get_offset_size(sections->version);
+        unsigned int chunk_count = 
+            (map_header->width + chunk_width - 1) / chunk_width;
+        map_end += (chunk_count + 1) * offset_size;
+
+        result = extend_stream_prefix(fd, &archive, archive_size, map_end);
+        if (!result)
+        {
+            unsigned long long chunks_end = 0;
+            memcpy(&chunks_end, &archive[map_end - offset_size], offset_size);
+            if (map_offset + chunks_end > map_end)
+            {
+                map_end = map_offset + chunks_end;
+            }
+        }
+    }
+
+    /* Tiles stored after the map, if any */
+
+    unsigned long long tiles_end[0x2] = {
+        header_size + 
+            get_tile_paths_size(sections, *tile_attributes_offset),
+        *tile_attributes_offset + 
+            (unsigned long long)sections->tile_count * 0x20
+    };
+    for (unsigned int i = 0; i < 0x2; ++i)
+    {
+        if (tiles_end[i] > map_end)
+        {
+            map_end = tiles_end[i];
+        }
+    }
+
+    if (!result)
+    {
+        result = extend_stream_prefix(fd, &archive, archive_size, map_end);
+    }
+
+    if (result < 0)
+    {
+        free(archive);
+        return NULL;
+    }
+
+    return archive;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Extend stream prefix.
+ *
+ *************************************************************/
+int extend_stream_prefix(
+    int fd, char** archive, size_t* archive_size, 
+    unsigned long long size
+)
+{
+    if (size <= *archive_size)
+    {
+        return 0;
+    }
+
+    if (size != (size_t)size)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    char* extended_archive = (char*)realloc(*archive, size);
+    if (extended_archive == NULL)
+    {
+        return -1;
+    }
+    *archive = extended_archive;
+
+    int result = read_stream(
+        fd, 
+        &extended_archive[*archive_size], 
+        size - *archive_size, 
+        *archive_size
+    );
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    *archive_size = size;
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read stream trailer.
+ *
+ *************************************************************/
+int read_stream_trailer(int fd, MarcSections* sections)
+{
+    /* The last bytes are kept at the front of the window */
+
+    char window[0x1000 + 0x10];
+    size_t kept_size = 0;
+    for (;;)
+    {
+        ssize_t rw_result = read(fd, &window[kept_size], 0x1000);
+        if (rw_result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if (!rw_result)
+        {
+            break;
+        }
+
+        size_t window_size = kept_size + rw_result;
+        kept_size = (window_size < 0x10 ? window_size : 0x10);
+        memmove(window, &window[window_size - kept_size], kept_size);
+    }
+
+    sections->checksummed = 0;
+    if (kept_size < 0x10)
+    {
+        return 0;
+    }
+
+    unsigned int trailer[0x4];
+    memcpy(trailer, window, sizeof(trailer));
+    if (trailer[0x3] == MCRC_TRAILER)
+    {
+        sections->checksummed = 1;
+        memcpy(sections->checksums, trailer, sizeof(sections->checksums));
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get tile paths size.
+ *
+ *************************************************************/
+size_t get_tile_paths_size(
+    const MarcSections* sections, 
+    unsigned long long tile_attributes_offset
+)
+{
+    size_t header_size = get_header_size(sections->version);
+    if (tile_attributes_offset > header_size)
+    {
+        return (size_t)(tile_attributes_offset - header_size);
+    }
+
+    return (size_t)sections->tile_count * 0x40;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse tile paths.
+ *
+ *************************************************************/
+int parse_tile_paths(
+    const char* section, size_t size, MarcSections* sections
+)
+{
+    ssize_t table_size = path_table_parse(
+        &sections->tile_paths, 
+        section, 
+        size, 
+        sections->tile_count
+    );
+    if (table_size < 0)
+    {
+        fprintf(
+            stderr,
+            "Tile paths do not match at offset [%lx]!\n",
+            get_header_size(sections->version)
+        );
+        return -1;
+    }
+
+    if (sections->checksummed)
+    {
+        return verify_checksum(
+            sections->checksums[0x0], 
+            section, 
+            (size_t)table_size, 
+            "tile paths"
+        );
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse tiles.
+ *
+ *************************************************************/
+int parse_tiles(
+    const char* archive, size_t archive_size, MarcSections* sections,
+    unsigned long long tile_attributes_offset
+)
+{
+    size_t header_size = get_header_size(sections->version);
+
+    /* Tile paths */
+
+    size_t tile_paths_size = 
+        get_tile_paths_size(sections, tile_attributes_offset);
+    if (validate_section_bounds(
+            archive_size, 
+            header_size,
+            tile_paths_size
+        ) < 0 || parse_tile_paths(
+            &archive[header_size], 
+            tile_paths_size, 
+            sections
+        ) < 0)
+    {
+        return -1;
+    }
+
+    /* Tile attributes */
+
+    size_t tile_attributes_size = (size_t)sections->tile_count * 0x20;
+    if (validate_section_bounds(
+            archive_size, 
+            tile_attributes_offset, 
+            tile_attributes_size
+        ) < 0)
+    {
+        return -1;
+    }
+
+    sections->tile_attributes = 
+        (const unsigned int*)&archive[tile_attributes_offset];
+    if (validate_tile_attributes(
+            sections->tile_attributes, 
+            sections->tile_count, 
+            tile_attributes_offset
+        ) < 0 || (sections->checksummed && verify_checksum(
+            sections->checksums[0x1], 
+            sections->tile_attributes, 
+            tile_attributes_size, 
+            "tile properties"
+        ) < 0))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse map.
+ *
+ *************************************************************/
+int parse_map(
+    const char* archive, size_t archive_size, MarcSections* sections,
+    char** map_data
+)
+{
+    *map_data = NULL;
+
+    unsigned long long map_data_offset = 
+        sections->map_offset + get_header_size(sections->version);
+    if (validate_section_bounds(
+            archive_size, 
+            map_data_offset,
+            get_stored_map_size(&sections->map_header)
+        ) < 0)
+    {
+        return -1;
+    }
+
+    const char* stored_data = &archive[map_data_offset];
+    if (decode_map_data(
+            &sections->map_header,
+            stored_data, 
+            sections->map_offset,
+            map_data
+        ) < 0)
+    {
+        return -1;
+    }
+
+    sections->map_data = (*map_data ? *map_data : stored_data);
+    if ((sections->checksummed && verify_checksum(
+            sections->checksums[0x2], 
+            sections->map_data, 
+            get_map_size(&sections->map_header),
+            "map data"
+        ) < 0) || verify_map_cells(
+            sections->map_data,
+            (size_t)sections->map_header.width * sections->map_header.height,
+            sections->map_header.cell_size,
+            sections->tile_count
+        ) < 0)
+    {
+        free(*map_data);
+        *map_data = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read level directory.
+ *
+ *************************************************************/
+int read_level_directory(int fd, LevelArchive* archive)
+{
+    const MarcSections* sections = &archive->sections;
+    unsigned long long directory_offset = sections->directory_offset;
+
+    /* Archives without a directory hold a single level */
+
+    unsigned int level_count = 1;
+    if (directory_offset)
+    {
+        unsigned int directory_header[0x4];
+        int result = read_section(
+            fd, 
+            directory_header, 
+            sizeof(directory_header), 
+            directory_offset
+        );
+        if (result < 0)
+        {
+            return -1;
+        }
+
+        if (directory_header[0x0] != MDIR_HEADER)
+        {
+            fprintf(
+                stderr,
+                "MDIR header [%x] does not match at offset [%llx]!\n",
+                directory_header[0x0],
+                directory_offset
+            );
+            return -1;
+        }
+
+        level_count = directory_header[0x1];
+        if (!level_count)
+        {
+            fprintf(
+                stderr,
+                "Level count [%x] does not match at offset [%llx]!\n",
+                level_count,
+                directory_offset + 0x4
+            );
+            return -1;
+        }
+    }
+
+    archive->level_offsets = (unsigned long long*)malloc(
+        level_count * sizeof(unsigned long long)
+    );
+    archive->level_checksums = (unsigned int*)malloc(
+        level_count * sizeof(unsigned int)
+    );
+    if (archive->level_offsets == NULL || archive->level_checksums == NULL)
+    {
+        return -1;
+    }
+
+    archive->level_count = level_count;
+
+    if (!directory_offset)
+    {
+        archive->level_offsets[0x0] = sections->map_offset;
+        archive->level_checksums[0x0] = sections->checksums[0x2];
+        return 0;
+    }
+
+    /* Levels */
+
+    size_t entries_size = (size_t)level_count * 0x10;
+    char* entries = (char*)malloc(entries_size * sizeof(char));
+    if (entries == NULL)
+    {
+        return -1;
+    }
+
+    int result = read_section(
+        fd, 
+        entries, 
+        entries_size, 
+        directory_offset + 0x10
+    );
+    for (unsigned int i = 0; !result && i < level_count; ++i)
+    {
+        memcpy(
+            &archive->level_offsets[i], 
+            &entries[i * 0x10], 
+            sizeof(unsigned long long)
+        );
+        memcpy(
+            &archive->level_checksums[i], 
+            &entries[i * 0x10 + 0x8], 
+            sizeof(unsigned int)
+        );
+    }
+
+    free(entries);
+
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    /* The first level is the map of the archive header */
+
+    if (archive->level_offsets[0x0] != sections->map_offset)
+    {
+        fprintf(
+            stderr,
+            "Level offset [%llx] does not match at offset [%llx]!\n",
+            archive->level_offsets[0x0],
+            directory_offset + 0x10
+        );
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Open level archive.
+ *
+ *************************************************************/
+int open_level_archive(LevelArchive* archive, const char* filename)
+{
+    memset(archive, 0, sizeof(LevelArchive));
+    archive->fd = -1;
+
+    archive->filename = strdup(filename);
+    if (archive->filename == NULL)
+    {
+        return -1;
+    }
+
+    archive->fd = open(filename, O_RDONLY);
+    if (archive->fd < 0 || fstat(archive->fd, &archive->archive_stat) < 0)
+    {
+        return -1;
+    }
+
+    if (read_tiles(archive->fd, &archive->sections) < 0)
+    {
+        return -1;
+    }
+
+    return read_level_directory(archive->fd, archive);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Is level archive.
+ *
+ *************************************************************/
+int is_level_archive(const LevelArchive* archive, const char* filename)
+{
+    return is_unmodified_archive(
+        archive->filename, 
+        &archive->archive_stat, 
+        filename
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Is unmodified archive.
+ *
+ *************************************************************/
+int is_unmodified_archive(
+    const char* kept_filename, const struct stat* kept_stat,
+    const char* filename
+)
+{
+    if (kept_filename == NULL || strcmp(kept_filename, filename))
+    {
+        return 0;
+    }
+
+    struct stat archive_stat;
+    if (stat(filename, &archive_stat) < 0)
+    {
+        return 0;
+    }
+
+    /* Saved archives are renamed over the previous ones */
+
+    return archive_stat.st_dev == kept_stat->st_dev &&
+        archive_stat.st_ino == kept_stat->st_ino &&
+        archive_stat.st_size == kept_stat->st_size &&
+        archive_stat.st_mtim.tv_sec == kept_stat->st_mtim.tv_sec &&
+        archive_stat.st_mtim.tv_nsec == kept_stat->st_mtim.tv_nsec;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Close level archive.
+ *
+ *************************************************************/
+void close_level_archive(LevelArchive* archive)
+{
+    if (archive->filename == NULL)
+    {
+        return;
+    }
+
+    if (archive->fd >= 0)
+    {
+        int result = close(archive->fd);
+        exit_on_error(result < 0);
+    }
+
+    free_sections(&archive->sections);
+    free(archive->level_offsets);
+    free(archive->level_checksums);
+    free(archive->filename);
+
+    memset(archive, 0, sizeof(LevelArchive));
+    archive->fd = -1;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read chunked map.
+ *
+ *************************************************************/
+int read_chunked_map(
+    int fd, const char* archive, size_t archive_size,
+    MarcSections* sections
+)
+{
+    MapStream chunks;
+    int result = stream_open(
+        &chunks, 
+        fd, 
+        archive, 
+        archive_size, 
+        &sections->map_header,
+        sections->map_offset
+    );
+
+    /* Planes of wide tiles are chunked as extra rows */
+
+    unsigned int map_w = sections->map_header.width;
+    unsigned int map_rows =
+        sections->map_header.height * sections->map_header.cell_size;
+    unsigned int chunk_width = (unsigned int)sections->map_header.size;
+
+    char* map_data = NULL;
+    char* chunk = NULL;
+    if (!result)
+    {
+        map_data = (char*)malloc(
+            get_map_size(&sections->map_header) * sizeof(char)
+        );
+        chunk = (char*)malloc(
+            ((size_t)chunk_width * map_rows + RLE_DECODE_PADDING) *
+            sizeof(char)
+        );
+        result = (map_data == NULL || chunk == NULL ? -1 : 0);
+    }
+
+    /* Chunks */
+
+    for (unsigned int i = 0; !result && i < chunks.chunk_count; ++i)
+    {
+        int chunk_w = stream_read_chunk(&chunks, i, chunk);
+        if (chunk_w < 0)
+        {
+            result = -1;
+            break;
+        }
+
+        for (unsigned int y = 0; y < map_rows; ++y)
+        {
+            memcpy(
+                &map_data[(size_t)y * map_w + i * chunk_width],
+                &chunk[y * chunk_w], 
+                chunk_w * sizeof(char)
+            );
+        }
+    }
+
+    free(chunk);
+
+    /* The archive is released by the caller */
+
+    chunks.fd = -1;
+    chunks.archive = NULL;
+    stream_close(&chunks);
+
+    if (!result && sections->checksummed)
+    {
+        result = verify_checksum(
+            sections->checksums[0x2], 
+            map_data, 
+            get_map_size(&sections->map_header),
+            "map data"
+        );
+    }
+
+    if (!result)
+    {
+        result = verify_map_cells(
+            map_data,
+            (size_t)map_w * sections->map_header.height,
+            sections->map_header.cell_size,
+            sections->tile_count
+        );
+    }
+
+    if (result < 0)
+    {
+        free(map_data);
+        return -1;
+    }
+
+    sections->map_data = map_data;
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Free sections.
+ *
+ *************************************************************/
+void free_sections(MarcSections* sections)
+{
+    path_table_free(&sections->tile_paths);
+    free((void*)sections->tile_attributes);
+    free((void*)sections->map_data);
+
+    sections->tile_attributes = NULL;
+    sections->map_data = NULL;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Stream open.
+ *
+ *************************************************************/
+int stream_open(
+    MapStream* chunks, int fd, const char* archive, 
+    size_t archive_size, const MapHeader* map_header,
+    unsigned long long map_offset
+)
+{
+    chunks->fd = fd;
+    chunks->archive = archive;
+    chunks->archive_size = archive_size;
+    chunks->map_offset = map_offset;
+    chunks->map_header = *map_header;
+    chunks->chunk_count = 0;
+    chunks->chunk_offsets = NULL;
+    chunks->chunk_loaded = NULL;
+    chunks->pending_chunks = 0;
+    chunks->checksummed = 0;
+    chunks->map_checksum = 0;
+
+    size_t header_size = get_header_size(map_header->version);
+    unsigned int map_w = map_header->width;
+    unsigned int chunk_width = (unsigned int)map_header->size;
+    if (!chunk_width || chunk_width != map_header->size)
+    {
+        fprintf(
+            stderr, 
+            "Invalid chunk width at offset [%llx]!\n",
+            map_offset + (map_header->version == MARC_VERSION_1 ?
+                0xc : 0x10)
+        );
+        return -1;
+    }
+
+    /*
+        Chunk table
+
+        The offsets are widened to 64 bits whatever the
+        version of the archive.
+     */
+
+    unsigned int chunk_count = (map_w + chunk_width - 1) / chunk_width;
+    size_t offset_size = get_offset_size(map_header->version);
+    size_t table_size = (chunk_count + 1) * offset_size;
+    chunks->chunk_offsets = (unsigned long long*)calloc(
+        chunk_count + 1,
+        sizeof(unsigned long long)
+    );
+    char* stored_table = (char*)malloc(table_size);
+    if (chunks->chunk_offsets == NULL || stored_table == NULL)
+    {
+        free(stored_table);
+        return -1;
+    }
+
+    int result = 0;
+    if (archive)
+    {
+        result = validate_section_bounds(
+            archive_size,
+            map_offset + header_size,
+            table_size
+        );
+        if (!result)
+        {
+            memcpy(
+                stored_table,
+                &archive[map_offset + header_size],
+                table_size
+            );
+        }
+    }
+    else
+    {
+        result = read_section(
+            fd,
+            stored_table,
+            table_size,
+            map_offset + header_size
+        );
+    }
+
+    for (unsigned int i = 0; !result && i <= chunk_count; ++i)
+    {
+        memcpy(
+            &chunks->chunk_offsets[i],
+            &stored_table[i * offset_size],
+            offset_size
+        );
+    }
+
+    free(stored_table);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    /* Chunks must follow each other */
+
+    unsigned long long expected_offset = header_size + table_size;
+    for (unsigned int i = 0; i <= chunk_count; ++i)
+    {
+        if (chunks->chunk_offsets[i] < expected_offset)
+        {
+            fprintf(
+                stderr, 
+                "Chunk offset [%llx] does not match at offset [%llx]!\n",
+                chunks->chunk_offsets[i],
+                map_offset + header_size + i * offset_size
+            );
+            return -1;
+        }
+        expected_offset = chunks->chunk_offsets[i];
+    }
+
+    if (archive && validate_section_bounds(
+            archive_size, 
+            map_offset, 
+            chunks->chunk_offsets[chunk_count]
+        ) < 0)
+    {
+        return -1;
+    }
+
+    chunks->chunk_loaded = (char*)calloc(chunk_count, sizeof(char));
+    if (chunks->chunk_loaded == NULL)
+    {
+        return -1;
+    }
+
+    chunks->chunk_count = chunk_count;
+    chunks->pending_chunks = chunk_count;
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Stream read chunk.
+ *
+ *************************************************************/
+int stream_read_chunk(
+    const MapStream* chunks, unsigned int chunk, char* chunk_data
+)
+{
+    unsigned int map_w = chunks->map_header.width;
+    unsigned int map_rows =
+        chunks->map_header.height * chunks->map_header.cell_size;
+    unsigned int chunk_width = (unsigned int)chunks->map_header.size;
+    int encoded = (chunks->map_header.signature == MAPC_RLE_HEADER);
+
+    unsigned int chunk_w = map_w - chunk * chunk_width;
+    if (chunk_w > chunk_width)
+    {
+        chunk_w = chunk_width;
+    }
+
+    /* Chunk as stored in the archive */
+
+    unsigned long long chunk_offset =
+        chunks->map_offset + chunks->chunk_offsets[chunk];
+    size_t stored_size = 
+        chunks->chunk_offsets[chunk + 1] - chunks->chunk_offsets[chunk];
+    size_t chunk_size = (size_t)chunk_w * map_rows;
+
+    if (!encoded && stored_size != chunk_size)
+    {
+        fprintf(
+            stderr,
+            "Chunk size [%lx] does not match at offset [%llx]!\n",
+            stored_size,
+            chunk_offset
+        );
+        return -1;
+    }
+
+    if (!encoded && !chunks->archive)
+    {
+        /* Raw chunks are read in place */
+
+        int result = read_section(
+            chunks->fd, 
+            chunk_data, 
+            chunk_size, 
+            chunk_offset
+        );
+        return (result < 0 ? -1 : (int)chunk_w);
+    }
+
+    char* stored_chunk = NULL;
+    const char* stored_data = &chunks->archive[chunk_offset];
+    if (!chunks->archive)
+    {
+        stored_chunk = (char*)malloc(stored_size * sizeof(char));
+        if ((stored_size && stored_chunk == NULL) ||
+            read_section(
+                chunks->fd, 
+                stored_chunk, 
+                stored_size, 
+                chunk_offset
+            ) < 0)
+        {
+            free(stored_chunk);
+            return -1;
+        }
+        stored_data = stored_chunk;
+    }
+
+    /* Decoded chunk */
+
+    int result = 0;
+    if (encoded)
+    {
+        result = rle_decode(
+            stored_data, 
+            stored_size, 
+            chunk_data, 
+            chunk_size
+        );
+        if (result < 0)
+        {
+            fprintf(
+                stderr,
+                "Malformed encoded chunk at offset [%llx]!\n",
+                chunk_offset
+            );
+        }
+    }
+    else
+    {
+        memcpy(chunk_data, stored_data, chunk_size);
+    }
+
+    free(stored_chunk);
+
+    return (result < 0 ? -1 : (int)chunk_w);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load map file.
+ *
+ *************************************************************/
+void load_map(char* filename, int streamed)
+{
+    /* Input file */
+    
+    int fd_in = open(filename, O_RDONLY);
+    exit_on_error(fd_in < 0);
+
+    /* Pipes and sockets are read forward only */
+
+    struct stat stat_in;
+    int result = fstat(fd_in, &stat_in);
+    exit_on_error(result < 0);
+
+    if (!S_ISREG(stat_in.st_mode))
+    {
+        map_load_fd(fd_in);
+        result = close(fd_in);
+        exit_on_error(result < 0);
+        return;
+    }
+
+    /* Sections */
+
+    MarcSections sections;
+    result = read_sections(fd_in, &sections);
+    exit_on_error(result < 0);
+
+    stream_close(&stream);
+    commit_sections(&sections);
+    free_sections(&sections);
+
+    if (is_chunked_map(&sections.map_header))
+    {
+        /* 
+            Chunks
+
+            The archive is kept opened until all the
+            chunks are loaded, either at once or by 
+            map_stream().
+         */
+
+        result = stream_open(
+            &stream, 
+            fd_in, 
+            NULL, 
+            0, 
+            &sections.map_header,
+            sections.map_offset
+        );
+        exit_on_error(result < 0);
+
+        stream.checksummed = sections.checksummed;
+        stream.map_checksum = sections.checksums[0x2];
+        stream.tile_count = sections.tile_count;
+
+        if (streamed)
+        {
+            map_stream(0);
+        }
+        else
+        {
+            stream_chunks(0, stream.chunk_count);
+        }
+        return;
+    }
+
+    result = close(fd_in);
+    exit_on_error(result < 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Stream chunks.
+ *
+ *************************************************************/
+void stream_chunks(unsigned int first, unsigned int last)
+{
+    if (last > stream.chunk_count)
+    {
+        last = stream.chunk_count;
+    }
+
+    if (first >= last)
+    {
+        return;
+    }
+
+    unsigned int map_h = stream.map_header.height;
+    unsigned int cell_size = stream.map_header.cell_size;
+    unsigned int chunk_width = (unsigned int)stream.map_header.size;
+
+    char* chunk = (char*)malloc(
+        ((size_t)chunk_width * map_h * cell_size + RLE_DECODE_PADDING) *
+        sizeof(char)
+    );
+    exit_on_error(chunk == NULL);
+
+    for (unsigned int i = first; i < last; ++i)
+    {
+        if (stream.chunk_loaded[i])
+        {
+            continue;
+        }
+
+        int chunk_w = stream_read_chunk(&stream, i, chunk);
+        exit_on_error(chunk_w < 0);
+
+        size_t plane_size = (size_t)chunk_w * map_h;
+        int result = verify_map_cells(
+            chunk, 
+            plane_size, 
+            cell_size, 
+            stream.tile_count
+        );
+        exit_on_error(result < 0);
+
+        for (unsigned int y = 0; y < map_h; ++y)
+        {
+            for (int x = 0; x < chunk_w; ++x)
+            {
+                map_set(
+                    i * chunk_width + x,
+                    y,
+                    get_map_cell(
+                        chunk,
+                        plane_size,
+                        cell_size,
+                        (size_t)y * chunk_w + x
+                    )
+                );
+            }
+        }
+
+        stream.chunk_loaded[i] = 1;
+        --stream.pending_chunks;
+    }
+
+    free(chunk);
+
+    if (stream.pending_chunks)
+    {
+        return;
+    }
+
+    /* 
+        Checksum
+
+        The map data are laid out again once all the
+        chunks are loaded.
+     */
+
+    if (stream.checksummed)
+    {
+        unsigned int map_w = stream.map_header.width;
+        size_t map_size = get_map_size(&stream.map_header);
+        char* map_data = (char*)malloc(map_size * sizeof(char));
+        exit_on_error(map_data == NULL);
+
+        for (unsigned int y = 0; y < map_h; ++y)
+        {
+            for (unsigned int x = 0; x < map_w; ++x)
+            {
+                set_map_cell(
+                    map_data,
+                    (size_t)map_w * map_h,
+                    cell_size,
+                    (size_t)y * map_w + x,
+                    map_get(x, y)
+                );
+            }
+        }
+
+        unsigned int checksum = crc32c(0, map_data, map_size);
+        free(map_data);
+
+        if (checksum != stream.map_checksum)
+        {
+            fprintf(stderr, "Checksum of the map data does not match!\n");
+            exit_on_error(1);
+        }
+    }
+
+    stream_close(&stream);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Stream close.
+ *
+ *************************************************************/
+void stream_close(MapStream* chunks)
+{
+    if (chunks->fd >= 0)
+    {
+        int result = close(chunks->fd);
+        exit_on_error(result < 0);
+    }
+
+    if (chunks->archive)
+    {
+        int result = munmap((void*)chunks->archive, chunks->archive_size);
+        exit_on_error(result < 0);
+    }
+
+    free(chunks->chunk_offsets);
+    free(chunks->chunk_loaded);
+
+    chunks->fd = -1;
+    chunks->archive = NULL;
+    chunks->archive_size = 0;
+    chunks->chunk_count = 0;
+    chunks->chunk_offsets = NULL;
+    chunks->chunk_loaded = NULL;
+    chunks->pending_chunks = 0;
+    chunks->checksummed = 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Load worker.
+ *
+ *************************************************************/
+void* load_worker(void* parameters)
+{
+    MapLoadRequest* request = (MapLoadRequest*)parameters;
+
+    /* Staging */
+
+    request->status = -1;
+    int fd_in = open(request->filename, O_RDONLY);
+    if (fd_in < 0)
+    {
+        fprintf(
+            stderr, 
+            "[%d]: %s\n", 
+            errno, 
+            strerror(errno)
+        );
+    }
+    else
+    {
+        struct stat stat_in;
+        if (!fstat(fd_in, &stat_in) && !S_ISREG(stat_in.st_mode))
+        {
+            request->status = 
+                read_streamed_sections(fd_in, &request->sections);
+        }
+        else
+        {
+            request->status = read_sections(fd_in, &request->sections);
+        }
+
+        /* map_allocate() exits on the sizes out of range */
+
+        const MapHeader* map_header = &request->sections.map_header;
+        if (!request->status && (
+                map_header->width < MIN_WIDTH || 
+                map_header->width > MAX_WIDTH ||
+                map_header->height < MIN_HEIGHT || 
+                map_header->height > MAX_HEIGHT))
+        {
+            fprintf(
+                stderr, 
+                "Map size [%x] x [%x] is out of range!\n", 
+                map_header->width, 
+                map_header->height
+            );
+            request->status = -1;
+        }
+
+        if (!request->status && 
+            !request->sections.map_data &&
+            is_chunked_map(&request->sections.map_header))
+        {
+            request->status = 
+                read_chunked_map(fd_in, NULL, 0, &request->sections);
+        }
+
+        close(fd_in);
+    }
+
+    /* Completion */
+
+    __atomic_store_n(&request->done, 1, __ATOMIC_RELEASE);
+    push_map_event(MAP_EVENT_LOADED, request);
+
+    return NULL;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Push map event.
+ *
+ *************************************************************/
+void push_map_event(int code, void* request)
+{
+    if (map_event == (Uint32)-1)
+    {
+        return;
+    }
+
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = map_event;
+    event.user.code = code;
+    event.user.data1 = request;
+
+    SDL_PushEvent(&event);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Commit sections.
+ *
+ *************************************************************/
+void commit_sections(const MarcSections* sections)
+{
+    /* Allocate map */
+
+    unsigned int map_w = sections->map_header.width;
+    unsigned int map_h = sections->map_header.height;
+    unsigned int cell_size = sections->map_header.cell_size;
+    map_allocate(map_w, map_h);
+
+    /* Chunked maps are filled in by map_stream() */
+
+    if (sections->map_data)
+    {
+        /* Bands of columns */
+
+        unsigned int band_count = 
+            get_band_count((size_t)map_w * map_h * cell_size);
+        if (band_count > map_w)
+        {
+            band_count = map_w;
+        }
+
+        MapBand bands[MAP_BAND_MAX_COUNT];
+        for (unsigned int b = 0; b < band_count; ++b)
+        {
+            bands[b].input = sections->map_data;
+            bands[b].sections = sections;
+            bands[b].begin = (unsigned int)((size_t)map_w * b / band_count);
+            bands[b].end = 
+                (unsigned int)((size_t)map_w * (b + 1) / band_count);
+        }
+
+        run_bands(bands, band_count, commit_band);
+    }
+
+    /* Tiles */
+
+    map_object_begin(sections->tile_count);
+
+    for (unsigned int i = 0; i < sections->tile_count; ++i)
+    {
+        const unsigned int* tile_attributes = 
+            &sections->tile_attributes[i * 0x8];
+        map_object_add(
+            (char*)path_table_get(&sections->tile_paths, i), 
+            tile_attributes[0x1], 
+            tile_attributes[0x2] | 
+            tile_attributes[0x3] | 
+            tile_attributes[0x4] | 
+            tile_attributes[0x5]
+        );
+    }
+
+    map_object_end();
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get shared name.
+ *
+ *************************************************************/
+char* get_shared_name(const char* filename, const struct stat* archive_stat)
+{
+    char* path = realpath(filename, NULL);
+    exit_on_error(path == NULL);
+
+    size_t size = 0x40;
+    char* shared_name = (char*)malloc(size * sizeof(char));
+    exit_on_error(shared_name == NULL);
+
+    snprintf(
+        shared_name, 
+        size, 
+        "/marc-%08x-%llx-%llx.%lx",
+        crc32c(0, path, strlen(path)),
+        (unsigned long long)archive_stat->st_size,
+        (unsigned long long)archive_stat->st_mtim.tv_sec,
+        (unsigned long)archive_stat->st_mtim.tv_nsec
+    );
+
+    free(path);
+
+    return shared_name;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get shared size.
+ *
+ *************************************************************/
+size_t get_shared_size(
+    unsigned int tile_count, size_t tile_paths_size,
+    const MapHeader* map_header
+)
+{
+    return 0x40 + tile_paths_size + (size_t)tile_count * 0x20 + 
+        get_map_size(map_header);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read decoded sections.
+ *
+ *************************************************************/
+int read_decoded_sections(int fd, MarcSections* sections)
+{
+    int result = read_sections(fd, sections);
+    if (!result && 
+        !sections->map_data && 
+        is_chunked_map(&sections->map_header))
+    {
+        result = read_chunked_map(fd, NULL, 0, sections);
+    }
+
+    if (result < 0)
+    {
+        free_sections(sections);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Create shared map.
+ *
+ *************************************************************/
+int create_shared_map(int fd_shared, int fd_in)
+{
+    /* Sections, the chunks included */
+
+    MarcSections sections;
+    int result = read_decoded_sections(fd_in, &sections);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    /* Segment */
+
+    size_t paths_size = 
+        path_table_size(&sections.tile_paths, PATH_TABLE_PACKED);
+    size_t attributes_size = (size_t)sections.tile_count * 0x20;
+    size_t segment_size = get_shared_size(
+        sections.tile_count, 
+        paths_size, 
+        &sections.map_header
+    );
+
+    char* segment = MAP_FAILED;
+    if (!ftruncate(fd_shared, segment_size))
+    {
+        segment = (char*)mmap(
+            NULL, 
+            segment_size, 
+            PROT_READ | PROT_WRITE, 
+            MAP_SHARED, 
+            fd_shared, 
+            0
+        );
+    }
+
+    if (segment == MAP_FAILED)
+    {
+        free_sections(&sections);
+        return -1;
+    }
+
+    SharedMap* shared = (SharedMap*)segment;
+    shared->tile_count = sections.tile_count;
+    shared->map_header = sections.map_header;
+    shared->tile_paths_size = paths_size;
+    shared->size = segment_size;
+
+    path_table_format(
+        &sections.tile_paths, 
+        PATH_TABLE_PACKED, 
+        &segment[0x40]
+    );
+    memcpy(
+        &segment[0x40 + paths_size], 
+        sections.tile_attributes, 
+        attributes_size
+    );
+    memcpy(
+        &segment[0x40 + paths_size + attributes_size], 
+        sections.map_data, 
+        get_map_size(&sections.map_header)
+    );
+
+    shared->signature = MSHM_HEADER;
+
+    result = munmap(segment, segment_size);
+
+    /* Map */
+
+    stream_close(&stream);
+    commit_sections(&sections);
+    free_sections(&sections);
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Attach shared map.
+ *
+ *************************************************************/
+int attach_shared_map(int fd_shared)
+{
+    struct stat shared_stat;
+    int result = fstat(fd_shared, &shared_stat);
+    if (result < 0 || (size_t)shared_stat.st_size < 0x40)
+    {
+        return -1;
+    }
+
+    size_t segment_size = (size_t)shared_stat.st_size;
+    const char* segment = (const char*)mmap(
+        NULL, 
+        segment_size, 
+        PROT_READ, 
+        MAP_SHARED, 
+        fd_shared, 
+        0
+    );
+    if (segment == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    const SharedMap* shared = (const SharedMap*)segment;
+    size_t paths_size = (size_t)shared->tile_paths_size;
+    if (shared->signature != MSHM_HEADER ||
+        shared->size != segment_size ||
+        get_shared_size(
+            shared->tile_count, 
+            paths_size, 
+            &shared->map_header
+        ) != segment_size)
+    {
+        munmap((void*)segment, segment_size);
+        return -1;
+    }
+
+    /* The sections are read straight from the segment */
+
+    MarcSections sections;
+    memset(&sections, 0, sizeof(MarcSections));
+
+    sections.tile_count = shared->tile_count;
+    sections.map_header = shared->map_header;
+    sections.tile_attributes = 
+        (const unsigned int*)&segment[0x40 + paths_size];
+    sections.map_data = 
+        &segment[0x40 + paths_size + (size_t)shared->tile_count * 0x20];
+
+    result = (path_table_parse(
+        &sections.tile_paths, 
+        &segment[0x40], 
+        paths_size, 
+        sections.tile_count
+    ) < 0 ? -1 : 0);
+    if (!result)
+    {
+        stream_close(&stream);
+        commit_sections(&sections);
+    }
+
+    path_table_free(&sections.tile_paths);
+    munmap((void*)segment, segment_size);
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get temporary filename.
+ *
+ *************************************************************/
+char* get_temporary_filename(const char* filename)
+{
+    size_t size = strlen(filename) + 0x20;
+    char* temporary_filename = (char*)malloc(size * sizeof(char));
+    exit_on_error(temporary_filename == NULL);
+
+    snprintf(temporary_filename, size, "%s.%d.tmp", filename, getpid());
+
+    return temporary_filename;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Sync directory.
+ *
+ *************************************************************/
+int sync_directory(const char* filename)
+{
+    /* Directory of the archive */
+
+    char* directory = strdup(filename);
+    if (directory == NULL)
+    {
+        return -1;
+    }
+
+    char* separator = strrchr(directory, '/');
+    if (separator == directory)
+    {
+        separator[0x1] = '\0';
+    }
+    else if (separator)
+    {
+        separator[0x0] = '\0';
+    }
+
+    int fd_dir = open(separator ? directory : ".", O_RDONLY | O_DIRECTORY);
+    free(directory);
+    if (fd_dir < 0)
+    {
+        return -1;
+    }
+
+    int result = fsync(fd_dir);
+    if (close(fd_dir) < 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write sections.
+ *
+ *************************************************************/
+ssize_t write_sections(
+    int fd, struct iovec* sections, int count, unsigned int sync
+)
+{
+    if (io_batch_available())
+    {
+        /* Sections at their offsets, followed by the synchronization */
+
+        IoRequest requests[count + 1];
+        unsigned int request_count = 0;
+        unsigned long long offset = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            if (sections[i].iov_len)
+            {
+                IoRequest request = {
+                    IO_BATCH_WRITE,
+                    fd,
+                    sections[i].iov_base,
+                    sections[i].iov_len,
+                    offset,
+                    0
+                };
+                requests[request_count++] = request;
+            }
+            offset += sections[i].iov_len;
+        }
+
+        if (sync != MAP_SYNC_NONE)
+        {
+            IoRequest request = {
+                (sync == MAP_SYNC_FULL ? IO_BATCH_SYNC : IO_BATCH_DATASYNC),
+                fd,
+                NULL,
+                0,
+                0,
+                0
+            };
+            requests[request_count++] = request;
+        }
+
+        if (io_batch_submit(requests, request_count) < 0)
+        {
+            return -1;
+        }
+
+        return (ssize_t)offset;
+    }
+
+    ssize_t written = 0;
+    while (count)
+    {
+        ssize_t rw_result = writev(fd, sections, count);
+        if (rw_result < 0)
+        {
+            return -1;
+        }
+
+        written += rw_result;
+
+        /* Skip what has already been written */
+
+        while (count && (size_t)rw_result >= sections->iov_len)
+        {
+            rw_result -= sections->iov_len;
+            ++sections;
+            --count;
+        }
+
+        if (count)
+        {
+            sections->iov_base = (char*)sections->iov_base + rw_result;
+            sections->iov_len -= rw_result;
+        }
+    }
+
+    /* Synchronization */
+
+    int result = 0;
+    if (sync == MAP_SYNC_DATA)
+    {
+        result = fdatasync(fd);
+    }
+    else if (sync == MAP_SYNC_FULL)
+    {
+        result = fsync(fd);
+    }
+
+    return (result < 0 ? -1 : written);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Format tiles.
+ *
+ *************************************************************/
+int format_tiles(
+    unsigned int tile_count, char** tile_paths, 
+    size_t* tile_paths_size, unsigned int** tile_attributes
+)
+{
+    /* Enumeration of tile paths, longer ones being truncated */
+
+    PathTable paths;
+    path_table_init(&paths);
+
+    int result = 0;
+    char tile_path[0x40] = {0};
+    for (unsigned int i = 0; !result && i < tile_count; ++i)
+    {
+        strncpy(tile_path, map_get_name(i), PATH_TABLE_MAX_LENGTH);
+        result = path_table_add(&paths, tile_path);
+    }
+
+    unsigned int encoding = (save_paths == MAP_PATHS_PACKED ? 
+        PATH_TABLE_PACKED : PATH_TABLE_FIXED);
+    *tile_paths_size = path_table_size(&paths, encoding);
+    *tile_paths = (char*)malloc(*tile_paths_size * sizeof(char));
+    *tile_attributes = (unsigned int*)calloc(
+        tile_count, 
+        0x8 * sizeof(unsigned int)
+    );
+    if (result < 0 || (*tile_paths_size && *tile_paths == NULL) || 
+        (tile_count && *tile_attributes == NULL))
+    {
+        path_table_free(&paths);
+        free(*tile_paths);
+        free(*tile_attributes);
+        return -1;
+    }
+
+    path_table_format(&paths, encoding, *tile_paths);
+    path_table_free(&paths);
+
+    /* Tile attributes */
+
+    for (unsigned int i = 0; i < tile_count; ++i)
+    {
+        unsigned int* attributes = &(*tile_attributes)[i * 0x8];
+        attributes[0x0] = OBJECT_PROPERTIES_HEADER;
+        attributes[0x1] = map_get_frames(i);
+        attributes[0x2] = map_get_solidity(i);
+        attributes[0x3] = 
+            (map_is_destructible(i) ? MAP_OBJECT_DESTRUCTIBLE : 0);
+        attributes[0x4] = 
+            (map_is_collectible(i) ? MAP_OBJECT_COLLECTIBLE : 0);
+        attributes[0x5] = 
+            (map_is_generator(i) ? MAP_OBJECT_GENERATOR : 0);
+    }
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Format map data.
+ *
+ *************************************************************/
+char* format_map_data(const MapHeader* map_header, char* map_data)
+{
+    unsigned int map_w = map_header->width;
+    unsigned int map_h = map_header->height;
+
+    if (map_data == NULL)
+    {
+        map_data = (char*)malloc(get_map_size(map_header) * sizeof(char));
+        if (map_data == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    for (unsigned int j = 0; j < map_h; ++j)
+    {
+        for (unsigned int i = 0; i < map_w; ++i)
+        {
+            set_map_cell(
+                map_data,
+                (size_t)map_w * map_h,
+                map_header->cell_size,
+                (size_t)j * map_w + i,
+                map_get(i, j)
+            );
+        }
+    }
 
+    return map_data;
+}
 
 /*************************************************************
  *************************************************************
  *
- * Allocate a map object.
+ * Take snapshot.
  *
  *************************************************************/
-void map_new(unsigned width, unsigned height)
+int take_snapshot(MapSnapshot* snapshot)
 {
-    map_allocate(width, height);
+    memset(snapshot, 0, sizeof(MapSnapshot));
 
-    /* Ground */
+    /* Chunks not loaded yet */
 
-    for (int x = 0; x < width; ++x)
+    stream_chunks(0, stream.chunk_count);
+
+    /*
+        Width of a tile
+
+        A byte indexes the tiles up to 0xfe, 0xff standing
+        for no tile. Wider tiles need a version 2 archive.
+     */
+
+    unsigned int tile_count = map_objects();
+    unsigned int cell_size = (tile_count < 0xff ? 1 : 2);
+    unsigned int version =
+        (cell_size > 1 ? MARC_VERSION_2 : save_version);
+
+    /* map_get() only keeps the 10 low bits of a cell */
+
+    if (tile_count > MAX_OBJECTS)
     {
-        map_set(x, height - 1, 0);          // Ground.
+        fprintf(
+            stderr,
+            "Number of tiles [%x] exceeds [%x]!\n",
+            tile_count,
+            MAX_OBJECTS
+        );
+        return -1;
     }
 
-    /* Walls */
+    snapshot->tile_count = tile_count;
+    snapshot->encoding = save_encoding;
+    snapshot->layout = save_layout;
+    snapshot->sync = save_sync;
+    snapshot->checksums = save_checksums;
 
-    for (int y = 0; y < height - 1; ++y) 
+    /* Tile paths and attributes */
+
+    if (format_tiles(
+            tile_count, 
+            &snapshot->tile_paths, 
+            &snapshot->tile_paths_size, 
+            &snapshot->tile_attributes
+        ) < 0)
     {
-        map_set(0, y, 1);                  
-        map_set(width - 1, y, 1);
+        snapshot->tile_paths = NULL;
+        snapshot->tile_attributes = NULL;
+        return -1;
     }
 
-    map_object_begin(6);
+    /* MAPF map */
 
-    map_object_add("images/ground.png", 1, MAP_OBJECT_SOLID);
-    map_object_add("images/wall.png", 1, MAP_OBJECT_SOLID);
-    map_object_add("images/grass.png", 1, MAP_OBJECT_SEMI_SOLID);
-    map_object_add(
-        "images/marble.png", 
-        1, 
-        MAP_OBJECT_SOLID | MAP_OBJECT_DESTRUCTIBLE
-    );
-    map_object_add("images/flower.png", 1, MAP_OBJECT_AIR);
-    map_object_add(
-        "images/coin.png", 
-        20, 
-        MAP_OBJECT_AIR | MAP_OBJECT_COLLECTIBLE
-    );
-    
-    map_object_end();
+    unsigned int map_w = map_width();
+    unsigned int map_h = map_height();
+    MapHeader map_header = {
+        version,
+        MAPF_HEADER,
+        map_w,
+        map_h,
+        cell_size,
+        0
+    };
+    size_t map_size = get_map_size(&map_header);
+    map_header.size = (version == MARC_VERSION_1 ?
+        (unsigned long long)map_w * map_h : map_size);
+    snapshot->map_header = map_header;
+
+    /* Buffer of a released snapshot, if large enough */
+
+    char* map_data = NULL;
+    size_t map_data_capacity = map_size;
+    if (recycled_map_data != NULL && recycled_map_capacity >= map_size)
+    {
+        map_data = recycled_map_data;
+        map_data_capacity = recycled_map_capacity;
+    }
+    else
+    {
+        free(recycled_map_data);
+    }
+    recycled_map_data = NULL;
+    recycled_map_capacity = 0;
+
+    snapshot->map_data = format_map_data(&map_header, map_data);
+    snapshot->map_data_capacity = map_data_capacity;
+    if (map_size && snapshot->map_data == NULL)
+    {
+        release_snapshot(snapshot);
+        return -1;
+    }
+
+    return 0;
 }
 
 /*************************************************************
  *************************************************************
  *
- * Save map.
+ * Write snapshot.
  *
  *************************************************************/
-void map_save(char* filename)
-{                                 
-    /* Output file */
+ssize_t write_snapshot(const char* filename, MapSnapshot* snapshot)
+{
+    /* Layout of the archive */
 
-    int fd_out = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
-    exit_on_error(fd_out < 0);
+    MapHeader map_header = snapshot->map_header;
+    unsigned int version = map_header.version;
+    unsigned int tile_count = snapshot->tile_count;
+    size_t header_size = get_header_size(version);
+    size_t map_size = get_map_size(&map_header);
+    char* map_data = snapshot->map_data;
 
-    /* Keeps track of write offset */
+    unsigned long long tile_attributes_offset =
+        header_size + (unsigned long long)snapshot->tile_paths_size;
+    unsigned long long tile_map_offset =
+        tile_attributes_offset + (unsigned long long)tile_count * 0x20;
 
-    ssize_t current_offset = 0;
-    
     /* MARC archive */
-    
-    unsigned int arch_header = MARC_HEADER; 
-    ssize_t rw_result = write(
-        fd_out, 
-        &arch_header, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
-
-    /* Number of tiles */
 
-    unsigned int tile_count = map_objects(); 
-    rw_result = write(fd_out, &tile_count, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
+    char arch_header[0x20] = {0};
+    if (version == MARC_VERSION_1)
+    {
+        unsigned int* fields = (unsigned int*)arch_header;
+        fields[0x0] = MARC_HEADER;
+        fields[0x1] = tile_count;
+        fields[0x2] = (unsigned int)tile_attributes_offset;
+        fields[0x3] = (unsigned int)tile_map_offset;
+    }
+    else
+    {
+        unsigned int* fields = (unsigned int*)arch_header;
+        unsigned long long* offsets =
+            (unsigned long long*)&arch_header[0x8];
+        fields[0x0] = MARC_V2_HEADER;
+        fields[0x1] = tile_count;
+        offsets[0x0] = tile_attributes_offset;
+        offsets[0x1] = tile_map_offset;
+    }
 
     /* 
-        Tile attributes offset 
+        Run-length encoding
 
-        Need to be written later 
+        The size field of the header holds the size of
+        the encoded data instead of the number of tiles.
      */
-    
-    unsigned int tile_attributes_offset = 0;
-    rw_result = write(
-        fd_out, 
-        &tile_attributes_offset, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
 
-    /* 
-        Tile map offset
+    char* stored_data = map_data;
+    size_t stored_size = map_size;
+    if (snapshot->layout == MAP_LAYOUT_CHUNKED)
+    {
+        /* 
+            Chunks
 
-        Need to be written later 
-     */
+            The size field of the header holds the width
+            of a chunk instead of the number of tiles.
+         */
 
-    unsigned int tile_map_offset = 0;
-    rw_result = write(fd_out, &tile_map_offset, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
+        map_header.signature = (snapshot->encoding == MAP_ENCODING_RLE ?
+            MAPC_RLE_HEADER : MAPC_HEADER);
+        map_header.size = MAP_CHUNK_WIDTH;
 
-    /* Enumeration of tile paths */
-    
-    char tile_path[0x40] = {0};
-    for (unsigned int i = 0; i < tile_count; ++i)
+        stored_data = encode_map_chunks(
+            &map_header,
+            map_data, 
+            &stored_size
+        );
+    }
+    else if (snapshot->encoding == MAP_ENCODING_RLE)
     {
-        /* Path of tile */
-        
-        strcpy(tile_path, map_get_name(i));
-        rw_result = write(fd_out, tile_path, 0x40 * sizeof(char));
-        exit_on_error(rw_result < 0);
-        current_offset += rw_result;
+        stored_data = (char*)malloc(
+            RLE_MAX_ENCODED_SIZE(map_size) * sizeof(char)
+        );
+        if (map_size && stored_data == NULL)
+        {
+            return -1;
+        }
+        stored_size = rle_encode(map_data, map_size, stored_data);
+
+        map_header.signature = MAPF_RLE_HEADER;
+        map_header.size = stored_size;
     }
-    
-    /* Writes tiles attributes offset */
-    
-    off_t seek_result = lseek(fd_out, 0x8, SEEK_SET);
-    exit_on_error(seek_result < 0);
-    
-    tile_attributes_offset = (unsigned int)current_offset;
-    rw_result = write(
-        fd_out, 
-        &tile_attributes_offset, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
 
-    seek_result = lseek(fd_out, 0, SEEK_END);
-    exit_on_error(seek_result < 0);
+    char stored_map_header[0x20];
+    format_map_header(&map_header, stored_map_header);
 
-    /* Tile attributes */
-    
-    unsigned int tile_attributes[0x8] = {0};
-    tile_attributes[0x0] = OBJECT_PROPERTIES_HEADER;
-    for (unsigned int i = 0; i < tile_count; ++i)
+    /* 
+        Padding if needed
+
+        Earlier versions wrote one unsigned int per missing
+        byte, the layout is kept as is.
+     */
+
+    size_t padding_size = 0;
+    size_t remainder =
+        (tile_map_offset + header_size + stored_size) % 0x10;
+    if (remainder)
     {
-        tile_attributes[0x1] = map_get_frames(i);
-        tile_attributes[0x2] = map_get_solidity(i);
-        tile_attributes[0x3] = 
-            (map_is_destructible(i) ? MAP_OBJECT_DESTRUCTIBLE : 0);
-        tile_attributes[0x4] = 
-            (map_is_collectible(i) ? MAP_OBJECT_COLLECTIBLE : 0);
-        tile_attributes[0x5] = 
-            (map_is_generator(i) ? MAP_OBJECT_GENERATOR : 0);
-        rw_result = write(
-            fd_out, 
-            tile_attributes, 
-            0x8 * sizeof(unsigned int)
-        );
-        exit_on_error(rw_result < 0);
-        current_offset += rw_result;
+        padding_size = (0x10 - remainder) * sizeof(unsigned int);
     }
 
-    /* Writes first map offset */
-    
-    seek_result = lseek(fd_out, 0xc, SEEK_SET);
-    exit_on_error(seek_result < 0);
+    /* Checksum trailer */
 
-    tile_map_offset = (unsigned int)current_offset;
-    rw_result = write(fd_out, &tile_map_offset, sizeof(unsigned int));
+    unsigned int trailer[0x4] = {0, 0, 0, MCRC_TRAILER};
+    if (snapshot->checksums)
+    {
+        trailer[0x0] = 
+            crc32c(0, snapshot->tile_paths, snapshot->tile_paths_size);
+        trailer[0x1] = 
+            crc32c(0, snapshot->tile_attributes, tile_count * 0x20);
+        trailer[0x2] = crc32c(0, map_data, map_size);
+    }
 
-    seek_result = lseek(fd_out, 0, SEEK_END);
-    exit_on_error(seek_result < 0);
+    /* 
+        Output file
 
-    /* MAPF map */
+        The archive is written next to the original one,
+        then renamed over it once complete. Hence, a crash
+        never leaves a truncated archive behind.
+     */
 
-    unsigned int map_header = MAPF_HEADER;
-    rw_result = write(fd_out, &map_header, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
+    char* temporary_filename = get_temporary_filename(filename);
+    int fd_out = open(
+        temporary_filename, 
+        O_CREAT | O_WRONLY | O_TRUNC, 
+        0666
+    );
 
-    unsigned int map_w = map_width();
-    rw_result = write(fd_out, &map_w, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
+    ssize_t current_offset = -1;
+    int result = -1;
+    if (fd_out >= 0)
+    {
+        /* Permissions of the original archive are kept */
 
-    unsigned int map_h = map_height();
-    rw_result = write(fd_out, &map_h, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
+        struct stat archive_stat;
+        result = 0;
+        if (!stat(filename, &archive_stat))
+        {
+            result = fchmod(fd_out, archive_stat.st_mode & 07777);
+        }
 
-    unsigned int map_size = map_w * map_h;
-    rw_result = write(fd_out, &map_size, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    current_offset += rw_result;
+        static const char zero[0x40] = {0};
+        struct iovec sections[] = {
+            {arch_header, header_size},
+            {snapshot->tile_paths, snapshot->tile_paths_size * sizeof(char)},
+            {
+                snapshot->tile_attributes, 
+                tile_count * 0x8 * sizeof(unsigned int)
+            },
+            {stored_map_header, header_size},
+            {stored_data, stored_size * sizeof(char)},
+            {(void*)zero, padding_size},
+            {trailer, snapshot->checksums ? sizeof(trailer) : 0}
+        };
+        if (!result)
+        {
+            current_offset = write_sections(
+                fd_out, 
+                sections, 
+                sizeof(sections) / sizeof(struct iovec),
+                snapshot->sync
+            );
+        }
 
-    /* Map */
-    
-    char map_data;
-    for (unsigned int j = 0; j < map_h; ++j)
-    {
-        for (unsigned int i = 0; i < map_w; ++i)
+        if (close(fd_out) < 0)
         {
-            map_data = (char)map_get(i, j);
-            rw_result = write(fd_out, &map_data, sizeof(char));
-            exit_on_error(rw_result < 0);
-            current_offset += rw_result;
+            result = -1;
         }
     }
- 
-    /* Padding if needed */
 
-    ssize_t remainder = current_offset % 0x10;
-    if (remainder)
+    if (current_offset < 0 || result < 0 || 
+        rename(temporary_filename, filename) < 0)
     {
-        unsigned int zero = 0;
-        remainder = 0x10 - remainder;
-        while (remainder)
+        int error = errno;
+        if (fd_out >= 0)
         {
-            rw_result = write(fd_out, &zero, sizeof(unsigned int));
-            exit_on_error(rw_result < 0);
-            current_offset += rw_result;
-            --remainder;
+            unlink(temporary_filename);
         }
+        errno = error;
+        current_offset = -1;
+    }
+    else if (snapshot->sync == MAP_SYNC_FULL && sync_directory(filename) < 0)
+    {
+        current_offset = -1;
     }
 
-    close(fd_out);
+    free(temporary_filename);
 
-    fprintf(
-        stderr, 
-        "Map successfully saved!\n"
-        "[%lx] bytes written!\n",
-        current_offset
-    );
+    if (stored_data != map_data)
+    {
+        free(stored_data);
+    }
+
+    /* 
+        Archive kept for incremental saves
+
+        Only raw contiguous map data can be updated in
+        place.
+     */
+
+    snapshot->map_data_offset = tile_map_offset + header_size;
+    snapshot->in_place = current_offset >= 0 && stored_data == map_data &&
+        !stat(filename, &snapshot->archive_stat);
+
+    return current_offset;
 }
 
 /*************************************************************
  *************************************************************
  *
- * Load map.
+ * Keep snapshot.
  *
  *************************************************************/
-void map_load(char* filename)
+void keep_snapshot(const char* filename, MapSnapshot* snapshot)
 {
-    /* Input file */
-    
-    int fd_in = open(filename, O_RDONLY);
-    exit_on_error(fd_in < 0);
+    close_saved_archive(&saved);
+    if (!snapshot->in_place)
+    {
+        return;
+    }
 
-    /* MARC archive */
- 
-    unsigned int header;
-    ssize_t rw_result = read(fd_in, &header, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    if (header != MARC_HEADER)
+    saved.filename = strdup(filename);
+    if (saved.filename == NULL)
     {
-        fprintf(
-            stderr, 
-            "MARC header [%x] does not match at offset [0]!\n", 
-            header
-        );
-        exit_on_error(1);
-    } 
+        return;
+    }
 
-    /* Number of tiles */
+    saved.archive_stat = snapshot->archive_stat;
+    saved.map_header = snapshot->map_header;
+    saved.map_data_offset = snapshot->map_data_offset;
+    saved.checksummed = snapshot->checksums;
+    saved.tile_count = snapshot->tile_count;
+    saved.tile_paths = snapshot->tile_paths;
+    saved.tile_paths_size = snapshot->tile_paths_size;
+    saved.tile_attributes = snapshot->tile_attributes;
+    saved.map_data = snapshot->map_data;
 
-    unsigned int tile_count;
-    rw_result = read(fd_in, &tile_count, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    snapshot->tile_paths = NULL;
+    snapshot->tile_attributes = NULL;
+    snapshot->map_data = NULL;
+}
 
-    /* Tile attributes offset */
-    
-    unsigned int tile_attributes_offset;
-    rw_result = read(
-        fd_in, 
-        &tile_attributes_offset, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Release snapshot.
+ *
+ *************************************************************/
+void release_snapshot(MapSnapshot* snapshot)
+{
+    free(snapshot->tile_paths);
+    free(snapshot->tile_attributes);
 
-    /* Map offset */
+    if (snapshot->map_data != NULL)
+    {
+        free(recycled_map_data);
+        recycled_map_data = snapshot->map_data;
+        recycled_map_capacity = snapshot->map_data_capacity;
+    }
 
-    unsigned int tile_map_offset;
-    rw_result = read(fd_in, &tile_map_offset, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    memset(snapshot, 0, sizeof(MapSnapshot));
+}
 
-    off_t seek_result = lseek(fd_in, tile_map_offset, SEEK_SET);
-    exit_on_error(seek_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Save worker.
+ *
+ *************************************************************/
+void* save_worker(void* parameters)
+{
+    MapSaveRequest* request = (MapSaveRequest*)parameters;
 
-    /* MAPF map */
-    
-    seek_result = lseek(fd_in, 0, SEEK_CUR);
-    exit_on_error(seek_result < 0);
-    
-    rw_result = read(fd_in, &header, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-    if (header != MAPF_HEADER)
+    request->size = write_snapshot(request->filename, &request->snapshot);
+    if (request->size < 0)
     {
         fprintf(
             stderr, 
-            "MAPF header [%x] does not match at offset [%lx]!\n", 
-            header, 
-            seek_result
+            "[%d]: %s\n", 
+            errno, 
+            strerror(errno)
         );
-        exit_on_error(1);
     }
 
-    /* Map width */
+    /* Completion */
+
+    __atomic_store_n(&request->done, 1, __ATOMIC_RELEASE);
+    push_map_event(MAP_EVENT_SAVED, request);
+
+    return NULL;
+}
 
-    unsigned int map_w;
-    rw_result = read(fd_in, &map_w, sizeof(unsigned int));  
-    exit_on_error(rw_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Wait pending save.
+ *
+ *************************************************************/
+void wait_pending_save(void)
+{
+    if (pending_save == NULL)
+    {
+        return;
+    }
 
-    /* Map Height */
+    if (!pending_save->joined)
+    {
+        int result = pthread_join(pending_save->thread, NULL);
+        exit_on_error(result != 0);
+        pending_save->joined = 1;
+    }
 
-    unsigned int map_h;
-    rw_result = read(fd_in, &map_h, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    pending_save->superseded = 1;
+}
 
-    /* Skip map size */
+/*************************************************************
+ *************************************************************
+ *
+ * Write dirty rows.
+ *
+ *************************************************************/
+ssize_t write_dirty_rows(
+    int fd, const SavedArchive* archive, const char* map_data,
+    unsigned int sync
+)
+{
+    /* Planes of wide tiles are handled as extra rows */
 
-    seek_result = lseek(fd_in, 0x4, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    const MapHeader* map_header = &archive->map_header;
+    size_t map_w = map_header->width;
+    unsigned int map_rows = map_header->height * map_header->cell_size;
 
-    /* Allocate map */
+    /* The synchronization is kept room for */
 
-    map_allocate(map_w, map_h);
+    unsigned int request_count = 0;
+    unsigned int request_capacity = 0x10;
+    IoRequest* requests = 
+        (IoRequest*)malloc(request_capacity * sizeof(IoRequest));
+    if (requests == NULL)
+    {
+        return -1;
+    }
 
-    char map_data;
-    for (unsigned int y = 0; y < map_h; ++y)
+    ssize_t written = 0;
+    for (unsigned int y = 0; y < map_rows; ++y)
     {
-        for (unsigned int x = 0; x < map_w; ++x)
+        size_t offset = (size_t)y * map_w;
+        const char* row = &map_data[offset];
+        const char* saved_row = &archive->map_data[offset];
+        if (!memcmp(row, saved_row, map_w * sizeof(char)))
         {
-            rw_result = read(fd_in, &map_data, sizeof(char));
-            exit_on_error(rw_result < 0);
-            map_set(x, y, (int)map_data);  
+            continue;
         }
-    }
-
-    /* Tile paths */
 
-    seek_result = lseek(fd_in, 0x10, SEEK_SET);
-    exit_on_error(seek_result < 0);
+        /* Dirty bytes of the row */
 
-    char tile_path[tile_count][0x40];
-    for (unsigned i = 0; i < tile_count; ++i)
-    {
-        rw_result = read(fd_in, &tile_path[i][0], 0x40 * sizeof(char));
-        exit_on_error(rw_result < 0);
-    }
-
-    /* Tile attributes */
+        size_t begin = 0;
+        size_t end = map_w;
+        while (row[begin] == saved_row[begin])
+        {
+            ++begin;
+        }
 
-    map_object_begin(tile_count);
+        while (row[end - 1] == saved_row[end - 1])
+        {
+            --end;
+        }
 
-    unsigned int tile_attributes[5];
-    for (unsigned int i = 0; i < tile_count; ++i)
-    {
-        /* Attribute flag */
+        /* Ranges less than 0x40 bytes apart are merged */
 
-        rw_result = read(fd_in, &header, sizeof(unsigned int));
-        exit_on_error(rw_result < 0);
-        if (header != OBJECT_PROPERTIES_HEADER)
+        IoRequest* last = 
+            (request_count ? &requests[request_count - 1] : NULL);
+        unsigned long long first = archive->map_data_offset + offset;
+        if (last && first + begin <= last->offset + last->size + 0x40)
         {
-            seek_result = lseek(fd_in, 0, SEEK_CUR);
-            exit_on_error(seek_result < 0);
-            
-            seek_result -= 0x4;
-            fprintf(
-                stderr, 
-                "Tile properties flag [%x] "
-                "does not match at offset [%lx]!\n", 
-                header,
-                seek_result
-            );
-            exit_on_error(1);
+            written += first + end - (last->offset + last->size);
+            last->size = first + end - last->offset;
+            continue;
         }
 
-        for (int j = 0; j < 5; ++j)
+        if (request_count + 0x2 >= request_capacity)
         {
-            rw_result = read(
-                fd_in, 
-                &tile_attributes[j], 
-                sizeof(unsigned int)
+            request_capacity *= 2;
+            IoRequest* extended_requests = (IoRequest*)realloc(
+                requests, 
+                request_capacity * sizeof(IoRequest)
             );
-            exit_on_error(rw_result < 0);
+            if (extended_requests == NULL)
+            {
+                free(requests);
+                return -1;
+            }
+            requests = extended_requests;
         }
 
-        map_object_add(
-            &tile_path[i][0x0], 
-            tile_attributes[0x0], 
-            tile_attributes[0x1] | 
-            tile_attributes[0x2] | 
-            tile_attributes[0x3] | 
-            tile_attributes[0x4]
-        );
-        
-        /* Skip padding */
+        IoRequest request = {
+            IO_BATCH_WRITE,
+            fd,
+            (void*)&row[begin],
+            end - begin,
+            first + begin,
+            0
+        };
+        requests[request_count++] = request;
+        written += end - begin;
+    }
 
-        seek_result = lseek(fd_in, 0x8, SEEK_CUR);
-        exit_on_error(seek_result < 0);
+    /* Synchronization */
+
+    if (request_count && sync != MAP_SYNC_NONE)
+    {
+        IoRequest request = {
+            (sync == MAP_SYNC_FULL ? IO_BATCH_SYNC : IO_BATCH_DATASYNC),
+            fd,
+            NULL,
+            0,
+            0,
+            0
+        };
+        requests[request_count++] = request;
     }
 
-    map_object_end();
+    int result = io_batch_submit(requests, request_count);
+    free(requests);
 
-    close(fd_in);
+    return (result < 0 ? -1 : written);
 }
 
-#endif
+/*************************************************************
+ *************************************************************
+ *
+ * Is saved archive.
+ *
+ *************************************************************/
+int is_saved_archive(const SavedArchive* archive, const char* filename)
+{
+    return is_unmodified_archive(
+        archive->filename, 
+        &archive->archive_stat, 
+        filename
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Close saved archive.
+ *
+ *************************************************************/
+void close_saved_archive(SavedArchive* archive)
+{
+    free(archive->filename);
+    free(archive->tile_paths);
+    free(archive->tile_attributes);
+    free(archive->map_data);
+
+    memset(archive, 0, sizeof(SavedArchive));
+}
 
+#endif
@@ -0,0 +1,752 @@
+/*!
+ * \ingroup util_group
+ * \file maputilbench.c
+ * \brief Benchmark of the operations of the `maputil`
+ *        program.
+ *
+ * The `maputilbench` program generates synthetic map
+ * archives across the sizes allowed by the game, from
+ * `16` to `1024` tiles wide and from `12` to `20` tiles
+ * high, and various numbers of tiles. The archives are
+ * written with the version `1` of the format, or the
+ * version `2` for more than `254` tiles.
+ *
+ * The following operations are measured on a freshly
+ * generated archive at each run:
+ *
+ *  - set_map_width(), doubling the width or halving
+ *    the widest maps;
+ *  - set_map_height(), switching between the lowest and
+ *    the highest maps;
+ *  - set_map_objects(), replacing every tile;
+ *  - prune_objects(), half of the tiles being unused.
+ *
+ * The program writes one line per operation on the
+ * standard output, fields being separated by tabulations:
+ *
+ * | Field         | Description                           |
+ * |:-------------:|:-------------------------------------:|
+ * | `operation`   | Name of the function                  |
+ * | `encoding`    | `raw` or `rle`                        |
+ * | `layout`      | `contiguous`                          |
+ * | `width`       | Width of the map                      |
+ * | `height`      | Height of the map                     |
+ * | `objects`     | Number of tiles                       |
+ * | `iterations`  | Number of runs of the operation       |
+ * | `wall_ns`     | Wall time of a run, in nanoseconds    |
+ * | `read_calls`  | Read system calls of a run            |
+ * | `write_calls` | Write system calls of a run           |
+ * | `read_bytes`  | Bytes read by a run                   |
+ * | `write_bytes` | Bytes written by a run                |
+ * | `faults`      | Page faults of a run                  |
+ *
+ * System calls and bytes are taken from `/proc/self/io`.
+ * The backup of the archive is made in process, by a 
+ * reflink when the file system supports it, otherwise 
+ * by `copy_file_range()`.
+ *
+ * Usage:
+ *
+ * ```
+ * ./bench/maputilbench [iterations] > bench.tsv
+ * ```
+ *
+ * \author H. Decoudras
+ * \version 1
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "maputil.h"
+#include "error.h"
+#include "rle.h"
+
+
+/*!
+ * \brief Default number of runs of an operation.
+ */
+#define BENCH_ITERATIONS 16
+
+/*!
+ * \brief Minimum height of a map in the game.
+ */
+#define BENCH_MIN_HEIGHT 12
+
+/*!
+ * \brief Maximum height of a map in the game.
+ */
+#define BENCH_MAX_HEIGHT 20
+
+/*!
+ * \brief Minimum width of a map in the game.
+ */
+#define BENCH_MIN_WIDTH 16
+
+/*!
+ * \brief Maximum width of a map in the game.
+ */
+#define BENCH_MAX_WIDTH 1024
+
+
+/*!
+ * \struct bench_counters
+ * \brief The \ref bench_counters structure represents the
+ *        resources consumed by the process at some point.
+ */
+struct bench_counters
+{
+    /*!
+     * \brief Monotonic time, in nanoseconds.
+     */
+    unsigned long long wall_ns;
+
+    /*!
+     * \brief Number of read system calls.
+     */
+    unsigned long long read_calls;
+
+    /*!
+     * \brief Number of write system calls.
+     */
+    unsigned long long write_calls;
+
+    /*!
+     * \brief Number of bytes read.
+     */
+    unsigned long long read_bytes;
+
+    /*!
+     * \brief Number of bytes written.
+     */
+    unsigned long long write_bytes;
+
+    /*!
+     * \brief Number of page faults.
+     */
+    unsigned long long faults;
+
+    /*!
+     * \brief Number of bytes read from `/proc/self/io`
+     *        to fill this structure.
+     */
+    unsigned long long own_bytes;
+};
+
+
+/*!
+ * \brief Type definition of the \ref bench_counters
+ *        structure.
+ *
+ * \see bench_counters
+ */
+typedef struct bench_counters BenchCounters;
+
+
+/*!
+ * \brief The bench_archive() function measures the
+ *        operations on an archive with every encoding.
+ *
+ * \param directory Directory of the archive.
+ * \param filename Map archive.
+ * \param width Number of tiles on the `x` axis.
+ * \param height Number of tiles on the `y` axis.
+ * \param objects Number of tiles.
+ * \param iterations Number of runs of an operation.
+ */
+static void bench_archive(
+    const char* directory,
+    const char* filename,
+    unsigned int width,
+    unsigned int height,
+    unsigned int objects,
+    unsigned int iterations
+);
+
+/*!
+ * \brief The run_operation() function runs an operation
+ *        on an archive.
+ *
+ * \param op Index of the operation.
+ * \param filename Map archive.
+ * \param width Number of tiles on the `x` axis.
+ * \param height Number of tiles on the `y` axis.
+ * \param properties Tile properties.
+ * \param objects Number of tiles.
+ */
+static void run_operation(
+    unsigned int op,
+    const char* filename,
+    unsigned int width,
+    unsigned int height,
+    MapObjectProperties** properties,
+    unsigned int objects
+);
+
+/*!
+ * \brief The generate_archive() function writes a
+ *        synthetic map archive.
+ *
+ * The rows are made of runs of empty cells and of random
+ * tiles, so that run-length encoding is meaningful. Only
+ * the tiles of even index are used. The content only
+ * depends on the size of the map and on the number of
+ * tiles.
+ *
+ * \param filename Map archive.
+ * \param width Number of tiles on the `x` axis.
+ * \param height Number of tiles on the `y` axis.
+ * \param objects Number of tiles.
+ * \param encoding Encoding of the map data.
+ *
+ * \see MAP_ENCODING_RAW
+ * \see MAP_ENCODING_RLE
+ */
+static void generate_archive(
+    const char* filename,
+    unsigned int width,
+    unsigned int height,
+    unsigned int objects,
+    unsigned int encoding
+);
+
+/*!
+ * \brief The clear_directory() function removes the
+ *        archive and its backups.
+ *
+ * \param directory Directory of the archive.
+ */
+static void clear_directory(const char* directory);
+
+/*!
+ * \brief The read_counters() function reads the resources
+ *        consumed by the process.
+ *
+ * The counters are read with a single read system call,
+ * accounted by the next call of this function.
+ *
+ * \param counters Counters to fill.
+ *
+ * \return \p **0** on success, or \p **-1** if
+ *         `/proc/self/io` cannot be read.
+ */
+static int read_counters(BenchCounters* counters);
+
+/*!
+ * \brief The add_counters() function accumulates the
+ *        resources consumed between two readings.
+ *
+ * The read system call issued by the first reading is
+ * not accounted.
+ *
+ * \param total Accumulated counters.
+ * \param begin First reading.
+ * \param end Second reading.
+ */
+static void add_counters(
+    BenchCounters* total,
+    const BenchCounters* begin,
+    const BenchCounters* end
+);
+
+
+/*!
+ * \brief Names of the operations.
+ */
+static const char* operations[] = {
+    "set_map_width",
+    "set_map_height",
+    "set_map_objects",
+    "prune_objects"
+};
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Main.
+ *
+ *************************************************************/
+int main(int argc, char** argv)
+{
+    unsigned int iterations = BENCH_ITERATIONS;
+    if (argc > 1)
+    {
+        iterations = (unsigned int)strtoul(argv[1], NULL, 10);
+        if (!iterations)
+        {
+            fprintf(stderr, "Invalid number of iterations!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    BenchCounters counters;
+    if (read_counters(&counters))
+    {
+        fprintf(stderr, "Cannot read [/proc/self/io]!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Archive */
+
+    const char* tmpdir = getenv("TMPDIR");
+    char directory[0x100];
+    snprintf(
+        directory,
+        sizeof(directory),
+        "%s/maputilbench-XXXXXX",
+        (tmpdir ? tmpdir : "/tmp")
+    );
+    exit_on_error(mkdtemp(directory) == NULL);
+
+    char filename[0x120];
+    snprintf(filename, sizeof(filename), "%s/bench.map", directory);
+
+    static const unsigned int widths[] = {
+        BENCH_MIN_WIDTH, 64, 256, BENCH_MAX_WIDTH
+    };
+    static const unsigned int heights[] = {
+        BENCH_MIN_HEIGHT, 16, BENCH_MAX_HEIGHT
+    };
+    static const unsigned int objects[] = {
+        4, 64, 0xfe, 0x400
+    };
+
+    fprintf(
+        stdout,
+        "# operation\tencoding\tlayout\twidth\theight\tobjects\t"
+        "iterations\twall_ns\tread_calls\twrite_calls\t"
+        "read_bytes\twrite_bytes\tfaults\n"
+    );
+
+    for (size_t w = 0; w < sizeof(widths) / sizeof(*widths); ++w)
+    {
+        for (size_t h = 0; h < sizeof(heights) / sizeof(*heights); ++h)
+        {
+            for (size_t o = 0; o < sizeof(objects) / sizeof(*objects); ++o)
+            {
+                bench_archive(
+                    directory,
+                    filename,
+                    widths[w],
+                    heights[h],
+                    objects[o],
+                    iterations
+                );
+            }
+        }
+    }
+
+    rmdir(directory);
+
+    return EXIT_SUCCESS;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Bench archive.
+ *
+ *************************************************************/
+void bench_archive(
+    const char* directory,
+    const char* filename,
+    unsigned int width,
+    unsigned int height,
+    unsigned int objects,
+    unsigned int iterations
+)
+{
+    /* Replacing tiles */
+
+    MapObjectProperties** properties = (MapObjectProperties**)malloc(
+        objects * sizeof(MapObjectProperties*)
+    );
+    exit_on_error(properties == NULL);
+
+    char path[0x40];
+    for (unsigned int i = 0; i < objects; ++i)
+    {
+        snprintf(path, sizeof(path), "images/replaced-%u.png", i);
+        properties[i] = map_object_properties_new(
+            path,
+            1 + i % 20,
+            (i % 3 ? solidity_arg_air : solidity_arg_solid),
+            destructible_arg_not_destructible,
+            (i % 5 ? collectible_arg_not_collectible :
+                collectible_arg_collectible),
+            generator_arg_not_generator
+        );
+    }
+
+    for (unsigned int encoding = MAP_ENCODING_RAW;
+        encoding <= MAP_ENCODING_RLE; ++encoding)
+    {
+        for (unsigned int op = 0;
+            op < sizeof(operations) / sizeof(*operations); ++op)
+        {
+            BenchCounters total = {0};
+            for (unsigned int i = 0; i < iterations; ++i)
+            {
+                BenchCounters begin;
+                BenchCounters end;
+
+                generate_archive(
+                    filename,
+                    width,
+                    height,
+                    objects,
+                    encoding
+                );
+
+                read_counters(&begin);
+                run_operation(
+                    op,
+                    filename,
+                    width,
+                    height,
+                    properties,
+                    objects
+                );
+                read_counters(&end);
+
+                add_counters(&total, &begin, &end);
+                clear_directory(directory);
+            }
+
+            fprintf(
+                stdout,
+                "%s\t%s\tcontiguous\t%u\t%u\t%u\t%u\t"
+                "%llu\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+                operations[op],
+                (encoding == MAP_ENCODING_RLE ? "rle" : "raw"),
+                width,
+                height,
+                objects,
+                iterations,
+                total.wall_ns / iterations,
+                total.read_calls / iterations,
+                total.write_calls / iterations,
+                total.read_bytes / iterations,
+                total.write_bytes / iterations,
+                total.faults / iterations
+            );
+            fflush(stdout);
+        }
+    }
+
+    for (unsigned int i = 0; i < objects; ++i)
+    {
+        map_object_properties_delete(properties[i]);
+    }
+    free(properties);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Run operation.
+ *
+ *************************************************************/
+void run_operation(
+    unsigned int op,
+    const char* filename,
+    unsigned int width,
+    unsigned int height,
+    MapObjectProperties** properties,
+    unsigned int objects
+)
+{
+    switch (op)
+    {
+        case 0:
+        {
+            set_map_width(
+                filename,
+                (width < BENCH_MAX_WIDTH ? width * 2 : width / 2)
+            );
+            break;
+        }
+
+        case 1:
+        {
+            set_map_height(
+                filename,
+                (height < BENCH_MAX_HEIGHT ?
+                    BENCH_MAX_HEIGHT : BENCH_MIN_HEIGHT)
+            );
+            break;
+        }
+
+        case 2:
+        {
+            set_map_objects(filename, properties, objects);
+            break;
+        }
+
+        default:
+        {
+            prune_objects(filename);
+            break;
+        }
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Generate archive.
+ *
+ *************************************************************/
+void generate_archive(
+    const char* filename,
+    unsigned int width,
+    unsigned int height,
+    unsigned int objects,
+    unsigned int encoding
+)
+{
+    /* Wider tiles need a version 2 archive */
+
+    unsigned int version = (objects < 0xff ?
+        MARC_VERSION_1 : MARC_VERSION_2);
+    unsigned int cell_size = (version == MARC_VERSION_1 ? 1 : 2);
+    size_t header_size = (version == MARC_VERSION_1 ? 0x10 : 0x20);
+    size_t cell_count = (size_t)width * height;
+    size_t map_size = cell_count * cell_size;
+
+    /* Map data, the planes of the tiles included */
+
+    char* map_data = (char*)malloc(map_size * sizeof(char));
+    exit_on_error(map_data == NULL);
+
+    unsigned int seed = width * 0x10001 ^ height * 0x101 ^ objects;
+    size_t cell = 0;
+    while (cell < cell_count)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned int run = 1 + ((seed >> 16) & 0xf);
+        unsigned int object = (seed & 0x100 ?
+            ((seed >> 8) % objects) & ~1u : 0xffff);
+
+        for (; run && cell < cell_count; --run, ++cell)
+        {
+            map_data[cell] = (char)(object & 0xff);
+            if (cell_size > 1)
+            {
+                map_data[cell_count + cell] = (char)(object >> 8);
+            }
+        }
+    }
+
+    char* stored_data = map_data;
+    size_t stored_size = map_size;
+    unsigned int signature = MAPF_HEADER;
+    if (encoding == MAP_ENCODING_RLE)
+    {
+        stored_data = (char*)malloc(
+            RLE_MAX_ENCODED_SIZE(map_size) * sizeof(char)
+        );
+        exit_on_error(stored_data == NULL);
+        stored_size = rle_encode(map_data, map_size, stored_data);
+        signature = MAPF_RLE_HEADER;
+    }
+
+    /* Layout of the archive */
+
+    unsigned long long attributes_offset =
+        header_size + (unsigned long long)objects * 0x40;
+    unsigned long long map_offset =
+        attributes_offset + (unsigned long long)objects * 0x20;
+
+    char archive_header[0x20] = {0};
+    char map_header[0x20] = {0};
+    unsigned int* fields = (unsigned int*)archive_header;
+    unsigned int* map_fields = (unsigned int*)map_header;
+    fields[0x1] = objects;
+    map_fields[0x0] = signature;
+    map_fields[0x1] = width;
+    map_fields[0x2] = height;
+    if (version == MARC_VERSION_1)
+    {
+        fields[0x0] = MARC_HEADER;
+        fields[0x2] = (unsigned int)attributes_offset;
+        fields[0x3] = (unsigned int)map_offset;
+        map_fields[0x3] = (encoding == MAP_ENCODING_RLE ?
+            (unsigned int)stored_size : (unsigned int)cell_count);
+    }
+    else
+    {
+        unsigned long long* offsets =
+            (unsigned long long*)&archive_header[0x8];
+        fields[0x0] = MARC_V2_HEADER;
+        offsets[0x0] = attributes_offset;
+        offsets[0x1] = map_offset;
+        map_fields[0x3] = cell_size;
+        *(unsigned long long*)&map_header[0x10] = stored_size;
+    }
+
+    /* Output file */
+
+    int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    exit_on_error(fd < 0);
+    exit_on_error(write(fd, archive_header, header_size) < 0);
+
+    char path[0x40];
+    for (unsigned int i = 0; i < objects; ++i)
+    {
+        memset(path, 0, sizeof(path));
+        snprintf(path, sizeof(path), "images/bench-%u.png", i);
+        exit_on_error(write(fd, path, sizeof(path)) < 0);
+    }
+
+    unsigned int attributes[0x8] = {0};
+    attributes[0x0] = OBJECT_PROPERTIES_HEADER;
+    for (unsigned int i = 0; i < objects; ++i)
+    {
+        attributes[0x1] = 1 + i % 20;
+        attributes[0x2] = (i % 3 ? MAP_OBJECT_SOLID : MAP_OBJECT_AIR);
+        attributes[0x4] = (i % 5 ? 0 : MAP_OBJECT_COLLECTIBLE);
+        exit_on_error(write(fd, attributes, sizeof(attributes)) < 0);
+    }
+
+    exit_on_error(write(fd, map_header, header_size) < 0);
+    exit_on_error(write(fd, stored_data, stored_size) < 0);
+
+    /* Padding as written by the game */
+
+    static const char zero[0x40] = {0};
+    size_t remainder = (map_offset + header_size + stored_size) % 0x10;
+    if (remainder)
+    {
+        exit_on_error(write(
+            fd,
+            zero,
+            (0x10 - remainder) * sizeof(unsigned int)
+        ) < 0);
+    }
+
+    close(fd);
+
+    if (stored_data != map_data)
+    {
+        free(stored_data);
+    }
+    free(map_data);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Clear directory.
+ *
+ *************************************************************/
+void clear_directory(const char* directory)
+{
+    DIR* dir = opendir(directory);
+    exit_on_error(dir == NULL);
+
+    char filename[0x200];
+    struct dirent* entry;
+    while ((entry = readdir(dir)))
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        snprintf(
+            filename,
+            sizeof(filename),
+            "%s/%s",
+            directory,
+            entry->d_name
+        );
+        unlink(filename);
+    }
+
+    closedir(dir);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read counters.
+ *
+ *************************************************************/
+int read_counters(BenchCounters* counters)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    counters->faults = usage.ru_minflt + usage.ru_majflt;
+
+    char buffer[0x200];
+    int fd = open("/proc/self/io", O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    ssize_t size = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (size <= 0)
+    {
+        return -1;
+    }
+    buffer[size] = '\0';
+
+    counters->own_bytes = size;
+
+    static const char* fields[] = {
+        "rchar: ", "wchar: ", "syscr: ", "syscw: "
+    };
+    unsigned long long* values[] = {
+        &counters->read_bytes,
+        &counters->write_bytes,
+        &counters->read_calls,
+        &counters->write_calls
+    };
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        char* field = strstr(buffer, fields[i]);
+        *values[i] = (field ?
+            strtoull(field + strlen(fields[i]), NULL, 10) : 0);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    counters->wall_ns =
+        (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Add counters.
+ *
+ *************************************************************/
+void add_counters(
+    BenchCounters* total,
+    const BenchCounters* begin,
+    const BenchCounters* end
+)
+{
+    total->wall_ns += end->wall_ns - begin->wall_ns;
+    total->read_calls += end->read_calls - begin->read_calls - 1;
+    total->write_calls += end->write_calls - begin->write_calls;
+    total->read_bytes +=
+        end->read_bytes - begin->read_bytes - begin->own_bytes;
+    total->write_bytes += end->write_bytes - begin->write_bytes;
+    total->faults += end->faults - begin->faults;
+}
@@ -36,13 +36,18 @@ extern "C" {
 #define CMDLINE_PARSER_VERSION "1"
 #endif
 
+enum enum_setencoding { setencoding__NULL = -1, setencoding_arg_raw = 0, setencoding_arg_rle };
+enum enum_setpaths { setpaths__NULL = -1, setpaths_arg_fixed = 0, setpaths_arg_packed };
+
 /** @brief Where the command line options are stored */
 struct gengetopt_args_info
 {
   const char *help_help; /**< @brief Print help and exit help description.  */
   const char *version_help; /**< @brief Print version and exit help description.  */
-  char * file_arg;	/**< @brief Map file.  */
-  char * file_orig;	/**< @brief Map file original value given at command line.  */
+  char ** file_arg;	/**< @brief Map file.  */
+  char ** file_orig;	/**< @brief Map file original value given at command line.  */
+  unsigned int file_min; /**< @brief Map file's minimum occurreces */
+  unsigned int file_max; /**< @brief Map file's maximum occurreces */
   const char *file_help; /**< @brief Map file help description.  */
   const char *getwidth_help; /**< @brief Get the width of a map help description.  */
   const char *getheight_help; /**< @brief Get the height of a map help description.  */
@@ -60,6 +65,23 @@ struct gengetopt_args_info
   unsigned int setobjects_max; /**< @brief Replace the objects of a map's maximum occurreces */
   const char *setobjects_help; /**< @brief Replace the objects of a map help description.  */
   const char *pruneobjects_help; /**< @brief Remove unused objects of a map help description.  */
+  enum enum_setencoding setencoding_arg;	/**< @brief Set the encoding of the map data.  */
+  char * setencoding_orig;	/**< @brief Set the encoding of the map data original value given at command line.  */
+  const char *setencoding_help; /**< @brief Set the encoding of the map data help description.  */
+  int level_arg;	/**< @brief Select the level of a map.  */
+  char * level_orig;	/**< @brief Select the level of a map original value given at command line.  */
+  const char *level_help; /**< @brief Select the level of a map help description.  */
+  char * addlevels_arg;	/**< @brief Append the levels of another map archive.  */
+  char * addlevels_orig;	/**< @brief Append the levels of another map archive original value given at command line.  */
+  const char *addlevels_help; /**< @brief Append the levels of another map archive help description.  */
+  enum enum_setpaths setpaths_arg;	/**< @brief Set the encoding of the tile paths.  */
+  char * setpaths_orig;	/**< @brief Set the encoding of the tile paths original value given at command line.  */
+  const char *setpaths_help; /**< @brief Set the encoding of the tile paths help description.  */
+  char * thumbnail_arg;	/**< @brief Render a single map to a PPM thumbnail.  */
+  char * thumbnail_orig;	/**< @brief Render a single map to a PPM thumbnail original value given at command line.  */
+  const char *thumbnail_help; /**< @brief Render a single map to a PPM thumbnail help description.  */
+  const char *nobackup_help; /**< @brief Do not back up a map before editing it help description.  */
+  const char *stats_help; /**< @brief Display the tile usage statistics of a map help description.  */
   
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int version_given ;	/**< @brief Whether version was given.  */
@@ -72,6 +94,13 @@ struct gengetopt_args_info
   unsigned int setheight_given ;	/**< @brief Whether setheight was given.  */
   unsigned int setobjects_given ;	/**< @brief Whether setobjects was given.  */
   unsigned int pruneobjects_given ;	/**< @brief Whether pruneobjects was given.  */
+  unsigned int setencoding_given ;	/**< @brief Whether setencoding was given.  */
+  unsigned int level_given ;	/**< @brief Whether level was given.  */
+  unsigned int addlevels_given ;	/**< @brief Whether addlevels was given.  */
+  unsigned int setpaths_given ;	/**< @brief Whether setpaths was given.  */
+  unsigned int thumbnail_given ;	/**< @brief Whether thumbnail was given.  */
+  unsigned int nobackup_given ;	/**< @brief Whether nobackup was given.  */
+  unsigned int stats_given ;	/**< @brief Whether stats was given.  */
 
 } ;
 
@@ -197,6 +226,10 @@ int cmdline_parser_required (struct gengetopt_args_info *args_info,
   const char *prog_name);
 
 
+extern const char *cmdline_parser_setencoding_values[];  /**< @brief Possible values for setencoding. */
+extern const char *cmdline_parser_setpaths_values[];  /**< @brief Possible values for setpaths. */
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,140 @@
+/*!
+ * \ingroup util_group
+ * \file iobatch.h
+ * \brief Declaration of functions submitting batches of
+ *        reads and writes on map archives.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#ifndef DEF_IOBATCH_H
+#define DEF_IOBATCH_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+
+/*!
+ * \brief Reads \p size bytes at \p offset.
+ */
+#define IO_BATCH_READ 0
+
+/*!
+ * \brief Writes \p size bytes at \p offset.
+ */
+#define IO_BATCH_WRITE 1
+
+/*!
+ * \brief Flushes the data written so far, as
+ *        [fdatasync(int fd)](https://man7.org/linux/man-pages/man2/fdatasync.2.html)
+ *        does.
+ */
+#define IO_BATCH_DATASYNC 2
+
+/*!
+ * \brief Flushes the data and the metadata written so
+ *        far, as
+ *        [fsync(int fd)](https://man7.org/linux/man-pages/man2/fsync.2.html)
+ *        does.
+ */
+#define IO_BATCH_SYNC 3
+
+
+/*!
+ * \struct io_request
+ * \brief The \ref io_request structure represents an
+ *        operation of a batch.
+ */
+struct io_request
+{
+    /*!
+     * \brief Operation, among \ref IO_BATCH_READ,
+     *        \ref IO_BATCH_WRITE, \ref IO_BATCH_DATASYNC
+     *        and \ref IO_BATCH_SYNC.
+     */
+    unsigned int operation;
+
+    /*!
+     * \brief Opened file.
+     */
+    int fd;
+
+    /*!
+     * \brief Bytes read or written.
+     */
+    void* buffer;
+
+    /*!
+     * \brief Number of bytes.
+     */
+    size_t size;
+
+    /*!
+     * \brief Offset of the bytes in the file.
+     */
+    unsigned long long offset;
+
+    /*!
+     * \brief Number of bytes transferred, or the opposite
+     *        of the error number if the operation failed.
+     */
+    ssize_t result;
+};
+
+
+/*!
+ * \brief Type definition of the \ref io_request
+ *        structure.
+ *
+ * \see io_request
+ */
+typedef struct io_request IoRequest;
+
+
+/*!
+ * \brief The io_batch_available() function checks whether
+ *        batches are submitted with
+ *        [io_uring](https://man7.org/linux/man-pages/man7/io_uring.7.html).
+ *
+ * The ring is set up by the first call of this function
+ * or of io_batch_submit(). It is not available if the
+ * kernel does not support it or if the process is not
+ * allowed to use it.
+ *
+ * \return \p **1** if the ring is available, \p **0**
+ *         otherwise.
+ */
+int io_batch_available(void);
+
+/*!
+ * \brief The io_batch_submit() function performs a batch
+ *        of operations.
+ *
+ * If the ring is available, the operations are queued
+ * at once and a single
+ * [io_uring_enter(unsigned int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, sigset_t\* sig)](https://man7.org/linux/man-pages/man2/io_uring_enter.2.html)
+ * system call submits them and waits for their
+ * completion, every `64` operations. Otherwise, the
+ * operations are performed one after the other with
+ * `pread()`, `pwrite()`, `fdatasync()` and `fsync()`.
+ *
+ * Reads and writes of a batch may complete in any order,
+ * hence they must not overlap. A synchronization only
+ * starts once all the previous operations of the batch
+ * have completed. Partial transfers are completed
+ * synchronously.
+ *
+ * \param requests Operations, whose \p result field is
+ *        set.
+ * \param count Number of operations.
+ *
+ * \return \p **0** if all the bytes are transferred,
+ *         \p **-1** otherwise, \p errno being set to
+ *         \p **ENODATA** if a read reaches the end of its
+ *         file.
+ */
+int io_batch_submit(IoRequest* requests, unsigned int count);
+
+
+#endif // DEF_IOBATCH_H
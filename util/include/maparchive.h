@@ -0,0 +1,493 @@
+/*!
+ * \ingroup util_group
+ * \file maparchive.h
+ * \brief Declaration of functions handling map archives
+ *        read in memory.
+ *
+ * A map archive is parsed once into a \ref MapArchive
+ * handle, queried and edited through it, then serialized
+ * to a file descriptor or to a buffer. Unlike the
+ * operations of the \ref maputil.h header, these
+ * functions never exit the program, they return an error
+ * code instead. Both are gathered in the `libmaputil.a`
+ * static library:
+ *
+ * ```
+ * cc -I util/include -o editor editor.c util/libmaputil.a -lpng -lpthread
+ * ```
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#ifndef DEF_MAPARCHIVE_H
+#define DEF_MAPARCHIVE_H
+
+#include <stddef.h>
+
+#include "maputil.h"
+
+
+/*!
+ * \brief The operation succeeded.
+ */
+#define MAP_ARCHIVE_OK 0
+
+/*!
+ * \brief A system call failed, `errno` telling why.
+ */
+#define MAP_ARCHIVE_ERROR_IO -1
+
+/*!
+ * \brief A memory allocation failed.
+ */
+#define MAP_ARCHIVE_ERROR_MEMORY -2
+
+/*!
+ * \brief The map archive is malformed.
+ */
+#define MAP_ARCHIVE_ERROR_FORMAT -3
+
+/*!
+ * \brief A checksum of the map archive does not match.
+ */
+#define MAP_ARCHIVE_ERROR_CHECKSUM -4
+
+/*!
+ * \brief The level does not exist.
+ */
+#define MAP_ARCHIVE_ERROR_LEVEL -5
+
+/*!
+ * \brief The tile does not exist, or fewer tiles than
+ *        the map archive holds or more than 
+ *        \ref MAP_MAX_OBJECTS are provided.
+ */
+#define MAP_ARCHIVE_ERROR_OBJECT -6
+
+/*!
+ * \brief A tile path is longer than
+ *        \ref PATH_TABLE_MAX_LENGTH characters.
+ */
+#define MAP_ARCHIVE_ERROR_PATH -7
+
+/*!
+ * \brief An argument is out of range.
+ */
+#define MAP_ARCHIVE_ERROR_ARGUMENT -8
+
+
+/*!
+ * \brief Type definition of the \ref map_archive
+ *        structure, which represents a map archive read
+ *        in memory.
+ *
+ * The structure is opaque, it is allocated by the
+ * map_archive_parse() function and its variants and
+ * freed by the map_archive_free() function.
+ */
+typedef struct map_archive MapArchive;
+
+
+/*!
+ * \brief The map_archive_open() function reads and
+ *        parses a map archive.
+ *
+ * \param filename Map archive.
+ * \param archive Parsed map archive.
+ *
+ * \return \ref MAP_ARCHIVE_OK if the archive is parsed,
+ *         an error code otherwise.
+ *
+ * \see map_archive_parse()
+ */
+int map_archive_open(const char* filename, MapArchive** archive);
+
+/*!
+ * \brief The map_archive_read() function reads and
+ *        parses a map archive from a file descriptor.
+ *
+ * The archive spans the bytes from the file cursor to
+ * the end of the file, hence pipes can be read as well.
+ *
+ * \param fd Opened map archive.
+ * \param archive Parsed map archive.
+ *
+ * \return \ref MAP_ARCHIVE_OK if the archive is parsed,
+ *         an error code otherwise.
+ *
+ * \see map_archive_parse()
+ */
+int map_archive_read(int fd, MapArchive** archive);
+
+/*!
+ * \brief The map_archive_parse() function parses a map
+ *        archive stored in a buffer.
+ *
+ * All the levels are decoded. The checksums are checked
+ * if the archive ends with a checksum trailer.
+ *
+ * \param buffer Map archive, as stored.
+ * \param size Size of \p buffer.
+ * \param archive Parsed map archive, to be freed with
+ *                the map_archive_free() function.
+ *
+ * \return \ref MAP_ARCHIVE_OK if the archive is parsed,
+ *         an error code otherwise.
+ */
+int map_archive_parse(
+    const char* buffer, size_t size, MapArchive** archive
+);
+
+/*!
+ * \brief The map_archive_free() function frees a map
+ *        archive.
+ *
+ * \param archive Map archive, or `NULL`.
+ */
+void map_archive_free(MapArchive* archive);
+
+/*!
+ * \brief The map_archive_serialize() function stores a
+ *        map archive in a buffer.
+ *
+ * The levels are stored one after the other, followed
+ * by the level directory if there are several of them
+ * and by the checksum trailer if the parsed archive had
+ * one.
+ *
+ * \param archive Map archive.
+ * \param buffer Stored map archive, to be freed by the
+ *               caller.
+ * \param size Size of \p buffer.
+ *
+ * \return \ref MAP_ARCHIVE_OK if the archive is stored,
+ *         an error code otherwise.
+ */
+int map_archive_serialize(
+    const MapArchive* archive, char** buffer, size_t* size
+);
+
+/*!
+ * \brief The map_archive_write() function writes a map
+ *        archive to a file descriptor.
+ *
+ * \param archive Map archive.
+ * \param fd Opened file, written from its cursor.
+ *
+ * \return \ref MAP_ARCHIVE_OK if the archive is written,
+ *         an error code otherwise.
+ *
+ * \note The file is not truncated after the archive.
+ *
+ * \see map_archive_serialize()
+ */
+int map_archive_write(const MapArchive* archive, int fd);
+
+/*!
+ * \brief The map_archive_save() function writes a map
+ *        archive to a file, created or truncated.
+ *
+ * \param archive Map archive.
+ * \param filename File written.
+ *
+ * \return \ref MAP_ARCHIVE_OK if the archive is written,
+ *         an error code otherwise.
+ *
+ * \see map_archive_serialize()
+ */
+int map_archive_save(const MapArchive* archive, const char* filename);
+
+/*!
+ * \brief The map_archive_strerror() function describes
+ *        an error code.
+ *
+ * \param error Error code.
+ *
+ * \return A static description of the error.
+ */
+const char* map_archive_strerror(int error);
+
+/*!
+ * \brief The map_archive_get_version() function gets
+ *        the version of a map archive.
+ *
+ * \param archive Map archive.
+ *
+ * \return \ref MARC_VERSION_1 or \ref MARC_VERSION_2.
+ */
+unsigned int map_archive_get_version(const MapArchive* archive);
+
+/*!
+ * \brief The map_archive_get_level_count() function
+ *        gets the number of levels of a map archive.
+ *
+ * \param archive Map archive.
+ *
+ * \return The number of levels.
+ */
+unsigned int map_archive_get_level_count(const MapArchive* archive);
+
+/*!
+ * \brief The map_archive_get_objects_count() function
+ *        gets the number of tiles of a map archive.
+ *
+ * The tiles are shared by all the levels.
+ *
+ * \param archive Map archive.
+ *
+ * \return The number of tiles.
+ */
+unsigned int map_archive_get_objects_count(const MapArchive* archive);
+
+/*!
+ * \brief The map_archive_get_width() function gets the
+ *        width of the map of a level.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param map_width Width of the map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_LEVEL if the level does
+ *         not exist.
+ */
+int map_archive_get_width(
+    const MapArchive* archive, unsigned int level, unsigned int* map_width
+);
+
+/*!
+ * \brief The map_archive_get_height() function gets the
+ *        height of the map of a level.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param map_height Height of the map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_LEVEL if the level does
+ *         not exist.
+ */
+int map_archive_get_height(
+    const MapArchive* archive, unsigned int level,
+    unsigned int* map_height
+);
+
+/*!
+ * \brief The map_archive_get_info() function gets the
+ *        width and the height of the map of a level, the
+ *        number of tiles and the number of levels.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param info Information of the map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_LEVEL if the level does
+ *         not exist.
+ *
+ * \see MapInfo
+ */
+int map_archive_get_info(
+    const MapArchive* archive, unsigned int level, MapInfo* info
+);
+
+/*!
+ * \brief The map_archive_get_encoding() function gets
+ *        the encoding of the map data of a level.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param encoding \ref MAP_ENCODING_RAW or
+ *                 \ref MAP_ENCODING_RLE.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_LEVEL if the level does
+ *         not exist.
+ */
+int map_archive_get_encoding(
+    const MapArchive* archive, unsigned int level,
+    unsigned int* encoding
+);
+
+/*!
+ * \brief The map_archive_get_paths() function gets the
+ *        encoding of the tile paths of a map archive.
+ *
+ * \param archive Map archive.
+ *
+ * \return \ref MAP_PATHS_FIXED or \ref MAP_PATHS_PACKED.
+ */
+unsigned int map_archive_get_paths(const MapArchive* archive);
+
+/*!
+ * \brief The map_archive_get_object() function gets the
+ *        properties of a tile.
+ *
+ * \param archive Map archive.
+ * \param index Index of the tile.
+ * \param properties Properties of the tile. Its path
+ *                   belongs to the archive and remains
+ *                   valid until the tiles are modified.
+ *
+ * \return \ref MAP_ARCHIVE_OK,
+ *         \ref MAP_ARCHIVE_ERROR_OBJECT if the tile does
+ *         not exist or \ref MAP_ARCHIVE_ERROR_FORMAT if
+ *         its properties are not valid.
+ */
+int map_archive_get_object(
+    const MapArchive* archive, unsigned int index,
+    MapObjectProperties* properties
+);
+
+/*!
+ * \brief The map_archive_get_cell() function gets the
+ *        tile of a cell of the map of a level.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param x Column of the cell.
+ * \param y Row of the cell, from the top side of the
+ *          map.
+ * \param object Index of the tile, `-1` if the cell has
+ *               none.
+ *
+ * \return \ref MAP_ARCHIVE_OK,
+ *         \ref MAP_ARCHIVE_ERROR_LEVEL if the level does
+ *         not exist or \ref MAP_ARCHIVE_ERROR_ARGUMENT if
+ *         the cell is outside the map.
+ */
+int map_archive_get_cell(
+    const MapArchive* archive, unsigned int level, unsigned int x,
+    unsigned int y, int* object
+);
+
+/*!
+ * \brief The map_archive_set_cell() function sets the
+ *        tile of a cell of the map of a level.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param x Column of the cell.
+ * \param y Row of the cell, from the top side of the
+ *          map.
+ * \param object Index of the tile, `-1` for none.
+ *
+ * \return \ref MAP_ARCHIVE_OK,
+ *         \ref MAP_ARCHIVE_ERROR_LEVEL if the level does
+ *         not exist, \ref MAP_ARCHIVE_ERROR_ARGUMENT if
+ *         the cell is outside the map or
+ *         \ref MAP_ARCHIVE_ERROR_OBJECT if the tile does
+ *         not exist.
+ */
+int map_archive_set_cell(
+    MapArchive* archive, unsigned int level, unsigned int x,
+    unsigned int y, int object
+);
+
+/*!
+ * \brief The map_archive_set_width() function sets the
+ *        width of the map of a level.
+ *
+ * Columns are added or removed on the right side of the
+ * map, as the set_map_width() function does.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param map_width Width of the map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or an error code.
+ */
+int map_archive_set_width(
+    MapArchive* archive, unsigned int level, unsigned int map_width
+);
+
+/*!
+ * \brief The map_archive_set_height() function sets the
+ *        height of the map of a level.
+ *
+ * Rows are added or removed on the top side of the map,
+ * as the set_map_height() function does.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param map_height Height of the map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or an error code.
+ */
+int map_archive_set_height(
+    MapArchive* archive, unsigned int level, unsigned int map_height
+);
+
+/*!
+ * \brief The map_archive_set_objects() function
+ *        replaces the tiles of a map archive.
+ *
+ * The encoding of the tile paths is kept.
+ *
+ * \param archive Map archive.
+ * \param properties Tile properties.
+ * \param properties_count Number of tile properties, at
+ *                         least the number of tiles of
+ *                         the archive.
+ *
+ * \return \ref MAP_ARCHIVE_OK,
+ *         \ref MAP_ARCHIVE_ERROR_OBJECT if fewer tiles
+ *         than the archive holds or more than 
+ *         \ref MAP_MAX_OBJECTS are provided,
+ *         \ref MAP_ARCHIVE_ERROR_PATH if a tile path is
+ *         too long or \ref MAP_ARCHIVE_ERROR_MEMORY.
+ */
+int map_archive_set_objects(
+    MapArchive* archive, MapObjectProperties** properties,
+    unsigned int properties_count
+);
+
+/*!
+ * \brief The map_archive_prune_objects() function
+ *        removes the tiles that no level of a map archive
+ *        uses.
+ *
+ * The remaining tiles keep their order and the maps are
+ * renumbered accordingly, whichever tiles are removed.
+ *
+ * \param archive Map archive.
+ *
+ * \return \ref MAP_ARCHIVE_OK,
+ *         \ref MAP_ARCHIVE_ERROR_FORMAT if the tile
+ *         properties are not valid or
+ *         \ref MAP_ARCHIVE_ERROR_MEMORY.
+ */
+int map_archive_prune_objects(MapArchive* archive);
+
+/*!
+ * \brief The map_archive_set_encoding() function sets
+ *        the encoding of the map data of a level.
+ *
+ * Chunked maps stay chunked.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ * \param encoding \ref MAP_ENCODING_RAW or
+ *                 \ref MAP_ENCODING_RLE.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or an error code.
+ */
+int map_archive_set_encoding(
+    MapArchive* archive, unsigned int level, unsigned int encoding
+);
+
+/*!
+ * \brief The map_archive_set_paths() function sets the
+ *        encoding of the tile paths of a map archive.
+ *
+ * \param archive Map archive.
+ * \param encoding \ref MAP_PATHS_FIXED or
+ *                 \ref MAP_PATHS_PACKED.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or an error code.
+ */
+int map_archive_set_paths(MapArchive* archive, unsigned int encoding);
+
+
+#endif // DEF_MAPARCHIVE_H
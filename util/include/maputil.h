@@ -18,11 +18,92 @@
  */
 #define MARC_HEADER 0x4352414d
 
+/*!
+ * \brief MARC v2 header signature.
+ *
+ * Version `2` archives store their section offsets on
+ * `64` bits and the tiles of their maps on `1` or `2` 
+ * bytes each.
+ *
+ * \see MARC_VERSION_2
+ */
+#define MARC_V2_HEADER 0x3243524d
+
 /*!
  * \brief MAPF header signature
  */
 #define MAPF_HEADER 0x4650414d
 
+/*!
+ * \brief Run-length encoded MAPF header signature.
+ *
+ * The map data following such a header are run-length
+ * encoded and the last field of the header holds the
+ * size of the encoded data.
+ */
+#define MAPF_RLE_HEADER 0x5250414d
+
+/*!
+ * \brief Chunked MAPF header signature.
+ *
+ * The map data following such a header are split into
+ * chunks of columns and the last field of the header 
+ * holds the width of a chunk.
+ */
+#define MAPC_HEADER 0x4350414d
+
+/*!
+ * \brief Run-length encoded chunked MAPF header signature.
+ *
+ * Same as \ref MAPC_HEADER, except that each chunk is
+ * run-length encoded.
+ */
+#define MAPC_RLE_HEADER 0x5a50414d
+
+/*!
+ * \brief Checksum trailer signature.
+ *
+ * The trailer ends the archive and holds the `CRC32C` 
+ * checksums of the tile paths, of the tile properties 
+ * and of the decoded map data, followed by this 
+ * signature.
+ */
+#define MCRC_TRAILER 0x4352434d
+
+/*!
+ * \brief Level directory signature.
+ *
+ * The level directory of a \ref MARC_VERSION_2 archive
+ * follows its last level and holds, for each level, the 
+ * offset of its map on `8` bytes and the `CRC32C` 
+ * checksum of its decoded map data on `4` bytes, padded
+ * to `16` bytes. The first level is the map referenced 
+ * by the archive header.
+ */
+#define MDIR_HEADER 0x5249444d
+
+/*!
+ * \brief Version `1` of the map archives.
+ *
+ * The section offsets are stored on `32` bits and the 
+ * tiles of the map on `1` byte each.
+ *
+ * \see MARC_HEADER
+ */
+#define MARC_VERSION_1 1
+
+/*!
+ * \brief Version `2` of the map archives.
+ *
+ * The section offsets are stored on `64` bits and the 
+ * tiles of the map on `1` or `2` bytes each, the latter
+ * being split into a plane of low bytes followed by a 
+ * plane of high bytes.
+ *
+ * \see MARC_V2_HEADER
+ */
+#define MARC_VERSION_2 2
+
 /*!
  * \brief Tile properties header signature.
  */
@@ -33,6 +114,41 @@
  */
 #define MAP_OBJECT_NONE 0xff
 
+/*!
+ * \brief Maximum number of tiles of a map.
+ *
+ * The game only keeps the `10` low bits of a cell, 
+ * hence the tiles beyond cannot be displayed.
+ */
+#define MAP_MAX_OBJECTS 0x400
+
+/*!
+ * \brief Raw encoding of the map data.
+ *
+ * \see MAPF_HEADER
+ */
+#define MAP_ENCODING_RAW 0
+
+/*!
+ * \brief Run-length encoding of the map data.
+ *
+ * \see MAPF_RLE_HEADER
+ */
+#define MAP_ENCODING_RLE 1
+
+/*!
+ * \brief Tile paths stored in slots of `0x40` bytes.
+ */
+#define MAP_PATHS_FIXED 0
+
+/*!
+ * \brief Tile paths stored in a packed table, each 
+ *        distinct path being stored once.
+ *
+ * \see MSTR_HEADER
+ */
+#define MAP_PATHS_PACKED 1
+
 /*!
  * \brief Air property of a tile.
  *
@@ -75,6 +191,28 @@
  */
 #define MAP_OBJECT_GENERATOR 0x00000010
 
+/*!
+ * \brief Maximum width of a thumbnail, in pixels.
+ *
+ * Wider maps are downscaled, each pixel averaging a 
+ * square block of tiles.
+ */
+#define THUMBNAIL_MAX_WIDTH 0x100
+
+/*!
+ * \brief Maximum number of tiles whose colors are summed
+ *        in packed lanes before being unpacked.
+ *
+ * Each channel is summed in `21` bits.
+ */
+#define THUMBNAIL_LANE_CELLS 0x2000
+
+/*!
+ * \brief Size of the buffer through which the rows of a
+ *        map are moved when it is resized in place.
+ */
+#define MAP_RESIZE_BUFFER_SIZE 0x100000
+
 /*!
  * \struct map_info
  * \brief The \ref map_info structure contains 
@@ -86,7 +224,8 @@
  *    the number of tiles on the `x` axis;
  *  - The height of a map, which corresponds to 
  *    the number of tiles on the `y` axis;
- *  - The number of tiles of a map.
+ *  - The number of tiles of a map;
+ *  - The number of levels of a map archive.
  */
 struct map_info
 {
@@ -104,6 +243,11 @@ struct map_info
      * \brief Number of tiles of a map.
      */
     unsigned int map_objects_count;
+
+    /*!
+     * \brief Number of levels of a map archive.
+     */
+    unsigned int map_levels_count;
 };
 
 
@@ -171,6 +315,191 @@ struct map_object_properties
 typedef struct map_object_properties MapObjectProperties;
 
 
+/*!
+ * \struct map_edits
+ * \brief The \ref map_edits structure represents the 
+ *        edits of a map archive applied together by the
+ *        edit_map() function.
+ *
+ * The edits are applied in the order of their fields.
+ *
+ * \see edit_map()
+ */
+struct map_edits
+{
+    /*!
+     * \brief Whether the width of the map is set.
+     */
+    int set_width;
+
+    /*!
+     * \brief Width of the map.
+     */
+    unsigned int map_width;
+
+    /*!
+     * \brief Whether the height of the map is set.
+     */
+    int set_height;
+
+    /*!
+     * \brief Height of the map.
+     */
+    unsigned int map_height;
+
+    /*!
+     * \brief Tile properties replacing the tiles of the
+     *        map, or `NULL`.
+     */
+    MapObjectProperties** properties;
+
+    /*!
+     * \brief Number of tile properties.
+     */
+    unsigned int properties_count;
+
+    /*!
+     * \brief Whether the unused tiles are removed.
+     */
+    int prune_objects;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_edits structure.
+ *
+ * \see map_edits
+ */
+typedef struct map_edits MapEdits;
+
+
+/*!
+ * \struct map_object_stats
+ * \brief The \ref map_object_stats structure contains 
+ *        the usage of a tile in a map.
+ *
+ * The columns and rows of an unused tile are `0`.
+ *
+ * \see get_map_stats()
+ */
+struct map_object_stats
+{
+    /*!
+     * \brief Path of the tile.
+     */
+    char path[0x40];
+
+    /*!
+     * \brief Number of cells holding the tile.
+     */
+    unsigned int cells;
+
+    /*!
+     * \brief First column holding the tile.
+     */
+    unsigned int first_column;
+
+    /*!
+     * \brief Last column holding the tile.
+     */
+    unsigned int last_column;
+
+    /*!
+     * \brief First row, from the top, holding the tile.
+     */
+    unsigned int first_row;
+
+    /*!
+     * \brief Last row, from the top, holding the tile.
+     */
+    unsigned int last_row;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_object_stats 
+ *        structure.
+ *
+ * \see map_object_stats
+ */
+typedef struct map_object_stats MapObjectStats;
+
+
+/*!
+ * \struct map_stats
+ * \brief The \ref map_stats structure contains the 
+ *        usage of the tiles of a map.
+ *
+ * The cells are counted according to the properties of
+ * their tile. Cells without a tile count as air.
+ *
+ * \see get_map_stats()
+ * \see free_map_stats()
+ */
+struct map_stats
+{
+    /*!
+     * \brief Width of the map.
+     */
+    unsigned int map_width;
+
+    /*!
+     * \brief Height of the map.
+     */
+    unsigned int map_height;
+
+    /*!
+     * \brief Number of cells without a tile.
+     */
+    unsigned int empty_cells;
+
+    /*!
+     * \brief Number of cells that can be crossed in all
+     *        directions.
+     */
+    unsigned int air_cells;
+
+    /*!
+     * \brief Number of cells that can only be crossed 
+     *        from below.
+     */
+    unsigned int semi_solid_cells;
+
+    /*!
+     * \brief Number of cells that cannot be crossed.
+     */
+    unsigned int solid_cells;
+
+    /*!
+     * \brief Number of cells that can be destroyed.
+     */
+    unsigned int destructible_cells;
+
+    /*!
+     * \brief Number of cells holding a collectible item.
+     */
+    unsigned int collectible_cells;
+
+    /*!
+     * \brief Usage of each tile of the map.
+     */
+    MapObjectStats* objects;
+
+    /*!
+     * \brief Number of tiles of the map.
+     */
+    unsigned int objects_count;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_stats structure.
+ *
+ * \see map_stats
+ */
+typedef struct map_stats MapStats;
+
+
 /*!
  * \brief The map_object_properties_new() function allocates
  *        a \ref MapObjectProperties structure.
@@ -267,7 +596,8 @@ unsigned int get_map_objects_count(const char* filename);
  *
  * This function aggregates the same treatments as the
  * get_map_width(), get_map_height() and 
- * get_map_objects_count() functions.
+ * get_map_objects_count() functions. The number of 
+ * levels of the map archive is retrieved as well.
  *
  * \param filename Map archive.
  * \param info Contains the width, the height and the
@@ -280,6 +610,32 @@ unsigned int get_map_objects_count(const char* filename);
  */
 void get_map_info(const char* filename, MapInfo* info);
 
+/*!
+ * \brief The get_maps_info() function gets the width, 
+ *        the height and the number of tiles of several 
+ *        maps.
+ *
+ * The information is the one retrieved by the 
+ * get_map_info() function for each archive. Instead of
+ * reading the archives one after the other, the headers
+ * of all of them are read by a single batch, and so are
+ * their trailers and level directories, then the headers
+ * of their maps.
+ *
+ * \param filenames Map archives.
+ * \param count Number of map archives.
+ * \param infos Contains, for each archive, the width, 
+ *              the height and the number of tiles of a 
+ *              map.
+ *
+ * \see MapInfo
+ * \see get_map_info()
+ * \see io_batch_submit()
+ */
+void get_maps_info(
+    const char* const* filenames, unsigned int count, MapInfo* infos
+);
+
 /*!
  * \brief The set_map_width() function sets the width
  *        of a map.
@@ -336,6 +692,8 @@ void set_map_height(const char* filename, unsigned int map_height);
  *
  * The tiles of a map are replaced only if the provided 
  * \p properties contains at least the same amount of tiles.
+ * The program exits if more than \ref MAP_MAX_OBJECTS 
+ * tiles are provided.
  *
  * \param filename Map archive.
  * \param properties Tile properties.
@@ -358,8 +716,12 @@ void set_map_objects(
  * \brief The prune_object() function removes unused
  *        tiles from a map.
  *
+ * The remaining tiles keep their order and every level
+ * of the map is renumbered in one pass.
+ *
  * \param filename Map archive.
  *
+ * \see map_archive_prune_objects()
  * \see MAP_OBJECT_NONE
  * \see validate_marc_header()
  * \see seek_mapf_header()
@@ -370,5 +732,180 @@ void set_map_objects(
  */
 void prune_objects(const char* filename);
 
+/*!
+ * \brief The edit_map() function sets the width, the 
+ *        height and the tiles of a map, then removes its
+ *        unused tiles.
+ *
+ * The archive is read once and the edits are applied in
+ * memory, in this order, with the same effects as the 
+ * set_map_width(), set_map_height(), set_map_objects() 
+ * and prune_objects() functions called one after the 
+ * other. The archive is then backed up and rewritten 
+ * once, unless no edit changes it.
+ *
+ * \param filename Map archive.
+ * \param edits Edits of the map.
+ *
+ * \see MapEdits
+ * \see validate_marc_header()
+ * \see seek_mapf_header()
+ * \see validate_object_properties_header() 
+ * \see backup_archive()
+ * \see remove_archive()
+ */
+void edit_map(const char* filename, const MapEdits* edits);
+
+/*!
+ * \brief The set_map_encoding() function sets the
+ *        encoding of the data of a map.
+ *
+ * \param filename Map archive.
+ * \param encoding Encoding of the map data.
+ *
+ * \see MAP_ENCODING_RAW
+ * \see MAP_ENCODING_RLE
+ * \see validate_marc_header()
+ * \see seek_mapf_header()
+ * \see read_mapf_header()
+ * \see backup_archive()
+ * \see remove_archive()
+ */
+void set_map_encoding(const char* filename, unsigned int encoding);
+
+/*!
+ * \brief The set_map_paths() function sets the encoding
+ *        of the tile paths of a map archive.
+ *
+ * The tile paths of all the levels are shared, hence 
+ * the selected level does not matter.
+ *
+ * \param filename Map archive.
+ * \param encoding Encoding of the tile paths.
+ *
+ * \see MAP_PATHS_FIXED
+ * \see MAP_PATHS_PACKED
+ * \see validate_marc_header()
+ * \see backup_archive()
+ */
+void set_map_paths(const char* filename, unsigned int encoding);
+
+/*!
+ * \brief The add_map_levels() function appends the 
+ *        levels of another map archive to a map archive.
+ *
+ * The added levels share the tiles of \p filename, 
+ * hence they must not reference more tiles than it 
+ * holds. A \ref MARC_VERSION_1 archive is converted 
+ * to the \ref MARC_VERSION_2 version, the only one 
+ * holding a level directory.
+ *
+ * \param filename Map archive.
+ * \param level_filename Map archive holding the levels
+ *                       to add.
+ *
+ * \see MDIR_HEADER
+ * \see validate_marc_header()
+ * \see backup_archive()
+ */
+void add_map_levels(const char* filename, const char* level_filename);
+
+/*!
+ * \brief The render_map_thumbnail() function renders a
+ *        map to a binary `PPM` image.
+ *
+ * Each tile is drawn with the average color of its `PNG`
+ * image, computed once per distinct path and blended 
+ * over the average color of `images/background.png` by
+ * its opacity, the latter also drawing the cells without
+ * a tile. Tile paths are looked up from the current 
+ * directory, then from the parent directory of the 
+ * directory of the map archive. Tiles whose image cannot
+ * be read get a color derived from their path.
+ *
+ * A pixel stands for a tile, or for a square block of
+ * tiles if the map is wider than 
+ * \ref THUMBNAIL_MAX_WIDTH tiles. The image is rendered
+ * in a single pass over the map data.
+ *
+ * \param filename Map archive.
+ * \param thumbnail_filename Image written.
+ *
+ * \see THUMBNAIL_MAX_WIDTH
+ * \see validate_marc_header()
+ * \see seek_mapf_header()
+ * \see read_mapf_header()
+ */
+void render_map_thumbnail(
+    const char* filename, const char* thumbnail_filename
+);
+
+/*!
+ * \brief The get_map_stats() function gets the usage of
+ *        the tiles of a map.
+ *
+ * The map data are read once and the cells of each row
+ * are counted in a single pass, `16` cells at once where 
+ * they hold the same tile if `SSE2` is available. The 
+ * counts are then joined with the tile properties.
+ *
+ * \param filename Map archive.
+ * \param stats Usage of the tiles, to be freed with the
+ *              free_map_stats() function.
+ *
+ * \see free_map_stats()
+ * \see validate_marc_header()
+ * \see seek_mapf_header()
+ * \see read_mapf_header()
+ * \see validate_object_properties_header()
+ */
+void get_map_stats(const char* filename, MapStats* stats);
+
+/*!
+ * \brief The free_map_stats() function frees the usage 
+ *        of the tiles of a map.
+ *
+ * \param stats Usage of the tiles filled by the 
+ *              get_map_stats() function.
+ *
+ * \see get_map_stats()
+ */
+void free_map_stats(MapStats* stats);
+
+/*!
+ * \brief The set_map_level() function selects the 
+ *        level handled by the operations on a map.
+ *
+ * The first level, the default one, is the map 
+ * referenced by the archive header. Operations on a 
+ * map rewrite all the levels of the archive, only the
+ * selected one being modified. They exit the program 
+ * if the selected level does not exist.
+ *
+ * \param level Index of the level, starting from `0`.
+ *
+ * \see seek_mapf_header()
+ */
+void set_map_level(unsigned int level);
+
+/*!
+ * \brief The set_map_backups() function enables or 
+ *        disables the backup of a map archive before it
+ *        is edited.
+ *
+ * Backups are enabled by default. They concern the 
+ * edits of the edit_map() function, which read the whole
+ * archive before rewriting it. The other operations read
+ * the backup while rewriting the archive, hence they 
+ * always make one.
+ *
+ * \param enabled \p **0** to disable the backups, any 
+ *                other value to enable them.
+ *
+ * \see backup_archive()
+ * \see edit_map()
+ */
+void set_map_backups(int enabled);
+
 #endif // DEF_MAPUTIL_H
 
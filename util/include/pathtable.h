@@ -0,0 +1,238 @@
+/*!
+ * \ingroup util_group
+ * \file pathtable.h
+ * \brief Declaration of functions related to the tables
+ *        of tile paths of map archives.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#ifndef DEF_PATHTABLE_H
+#define DEF_PATHTABLE_H
+
+#include <sys/types.h>
+#include <stddef.h>
+
+
+/*!
+ * \brief Packed tile path table signature.
+ *
+ * A packed table starts with this signature, followed by
+ * the number of distinct paths, the size of the string
+ * pool and a reserved field, each on `4` bytes. Then come
+ * the offsets of the paths of the tiles in the pool, on
+ * `4` bytes each, and the pool itself, made of `NUL`
+ * terminated paths. The table is padded with zeros to a
+ * multiple of `4` bytes.
+ */
+#define MSTR_HEADER 0x5254534d
+
+/*!
+ * \brief Tile paths stored in slots of `0x40` bytes.
+ */
+#define PATH_TABLE_FIXED 0
+
+/*!
+ * \brief Tile paths stored in a packed table.
+ *
+ * \see MSTR_HEADER
+ */
+#define PATH_TABLE_PACKED 1
+
+/*!
+ * \brief Maximum length of a tile path, the terminating
+ *        `NUL` character excluded.
+ */
+#define PATH_TABLE_MAX_LENGTH (0x40 - 1)
+
+
+/*!
+ * \struct path_table
+ * \brief The \ref path_table structure represents the
+ *        paths of the tiles of a map.
+ *
+ * Each distinct path is stored once in a pool of `NUL`
+ * terminated strings, the tiles referencing it by its
+ * offset. Paths are interned through a hash table of
+ * their `CRC32C` checksums.
+ *
+ * \see path_table_init()
+ * \see path_table_free()
+ */
+struct path_table
+{
+    /*!
+     * \brief Number of tiles.
+     */
+    unsigned int count;
+
+    /*!
+     * \brief Number of tiles that fit in \p offsets.
+     */
+    unsigned int capacity;
+
+    /*!
+     * \brief Offsets of the paths of the tiles in
+     *        \p strings.
+     */
+    unsigned int* offsets;
+
+    /*!
+     * \brief Number of distinct paths.
+     */
+    unsigned int string_count;
+
+    /*!
+     * \brief Pool of distinct paths.
+     */
+    char* strings;
+
+    /*!
+     * \brief Size of the pool.
+     */
+    size_t strings_size;
+
+    /*!
+     * \brief Number of bytes that fit in \p strings.
+     */
+    size_t strings_capacity;
+
+    /*!
+     * \brief Offsets of the distinct paths plus `1`,
+     *        indexed by their checksum, `0` standing for
+     *        an empty bucket.
+     */
+    unsigned int* buckets;
+
+    /*!
+     * \brief Number of buckets, a power of `2`.
+     */
+    unsigned int bucket_count;
+};
+
+
+/*!
+ * \brief Type definition of the \ref path_table
+ *        structure.
+ *
+ * \see path_table
+ */
+typedef struct path_table PathTable;
+
+
+/*!
+ * \brief The path_table_init() function initializes an
+ *        empty table.
+ *
+ * \param table Table of tile paths.
+ *
+ * \see path_table_free()
+ */
+void path_table_init(PathTable* table);
+
+/*!
+ * \brief The path_table_free() function frees a table
+ *        initialized by the path_table_init() function.
+ *
+ * \param table Table of tile paths.
+ */
+void path_table_free(PathTable* table);
+
+/*!
+ * \brief The path_table_add() function appends a tile to
+ *        a table.
+ *
+ * The path is added to the pool only if no other tile
+ * references it yet.
+ *
+ * \param table Table of tile paths.
+ * \param path Path of the tile.
+ *
+ * \return \p **0** if the tile is added, \p **-1** if
+ *         the path is longer than
+ *         \ref PATH_TABLE_MAX_LENGTH characters or if
+ *         the table cannot grow.
+ */
+int path_table_add(PathTable* table, const char* path);
+
+/*!
+ * \brief The path_table_get() function gets the path of
+ *        a tile.
+ *
+ * \param table Table of tile paths.
+ * \param index Index of the tile.
+ *
+ * \return The `NUL` terminated path of the tile.
+ */
+const char* path_table_get(const PathTable* table, unsigned int index);
+
+/*!
+ * \brief The path_table_encoding() function gets the
+ *        encoding of the table of tile paths stored in a
+ *        map archive.
+ *
+ * \param section Table of tile paths, as stored.
+ * \param size Number of bytes available in \p section.
+ *
+ * \return \ref PATH_TABLE_PACKED if \p section starts
+ *         with \ref MSTR_HEADER, \ref PATH_TABLE_FIXED
+ *         otherwise.
+ */
+unsigned int path_table_encoding(const char* section, size_t size);
+
+/*!
+ * \brief The path_table_parse() function appends the
+ *        tiles of a table of tile paths stored in a map
+ *        archive.
+ *
+ * Paths stored in slots of `0x40` bytes are not
+ * guaranteed to be terminated, only their first
+ * \ref PATH_TABLE_MAX_LENGTH characters are kept.
+ *
+ * \param table Table of tile paths, usually empty.
+ * \param section Table of tile paths, as stored.
+ * \param size Number of bytes available in \p section.
+ * \param count Number of tiles.
+ *
+ * \return The size of the stored table, or \p **-1** if
+ *         it is malformed or does not fit in \p size
+ *         bytes.
+ *
+ * \see path_table_format()
+ */
+ssize_t path_table_parse(
+    PathTable* table, const char* section, size_t size,
+    unsigned int count
+);
+
+/*!
+ * \brief The path_table_size() function gets the size of
+ *        a table of tile paths once stored.
+ *
+ * \param table Table of tile paths.
+ * \param encoding \ref PATH_TABLE_FIXED or
+ *                 \ref PATH_TABLE_PACKED.
+ *
+ * \return The size of the stored table.
+ */
+size_t path_table_size(const PathTable* table, unsigned int encoding);
+
+/*!
+ * \brief The path_table_format() function stores a table
+ *        of tile paths.
+ *
+ * \param table Table of tile paths.
+ * \param encoding \ref PATH_TABLE_FIXED or
+ *                 \ref PATH_TABLE_PACKED.
+ * \param section Stored table. The buffer must be able to
+ *                hold path_table_size() bytes.
+ *
+ * \see path_table_parse()
+ */
+void path_table_format(
+    const PathTable* table, unsigned int encoding, char* section
+);
+
+
+#endif // DEF_PATHTABLE_H
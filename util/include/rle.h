@@ -0,0 +1,78 @@
+/*!
+ * \ingroup util_group
+ * \file rle.h
+ * \brief Declaration of functions related to the 
+ *        run-length encoding of map data.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#ifndef DEF_RLE_H
+#define DEF_RLE_H
+
+#include <stddef.h>
+
+
+/*!
+ * \brief Number of bytes that must follow the decoded 
+ *        data in the buffer given to rle_decode().
+ *
+ * Runs are expanded by blocks of `16` bytes. The last block
+ * of a run may overflow the run, the next run overwriting 
+ * the overflow.
+ */
+#define RLE_DECODE_PADDING 0x10
+
+/*!
+ * \brief Maximum size of the run-length encoding of
+ *        \p size bytes.
+ */
+#define RLE_MAX_ENCODED_SIZE(size) (2 * (size))
+
+
+/*!
+ * \brief The rle_encode() function encodes data
+ *        with a run-length encoding.
+ *
+ * The data are encoded as a sequence of pairs of bytes. 
+ * The first byte of a pair contains the length of a run 
+ * (from `1` to `255`), the second byte the repeated value.
+ *
+ * \param data Data to encode.
+ * \param size Size of the data.
+ * \param encoded Encoded data. The buffer must be able to
+ *                hold \ref RLE_MAX_ENCODED_SIZE(\p size)
+ *                bytes.
+ *
+ * \return The size of the encoded data.
+ *
+ * \see rle_decode()
+ */
+size_t rle_encode(const char* data, size_t size, char* encoded);
+
+/*!
+ * \brief The rle_decode() function decodes data
+ *        encoded with the rle_encode() function.
+ *
+ * Runs are expanded with `SSE2` stores when available.
+ *
+ * \param encoded Encoded data.
+ * \param encoded_size Size of the encoded data.
+ * \param data Decoded data. The buffer must be able to
+ *             hold \p size + \ref RLE_DECODE_PADDING bytes.
+ * \param size Size of the decoded data.
+ *
+ * \return This function can return the following values:
+ *          - \p **0** if the data are decoded;
+ *          - \p **-1** if the encoded data are malformed
+ *            or do not decode to exactly \p size bytes.
+ *
+ * \see rle_encode()
+ */
+int rle_decode(
+    const char* encoded, size_t encoded_size, char* data, size_t size
+);
+
+
+#endif // DEF_RLE_H
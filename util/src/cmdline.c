@@ -46,12 +46,20 @@ const char *gengetopt_args_info_help[] = {
   "  -H, --setheight=INT      Set the height of a map",
   "  -O, --setobjects=STRING  Replace the objects of a map",
   "  -p, --pruneobjects       Remove unused objects of a map",
+  "  -e, --setencoding=ENUM   Set the encoding of the map data  (possible\n                             values=\"raw\", \"rle\")",
+  "  -l, --level=INT          Select the level of a map",
+  "  -a, --addlevels=STRING   Append the levels of another map archive",
+  "  -t, --setpaths=ENUM      Set the encoding of the tile paths  (possible\n                             values=\"fixed\", \"packed\")",
+  "  -T, --thumbnail=STRING   Render a single map to a PPM thumbnail",
+  "  -n, --nobackup           Do not back up a map before editing it",
+  "  -s, --stats              Display the tile usage statistics of a map",
     0
 };
 
 typedef enum {ARG_NO
   , ARG_STRING
   , ARG_INT
+  , ARG_ENUM
 } cmdline_parser_arg_type;
 
 static
@@ -69,6 +77,9 @@ cmdline_parser_required2 (struct gengetopt_args_info *args_info, const char *pro
 static char *
 gengetopt_strdup (const char *s);
 
+const char *cmdline_parser_setencoding_values[] = {"raw", "rle", 0}; /*< Possible values for setencoding. */
+const char *cmdline_parser_setpaths_values[] = {"fixed", "packed", 0}; /*< Possible values for setpaths. */
+
 static
 void clear_given (struct gengetopt_args_info *args_info)
 {
@@ -83,6 +94,13 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->setheight_given = 0 ;
   args_info->setobjects_given = 0 ;
   args_info->pruneobjects_given = 0 ;
+  args_info->setencoding_given = 0 ;
+  args_info->level_given = 0 ;
+  args_info->addlevels_given = 0 ;
+  args_info->setpaths_given = 0 ;
+  args_info->thumbnail_given = 0 ;
+  args_info->nobackup_given = 0 ;
+  args_info->stats_given = 0 ;
 }
 
 static
@@ -95,6 +113,15 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->setheight_orig = NULL;
   args_info->setobjects_arg = NULL;
   args_info->setobjects_orig = NULL;
+  args_info->setencoding_arg = setencoding__NULL;
+  args_info->setencoding_orig = NULL;
+  args_info->level_orig = NULL;
+  args_info->addlevels_arg = NULL;
+  args_info->addlevels_orig = NULL;
+  args_info->setpaths_arg = setpaths__NULL;
+  args_info->setpaths_orig = NULL;
+  args_info->thumbnail_arg = NULL;
+  args_info->thumbnail_orig = NULL;
   
 }
 
@@ -106,6 +133,8 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->help_help = gengetopt_args_info_help[0] ;
   args_info->version_help = gengetopt_args_info_help[1] ;
   args_info->file_help = gengetopt_args_info_help[2] ;
+  args_info->file_min = 0;
+  args_info->file_max = 0;
   args_info->getwidth_help = gengetopt_args_info_help[3] ;
   args_info->getheight_help = gengetopt_args_info_help[4] ;
   args_info->getobjects_help = gengetopt_args_info_help[5] ;
@@ -116,6 +145,13 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->setobjects_min = 0;
   args_info->setobjects_max = 0;
   args_info->pruneobjects_help = gengetopt_args_info_help[10] ;
+  args_info->setencoding_help = gengetopt_args_info_help[11] ;
+  args_info->level_help = gengetopt_args_info_help[12] ;
+  args_info->addlevels_help = gengetopt_args_info_help[13] ;
+  args_info->setpaths_help = gengetopt_args_info_help[14] ;
+  args_info->thumbnail_help = gengetopt_args_info_help[15] ;
+  args_info->nobackup_help = gengetopt_args_info_help[16] ;
+  args_info->stats_help = gengetopt_args_info_help[17] ;
   
 }
 
@@ -250,11 +286,17 @@ static void
 cmdline_parser_release (struct gengetopt_args_info *args_info)
 {
 
-  free_string_field (&(args_info->file_arg));
-  free_string_field (&(args_info->file_orig));
+  free_multiple_string_field (args_info->file_given, &(args_info->file_arg), &(args_info->file_orig));
   free_string_field (&(args_info->setwidth_orig));
   free_string_field (&(args_info->setheight_orig));
   free_multiple_string_field (args_info->setobjects_given, &(args_info->setobjects_arg), &(args_info->setobjects_orig));
+  free_string_field (&(args_info->setencoding_orig));
+  free_string_field (&(args_info->level_orig));
+  free_string_field (&(args_info->addlevels_arg));
+  free_string_field (&(args_info->addlevels_orig));
+  free_string_field (&(args_info->setpaths_orig));
+  free_string_field (&(args_info->thumbnail_arg));
+  free_string_field (&(args_info->thumbnail_orig));
   
   
 
@@ -262,12 +304,54 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
 }
 
 
+/**
+ * @param val the value to check
+ * @param values the possible values
+ * @return the index of the matched value:
+ * -1 if no value matched,
+ * -2 if more than one value has matched
+ */
+static int
+check_possible_values(const char *val, const char *values[])
+{
+  int i, found, last;
+  size_t len;
+
+  if (!val)   /* otherwise strlen() crashes below */
+    return -1; /* -1 means no argument for the option */
+
+  found = last = 0;
+
+  for (i = 0, len = strlen(val); values[i]; ++i)
+    {
+      if (strncmp(val, values[i], len) == 0)
+        {
+          ++found;
+          last = i;
+          if (strlen(values[i]) == len)
+            return i; /* exact macth no need to check more */
+        }
+    }
+
+  if (found == 1) /* one match: OK */
+    return last;
+
+  return (found ? -2 : -1); /* return many values or none matched */
+}
+
+
 static void
 write_into_file(FILE *outfile, const char *opt, const char *arg, const char *values[])
 {
-  FIX_UNUSED (values);
+  int found = -1;
   if (arg) {
-    fprintf(outfile, "%s=\"%s\"\n", opt, arg);
+    if (values) {
+      found = check_possible_values(arg, values);      
+    }
+    if (found >= 0)
+      fprintf(outfile, "%s=\"%s\" # %s\n", opt, arg, values[found]);
+    else
+      fprintf(outfile, "%s=\"%s\"\n", opt, arg);
   } else {
     fprintf(outfile, "%s\n", opt);
   }
@@ -297,8 +381,7 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "help", 0, 0 );
   if (args_info->version_given)
     write_into_file(outfile, "version", 0, 0 );
-  if (args_info->file_given)
-    write_into_file(outfile, "file", args_info->file_orig, 0);
+  write_multiple_into_file(outfile, args_info->file_given, "file", args_info->file_orig, 0);
   if (args_info->getwidth_given)
     write_into_file(outfile, "getwidth", 0, 0 );
   if (args_info->getheight_given)
@@ -314,6 +397,20 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
   write_multiple_into_file(outfile, args_info->setobjects_given, "setobjects", args_info->setobjects_orig, 0);
   if (args_info->pruneobjects_given)
     write_into_file(outfile, "pruneobjects", 0, 0 );
+  if (args_info->setencoding_given)
+    write_into_file(outfile, "setencoding", args_info->setencoding_orig, cmdline_parser_setencoding_values);
+  if (args_info->level_given)
+    write_into_file(outfile, "level", args_info->level_orig, 0);
+  if (args_info->addlevels_given)
+    write_into_file(outfile, "addlevels", args_info->addlevels_orig, 0);
+  if (args_info->setpaths_given)
+    write_into_file(outfile, "setpaths", args_info->setpaths_orig, cmdline_parser_setpaths_values);
+  if (args_info->thumbnail_given)
+    write_into_file(outfile, "thumbnail", args_info->thumbnail_orig, 0);
+  if (args_info->nobackup_given)
+    write_into_file(outfile, "nobackup", 0, 0 );
+  if (args_info->stats_given)
+    write_into_file(outfile, "stats", 0, 0 );
   
 
   i = EXIT_SUCCESS;
@@ -571,6 +668,9 @@ cmdline_parser_required2 (struct gengetopt_args_info *args_info, const char *pro
       error_occurred = 1;
     }
   
+  if (check_multiple_option_occurrences(prog_name, args_info->file_given, args_info->file_min, args_info->file_max, "'--file' ('-f')"))
+     error_occurred = 1;
+  
   if (check_multiple_option_occurrences(prog_name, args_info->setobjects_given, args_info->setobjects_min, args_info->setobjects_max, "'--setobjects' ('-O')"))
      error_occurred = 1;
   
@@ -1226,7 +1326,18 @@ int update_arg(void *field, char **orig_field,
       return 1; /* failure */
     }
 
-  FIX_UNUSED (default_value);
+  if (possible_values && (found = check_possible_values((value ? value : default_value), possible_values)) < 0)
+    {
+      if (short_opt != '-')
+        fprintf (stderr, "%s: %s argument, \"%s\", for option `--%s' (`-%c')%s\n", 
+          package_name, (found == -2) ? "ambiguous" : "invalid", value, long_opt, short_opt,
+          (additional_error ? additional_error : ""));
+      else
+        fprintf (stderr, "%s: %s argument, \"%s\", for option `--%s'%s\n", 
+          package_name, (found == -2) ? "ambiguous" : "invalid", value, long_opt,
+          (additional_error ? additional_error : ""));
+      return 1; /* failure */
+    }
     
   if (field_given && *field_given && ! override)
     return 0;
@@ -1241,6 +1352,9 @@ int update_arg(void *field, char **orig_field,
   case ARG_INT:
     if (val) *((int *)field) = strtol (val, &stop_char, 0);
     break;
+  case ARG_ENUM:
+    if (val) *((int *)field) = found;
+    break;
   case ARG_STRING:
     if (val) {
       string_field = (char **)field;
@@ -1423,6 +1537,7 @@ cmdline_parser_internal (
 {
   int c;	/* Character of the parsed option.  */
 
+  struct generic_list * file_list = NULL;
   struct generic_list * setobjects_list = NULL;
   int error_occurred = 0;
   struct gengetopt_args_info local_args_info;
@@ -1476,6 +1591,13 @@ cmdline_parser_internal (
         { "setheight",	1, NULL, 'H' },
         { "setobjects",	1, NULL, 'O' },
         { "pruneobjects",	0, NULL, 'p' },
+        { "setencoding",	1, NULL, 'e' },
+        { "level",	1, NULL, 'l' },
+        { "addlevels",	1, NULL, 'a' },
+        { "setpaths",	1, NULL, 't' },
+        { "thumbnail",	1, NULL, 'T' },
+        { "nobackup",	0, NULL, 'n' },
+        { "stats",	0, NULL, 's' },
         { 0,  0, 0, 0 }
       };
 
@@ -1484,7 +1606,7 @@ cmdline_parser_internal (
       custom_opterr = opterr;
       custom_optopt = optopt;
 
-      c = custom_getopt_long (argc, argv, "Vf:whoiW:H:O:p", long_options, &option_index);
+      c = custom_getopt_long (argc, argv, "Vf:whoiW:H:O:pe:l:a:t:T:ns", long_options, &option_index);
 
       optarg = custom_optarg;
       optind = custom_optind;
@@ -1502,11 +1624,8 @@ cmdline_parser_internal (
 
         case 'f':	/* Map file.  */
         
-        
-          if (update_arg( (void *)&(args_info->file_arg), 
-               &(args_info->file_orig), &(args_info->file_given),
+          if (update_multiple_arg_temp(&file_list, 
               &(local_args_info.file_given), optarg, 0, 0, ARG_STRING,
-              check_ambiguity, override, 0, 0,
               "file", 'f',
               additional_error))
             goto failure;
@@ -1605,6 +1724,90 @@ cmdline_parser_internal (
             goto failure;
         
           break;
+        case 'e':	/* Set the encoding of the map data.  */
+        
+        
+          if (update_arg( (void *)&(args_info->setencoding_arg), 
+               &(args_info->setencoding_orig), &(args_info->setencoding_given),
+              &(local_args_info.setencoding_given), optarg, cmdline_parser_setencoding_values, 0, ARG_ENUM,
+              check_ambiguity, override, 0, 0,
+              "setencoding", 'e',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'l':	/* Select the level of a map.  */
+        
+        
+          if (update_arg( (void *)&(args_info->level_arg), 
+               &(args_info->level_orig), &(args_info->level_given),
+              &(local_args_info.level_given), optarg, 0, 0, ARG_INT,
+              check_ambiguity, override, 0, 0,
+              "level", 'l',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'a':	/* Append the levels of another map archive.  */
+        
+        
+          if (update_arg( (void *)&(args_info->addlevels_arg), 
+               &(args_info->addlevels_orig), &(args_info->addlevels_given),
+              &(local_args_info.addlevels_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "addlevels", 'a',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 't':	/* Set the encoding of the tile paths.  */
+        
+        
+          if (update_arg( (void *)&(args_info->setpaths_arg), 
+               &(args_info->setpaths_orig), &(args_info->setpaths_given),
+              &(local_args_info.setpaths_given), optarg, cmdline_parser_setpaths_values, 0, ARG_ENUM,
+              check_ambiguity, override, 0, 0,
+              "setpaths", 't',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'T':	/* Render a map to a PPM thumbnail.  */
+        
+        
+          if (update_arg( (void *)&(args_info->thumbnail_arg), 
+               &(args_info->thumbnail_orig), &(args_info->thumbnail_given),
+              &(local_args_info.thumbnail_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "thumbnail", 'T',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'n':	/* Do not back up a map before editing it.  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->nobackup_given),
+              &(local_args_info.nobackup_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "nobackup", 'n',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 's':	/* Display the tile usage statistics of a map.  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->stats_given),
+              &(local_args_info.stats_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "stats", 's',
+              additional_error))
+            goto failure;
+        
+          break;
 
         case 0:	/* Long option with no short option */
           if (strcmp (long_options[option_index].name, "help") == 0) {
@@ -1624,11 +1827,17 @@ cmdline_parser_internal (
     } /* while */
 
 
+  update_multiple_arg((void *)&(args_info->file_arg),
+    &(args_info->file_orig), args_info->file_given,
+    local_args_info.file_given, 0,
+    ARG_STRING, file_list);
   update_multiple_arg((void *)&(args_info->setobjects_arg),
     &(args_info->setobjects_orig), args_info->setobjects_given,
     local_args_info.setobjects_given, 0,
     ARG_STRING, setobjects_list);
 
+  args_info->file_given += local_args_info.file_given;
+  local_args_info.file_given = 0;
   args_info->setobjects_given += local_args_info.setobjects_given;
   local_args_info.setobjects_given = 0;
   
@@ -1645,6 +1854,7 @@ cmdline_parser_internal (
   return 0;
 
 failure:
+  free_list (file_list, 1 );
   free_list (setobjects_list, 1 );
   
   cmdline_parser_release (&local_args_info);
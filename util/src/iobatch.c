@@ -0,0 +1,538 @@
+/*!
+ * \ingroup util_group
+ * \file iobatch.c
+ * \brief Implementation of functions submitting batches
+ *        of reads and writes on map archives.
+ *
+ * Implementation of the functions declared in the \ref
+ * iobatch.h header.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#define _GNU_SOURCE
+
+#include "iobatch.h"
+
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <string.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && \
+    defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#define IO_BATCH_URING
+#endif
+#endif
+
+
+/*!
+ * \brief Number of entries of the submission queue.
+ */
+#define IO_BATCH_ENTRIES 64
+
+
+#ifdef IO_BATCH_URING
+/*!
+ * \struct io_ring
+ * \brief The \ref io_ring structure references the
+ *        queues of an `io_uring` instance shared with
+ *        the kernel.
+ */
+struct io_ring
+{
+    /*!
+     * \brief Ring file descriptor.
+     */
+    int fd;
+
+    /*!
+     * \brief Mapping of the submission queue.
+     */
+    void* sq_ring;
+
+    /*!
+     * \brief Size of the mapping of the submission queue.
+     */
+    size_t sq_ring_size;
+
+    /*!
+     * \brief Mapping of the completion queue.
+     */
+    void* cq_ring;
+
+    /*!
+     * \brief Size of the mapping of the completion queue.
+     */
+    size_t cq_ring_size;
+
+    /*!
+     * \brief Submission queue entries.
+     */
+    struct io_uring_sqe* sqes;
+
+    /*!
+     * \brief Head of the submission queue, moved by the
+     *        kernel.
+     */
+    unsigned int* sq_head;
+
+    /*!
+     * \brief Tail of the submission queue.
+     */
+    unsigned int* sq_tail;
+
+    /*!
+     * \brief Mask of the indexes of the submission queue.
+     */
+    unsigned int sq_mask;
+
+    /*!
+     * \brief Indexes of the submitted entries.
+     */
+    unsigned int* sq_array;
+
+    /*!
+     * \brief Head of the completion queue.
+     */
+    unsigned int* cq_head;
+
+    /*!
+     * \brief Tail of the completion queue, moved by the
+     *        kernel.
+     */
+    unsigned int* cq_tail;
+
+    /*!
+     * \brief Mask of the indexes of the completion queue.
+     */
+    unsigned int cq_mask;
+
+    /*!
+     * \brief Completion queue entries.
+     */
+    struct io_uring_cqe* cqes;
+};
+
+
+/*!
+ * \brief Type definition of the \ref io_ring structure.
+ *
+ * \see io_ring
+ */
+typedef struct io_ring IoRing;
+#endif
+
+
+#ifdef IO_BATCH_URING
+/*!
+ * \brief Ring shared by all the batches.
+ */
+static IoRing ring;
+#endif
+
+/*!
+ * \brief Whether the ring is available: \p **-1** if not
+ *        probed yet, then \p **0** or \p **1**.
+ */
+static int ring_available = -1;
+
+/*!
+ * \brief Lock serializing the batches, which may be
+ *        submitted by several threads.
+ */
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*!
+ * \brief The io_batch_probe() function sets the ring up
+ *        if it was not probed yet.
+ *
+ * The lock must be held.
+ */
+static void io_batch_probe(void);
+
+#ifdef IO_BATCH_URING
+/*!
+ * \brief The io_batch_ring() function performs a batch
+ *        of operations with the ring.
+ *
+ * The lock must be held.
+ *
+ * \param requests Operations.
+ * \param count Number of operations.
+ *
+ * \return \p **0** once all the operations are 
+ *         performed.
+ */
+static int io_batch_ring(IoRequest* requests, unsigned int count);
+#endif
+
+/*!
+ * \brief The io_batch_complete() function performs an
+ *        operation, or the remaining part of a partial
+ *        transfer, synchronously.
+ *
+ * \param request Operation, whose \p result field holds
+ *        the number of bytes already transferred.
+ */
+static void io_batch_complete(IoRequest* request);
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Available.
+ *
+ *************************************************************/
+int io_batch_available(void)
+{
+    pthread_mutex_lock(&ring_mutex);
+    io_batch_probe();
+    int available = ring_available;
+    pthread_mutex_unlock(&ring_mutex);
+
+    return available;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Submit.
+ *
+ *************************************************************/
+int io_batch_submit(IoRequest* requests, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        requests[i].result = 0;
+    }
+
+    pthread_mutex_lock(&ring_mutex);
+    io_batch_probe();
+
+    int result = -1;
+#ifdef IO_BATCH_URING
+    if (ring_available)
+    {
+        result = io_batch_ring(requests, count);
+    }
+#endif
+
+    pthread_mutex_unlock(&ring_mutex);
+
+    /* Without the ring, the operations are performed in order */
+
+    for (unsigned int i = 0; result < 0 && i < count; ++i)
+    {
+        io_batch_complete(&requests[i]);
+    }
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (requests[i].result < 0)
+        {
+            errno = (int)-requests[i].result;
+            return -1;
+        }
+
+        if (requests[i].operation <= IO_BATCH_WRITE &&
+            (size_t)requests[i].result < requests[i].size)
+        {
+            errno = ENODATA;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Probe.
+ *
+ *************************************************************/
+void io_batch_probe(void)
+{
+    if (ring_available >= 0)
+    {
+        return;
+    }
+
+    ring_available = 0;
+
+#ifdef IO_BATCH_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, IO_BATCH_ENTRIES, &params);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    /* Queues shared with the kernel */
+
+    size_t sq_ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void* sq_ring = mmap(
+        NULL,
+        sq_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd,
+        IORING_OFF_SQ_RING
+    );
+    void* cq_ring = mmap(
+        NULL,
+        cq_ring_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd,
+        IORING_OFF_CQ_RING
+    );
+    void* sqes = mmap(
+        NULL,
+        sqes_size,
+        PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd,
+        IORING_OFF_SQES
+    );
+    if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED ||
+        sqes == MAP_FAILED)
+    {
+        if (sq_ring != MAP_FAILED)
+        {
+            munmap(sq_ring, sq_ring_size);
+        }
+
+        if (cq_ring != MAP_FAILED)
+        {
+            munmap(cq_ring, cq_ring_size);
+        }
+
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, sqes_size);
+        }
+
+        close(fd);
+        return;
+    }
+
+    char* sq = (char*)sq_ring;
+    char* cq = (char*)cq_ring;
+
+    ring.fd = fd;
+    ring.sq_ring = sq_ring;
+    ring.sq_ring_size = sq_ring_size;
+    ring.cq_ring = cq_ring;
+    ring.cq_ring_size = cq_ring_size;
+    ring.sqes = (struct io_uring_sqe*)sqes;
+    ring.sq_head = (unsigned int*)&sq[params.sq_off.head];
+    ring.sq_tail = (unsigned int*)&sq[params.sq_off.tail];
+    ring.sq_mask = *(unsigned int*)&sq[params.sq_off.ring_mask];
+    ring.sq_array = (unsigned int*)&sq[params.sq_off.array];
+    ring.cq_head = (unsigned int*)&cq[params.cq_off.head];
+    ring.cq_tail = (unsigned int*)&cq[params.cq_off.tail];
+    ring.cq_mask = *(unsigned int*)&cq[params.cq_off.ring_mask];
+    ring.cqes = (struct io_uring_cqe*)&cq[params.cq_off.cqes];
+
+    ring_available = 1;
+#endif
+}
+
+#ifdef IO_BATCH_URING
+/*************************************************************
+ *************************************************************
+ *
+ * Ring.
+ *
+ *************************************************************/
+int io_batch_ring(IoRequest* requests, unsigned int count)
+{
+    struct iovec iovecs[IO_BATCH_ENTRIES];
+    for (unsigned int first = 0; first < count; first += IO_BATCH_ENTRIES)
+    {
+        unsigned int batch_count = count - first;
+        if (batch_count > IO_BATCH_ENTRIES)
+        {
+            batch_count = IO_BATCH_ENTRIES;
+        }
+
+        /* Submission queue entries */
+
+        unsigned int tail = *ring.sq_tail;
+        for (unsigned int i = 0; i < batch_count; ++i)
+        {
+            IoRequest* request = &requests[first + i];
+            unsigned int index = (tail + i) & ring.sq_mask;
+            struct io_uring_sqe* sqe = &ring.sqes[index];
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+            sqe->fd = request->fd;
+            sqe->user_data = first + i;
+            if (request->operation <= IO_BATCH_WRITE)
+            {
+                iovecs[i].iov_base = request->buffer;
+                iovecs[i].iov_len = request->size;
+
+                sqe->opcode = (request->operation == IO_BATCH_READ ?
+                    IORING_OP_READV : IORING_OP_WRITEV);
+                sqe->addr = (unsigned long long)(size_t)&iovecs[i];
+                sqe->len = 1;
+                sqe->off = request->offset;
+            }
+            else
+            {
+                /* Synchronizations wait for the previous entries */
+
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->flags = IOSQE_IO_DRAIN;
+                sqe->fsync_flags =
+                    (request->operation == IO_BATCH_DATASYNC ?
+                        IORING_FSYNC_DATASYNC : 0);
+            }
+
+            ring.sq_array[index] = index;
+        }
+
+        __atomic_store_n(ring.sq_tail, tail + batch_count, __ATOMIC_RELEASE);
+
+        /* Submission and completion */
+
+        unsigned int submitted = 0;
+        unsigned int completed = 0;
+        while (completed < batch_count)
+        {
+            int enter_result = (int)syscall(
+                __NR_io_uring_enter,
+                ring.fd,
+                batch_count - submitted,
+                batch_count - completed,
+                IORING_ENTER_GETEVENTS,
+                NULL,
+                0
+            );
+            if (enter_result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (enter_result < 0 && !submitted)
+            {
+                /* Nothing is in flight, the rest is performed in order */
+
+                __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+                for (unsigned int i = first; i < count; ++i)
+                {
+                    io_batch_complete(&requests[i]);
+                }
+                return 0;
+            }
+
+            if (enter_result < 0)
+            {
+                /* The ring is no longer used */
+
+                for (unsigned int i = 0; i < batch_count; ++i)
+                {
+                    requests[first + i].result = -errno;
+                }
+                ring_available = 0;
+                return 0;
+            }
+
+            submitted += (unsigned int)enter_result;
+
+            unsigned int head = *ring.cq_head;
+            unsigned int cq_tail =
+                __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != cq_tail; ++head, ++completed)
+            {
+                struct io_uring_cqe* cqe = &ring.cqes[head & ring.cq_mask];
+                requests[cqe->user_data].result = cqe->res;
+            }
+
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        /* Partial transfers */
+
+        for (unsigned int i = 0; i < batch_count; ++i)
+        {
+            IoRequest* request = &requests[first + i];
+            if (request->operation <= IO_BATCH_WRITE &&
+                request->result >= 0 &&
+                (size_t)request->result < request->size)
+            {
+                io_batch_complete(request);
+            }
+        }
+    }
+
+    return 0;
+}
+#endif
+
+/*************************************************************
+ *************************************************************
+ *
+ * Complete.
+ *
+ *************************************************************/
+void io_batch_complete(IoRequest* request)
+{
+    if (request->operation == IO_BATCH_DATASYNC)
+    {
+        request->result = (fdatasync(request->fd) < 0 ? -errno : 0);
+        return;
+    }
+
+    if (request->operation == IO_BATCH_SYNC)
+    {
+        request->result = (fsync(request->fd) < 0 ? -errno : 0);
+        return;
+    }
+
+    char* cursor = (char*)request->buffer;
+    while ((size_t)request->result < request->size)
+    {
+        size_t size = request->size - request->result;
+        off_t offset = (off_t)(request->offset + request->result);
+        ssize_t rw_result = (request->operation == IO_BATCH_READ ?
+            pread(request->fd, &cursor[request->result], size, offset) :
+            pwrite(request->fd, &cursor[request->result], size, offset));
+        if (rw_result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (rw_result < 0)
+        {
+            request->result = -errno;
+            return;
+        }
+
+        if (!rw_result)
+        {
+            return;
+        }
+
+        request->result += rw_result;
+    }
+}
@@ -14,7 +14,10 @@
  *  - Sets the width of a map;
  *  - Sets the height of a map;
  *  - Replaces the tiles of a map;
- *  - Removes unused tiles from a map.
+ *  - Removes unused tiles from a map;
+ *  - Appends the levels of another map archive;
+ *  - Renders a map to a thumbnail;
+ *  - Displays the tile usage statistics of a map.
  *
  * Modifying the width of a map will alter its right side. 
  * A larger width expands the map from the right side and
@@ -39,6 +42,14 @@
  *  - `mm` corresponds to the current minute;
  *  - `ss` corresponds to the current second.
  *
+ * The `--nobackup` option skips the copy when a map is
+ * resized or when its tiles are replaced or removed.
+ *
+ * Combined, the `--setwidth`, `--setheight`, 
+ * `--setobjects` and `--pruneobjects` options are 
+ * applied in this order to the archive read once, which
+ * is then backed up and rewritten once.
+ *
  * The examples below desmonstrate how to use this
  * program:
  *
@@ -66,6 +77,13 @@
  * ./maputil -f ../maps/saved.map -i
  * ```
  *
+ *  - Gets the information of several maps, whose 
+ *    archives are read together:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -f ../maps/level.map -i
+ * ```
+ *
  *  - Sets the width of a map:
  *
  * ```
@@ -90,6 +108,39 @@
  * ./maputil -f ../maps/saved.map -p
  * ```
  *
+ *  - Resizes a map and removes its unused tiles, the 
+ *    archive being rewritten once:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -W 200 -H 16 -p
+ * ```
+ *
+ *  - Appends the levels of another map archive:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -a ../maps/other.map
+ * ```
+ *
+ *  - Sets the width of the second level of a map:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -l 1 -W 40
+ * ```
+ *
+ *  - Renders a map to a thumbnail:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -T saved.ppm
+ * ```
+ *
+ *  - Displays, for each tile, its number of cells and the
+ *    columns and rows it spans, then the ratios of air,
+ *    solid, destructible and collectible cells:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -s
+ * ```
+ *
  * See the table below for a complete overview of the 
  * program options:
  *
@@ -106,6 +157,13 @@
  * | `--setheight`    | `-H`          | `No`                | `Integer`  | sets the height of a map.                                    |
  * | `--setobjects`   | `-O`          | See the table below | `Sring`    | Replaces the tile of a map.                                  |
  * | `--pruneobjects` | `-p`          | `No`                | `None`     | Remove unused tiles from a map.                              |
+ * | `--setencoding`  | `-e`          | `No`                | `Enumeration {raw, rle}` | Sets the encoding of the map data.             |
+ * | `--level`        | `-l`          | `No`                | `Integer`  | Selects the level of a map, the first one by default.        |
+ * | `--addlevels`    | `-a`          | `No`                | `String`   | Appends the levels of another map archive.                   |
+ * | `--setpaths`     | `-t`          | `No`                | `Enumeration {fixed, packed}` | Sets the encoding of the tile paths.        |
+ * | `--thumbnail`    | `-T`          | `No`                | `String`   | Renders a single map to a `PPM` thumbnail.                   |
+ * | `--nobackup`     | `-n`          | `No`                | `None`     | Does not back up a map before editing it.                    |
+ * | `--stats`        | `-s`          | `No`                | `None`     | Displays the tile usage statistics of a map.                 |
  *
  * The `--setobjects` option accepts a string where the following parameters are madatory:
  *
@@ -145,7 +203,10 @@
  *  - Sets the width of a map;
  *  - Sets the height of a map;
  *  - Replaces the tiles of a map;
- *  - Removes unused tiles from a map.
+ *  - Removes unused tiles from a map;
+ *  - Appends the levels of another map archive;
+ *  - Renders a map to a thumbnail;
+ *  - Displays the tile usage statistics of a map.
  *
  * Modifying the width of a map will alter its right side. 
  * A larger width expands the map from the right side and
@@ -170,6 +231,14 @@
  *  - `mm` corresponds to the current minute;
  *  - `ss` corresponds to the current second.
  *
+ * The `--nobackup` option skips the copy when a map is
+ * resized or when its tiles are replaced or removed.
+ *
+ * Combined, the `--setwidth`, `--setheight`, 
+ * `--setobjects` and `--pruneobjects` options are 
+ * applied in this order to the archive read once, which
+ * is then backed up and rewritten once.
+ *
  * The examples below desmonstrate how to use this
  * program:
  *
@@ -197,6 +266,13 @@
  * ./maputil -f ../maps/saved.map -i
  * ```
  *
+ *  - Gets the information of several maps, whose 
+ *    archives are read together:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -f ../maps/level.map -i
+ * ```
+ *
  *  - Sets the width of a map:
  *
  * ```
@@ -221,6 +297,39 @@
  * ./maputil -f ../maps/saved.map -p
  * ```
  *
+ *  - Resizes a map and removes its unused tiles, the 
+ *    archive being rewritten once:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -W 200 -H 16 -p
+ * ```
+ *
+ *  - Appends the levels of another map archive:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -a ../maps/other.map
+ * ```
+ *
+ *  - Sets the width of the second level of a map:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -l 1 -W 40
+ * ```
+ *
+ *  - Renders a map to a thumbnail:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -T saved.ppm
+ * ```
+ *
+ *  - Displays, for each tile, its number of cells and the
+ *    columns and rows it spans, then the ratios of air,
+ *    solid, destructible and collectible cells:
+ *
+ * ```
+ * ./maputil -f ../maps/saved.map -s
+ * ```
+ *
  * See the table below for a complete overview of the 
  * program options:
  *
@@ -237,6 +346,13 @@
  * | `--setheight`    | `-H`          | `No`                | `Integer`  | sets the height of a map.                                    |
  * | `--setobjects`   | `-O`          | See the table below | `Sring`    | Replaces the tile of a map.                                  |
  * | `--pruneobjects` | `-p`          | `No`                | `None`     | Remove unused tiles from a map.                              |
+ * | `--setencoding`  | `-e`          | `No`                | `Enumeration {raw, rle}` | Sets the encoding of the map data.             |
+ * | `--level`        | `-l`          | `No`                | `Integer`  | Selects the level of a map, the first one by default.        |
+ * | `--addlevels`    | `-a`          | `No`                | `String`   | Appends the levels of another map archive.                   |
+ * | `--setpaths`     | `-t`          | `No`                | `Enumeration {fixed, packed}` | Sets the encoding of the tile paths.        |
+ * | `--thumbnail`    | `-T`          | `No`                | `String`   | Renders a single map to a `PPM` thumbnail.                   |
+ * | `--nobackup`     | `-n`          | `No`                | `None`     | Does not back up a map before editing it.                    |
+ * | `--stats`        | `-s`          | `No`                | `None`     | Displays the tile usage statistics of a map.                 |
  *
  * The `--setobjects` option accepts a string where the following parameters are madatory:
  *
@@ -265,117 +381,244 @@ int main(int argc, char** argv)
     {
         exit(EXIT_FAILURE);
     } 
-  
-    if (args_info.getwidth_given)
-    {
-        fprintf(
-            stdout, 
-            "Map width        : [%6u]\n", 
-            get_map_width(args_info.file_arg)
-        );
-    }
-    
-    if (args_info.getheight_given)
-    {
-        fprintf(
-            stdout, 
-            "Map height       : [%6u]\n", 
-            get_map_height(args_info.file_arg)
-        );
-    }
 
-    if (args_info.getobjects_given)
+    if (args_info.level_given)
     {
-        fprintf(
-            stdout, 
-            "Number of objects: [%6u]\n", 
-            get_map_objects_count(args_info.file_arg)
-        );
-
+        set_map_level((unsigned int)args_info.level_arg);
     }
 
-    if (args_info.getinfo_given)
+    if (args_info.nobackup_given)
     {
-        MapInfo info;
-        get_map_info(args_info.file_arg, &info);
-        fprintf(
-            stdout, 
-            "Map width        : [%6u]\n"
-            "Map height       : [%6u]\n"
-            "Number of objects: [%6u]\n",
-            info.map_width,
-            info.map_height,
-            info.map_objects_count
-        );            
+        set_map_backups(0);
     }
+  
+    /* A thumbnail is rendered from a single map */
 
-    if (args_info.setwidth_given)
+    if (args_info.thumbnail_given && args_info.file_given > 1)
     {
-        set_map_width(
-            args_info.file_arg, 
-            (unsigned int)args_info.setwidth_arg
-        );
+        fprintf(stderr, "A thumbnail is rendered from a single map!\n");
+        exit(EXIT_FAILURE);
     }
 
-    if (args_info.setheight_given)
+    /* The information of all the maps is read at once */
+
+    MapInfo infos[args_info.file_given];
+    if (args_info.getinfo_given)
     {
-        set_map_height(
-            args_info.file_arg,
-            (unsigned int)args_info.setheight_arg
+        get_maps_info(
+            (const char* const*)args_info.file_arg, 
+            args_info.file_given, 
+            infos
         );
     }
 
-    if (args_info.setobjects_given)
+    for (unsigned int f = 0; f < args_info.file_given; ++f)
     {
-        MapObjectProperties* properties_array[
-            args_info.setobjects_given
-        ];
-        struct gengetopt_args_info_object_properties
-                args_info_object_properties;
-        for (unsigned int i = 0, res; 
-             i < args_info.setobjects_given; 
-             ++i)
+        const char* filename = args_info.file_arg[f];
+        if (args_info.file_given > 1)
         {
-            res = cmdline_parser_object_properties_string(
-                args_info.setobjects_arg[i],
-                &args_info_object_properties,
-                argv[0]
+            fprintf(stdout, "%s:\n", filename);
+        }
+
+        if (args_info.getwidth_given)
+        {
+            fprintf(
+                stdout, 
+                "Map width        : [%6u]\n", 
+                get_map_width(filename)
             );
-            
-            if (res)
+        }
+    
+        if (args_info.getheight_given)
+        {
+            fprintf(
+                stdout, 
+                "Map height       : [%6u]\n", 
+                get_map_height(filename)
+            );
+        }
+
+        if (args_info.getobjects_given)
+        {
+            fprintf(
+                stdout, 
+                "Number of objects: [%6u]\n", 
+                get_map_objects_count(filename)
+            );
+
+        }
+
+        if (args_info.getinfo_given)
+        {
+            const MapInfo info = infos[f];
+            fprintf(
+                stdout, 
+                "Map width        : [%6u]\n"
+                "Map height       : [%6u]\n"
+                "Number of objects: [%6u]\n"
+                "Number of levels : [%6u]\n",
+                info.map_width,
+                info.map_height,
+                info.map_objects_count,
+                info.map_levels_count
+            );            
+        }
+
+        if (args_info.stats_given)
+        {
+            MapStats stats;
+            get_map_stats(filename, &stats);
+
+            double map_size = (double)stats.map_width * stats.map_height;
+            if (map_size < 1)
             {
-                exit(EXIT_FAILURE);
+                map_size = 1;
             }
-            
-            properties_array[i] = map_object_properties_new(
-                args_info_object_properties.path_arg,
-                (unsigned int)args_info_object_properties.frames_arg,
-                args_info_object_properties.solidity_arg,
-                args_info_object_properties.destructible_arg,
-                args_info_object_properties.collectible_arg,
-                args_info_object_properties.generator_arg
+
+            fprintf(
+                stdout, 
+                "Map width        : [%6u]\n"
+                "Map height       : [%6u]\n"
+                "Empty cells      : [%6u] (%6.2f%%)\n"
+                "Air cells        : [%6u] (%6.2f%%)\n"
+                "Semi-solid cells : [%6u] (%6.2f%%)\n"
+                "Solid cells      : [%6u] (%6.2f%%)\n"
+                "Destructible     : [%6u] (%6.2f%%)\n"
+                "Collectible      : [%6u] (%6.2f%%)\n",
+                stats.map_width,
+                stats.map_height,
+                stats.empty_cells, 
+                100 * stats.empty_cells / map_size,
+                stats.air_cells, 
+                100 * stats.air_cells / map_size,
+                stats.semi_solid_cells, 
+                100 * stats.semi_solid_cells / map_size,
+                stats.solid_cells, 
+                100 * stats.solid_cells / map_size,
+                stats.destructible_cells, 
+                100 * stats.destructible_cells / map_size,
+                stats.collectible_cells, 
+                100 * stats.collectible_cells / map_size
             );
 
-            cmdline_parser_object_properties_free(
-                &args_info_object_properties
-            );       
+            for (unsigned int i = 0; i < stats.objects_count; ++i)
+            {
+                const MapObjectStats* object = &stats.objects[i];
+                fprintf(
+                    stdout,
+                    "Object [%6u]  : [%6u] (%6.2f%%) "
+                    "columns [%6u, %6u] rows [%6u, %6u] %s\n",
+                    i,
+                    object->cells,
+                    100 * object->cells / map_size,
+                    object->first_column,
+                    object->last_column,
+                    object->first_row,
+                    object->last_row,
+                    object->path
+                );
+            }
+
+            free_map_stats(&stats);
         }
 
-        set_map_objects(
-            args_info.file_arg, 
-            properties_array, 
-            (unsigned int)args_info.setobjects_given
-        );
+        /* Edits of the map, the archive being rewritten once */
 
-        for (int i = 0; i < args_info.setobjects_given; ++i)
+        MapEdits edits = {0};
+        edits.set_width = args_info.setwidth_given;
+        edits.map_width = (unsigned int)args_info.setwidth_arg;
+        edits.set_height = args_info.setheight_given;
+        edits.map_height = (unsigned int)args_info.setheight_arg;
+        edits.prune_objects = args_info.pruneobjects_given;
+
+        MapObjectProperties* properties_array[
+            args_info.setobjects_given + 1
+        ];
+        if (args_info.setobjects_given)
+        {
+            struct gengetopt_args_info_object_properties
+                    args_info_object_properties;
+            for (unsigned int i = 0, res; 
+                 i < args_info.setobjects_given; 
+                 ++i)
+            {
+                res = cmdline_parser_object_properties_string(
+                    args_info.setobjects_arg[i],
+                    &args_info_object_properties,
+                    argv[0]
+                );
+            
+                if (res)
+                {
+                    exit(EXIT_FAILURE);
+                }
+            
+                properties_array[i] = map_object_properties_new(
+                    args_info_object_properties.path_arg,
+                    (unsigned int)args_info_object_properties.frames_arg,
+                    args_info_object_properties.solidity_arg,
+                    args_info_object_properties.destructible_arg,
+                    args_info_object_properties.collectible_arg,
+                    args_info_object_properties.generator_arg
+                );
+
+                cmdline_parser_object_properties_free(
+                    &args_info_object_properties
+                );       
+            }
+
+            edits.properties = properties_array;
+            edits.properties_count = (unsigned int)args_info.setobjects_given;
+        }
+
+        unsigned int edit_count = (edits.set_width ? 1 : 0) + 
+            (edits.set_height ? 1 : 0) + (edits.properties ? 1 : 0) + 
+            (edits.prune_objects ? 1 : 0);
+        if (edit_count == 1 && edits.set_width)
+        {
+            set_map_width(filename, edits.map_width);
+        }
+        else if (edit_count == 1 && edits.set_height)
+        {
+            set_map_height(filename, edits.map_height);
+        }
+        else if (edit_count)
+        {
+            edit_map(filename, &edits);
+        }
+
+        for (unsigned int i = 0; i < edits.properties_count; ++i)
         {
             map_object_properties_delete(properties_array[i]);
         }
-    }
 
-    if (args_info.pruneobjects_given)
-    {
-        prune_objects(args_info.file_arg);
+        if (args_info.setencoding_given)
+        {
+            set_map_encoding(
+                filename,
+                args_info.setencoding_arg == setencoding_arg_rle ?
+                    MAP_ENCODING_RLE : MAP_ENCODING_RAW
+            );
+        }
+
+        if (args_info.addlevels_given)
+        {
+            add_map_levels(filename, args_info.addlevels_arg);
+        }
+
+        if (args_info.setpaths_given)
+        {
+            set_map_paths(
+                filename,
+                args_info.setpaths_arg == setpaths_arg_packed ?
+                    MAP_PATHS_PACKED : MAP_PATHS_FIXED
+            );
+        }
+
+        if (args_info.thumbnail_given)
+        {
+            render_map_thumbnail(filename, args_info.thumbnail_arg);
+        }
     }
 
     cmdline_parser_free(&args_info);
@@ -0,0 +1,2283 @@
+/*!
+ * \ingroup util_group
+ * \file maparchive.c
+ * \brief Implementation of functions handling map
+ *        archives read in memory.
+ *
+ * Implementation of the functions declared in the \ref
+ * maparchive.h header.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#include "maparchive.h"
+#include "rle.h"
+#include "crc32c.h"
+#include "pathtable.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/*!
+ * \brief Number of bytes read at once from a file
+ *        descriptor, doubled as the archive grows.
+ */
+#define MAP_ARCHIVE_READ_SIZE 0x10000
+
+
+/*!
+ * \struct map_archive_level
+ * \brief The \ref map_archive_level structure represents
+ *        a level of a map archive once decoded.
+ *
+ * Tiles stored on `2` bytes make up two planes of
+ * \p height rows each, the low bytes followed by the
+ * high bytes.
+ */
+struct map_archive_level
+{
+    /*!
+     * \brief Signature of the map header, which gives the
+     *        encoding and the layout of the map data.
+     */
+    unsigned int signature;
+
+    /*!
+     * \brief Width of the map.
+     */
+    unsigned int width;
+
+    /*!
+     * \brief Height of the map.
+     */
+    unsigned int height;
+
+    /*!
+     * \brief Number of bytes of a tile.
+     */
+    unsigned int cell_size;
+
+    /*!
+     * \brief Width of a chunk of a chunked map.
+     */
+    unsigned int chunk_width;
+
+    /*!
+     * \brief Decoded map data, row after row.
+     */
+    char* data;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_archive_level
+ *        structure.
+ *
+ * \see map_archive_level
+ */
+typedef struct map_archive_level MapArchiveLevel;
+
+
+/*!
+ * \struct map_archive
+ * \brief The \ref map_archive structure represents a
+ *        map archive read in memory.
+ *
+ * The bytes preceding the first map are kept as stored,
+ * so that an archive is serialized as the operations of
+ * the \ref maputil.h header would rewrite it.
+ */
+struct map_archive
+{
+    /*!
+     * \brief Version of the archive.
+     */
+    unsigned int version;
+
+    /*!
+     * \brief Whether the archive ends with a checksum
+     *        trailer.
+     */
+    int checksummed;
+
+    /*!
+     * \brief Archive header, tile paths and tile
+     *        properties, as stored.
+     */
+    char* prefix;
+
+    /*!
+     * \brief Size of \p prefix, the offset of the first
+     *        map.
+     */
+    size_t prefix_size;
+
+    /*!
+     * \brief Tile paths.
+     */
+    PathTable tile_paths;
+
+    /*!
+     * \brief \ref PATH_TABLE_FIXED or
+     *        \ref PATH_TABLE_PACKED.
+     */
+    unsigned int paths_encoding;
+
+    /*!
+     * \brief Size of the stored table of tile paths.
+     */
+    size_t tile_paths_size;
+
+    /*!
+     * \brief Offset of the tile properties in \p prefix.
+     */
+    size_t tile_properties_offset;
+
+    /*!
+     * \brief Levels of the archive.
+     */
+    MapArchiveLevel* levels;
+
+    /*!
+     * \brief Number of levels.
+     */
+    unsigned int level_count;
+};
+
+
+/*!
+ * \brief The get_header_size() function gets the size
+ *        of the archive header and of the map headers.
+ *
+ * \param version Version of the archive.
+ *
+ * \return The size of the headers.
+ */
+static size_t get_header_size(unsigned int version);
+
+/*!
+ * \brief The get_offset_size() function gets the size
+ *        of the offsets of an archive.
+ *
+ * \param version Version of the archive.
+ *
+ * \return The size of an offset.
+ */
+static size_t get_offset_size(unsigned int version);
+
+/*!
+ * \brief The read_offset() function reads an offset of
+ *        the archive header.
+ *
+ * \param header Archive header.
+ * \param version Version of the archive.
+ * \param section `0` for the tile properties, `1` for
+ *                the first map, `2` for the level
+ *                directory.
+ *
+ * \return The offset of the section.
+ */
+static unsigned long long read_offset(
+    const char* header, unsigned int version, unsigned int section
+);
+
+/*!
+ * \brief The write_offset() function writes an offset
+ *        of the archive header.
+ *
+ * \param header Archive header.
+ * \param version Version of the archive.
+ * \param section `0` for the tile properties, `1` for
+ *                the first map, `2` for the level
+ *                directory.
+ * \param offset Offset of the section.
+ */
+static void write_offset(
+    char* header, unsigned int version, unsigned int section,
+    unsigned long long offset
+);
+
+/*!
+ * \brief The parse_archive() function parses a map
+ *        archive into an allocated structure.
+ *
+ * \param archive Map archive, filled.
+ * \param buffer Map archive, as stored.
+ * \param size Size of \p buffer.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or an error code.
+ */
+static int parse_archive(
+    MapArchive* archive, const char* buffer, size_t size
+);
+
+/*!
+ * \brief The parse_tiles() function parses the tile
+ *        paths stored in the prefix of a map archive.
+ *
+ * \param archive Map archive.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_FORMAT.
+ */
+static int parse_tiles(MapArchive* archive);
+
+/*!
+ * \brief The parse_level() function decodes the map of
+ *        a level.
+ *
+ * \param version Version of the archive.
+ * \param buffer Map archive, as stored.
+ * \param size Size of \p buffer.
+ * \param offset Offset of the map.
+ * \param level Level, filled.
+ * \param map_end End of the stored map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or an error code.
+ */
+static int parse_level(
+    unsigned int version, const char* buffer, size_t size,
+    unsigned long long offset, MapArchiveLevel* level,
+    unsigned long long* map_end
+);
+
+/*!
+ * \brief The parse_chunks() function decodes the chunks
+ *        of a chunked map.
+ *
+ * \param version Version of the archive.
+ * \param map Stored map, header included.
+ * \param size Number of bytes available in \p map.
+ * \param level Level, whose data are filled.
+ * \param chunks_end End of the last chunk, from the
+ *                   start of the map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or an error code.
+ */
+static int parse_chunks(
+    unsigned int version, const char* map, size_t size,
+    MapArchiveLevel* level, unsigned long long* chunks_end
+);
+
+/*!
+ * \brief The format_level() function stores the map of
+ *        a level.
+ *
+ * \param version Version of the archive.
+ * \param level Level.
+ * \param map Stored map, header included. The buffer
+ *            must be able to hold get_level_bound()
+ *            bytes.
+ * \param map_size Size of the stored map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_MEMORY.
+ */
+static int format_level(
+    unsigned int version, const MapArchiveLevel* level, char* map,
+    size_t* map_size
+);
+
+/*!
+ * \brief The get_level_bound() function gets the
+ *        maximum size of the map of a level once stored.
+ *
+ * \param version Version of the archive.
+ * \param level Level.
+ *
+ * \return The maximum size of the stored map.
+ */
+static size_t get_level_bound(
+    unsigned int version, const MapArchiveLevel* level
+);
+
+/*!
+ * \brief The compute_checksums() function computes the
+ *        checksums of the tile paths, of the tile
+ *        properties and of the map data of the first
+ *        level of a map archive.
+ *
+ * \param archive Map archive.
+ * \param checksums Checksums, as stored in the trailer.
+ */
+static void compute_checksums(
+    const MapArchive* archive, unsigned int* checksums
+);
+
+/*!
+ * \brief The get_level() function gets a level of a map
+ *        archive.
+ *
+ * \param archive Map archive.
+ * \param level Index of the level.
+ *
+ * \return The level, or `NULL` if it does not exist.
+ */
+static MapArchiveLevel* get_level(
+    const MapArchive* archive, unsigned int level
+);
+
+/*!
+ * \brief The resize_level() function resizes the map of
+ *        a level.
+ *
+ * The columns are added or removed on the right side of
+ * the map, the rows on the top side of each plane of its
+ * tiles. Added tiles reference the \ref MAP_OBJECT_NONE
+ * map data.
+ *
+ * \param level Level, updated.
+ * \param map_width New width of the map.
+ * \param map_height New height of the map.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_MEMORY.
+ */
+static int resize_level(
+    MapArchiveLevel* level, unsigned int map_width,
+    unsigned int map_height
+);
+
+/*!
+ * \brief The replace_tiles() function replaces the
+ *        tiles stored in the prefix of a map archive.
+ *
+ * \param archive Map archive.
+ * \param tile_paths Table of tile paths, owned by the
+ *                   archive once replaced.
+ * \param paths_encoding \ref PATH_TABLE_FIXED or
+ *                       \ref PATH_TABLE_PACKED.
+ * \param tile_properties Tile properties, as stored, one
+ *                        per tile of \p tile_paths.
+ *
+ * \return \ref MAP_ARCHIVE_OK, or
+ *         \ref MAP_ARCHIVE_ERROR_MEMORY.
+ */
+static int replace_tiles(
+    MapArchive* archive, PathTable* tile_paths,
+    unsigned int paths_encoding, const char* tile_properties
+);
+
+/*!
+ * \brief The mark_used_tiles() function marks the tiles
+ *        used by the map of a level.
+ *
+ * \param level Level.
+ * \param used_tiles Flags, one per value a tile may hold.
+ */
+static void mark_used_tiles(const MapArchiveLevel* level, char* used_tiles);
+
+/*!
+ * \brief The remap_tiles() function replaces the tiles of
+ *        the map of a level in one pass.
+ *
+ * Blocks of tiles lower than \p first_moved, or that
+ * reference no tile, are skipped with `SSE2` when 
+ * available.
+ *
+ * \param level Level, updated.
+ * \param remap New index of each value a tile may hold.
+ * \param first_moved First value whose index changes.
+ */
+static void remap_tiles(
+    MapArchiveLevel* level, const unsigned int* remap,
+    unsigned int first_moved
+);
+
+/*!
+ * \brief The get_cell() function gets the tile of a
+ *        cell.
+ *
+ * \param data Map data.
+ * \param plane_size Number of cells of a plane.
+ * \param cell_size Number of bytes of a tile.
+ * \param index Index of the cell.
+ *
+ * \return The index of the tile, `-1` if the cell has
+ *         none.
+ */
+static int get_cell(
+    const char* data, size_t plane_size, unsigned int cell_size,
+    size_t index
+);
+
+/*!
+ * \brief The set_cell() function sets the tile of a
+ *        cell.
+ *
+ * \param data Map data.
+ * \param plane_size Number of cells of a plane.
+ * \param cell_size Number of bytes of a tile.
+ * \param index Index of the cell.
+ * \param object Index of the tile, `-1` for none.
+ */
+static void set_cell(
+    char* data, size_t plane_size, unsigned int cell_size,
+    size_t index, int object
+);
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Open.
+ *
+ *************************************************************/
+int map_archive_open(const char* filename, MapArchive** archive)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return MAP_ARCHIVE_ERROR_IO;
+    }
+
+    int result = map_archive_read(fd, archive);
+
+    int error = errno;
+    close(fd);
+    errno = error;
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read.
+ *
+ *************************************************************/
+int map_archive_read(int fd, MapArchive** archive)
+{
+    size_t size = 0;
+    size_t capacity = MAP_ARCHIVE_READ_SIZE;
+    char* buffer = (char*)malloc(capacity * sizeof(char));
+    if (buffer == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    for (;;)
+    {
+        if (size == capacity)
+        {
+            char* grown = (char*)realloc(buffer, 2 * capacity);
+            if (grown == NULL)
+            {
+                free(buffer);
+                return MAP_ARCHIVE_ERROR_MEMORY;
+            }
+
+            buffer = grown;
+            capacity *= 2;
+        }
+
+        ssize_t rw_result = read(fd, &buffer[size], capacity - size);
+        if (rw_result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rw_result < 0)
+        {
+            free(buffer);
+            return MAP_ARCHIVE_ERROR_IO;
+        }
+        if (!rw_result)
+        {
+            break;
+        }
+
+        size += rw_result;
+    }
+
+    int result = map_archive_parse(buffer, size, archive);
+    free(buffer);
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse.
+ *
+ *************************************************************/
+int map_archive_parse(
+    const char* buffer, size_t size, MapArchive** archive
+)
+{
+    MapArchive* parsed = (MapArchive*)calloc(1, sizeof(MapArchive));
+    if (parsed == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    path_table_init(&parsed->tile_paths);
+
+    int result = parse_archive(parsed, buffer, size);
+    if (result < 0)
+    {
+        map_archive_free(parsed);
+        return result;
+    }
+
+    *archive = parsed;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Free.
+ *
+ *************************************************************/
+void map_archive_free(MapArchive* archive)
+{
+    if (archive == NULL)
+    {
+        return;
+    }
+
+    for (unsigned int i = 0; archive->levels && i < archive->level_count; ++i)
+    {
+        free(archive->levels[i].data);
+    }
+
+    free(archive->levels);
+    path_table_free(&archive->tile_paths);
+    free(archive->prefix);
+    free(archive);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Serialize.
+ *
+ *************************************************************/
+int map_archive_serialize(
+    const MapArchive* archive, char** buffer, size_t* size
+)
+{
+    unsigned int version = archive->version;
+
+    /* Level directory and checksum trailer included */
+
+    size_t capacity = archive->prefix_size +
+        0x10 + archive->level_count * 0x10 + 0x10;
+    for (unsigned int i = 0; i < archive->level_count; ++i)
+    {
+        capacity += get_level_bound(version, &archive->levels[i]);
+    }
+
+    char* stored = (char*)malloc(capacity * sizeof(char));
+    unsigned long long* level_offsets = (unsigned long long*)malloc(
+        archive->level_count * sizeof(unsigned long long)
+    );
+    if (stored == NULL || level_offsets == NULL)
+    {
+        free(level_offsets);
+        free(stored);
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    memcpy(stored, archive->prefix, archive->prefix_size);
+    size_t cursor = archive->prefix_size;
+
+    /* Maps */
+
+    for (unsigned int i = 0; i < archive->level_count; ++i)
+    {
+        level_offsets[i] = cursor;
+
+        size_t map_size;
+        int result = format_level(
+            version,
+            &archive->levels[i],
+            &stored[cursor],
+            &map_size
+        );
+        if (result < 0)
+        {
+            free(level_offsets);
+            free(stored);
+            return result;
+        }
+
+        cursor += map_size;
+    }
+
+    write_offset(stored, version, 1, archive->prefix_size);
+
+    /* Level directory */
+
+    if (version != MARC_VERSION_1)
+    {
+        unsigned long long directory_offset = 0;
+        if (archive->level_count > 1)
+        {
+            directory_offset = cursor;
+
+            unsigned int directory_header[0x4] = {
+                MDIR_HEADER,
+                archive->level_count,
+                0,
+                0
+            };
+            memcpy(&stored[cursor], directory_header, sizeof(directory_header));
+            cursor += sizeof(directory_header);
+
+            for (unsigned int i = 0; i < archive->level_count; ++i)
+            {
+                const MapArchiveLevel* level = &archive->levels[i];
+                unsigned int checksum = crc32c(
+                    0,
+                    level->data,
+                    (size_t)level->width * level->height * level->cell_size
+                );
+
+                char entry[0x10] = {0};
+                memcpy(entry, &level_offsets[i], sizeof(unsigned long long));
+                memcpy(&entry[0x8], &checksum, sizeof(unsigned int));
+
+                memcpy(&stored[cursor], entry, sizeof(entry));
+                cursor += sizeof(entry);
+            }
+        }
+
+        write_offset(stored, version, 2, directory_offset);
+    }
+
+    free(level_offsets);
+
+    /* Checksum trailer */
+
+    if (archive->checksummed)
+    {
+        unsigned int trailer[0x4];
+        compute_checksums(archive, trailer);
+        trailer[0x3] = MCRC_TRAILER;
+
+        memcpy(&stored[cursor], trailer, sizeof(trailer));
+        cursor += sizeof(trailer);
+    }
+
+    *buffer = stored;
+    *size = cursor;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write.
+ *
+ *************************************************************/
+int map_archive_write(const MapArchive* archive, int fd)
+{
+    char* stored;
+    size_t size;
+    int result = map_archive_serialize(archive, &stored, &size);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    size_t written = 0;
+    while (written < size)
+    {
+        ssize_t rw_result = write(fd, &stored[written], size - written);
+        if (rw_result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (rw_result < 0)
+        {
+            int error = errno;
+            free(stored);
+            errno = error;
+            return MAP_ARCHIVE_ERROR_IO;
+        }
+
+        written += rw_result;
+    }
+
+    free(stored);
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Save.
+ *
+ *************************************************************/
+int map_archive_save(const MapArchive* archive, const char* filename)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        return MAP_ARCHIVE_ERROR_IO;
+    }
+
+    int result = map_archive_write(archive, fd);
+    if (close(fd) < 0 && result == MAP_ARCHIVE_OK)
+    {
+        result = MAP_ARCHIVE_ERROR_IO;
+    }
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Describe an error.
+ *
+ *************************************************************/
+const char* map_archive_strerror(int error)
+{
+    switch (error)
+    {
+        case MAP_ARCHIVE_OK:
+            return "Success";
+        case MAP_ARCHIVE_ERROR_IO:
+            return "System call failed";
+        case MAP_ARCHIVE_ERROR_MEMORY:
+            return "Memory allocation failed";
+        case MAP_ARCHIVE_ERROR_FORMAT:
+            return "Malformed map archive";
+        case MAP_ARCHIVE_ERROR_CHECKSUM:
+            return "Checksum does not match";
+        case MAP_ARCHIVE_ERROR_LEVEL:
+            return "Level does not exist";
+        case MAP_ARCHIVE_ERROR_OBJECT:
+            return "Tile does not exist";
+        case MAP_ARCHIVE_ERROR_PATH:
+            return "Tile path is too long";
+        case MAP_ARCHIVE_ERROR_ARGUMENT:
+            return "Argument out of range";
+        default:
+            return "Unknown error";
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get version.
+ *
+ *************************************************************/
+unsigned int map_archive_get_version(const MapArchive* archive)
+{
+    return archive->version;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get level count.
+ *
+ *************************************************************/
+unsigned int map_archive_get_level_count(const MapArchive* archive)
+{
+    return archive->level_count;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get objects count.
+ *
+ *************************************************************/
+unsigned int map_archive_get_objects_count(const MapArchive* archive)
+{
+    return archive->tile_paths.count;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get width.
+ *
+ *************************************************************/
+int map_archive_get_width(
+    const MapArchive* archive, unsigned int level, unsigned int* map_width
+)
+{
+    const MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    *map_width = map_level->width;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get height.
+ *
+ *************************************************************/
+int map_archive_get_height(
+    const MapArchive* archive, unsigned int level,
+    unsigned int* map_height
+)
+{
+    const MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    *map_height = map_level->height;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get info.
+ *
+ *************************************************************/
+int map_archive_get_info(
+    const MapArchive* archive, unsigned int level, MapInfo* info
+)
+{
+    const MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    info->map_width = map_level->width;
+    info->map_height = map_level->height;
+    info->map_objects_count = archive->tile_paths.count;
+    info->map_levels_count = archive->level_count;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get encoding.
+ *
+ *************************************************************/
+int map_archive_get_encoding(
+    const MapArchive* archive, unsigned int level,
+    unsigned int* encoding
+)
+{
+    const MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    *encoding = (map_level->signature == MAPF_RLE_HEADER ||
+        map_level->signature == MAPC_RLE_HEADER ?
+        MAP_ENCODING_RLE : MAP_ENCODING_RAW);
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get paths.
+ *
+ *************************************************************/
+unsigned int map_archive_get_paths(const MapArchive* archive)
+{
+    return (archive->paths_encoding == PATH_TABLE_PACKED ?
+        MAP_PATHS_PACKED : MAP_PATHS_FIXED);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get object.
+ *
+ *************************************************************/
+int map_archive_get_object(
+    const MapArchive* archive, unsigned int index,
+    MapObjectProperties* properties
+)
+{
+    if (index >= archive->tile_paths.count)
+    {
+        return MAP_ARCHIVE_ERROR_OBJECT;
+    }
+
+    unsigned int fields[0x8];
+    memcpy(
+        fields,
+        &archive->prefix[archive->tile_properties_offset + index * 0x20],
+        sizeof(fields)
+    );
+    if (fields[0x0] != OBJECT_PROPERTIES_HEADER)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    properties->path = (char*)path_table_get(&archive->tile_paths, index);
+    properties->frames = fields[0x1];
+    properties->solidity = fields[0x2];
+    properties->destructible = fields[0x3];
+    properties->collectible = fields[0x4];
+    properties->generator = fields[0x5];
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get cell.
+ *
+ *************************************************************/
+int map_archive_get_cell(
+    const MapArchive* archive, unsigned int level, unsigned int x,
+    unsigned int y, int* object
+)
+{
+    const MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    if (x >= map_level->width || y >= map_level->height)
+    {
+        return MAP_ARCHIVE_ERROR_ARGUMENT;
+    }
+
+    *object = get_cell(
+        map_level->data,
+        (size_t)map_level->width * map_level->height,
+        map_level->cell_size,
+        (size_t)y * map_level->width + x
+    );
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set cell.
+ *
+ *************************************************************/
+int map_archive_set_cell(
+    MapArchive* archive, unsigned int level, unsigned int x,
+    unsigned int y, int object
+)
+{
+    MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    if (x >= map_level->width || y >= map_level->height)
+    {
+        return MAP_ARCHIVE_ERROR_ARGUMENT;
+    }
+
+    /* The last value of a tile stands for none */
+
+    unsigned int none = (1u << (map_level->cell_size * 8)) - 1;
+    if (object < -1 || (object >= 0 &&
+            ((unsigned int)object >= archive->tile_paths.count ||
+             (unsigned int)object >= none)))
+    {
+        return MAP_ARCHIVE_ERROR_OBJECT;
+    }
+
+    set_cell(
+        map_level->data,
+        (size_t)map_level->width * map_level->height,
+        map_level->cell_size,
+        (size_t)y * map_level->width + x,
+        (object < 0 ? (int)none : object)
+    );
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set width.
+ *
+ *************************************************************/
+int map_archive_set_width(
+    MapArchive* archive, unsigned int level, unsigned int map_width
+)
+{
+    MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    if (map_width == map_level->width)
+    {
+        return MAP_ARCHIVE_OK;
+    }
+
+    return resize_level(map_level, map_width, map_level->height);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set height.
+ *
+ *************************************************************/
+int map_archive_set_height(
+    MapArchive* archive, unsigned int level, unsigned int map_height
+)
+{
+    MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    if (map_height == map_level->height)
+    {
+        return MAP_ARCHIVE_OK;
+    }
+
+    return resize_level(map_level, map_level->width, map_height);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set objects.
+ *
+ *************************************************************/
+int map_archive_set_objects(
+    MapArchive* archive, MapObjectProperties** properties,
+    unsigned int properties_count
+)
+{
+    if (archive->tile_paths.count > properties_count ||
+        properties_count > MAP_MAX_OBJECTS)
+    {
+        return MAP_ARCHIVE_ERROR_OBJECT;
+    }
+
+    for (unsigned int i = 0; i < properties_count; ++i)
+    {
+        if (strlen(properties[i]->path) > PATH_TABLE_MAX_LENGTH)
+        {
+            return MAP_ARCHIVE_ERROR_PATH;
+        }
+    }
+
+    /* Intern tile paths and store tile properties */
+
+    PathTable tile_paths;
+    path_table_init(&tile_paths);
+
+    char* tile_properties =
+        (char*)malloc(properties_count * 0x20 * sizeof(char));
+    if (properties_count && tile_properties == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    for (unsigned int i = 0; i < properties_count; ++i)
+    {
+        if (path_table_add(&tile_paths, properties[i]->path) < 0)
+        {
+            path_table_free(&tile_paths);
+            free(tile_properties);
+            return MAP_ARCHIVE_ERROR_MEMORY;
+        }
+
+        unsigned int fields[0x8] = {
+            OBJECT_PROPERTIES_HEADER,
+            properties[i]->frames,
+            properties[i]->solidity,
+            properties[i]->destructible,
+            properties[i]->collectible,
+            properties[i]->generator
+        };
+        memcpy(&tile_properties[i * 0x20], fields, sizeof(fields));
+    }
+
+    /* The encoding of the tile paths is kept */
+
+    int result = replace_tiles(
+        archive,
+        &tile_paths,
+        archive->paths_encoding,
+        tile_properties
+    );
+    if (result < 0)
+    {
+        path_table_free(&tile_paths);
+    }
+
+    free(tile_properties);
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Prune objects.
+ *
+ *************************************************************/
+int map_archive_prune_objects(MapArchive* archive)
+{
+    unsigned int tiles_count = archive->tile_paths.count;
+    const char* tile_properties =
+        &archive->prefix[archive->tile_properties_offset];
+    for (unsigned int i = 0; i < tiles_count; ++i)
+    {
+        unsigned int header;
+        memcpy(&header, &tile_properties[i * 0x20], sizeof(unsigned int));
+        if (header != OBJECT_PROPERTIES_HEADER)
+        {
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+    }
+
+    /* One entry per value a tile may hold */
+
+    unsigned int cell_size = 1;
+    for (unsigned int l = 0; l < archive->level_count; ++l)
+    {
+        if (archive->levels[l].cell_size > cell_size)
+        {
+            cell_size = archive->levels[l].cell_size;
+        }
+    }
+
+    size_t table_size = (size_t)1 << (cell_size * 8);
+    char* used_tiles = (char*)calloc(table_size, sizeof(char));
+    unsigned int* remap =
+        (unsigned int*)malloc(table_size * sizeof(unsigned int));
+    char* used_properties =
+        (char*)malloc((tiles_count * 0x20 + 1) * sizeof(char));
+    if (used_tiles == NULL || remap == NULL || used_properties == NULL)
+    {
+        free(used_properties);
+        free(remap);
+        free(used_tiles);
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    /* Usage of the tiles over all the levels */
+
+    for (unsigned int l = 0; l < archive->level_count; ++l)
+    {
+        mark_used_tiles(&archive->levels[l], used_tiles);
+    }
+
+    /* Keep used paths and properties, in order */
+
+    PathTable used_paths;
+    path_table_init(&used_paths);
+    for (unsigned int i = 0; i < tiles_count && i < table_size; ++i)
+    {
+        if (!used_tiles[i])
+        {
+            continue;
+        }
+
+        memcpy(
+            &used_properties[used_paths.count * 0x20],
+            &tile_properties[i * 0x20],
+            0x20 * sizeof(char)
+        );
+
+        if (path_table_add(
+                &used_paths,
+                path_table_get(&archive->tile_paths, i)
+            ) < 0)
+        {
+            path_table_free(&used_paths);
+            free(used_properties);
+            free(remap);
+            free(used_tiles);
+            return MAP_ARCHIVE_ERROR_MEMORY;
+        }
+    }
+
+    /* Dense remap table, values of no tile being kept */
+
+    unsigned int new_tiles_count = 0;
+    unsigned int first_moved = (unsigned int)table_size;
+    for (size_t i = 0; i < table_size; ++i)
+    {
+        remap[i] = (unsigned int)i;
+        if (i < tiles_count && used_tiles[i])
+        {
+            remap[i] = new_tiles_count++;
+        }
+
+        if (remap[i] != i && first_moved == table_size)
+        {
+            first_moved = (unsigned int)i;
+        }
+    }
+
+    free(used_tiles);
+
+    int result = replace_tiles(
+        archive,
+        &used_paths,
+        archive->paths_encoding,
+        used_properties
+    );
+    free(used_properties);
+    if (result < 0)
+    {
+        path_table_free(&used_paths);
+        free(remap);
+        return result;
+    }
+
+    /* Update the tiles of all the levels */
+
+    for (unsigned int l = 0; l < archive->level_count; ++l)
+    {
+        remap_tiles(&archive->levels[l], remap, first_moved);
+    }
+
+    free(remap);
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set encoding.
+ *
+ *************************************************************/
+int map_archive_set_encoding(
+    MapArchive* archive, unsigned int level, unsigned int encoding
+)
+{
+    MapArchiveLevel* map_level = get_level(archive, level);
+    if (map_level == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_LEVEL;
+    }
+
+    if (encoding != MAP_ENCODING_RAW && encoding != MAP_ENCODING_RLE)
+    {
+        return MAP_ARCHIVE_ERROR_ARGUMENT;
+    }
+
+    if (map_level->signature == MAPC_HEADER ||
+        map_level->signature == MAPC_RLE_HEADER)
+    {
+        /* The layout of the map is kept */
+
+        map_level->signature =
+            (encoding == MAP_ENCODING_RLE ? MAPC_RLE_HEADER : MAPC_HEADER);
+        return MAP_ARCHIVE_OK;
+    }
+
+    map_level->signature =
+        (encoding == MAP_ENCODING_RLE ? MAPF_RLE_HEADER : MAPF_HEADER);
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set paths.
+ *
+ *************************************************************/
+int map_archive_set_paths(MapArchive* archive, unsigned int encoding)
+{
+    if (encoding != MAP_PATHS_FIXED && encoding != MAP_PATHS_PACKED)
+    {
+        return MAP_ARCHIVE_ERROR_ARGUMENT;
+    }
+
+    unsigned int paths_encoding = (encoding == MAP_PATHS_PACKED ?
+        PATH_TABLE_PACKED : PATH_TABLE_FIXED);
+    if (paths_encoding == archive->paths_encoding)
+    {
+        return MAP_ARCHIVE_OK;
+    }
+
+    /* Same tiles, stored again */
+
+    PathTable tile_paths;
+    path_table_init(&tile_paths);
+    for (unsigned int i = 0; i < archive->tile_paths.count; ++i)
+    {
+        if (path_table_add(
+                &tile_paths,
+                path_table_get(&archive->tile_paths, i)
+            ) < 0)
+        {
+            path_table_free(&tile_paths);
+            return MAP_ARCHIVE_ERROR_MEMORY;
+        }
+    }
+
+    int result = replace_tiles(
+        archive,
+        &tile_paths,
+        paths_encoding,
+        &archive->prefix[archive->tile_properties_offset]
+    );
+    if (result < 0)
+    {
+        path_table_free(&tile_paths);
+    }
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get header size.
+ *
+ *************************************************************/
+size_t get_header_size(unsigned int version)
+{
+    return (version == MARC_VERSION_1 ? 0x10 : 0x20);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get offset size.
+ *
+ *************************************************************/
+size_t get_offset_size(unsigned int version)
+{
+    return (version == MARC_VERSION_1 ?
+        sizeof(unsigned int) : sizeof(unsigned long long));
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read offset.
+ *
+ *************************************************************/
+unsigned long long read_offset(
+    const char* header, unsigned int version, unsigned int section
+)
+{
+    size_t offset_size = get_offset_size(version);
+
+    unsigned long long offset = 0;
+    memcpy(&offset, &header[0x8 + section * offset_size], offset_size);
+
+    return offset;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write offset.
+ *
+ *************************************************************/
+void write_offset(
+    char* header, unsigned int version, unsigned int section,
+    unsigned long long offset
+)
+{
+    size_t offset_size = get_offset_size(version);
+    memcpy(&header[0x8 + section * offset_size], &offset, offset_size);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse archive.
+ *
+ *************************************************************/
+int parse_archive(MapArchive* archive, const char* buffer, size_t size)
+{
+    unsigned int signature;
+    if (size < sizeof(unsigned int))
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+    memcpy(&signature, buffer, sizeof(unsigned int));
+
+    if (signature != MARC_HEADER && signature != MARC_V2_HEADER)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    unsigned int version =
+        (signature == MARC_V2_HEADER ? MARC_VERSION_2 : MARC_VERSION_1);
+    size_t header_size = get_header_size(version);
+    if (size < header_size)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    archive->version = version;
+
+    /* Everything up to the first map, as stored */
+
+    unsigned long long map_offset = read_offset(buffer, version, 1);
+    if (map_offset < header_size || map_offset > size)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    archive->prefix_size = map_offset;
+    archive->prefix = (char*)malloc(archive->prefix_size * sizeof(char));
+    if (archive->prefix == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+    memcpy(archive->prefix, buffer, archive->prefix_size);
+
+    int result = parse_tiles(archive);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    /* Level directory */
+
+    unsigned int level_count = 1;
+    unsigned long long directory_offset =
+        (version == MARC_VERSION_1 ? 0 : read_offset(buffer, version, 2));
+    if (directory_offset)
+    {
+        unsigned int directory_header[0x2];
+        if (directory_offset > size || size - directory_offset < 0x10)
+        {
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+        memcpy(
+            directory_header,
+            &buffer[directory_offset],
+            sizeof(directory_header)
+        );
+
+        if (directory_header[0x0] != MDIR_HEADER || !directory_header[0x1] ||
+            (size - directory_offset - 0x10) / 0x10 < directory_header[0x1])
+        {
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+
+        level_count = directory_header[0x1];
+    }
+
+    /* Levels */
+
+    archive->levels =
+        (MapArchiveLevel*)calloc(level_count, sizeof(MapArchiveLevel));
+    if (archive->levels == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+    archive->level_count = level_count;
+
+    unsigned long long map_end = 0;
+    for (unsigned int i = 0; i < level_count; ++i)
+    {
+        unsigned long long level_offset = map_offset;
+        unsigned long long level_end;
+        if (i)
+        {
+            memcpy(
+                &level_offset,
+                &buffer[directory_offset + 0x10 + i * 0x10],
+                sizeof(unsigned long long)
+            );
+        }
+
+        result = parse_level(
+            version,
+            buffer,
+            size,
+            level_offset,
+            &archive->levels[i],
+            &level_end
+        );
+        if (result < 0)
+        {
+            return result;
+        }
+
+        if (!i)
+        {
+            map_end = level_end;
+        }
+    }
+
+    /* Checksum trailer, after the first map at least */
+
+    unsigned int trailer[0x4] = {0};
+    if (size >= map_end + 0x10)
+    {
+        memcpy(trailer, &buffer[size - 0x10], sizeof(trailer));
+    }
+
+    archive->checksummed = (trailer[0x3] == MCRC_TRAILER);
+    if (!archive->checksummed)
+    {
+        return MAP_ARCHIVE_OK;
+    }
+
+    unsigned int checksums[0x3];
+    compute_checksums(archive, checksums);
+    if (memcmp(checksums, trailer, sizeof(checksums)))
+    {
+        return MAP_ARCHIVE_ERROR_CHECKSUM;
+    }
+
+    for (unsigned int i = 0; level_count > 1 && i < level_count; ++i)
+    {
+        const MapArchiveLevel* level = &archive->levels[i];
+
+        unsigned int checksum;
+        memcpy(
+            &checksum,
+            &buffer[directory_offset + 0x10 + i * 0x10 + 0x8],
+            sizeof(unsigned int)
+        );
+        if (crc32c(
+                0,
+                level->data,
+                (size_t)level->width * level->height * level->cell_size
+            ) != checksum)
+        {
+            return MAP_ARCHIVE_ERROR_CHECKSUM;
+        }
+    }
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse tiles.
+ *
+ *************************************************************/
+int parse_tiles(MapArchive* archive)
+{
+    unsigned int version = archive->version;
+    size_t header_size = get_header_size(version);
+
+    unsigned int tiles_count;
+    memcpy(&tiles_count, &archive->prefix[0x4], sizeof(unsigned int));
+    if (tiles_count > MAP_MAX_OBJECTS)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    /* The table ends where the tile properties start */
+
+    unsigned long long tile_properties_offset =
+        read_offset(archive->prefix, version, 0);
+    size_t size = (tile_properties_offset > header_size ?
+        tile_properties_offset - header_size : (size_t)tiles_count * 0x40);
+    if (size > archive->prefix_size - header_size)
+    {
+        size = archive->prefix_size - header_size;
+    }
+
+    const char* section = &archive->prefix[header_size];
+    ssize_t table_size = path_table_parse(
+        &archive->tile_paths,
+        section,
+        size,
+        tiles_count
+    );
+    if (table_size < 0)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    archive->paths_encoding = path_table_encoding(section, table_size);
+    archive->tile_paths_size = table_size;
+
+    /* Tile properties */
+
+    if (tile_properties_offset > archive->prefix_size ||
+        (archive->prefix_size - tile_properties_offset) / 0x20 < tiles_count)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    archive->tile_properties_offset = tile_properties_offset;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse level.
+ *
+ *************************************************************/
+int parse_level(
+    unsigned int version, const char* buffer, size_t size,
+    unsigned long long offset, MapArchiveLevel* level,
+    unsigned long long* map_end
+)
+{
+    size_t header_size = get_header_size(version);
+    if (offset > size || size - offset < header_size)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    unsigned int fields[0x8];
+    memcpy(fields, &buffer[offset], header_size);
+
+    unsigned int signature = fields[0x0];
+    if (signature != MAPF_HEADER && signature != MAPF_RLE_HEADER &&
+        signature != MAPC_HEADER && signature != MAPC_RLE_HEADER)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    level->signature = signature;
+    level->width = fields[0x1];
+    level->height = fields[0x2];
+
+    unsigned long long stored_size = fields[0x3];
+    level->cell_size = 1;
+    if (version != MARC_VERSION_1)
+    {
+        level->cell_size = fields[0x3];
+        memcpy(&stored_size, &fields[0x4], sizeof(unsigned long long));
+        if (level->cell_size != 1 && level->cell_size != 2)
+        {
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+    }
+
+    size_t map_size =
+        (size_t)level->width * level->height * level->cell_size;
+    level->data = (char*)malloc(
+        (map_size + RLE_DECODE_PADDING) * sizeof(char)
+    );
+    if (level->data == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    if (signature == MAPC_HEADER || signature == MAPC_RLE_HEADER)
+    {
+        if (!stored_size || stored_size > 0xffffffff)
+        {
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+        level->chunk_width = (unsigned int)stored_size;
+
+        unsigned long long chunks_end;
+        int result = parse_chunks(
+            version,
+            &buffer[offset],
+            size - offset,
+            level,
+            &chunks_end
+        );
+
+        *map_end = offset + chunks_end;
+        return result;
+    }
+
+    const char* stored_data = &buffer[offset + header_size];
+    size_t available = size - offset - header_size;
+    *map_end = offset + header_size + stored_size;
+
+    if (signature == MAPF_HEADER)
+    {
+        if (available < map_size)
+        {
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+
+        memcpy(level->data, stored_data, map_size);
+        return MAP_ARCHIVE_OK;
+    }
+
+    /* Run-length encoded map data */
+
+    if (stored_size > available ||
+        rle_decode(stored_data, stored_size, level->data, map_size) < 0)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse chunks.
+ *
+ *************************************************************/
+int parse_chunks(
+    unsigned int version, const char* map, size_t size,
+    MapArchiveLevel* level, unsigned long long* chunks_end
+)
+{
+    /* Planes of wide tiles are chunked as extra rows */
+
+    unsigned int map_width = level->width;
+    size_t map_height = (size_t)level->height * level->cell_size;
+    unsigned int chunk_width = level->chunk_width;
+    unsigned int chunk_count =
+        (unsigned int)(((unsigned long long)map_width + chunk_width - 1) /
+        chunk_width);
+
+    size_t header_size = get_header_size(version);
+    size_t offset_size = get_offset_size(version);
+    if ((size - header_size) / offset_size < (size_t)chunk_count + 1)
+    {
+        return MAP_ARCHIVE_ERROR_FORMAT;
+    }
+
+    char* chunk = (char*)malloc(
+        (chunk_width * map_height + RLE_DECODE_PADDING) * sizeof(char)
+    );
+    if (chunk == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    unsigned long long chunk_offset = 0;
+    memcpy(&chunk_offset, &map[header_size], offset_size);
+    for (unsigned int i = 0; i < chunk_count; ++i)
+    {
+        unsigned int chunk_x = i * chunk_width;
+        unsigned int chunk_w = map_width - chunk_x;
+        if (chunk_w > chunk_width)
+        {
+            chunk_w = chunk_width;
+        }
+
+        unsigned long long next_offset = 0;
+        memcpy(
+            &next_offset,
+            &map[header_size + (i + 1) * offset_size],
+            offset_size
+        );
+        if (next_offset < chunk_offset || next_offset > size)
+        {
+            free(chunk);
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+
+        size_t chunk_size = chunk_w * map_height;
+        size_t stored_size = next_offset - chunk_offset;
+        if (level->signature == MAPC_RLE_HEADER ?
+                rle_decode(&map[chunk_offset], stored_size, chunk, chunk_size) < 0 :
+                stored_size != chunk_size)
+        {
+            free(chunk);
+            return MAP_ARCHIVE_ERROR_FORMAT;
+        }
+
+        if (level->signature == MAPC_HEADER)
+        {
+            memcpy(chunk, &map[chunk_offset], chunk_size);
+        }
+
+        for (size_t y = 0; y < map_height; ++y)
+        {
+            memcpy(
+                &level->data[y * map_width + chunk_x],
+                &chunk[y * chunk_w],
+                chunk_w * sizeof(char)
+            );
+        }
+
+        chunk_offset = next_offset;
+    }
+
+    free(chunk);
+
+    *chunks_end = chunk_offset;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get level bound.
+ *
+ *************************************************************/
+size_t get_level_bound(unsigned int version, const MapArchiveLevel* level)
+{
+    size_t map_size = (size_t)level->width * level->height * level->cell_size;
+    size_t table_size = 0;
+    if (level->signature == MAPC_HEADER ||
+        level->signature == MAPC_RLE_HEADER)
+    {
+        size_t chunk_count =
+            ((size_t)level->width + level->chunk_width - 1) / level->chunk_width;
+        table_size = (chunk_count + 1) * get_offset_size(version);
+    }
+
+    return get_header_size(version) + table_size +
+        RLE_MAX_ENCODED_SIZE(map_size);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Format level.
+ *
+ *************************************************************/
+int format_level(
+    unsigned int version, const MapArchiveLevel* level, char* map,
+    size_t* map_size
+)
+{
+    size_t header_size = get_header_size(version);
+    size_t offset_size = get_offset_size(version);
+    size_t data_size =
+        (size_t)level->width * level->height * level->cell_size;
+    char* stored_data = &map[header_size];
+
+    /* The last field holds the chunk width of chunked maps */
+
+    unsigned long long stored_size = data_size;
+    size_t body_size = data_size;
+    if (level->signature == MAPC_HEADER ||
+        level->signature == MAPC_RLE_HEADER)
+    {
+        unsigned int map_width = level->width;
+        size_t map_height = (size_t)level->height * level->cell_size;
+        unsigned int chunk_width = level->chunk_width;
+        unsigned int chunk_count =
+            (unsigned int)(((unsigned long long)map_width + chunk_width - 1) /
+            chunk_width);
+        size_t table_size = (chunk_count + 1) * offset_size;
+
+        char* chunk = (char*)malloc(chunk_width * map_height * sizeof(char));
+        if (chunk_count && chunk == NULL)
+        {
+            return MAP_ARCHIVE_ERROR_MEMORY;
+        }
+
+        body_size = table_size;
+        for (unsigned int i = 0; i < chunk_count; ++i)
+        {
+            unsigned int chunk_x = i * chunk_width;
+            unsigned int chunk_w = map_width - chunk_x;
+            if (chunk_w > chunk_width)
+            {
+                chunk_w = chunk_width;
+            }
+
+            for (size_t y = 0; y < map_height; ++y)
+            {
+                memcpy(
+                    &chunk[y * chunk_w],
+                    &level->data[y * map_width + chunk_x],
+                    chunk_w * sizeof(char)
+                );
+            }
+
+            unsigned long long chunk_offset = header_size + body_size;
+            memcpy(&stored_data[i * offset_size], &chunk_offset, offset_size);
+            if (level->signature == MAPC_RLE_HEADER)
+            {
+                body_size += rle_encode(
+                    chunk,
+                    chunk_w * map_height,
+                    &stored_data[body_size]
+                );
+            }
+            else
+            {
+                memcpy(
+                    &stored_data[body_size],
+                    chunk,
+                    chunk_w * map_height * sizeof(char)
+                );
+                body_size += chunk_w * map_height;
+            }
+        }
+
+        unsigned long long chunks_end = header_size + body_size;
+        memcpy(
+            &stored_data[chunk_count * offset_size],
+            &chunks_end,
+            offset_size
+        );
+
+        free(chunk);
+
+        stored_size = chunk_width;
+    }
+    else if (level->signature == MAPF_RLE_HEADER)
+    {
+        body_size = rle_encode(level->data, data_size, stored_data);
+        stored_size = body_size;
+    }
+    else
+    {
+        memcpy(stored_data, level->data, data_size);
+    }
+
+    /* Header */
+
+    unsigned int fields[0x8] = {
+        level->signature,
+        level->width,
+        level->height,
+        (unsigned int)stored_size
+    };
+    if (version != MARC_VERSION_1)
+    {
+        fields[0x3] = level->cell_size;
+        memcpy(&fields[0x4], &stored_size, sizeof(unsigned long long));
+    }
+    memcpy(map, fields, header_size);
+
+    *map_size = header_size + body_size;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Compute checksums.
+ *
+ *************************************************************/
+void compute_checksums(const MapArchive* archive, unsigned int* checksums)
+{
+    checksums[0x0] = crc32c(
+        0,
+        &archive->prefix[get_header_size(archive->version)],
+        archive->tile_paths_size
+    );
+    checksums[0x1] = crc32c(
+        0,
+        &archive->prefix[archive->tile_properties_offset],
+        archive->tile_paths.count * 0x20
+    );
+
+    const MapArchiveLevel* level = &archive->levels[0x0];
+    checksums[0x2] = crc32c(
+        0,
+        level->data,
+        (size_t)level->width * level->height * level->cell_size
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get level.
+ *
+ *************************************************************/
+MapArchiveLevel* get_level(const MapArchive* archive, unsigned int level)
+{
+    if (level >= archive->level_count)
+    {
+        return NULL;
+    }
+
+    return &archive->levels[level];
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Resize level.
+ *
+ *************************************************************/
+int resize_level(
+    MapArchiveLevel* level, unsigned int map_width,
+    unsigned int map_height
+)
+{
+    unsigned int backup_map_width = level->width;
+    unsigned int backup_map_height = level->height;
+    unsigned int cell_size = level->cell_size;
+
+    char* map_data = (char*)malloc(
+        ((size_t)map_width * map_height * cell_size + RLE_DECODE_PADDING) *
+        sizeof(char)
+    );
+    if (map_data == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    unsigned int kept_width =
+        (map_width < backup_map_width ? map_width : backup_map_width);
+    for (unsigned int i = 0; i < cell_size; ++i)
+    {
+        for (unsigned int y = 0; y < map_height; ++y)
+        {
+            char* row = &map_data[((size_t)i * map_height + y) * map_width];
+            if (y + backup_map_height < map_height)
+            {
+                /* Row added on the top side */
+
+                memset(row, (char)MAP_OBJECT_NONE, map_width * sizeof(char));
+                continue;
+            }
+
+            const char* backup_row = &level->data[
+                ((size_t)i * backup_map_height + y + backup_map_height -
+                    map_height) * backup_map_width
+            ];
+            memcpy(row, backup_row, kept_width * sizeof(char));
+            memset(
+                &row[kept_width],
+                (char)MAP_OBJECT_NONE,
+                (map_width - kept_width) * sizeof(char)
+            );
+        }
+    }
+
+    free(level->data);
+    level->data = map_data;
+    level->width = map_width;
+    level->height = map_height;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Replace tiles.
+ *
+ *************************************************************/
+int replace_tiles(
+    MapArchive* archive, PathTable* tile_paths,
+    unsigned int paths_encoding, const char* tile_properties
+)
+{
+    unsigned int version = archive->version;
+    size_t header_size = get_header_size(version);
+    size_t tile_paths_size = path_table_size(tile_paths, paths_encoding);
+    size_t tile_properties_size = (size_t)tile_paths->count * 0x20;
+
+    size_t prefix_size = header_size + tile_paths_size + tile_properties_size;
+    char* prefix = (char*)malloc(prefix_size * sizeof(char));
+    if (prefix == NULL)
+    {
+        return MAP_ARCHIVE_ERROR_MEMORY;
+    }
+
+    /* Header, with the new tile count and properties offset */
+
+    memcpy(prefix, archive->prefix, header_size);
+    memcpy(&prefix[0x4], &tile_paths->count, sizeof(unsigned int));
+    write_offset(prefix, version, 0, header_size + tile_paths_size);
+
+    /* Tile paths and tile properties */
+
+    path_table_format(tile_paths, paths_encoding, &prefix[header_size]);
+    memcpy(
+        &prefix[header_size + tile_paths_size],
+        tile_properties,
+        tile_properties_size
+    );
+
+    free(archive->prefix);
+    archive->prefix = prefix;
+    archive->prefix_size = prefix_size;
+
+    path_table_free(&archive->tile_paths);
+    archive->tile_paths = *tile_paths;
+    archive->paths_encoding = paths_encoding;
+    archive->tile_paths_size = tile_paths_size;
+    archive->tile_properties_offset = header_size + tile_paths_size;
+
+    return MAP_ARCHIVE_OK;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Mark used tiles.
+ *
+ *************************************************************/
+void mark_used_tiles(const MapArchiveLevel* level, char* used_tiles)
+{
+    size_t map_size = (size_t)level->width * level->height;
+    const unsigned char* low = (const unsigned char*)level->data;
+    if (level->cell_size != 1)
+    {
+        const unsigned char* high = &low[map_size];
+        for (size_t i = 0; i < map_size; ++i)
+        {
+            used_tiles[low[i] | (high[i] << 8)] = 1;
+        }
+
+        used_tiles[0xffff] = 0;
+        return;
+    }
+
+    /* The last byte stands for none, not for a tile */
+
+    char level_tiles[0x100] = {0};
+    for (size_t i = 0; i < map_size; ++i)
+    {
+        level_tiles[low[i]] = 1;
+    }
+
+    for (unsigned int i = 0; i < 0xff; ++i)
+    {
+        used_tiles[i] |= level_tiles[i];
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Remap tiles.
+ *
+ *************************************************************/
+void remap_tiles(
+    MapArchiveLevel* level, const unsigned int* remap,
+    unsigned int first_moved
+)
+{
+    size_t map_size = (size_t)level->width * level->height;
+    unsigned int none = (1u << (level->cell_size * 8)) - 1;
+    if (first_moved >= none)
+    {
+        return;
+    }
+
+    unsigned char* low = (unsigned char*)level->data;
+    if (level->cell_size != 1)
+    {
+        unsigned char* high = &low[map_size];
+        for (size_t i = 0; i < map_size; ++i)
+        {
+            unsigned int object = low[i] | (high[i] << 8);
+            if (object >= first_moved && object != none)
+            {
+                object = remap[object];
+                low[i] = (unsigned char)(object & 0xff);
+                high[i] = (unsigned char)(object >> 8);
+            }
+        }
+
+        return;
+    }
+
+    size_t i = 0;
+
+#ifdef __SSE2__
+    /* Skip blocks of tiles left in place */
+
+    __m128i first = _mm_set1_epi8((char)first_moved);
+    __m128i all_none = _mm_set1_epi8((char)none);
+    for (; i + 0x10 <= map_size; i += 0x10)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*)&low[i]);
+        __m128i moved = _mm_andnot_si128(
+            _mm_cmpeq_epi8(block, all_none),
+            _mm_cmpeq_epi8(_mm_max_epu8(block, first), block)
+        );
+
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(moved);
+        while (mask)
+        {
+            unsigned int j = (unsigned int)__builtin_ctz(mask);
+            low[i + j] = (unsigned char)remap[low[i + j]];
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i < map_size; ++i)
+    {
+        if (low[i] >= first_moved && low[i] != none)
+        {
+            low[i] = (unsigned char)remap[low[i]];
+        }
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get cell.
+ *
+ *************************************************************/
+int get_cell(
+    const char* data, size_t plane_size, unsigned int cell_size,
+    size_t index
+)
+{
+    /* The high bytes are in the last plane */
+
+    unsigned int cell = 0;
+    for (unsigned int plane = cell_size; plane--; )
+    {
+        cell = (cell << 8) |
+            (unsigned char)data[plane * plane_size + index];
+    }
+
+    if (cell == (1u << (cell_size * 8)) - 1)
+    {
+        return -1;
+    }
+
+    return (int)cell;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set cell.
+ *
+ *************************************************************/
+void set_cell(
+    char* data, size_t plane_size, unsigned int cell_size,
+    size_t index, int object
+)
+{
+    unsigned int cell = (unsigned int)object;
+    for (unsigned int plane = 0; plane < cell_size; ++plane)
+    {
+        data[plane * plane_size + index] = (char)(cell & 0xff);
+        cell >>= 8;
+    }
+}
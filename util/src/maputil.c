@@ -10,9 +10,14 @@
  * \version 1
  */
 
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <linux/fs.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -20,25 +25,233 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <png.h>
 
 #include "maputil.h"
+#include "maparchive.h"
 #include "error.h"
+#include "rle.h"
+#include "crc32c.h"
+#include "pathtable.h"
+#include "iobatch.h"
 #include "cmdlineobjectproperties.h"
 
 
+/*!
+ * \struct map_header
+ * \brief The \ref map_header structure represents the
+ *        header of a map, whatever the version of the
+ *        archive holding it.
+ *
+ * Tiles stored on `2` bytes make up two planes of 
+ * \p height rows each, the low bytes followed by the 
+ * high bytes. Hence, the map data are handled as 
+ * \p height times \p cell_size rows of bytes.
+ */
+struct map_header
+{
+    /*!
+     * \brief Version of the archive.
+     */
+    unsigned int version;
+
+    /*!
+     * \brief Signature of the map header.
+     */
+    unsigned int signature;
+
+    /*!
+     * \brief Width of the map.
+     */
+    unsigned int width;
+
+    /*!
+     * \brief Height of the map.
+     */
+    unsigned int height;
+
+    /*!
+     * \brief Number of bytes of a tile.
+     */
+    unsigned int cell_size;
+
+    /*!
+     * \brief Size of the stored map data, or width of a
+     *        chunk for a chunked map.
+     */
+    unsigned long long size;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_header 
+ *        structure.
+ *
+ * \see map_header
+ */
+typedef struct map_header MapHeader;
+
+
+/*!
+ * \struct map_level
+ * \brief The \ref map_level structure represents a
+ *        level of a map archive once decoded.
+ */
+struct map_level
+{
+    /*!
+     * \brief Header of the map.
+     */
+    MapHeader header;
+
+    /*!
+     * \brief Decoded map data, row after row.
+     */
+    char* data;
+};
+
+
+/*!
+ * \brief Type definition of the \ref map_level 
+ *        structure.
+ *
+ * \see map_level
+ */
+typedef struct map_level MapLevel;
+
+
+/*!
+ * \struct cell_stats
+ * \brief The \ref cell_stats structure represents the 
+ *        usage of a value of the map data.
+ */
+struct cell_stats
+{
+    /*!
+     * \brief Number of cells holding the value.
+     */
+    unsigned int cells;
+
+    /*!
+     * \brief First column holding the value.
+     */
+    unsigned int first_column;
+
+    /*!
+     * \brief Last column holding the value.
+     */
+    unsigned int last_column;
+
+    /*!
+     * \brief First row holding the value.
+     */
+    unsigned int first_row;
+
+    /*!
+     * \brief Last row holding the value.
+     */
+    unsigned int last_row;
+};
+
+
+/*!
+ * \brief Type definition of the \ref cell_stats 
+ *        structure.
+ *
+ * \see cell_stats
+ */
+typedef struct cell_stats CellStats;
+
+
+/*!
+ * \brief Level of the map archives handled by the
+ *        operations.
+ */
+static unsigned int map_level = 0;
+
+/*!
+ * \brief Whether a map archive is backed up before being
+ *        resized.
+ */
+static int map_backups = 1;
+
+
 /*!
  * \brief The validate_marc_header() function
  *        validates the header of a map archive.
  *
- * This function exits the program if the header
- * of a map archive is not valid.
+ * If the map archive ends with a checksum trailer, the
+ * tile paths, the tile properties and the map data are 
+ * read in one pass and checked against it. This function 
+ * exits the program if the header of a map archive is 
+ * not valid or if a checksum does not match.
  *
  * \param fd Opened map archive.
  *
  * \note The file cursor is advanced by `sizeof(unsigned int)`.
+ *
+ * \see read_archive_checksums()
+ * \see compute_archive_checksums()
  */
 static void validate_marc_header(int fd);
 
+/*!
+ * \brief The read_archive_checksums() function reads
+ *        the checksum trailer of a map archive, if any.
+ *
+ * The trailer is only looked for past the end of the
+ * map, so that map data ending like a trailer are not
+ * mistaken for one.
+ *
+ * \param fd Opened map archive.
+ * \param checksums Checksums of the tile paths, of the
+ *                  tile properties and of the map data.
+ *
+ * \return `1` if the map archive ends with a checksum 
+ *         trailer, `0` otherwise.
+ *
+ * \note The file cursor is left unchanged.
+ *
+ * \see MCRC_TRAILER
+ */
+static int read_archive_checksums(int fd, unsigned int* checksums);
+
+/*!
+ * \brief The compute_archive_checksums() function 
+ *        computes the checksums of the tile paths, of 
+ *        the tile properties and of the map data of a
+ *        map archive.
+ *
+ * The checksum of the map data is computed over the
+ * decoded map data, row after row, whatever their
+ * encoding and layout.
+ *
+ * \param fd Opened map archive.
+ * \param checksums Checksums of the tile paths, of the
+ *                  tile properties and of the map data.
+ *
+ * \note The file cursor is advanced to the end of the
+ *       map data.
+ */
+static void compute_archive_checksums(int fd, unsigned int* checksums);
+
+/*!
+ * \brief The write_archive_checksums() function writes
+ *        the checksum trailer of a map archive at the 
+ *        file cursor, right after its last section.
+ *
+ * \param fd Opened map archive.
+ *
+ * \see compute_archive_checksums()
+ */
+static void write_archive_checksums(int fd);
+
 /*!
  * \brief The validate_mapf_header() function
  *        validates the header of a map.
@@ -52,6 +265,265 @@ static void validate_marc_header(int fd);
  */
 static void validate_mapf_header(int fd);
 
+/*!
+ * \brief The read_archive_version() function gets the
+ *        version of a map archive from its signature.
+ *
+ * \param fd Opened map archive.
+ *
+ * \return \ref MARC_VERSION_2 if the archive starts with
+ *         \ref MARC_V2_HEADER, \ref MARC_VERSION_1 
+ *         otherwise.
+ *
+ * \note The file cursor is left unchanged.
+ */
+static unsigned int read_archive_version(int fd);
+
+/*!
+ * \brief The get_header_size() function gets the size
+ *        of the archive header and of the map headers.
+ *
+ * The tile paths follow the archive header.
+ *
+ * \param version Version of the archive.
+ *
+ * \return `0x10` bytes for the \ref MARC_VERSION_1 
+ *         version, `0x20` bytes otherwise.
+ */
+static size_t get_header_size(unsigned int version);
+
+/*!
+ * \brief The get_offset_size() function gets the size
+ *        of the section offsets and of the chunk offsets.
+ *
+ * \param version Version of the archive.
+ *
+ * \return `4` bytes for the \ref MARC_VERSION_1 version,
+ *         `8` bytes otherwise.
+ */
+static size_t get_offset_size(unsigned int version);
+
+/*!
+ * \brief The read_archive_offset() function reads an
+ *        offset of the archive header.
+ *
+ * \param fd Opened map archive.
+ * \param section `0` for the offset of the tile 
+ *                properties, `1` for the offset of the 
+ *                first map, `2` for the offset of the 
+ *                level directory of a \ref MARC_VERSION_2
+ *                archive.
+ *
+ * \return The offset of the section.
+ *
+ * \note The file cursor is left unchanged.
+ */
+static unsigned long long read_archive_offset(int fd, unsigned int section);
+
+/*!
+ * \brief The write_archive_offset() function writes an
+ *        offset of the archive header.
+ *
+ * \param fd Opened map archive.
+ * \param section `0` for the offset of the tile 
+ *                properties, `1` for the offset of the 
+ *                first map, `2` for the offset of the 
+ *                level directory of a \ref MARC_VERSION_2
+ *                archive.
+ * \param offset Offset of the section.
+ *
+ * \note The file cursor is left unchanged.
+ */
+static void write_archive_offset(
+    int fd, unsigned int section, unsigned long long offset
+);
+
+/*!
+ * \brief The read_tile_paths() function reads the table
+ *        of tile paths of a map archive, as stored.
+ *
+ * The table spans the bytes between the archive header
+ * and the tile properties, whatever its encoding. This 
+ * function exits the program if the table is malformed.
+ *
+ * \param fd Opened map archive.
+ * \param tile_paths Table the tiles are appended to, or
+ *                   `NULL`.
+ * \param tile_paths_size Size of the stored table.
+ *
+ * \return The stored table, to be freed by the caller.
+ *
+ * \note The file cursor is left unchanged.
+ *
+ * \see path_table_parse()
+ */
+static char* read_tile_paths(
+    int fd, PathTable* tile_paths, size_t* tile_paths_size
+);
+
+/*!
+ * \brief The write_tile_paths() function writes a table
+ *        of tile paths at the file cursor.
+ *
+ * \param fd Opened map archive.
+ * \param tile_paths Table of tile paths.
+ * \param encoding \ref PATH_TABLE_FIXED or
+ *                 \ref PATH_TABLE_PACKED.
+ *
+ * \note The file cursor is advanced by the size of the
+ *       stored table.
+ *
+ * \see path_table_format()
+ */
+static void write_tile_paths(
+    int fd, const PathTable* tile_paths, unsigned int encoding
+);
+
+/*!
+ * \brief The read_mapf_header() function reads and 
+ *        validates the header of a map.
+ *
+ * The header of a map is made up of its signature,
+ * its width, its height, the width of its tiles and 
+ * the size of its data. This function exits the program
+ * if the header of a map is not valid.
+ *
+ * \param fd Opened map archive.
+ * \param map_header Header of the map.
+ *
+ * \note The file cursor is advanced by get_header_size()
+ *       bytes.
+ *
+ * \see validate_mapf_header()
+ */
+static void read_mapf_header(int fd, MapHeader* map_header);
+
+/*!
+ * \brief The write_mapf_header() function writes the
+ *        header of a map in the layout of the version
+ *        of the archive.
+ *
+ * \param fd Opened map archive.
+ * \param map_header Header of the map.
+ *
+ * \note The file cursor is advanced by get_header_size()
+ *       bytes.
+ */
+static void write_mapf_header(int fd, const MapHeader* map_header);
+
+/*!
+ * \brief The get_map_cell() function gets a tile of
+ *        decoded map data.
+ *
+ * \param map_data Decoded map data.
+ * \param plane_size Number of tiles of the map.
+ * \param cell_size Number of bytes of a tile.
+ * \param index Index of the tile.
+ *
+ * \return The tile, or `-1` if there is no tile.
+ */
+static int get_map_cell(
+    const char* map_data, size_t plane_size, 
+    unsigned int cell_size, size_t index
+);
+
+/*!
+ * \brief The set_map_cell() function sets a tile of
+ *        decoded map data.
+ *
+ * \param map_data Decoded map data.
+ * \param plane_size Number of tiles of the map.
+ * \param cell_size Number of bytes of a tile.
+ * \param index Index of the tile.
+ * \param object The tile, or `-1` if there is no tile.
+ */
+static void set_map_cell(
+    char* map_data, size_t plane_size, 
+    unsigned int cell_size, size_t index, int object
+);
+
+/*!
+ * \brief The read_map_data() function reads the data
+ *        of a map.
+ *
+ * Run-length encoded map data are decoded. This function
+ * exits the program if the map data cannot be read.
+ *
+ * \param fd Opened map archive.
+ * \param map_header Header of the map.
+ *
+ * \return The decoded map data that must be freed.
+ *
+ * \note The file cursor is advanced to the end of the
+ *       map data.
+ */
+static char* read_map_data(int fd, const MapHeader* map_header);
+
+/*!
+ * \brief The write_map_data() function writes the header
+ *        and the data of a map.
+ *
+ * The map data are run-length encoded if the signature 
+ * of the header is \ref MAPF_RLE_HEADER. The size field 
+ * of the header is updated accordingly. Chunked maps are
+ * written by the write_map_chunks() function. This 
+ * function exits the program if the map cannot be written.
+ *
+ * \param fd Opened map archive.
+ * \param map_header Header of the map.
+ * \param map_data Decoded map data.
+ *
+ * \note The file cursor is advanced to the end of the
+ *       map data.
+ */
+static void write_map_data(
+    int fd, MapHeader* map_header, const char* map_data
+);
+
+/*!
+ * \brief The read_map_chunks() function reads the data
+ *        of a chunked map.
+ *
+ * This function exits the program if a chunk is 
+ * malformed.
+ *
+ * \param fd Opened map archive.
+ * \param map_header Header of the map.
+ * \param map_data Decoded map data, row after row, the
+ *                 planes of the tiles included.
+ *
+ * \note The file cursor is advanced to the end of the
+ *       last chunk.
+ *
+ * \see MAPC_HEADER
+ * \see MAPC_RLE_HEADER
+ */
+static void read_map_chunks(
+    int fd, const MapHeader* map_header, char* map_data
+);
+
+/*!
+ * \brief The write_map_chunks() function writes the 
+ *        header and the chunks of a chunked map.
+ *
+ * The width of the chunks is the last field of the 
+ * header. This function exits the program if the map
+ * cannot be written.
+ *
+ * \param fd Opened map archive.
+ * \param map_header Header of the map.
+ * \param map_data Decoded map data, row after row.
+ *
+ * \note The file cursor is advanced to the end of the
+ *       last chunk.
+ *
+ * \see MAPC_HEADER
+ * \see MAPC_RLE_HEADER
+ */
+static void write_map_chunks(
+    int fd, const MapHeader* map_header, const char* map_data
+);
+
 /*!
  * \brief The validate_object_properties_header() function
  *        validates the header of the properties
@@ -68,11 +540,231 @@ static void validate_object_properties_header(int fd);
 
 /*!
  * \brief The seek_mapf_header() function moves the 
- *        file cursor to the begining of the first map.
+ *        file cursor to the begining of the map of a
+ *        level.
+ *
+ * The first level is the map referenced by the archive
+ * header, the other ones are referenced by the level 
+ * directory. This function exits the program if the 
+ * level does not exist.
+ *
+ * \param fd Opened map archive.
+ * \param level Index of the level.
+ *
+ * \see read_level_count()
+ */
+static void seek_mapf_header(int fd, unsigned int level);
+
+/*!
+ * \brief The read_level_count() function gets the 
+ *        number of levels of a map archive.
+ *
+ * This function exits the program if the level 
+ * directory is not valid.
+ *
+ * \param fd Opened map archive.
+ *
+ * \return The number of levels, `1` if the archive has
+ *         no level directory.
+ *
+ * \note The file cursor is left unchanged.
+ *
+ * \see MDIR_HEADER
+ */
+static unsigned int read_level_count(int fd);
+
+/*!
+ * \brief The read_map_levels() function reads the 
+ *        headers and the data of all the levels of a 
+ *        map archive.
+ *
+ * If the archive ends with a checksum trailer, the map 
+ * data of each level are checked against the level 
+ * directory. This function exits the program if a level
+ * cannot be read or if a checksum does not match.
+ *
+ * \param fd Opened map archive.
+ * \param level_count Number of levels.
+ *
+ * \return The levels that must be freed with the
+ *         free_map_levels() function.
+ */
+static MapLevel* read_map_levels(int fd, unsigned int* level_count);
+
+/*!
+ * \brief The write_map_levels() function writes the 
+ *        levels of a map archive and its level directory.
+ *
+ * The levels are written one after the other, followed
+ * by the level directory if there are several of them.
+ * The offsets of the archive header are updated
+ * accordingly. Only \ref MARC_VERSION_2 archives may
+ * hold several levels.
+ *
+ * \param fd Opened map archive.
+ * \param levels Levels of the map archive.
+ * \param level_count Number of levels.
+ *
+ * \note The file cursor is advanced to the end of the
+ *       last level or of the level directory.
+ */
+static void write_map_levels(
+    int fd, MapLevel* levels, unsigned int level_count
+);
+
+/*!
+ * \brief The free_map_levels() function frees the 
+ *        levels read by the read_map_levels() function.
+ *
+ * \param levels Levels of a map archive.
+ * \param level_count Number of levels.
+ */
+static void free_map_levels(MapLevel* levels, unsigned int level_count);
+
+/*!
+ * \brief The is_resizable_in_place() function checks
+ *        whether a map can be resized in place.
+ *
+ * Only the raw map of an archive holding a single level
+ * can, its data being the last section of the archive.
  *
  * \param fd Opened map archive.
+ * \param map_header Header of the map.
+ *
+ * \return \p **1** if the map can be resized in place, 
+ *         \p **0** otherwise.
+ */
+static int is_resizable_in_place(int fd, const MapHeader* map_header);
+
+/*!
+ * \brief The resize_map_in_place() function resizes the
+ *        map of an archive in place.
+ *
+ * The tiles are moved by batches of rows through a
+ * buffer of \ref MAP_RESIZE_BUFFER_SIZE bytes, from the
+ * last row to the first one if the map grows and from 
+ * the first row to the last one otherwise, so that no
+ * row is overwritten before being read. The columns are
+ * added or removed on the right side of the map, the 
+ * rows on its top side. The archive is then truncated
+ * after the map data. This function exits the program if
+ * the map cannot be resized.
+ *
+ * \param fd Map archive opened in read and write mode.
+ * \param map_header Header of the map, updated.
+ * \param map_width New width of the map.
+ * \param map_height New height of the map.
+ *
+ * \note The file cursor is advanced to the end of the
+ *       map data, and the map must be resized along a 
+ *       single dimension.
+ *
+ * \see is_resizable_in_place()
+ */
+static void resize_map_in_place(
+    int fd, MapHeader* map_header, unsigned int map_width, 
+    unsigned int map_height
+);
+
+/*!
+ * \brief The resize_map_level() function resizes the 
+ *        map of a level in memory.
+ *
+ * The columns are added or removed on the right side of
+ * the map, the rows on the top side of each plane of its
+ * tiles. Added tiles reference the \ref MAP_OBJECT_NONE 
+ * map data.
+ *
+ * \param level Level of a map archive, updated.
+ * \param map_width New width of the map.
+ * \param map_height New height of the map.
+ */
+static void resize_map_level(
+    MapLevel* level, unsigned int map_width, unsigned int map_height
+);
+
+/*!
+ * \brief The exit_on_archive_error() function exits the
+ *        program if an operation on a map archive read in
+ *        memory failed.
+ *
+ * \param filename Map archive.
+ * \param result Result of the operation.
+ *
+ * \see map_archive_strerror()
+ */
+static void exit_on_archive_error(const char* filename, int result);
+
+/*!
+ * \brief The count_cells() function counts cells of a 
+ *        row holding the same value.
+ *
+ * \param stats Usage of the value.
+ * \param first_column First column of the cells.
+ * \param last_column Last column of the cells.
+ * \param row Row of the cells.
+ * \param count Number of cells.
+ */
+static void count_cells(
+    CellStats* stats, unsigned int first_column, 
+    unsigned int last_column, unsigned int row, unsigned int count
+);
+
+/*!
+ * \brief The count_row_cells() function counts the cells
+ *        of a row of a map by value.
+ *
+ * Blocks of `16` cells holding the same value are 
+ * counted at once if `SSE2` is available.
+ *
+ * \param low_plane Low bytes of the row.
+ * \param high_plane High bytes of the row, or `NULL` for
+ *                   tiles stored on `1` byte.
+ * \param map_width Width of the map.
+ * \param row Index of the row.
+ * \param stats Usage of each value of the map data.
+ */
+static void count_row_cells(
+    const unsigned char* low_plane, const unsigned char* high_plane,
+    unsigned int map_width, unsigned int row, CellStats* stats
+);
+
+/*!
+ * \brief The read_tile_color() function computes the 
+ *        average color of the `PNG` image of a tile.
+ *
+ * The pixels are blended over the background color by
+ * their opacity.
+ *
+ * \param filename Map archive, whose directory is used
+ *                 to resolve relative tile paths.
+ * \param tile_path Path of the tile.
+ * \param background Background color, as `0xRRGGBB`.
+ * \param color Average color, as `0xRRGGBB`.
+ *
+ * \return \p **0** if the color is computed, \p **-1**
+ *         if the image cannot be read.
+ */
+static int read_tile_color(
+    const char* filename, const char* tile_path, 
+    unsigned int background, unsigned int* color
+);
+
+/*!
+ * \brief The read_png_color() function computes the 
+ *        average color of a `PNG` image.
+ *
+ * \param png_filename `PNG` image.
+ * \param background Background color, as `0xRRGGBB`.
+ * \param color Average color, as `0xRRGGBB`.
+ *
+ * \return \p **0** if the color is computed, \p **-1**
+ *         if the image cannot be read.
  */
-static void seek_mapf_header(int fd);
+static int read_png_color(
+    const char* png_filename, unsigned int background, 
+    unsigned int* color
+);
 
 /*!
  * \brief The backup_archive() function makes
@@ -252,7 +944,7 @@ unsigned int get_map_width(const char* filename)
 
     /* Go to the MAPF file */
     
-    seek_mapf_header(fd);
+    seek_mapf_header(fd, map_level);
 
     /* Validate MAPF header */
 
@@ -289,7 +981,7 @@ unsigned int get_map_height(const char* filename)
 
     /* Go to the MAPF file */
     
-    seek_mapf_header(fd);
+    seek_mapf_header(fd, map_level);
 
     /* Validate MAPF header */
 
@@ -350,47 +1042,242 @@ unsigned int get_map_objects_count(const char* filename)
  *************************************************************/
 void get_map_info(const char* filename, MapInfo* info)
 {
-    /* Open the file in read only mode */
-
-    int fd = open(filename, O_RDONLY);
-    exit_on_error(fd < 0);
+    get_maps_info(&filename, 1, info);
+}
 
-    /* Validate MARC header */
+/*************************************************************
+ *************************************************************
+ *
+ * Get map width, map height and number of tiles of 
+ * several maps.
+ *
+ *************************************************************/
+void get_maps_info(
+    const char* const* filenames, unsigned int count, MapInfo* infos
+)
+{
+    if (!count)
+    {
+        return;
+    }
 
-    validate_marc_header(fd);
+    int* fds = malloc(count * sizeof(int));
+    exit_on_error(!fds);
 
-    /* Get number of tiles */
+    /* Archive headers, trailers, directory headers and map headers */
 
-    off_t seek_result = lseek(fd, 0x4, SEEK_SET);
-    exit_on_error(seek_result < 0);
+    unsigned int (*headers)[0x8] = calloc(count, sizeof(*headers));
+    unsigned int (*trailers)[0x4] = calloc(count, sizeof(*trailers));
+    unsigned int (*directories)[0x2] = calloc(count, sizeof(*directories));
+    unsigned int (*maps)[0x3] = calloc(count, sizeof(*maps));
+    unsigned long long* map_offsets = 
+        malloc(count * sizeof(unsigned long long));
+    IoRequest* requests = malloc(count * 0x3 * sizeof(IoRequest));
+    exit_on_error(!headers || !trailers || !directories || 
+        !maps || !map_offsets || !requests);
 
-    ssize_t rw_result = read(
-        fd, 
-        &info->map_objects_count, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+    /* Read the archive headers of all the maps at once */
 
-    /* Go to the MAPF file */
+    off_t* archive_sizes = malloc(count * sizeof(off_t));
+    exit_on_error(!archive_sizes);
 
-    seek_mapf_header(fd);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        fds[i] = open(filenames[i], O_RDONLY);
+        exit_on_error(fds[i] < 0);
 
-    /* Validate MAPF header */
-    
-    validate_mapf_header(fd);
+        struct stat archive_stat;
+        int result = fstat(fds[i], &archive_stat);
+        exit_on_error(result < 0);
 
-    /* Get the width */
+        archive_sizes[i] = archive_stat.st_size;
 
-    rw_result = read(fd, &info->map_width, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+        requests[i] = (IoRequest) {
+            IO_BATCH_READ, 
+            fds[i], 
+            headers[i], 
+            (archive_sizes[i] < (off_t)sizeof(*headers) ? 
+                (size_t)archive_sizes[i] : sizeof(*headers)), 
+            0
+        };
+    }
 
-    /* Get the height */
+    int result = io_batch_submit(requests, count);
+    exit_on_error(result < 0);
 
-    rw_result = read(fd, &info->map_height, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    /* Then their trailers, level directories and first maps */
 
-    int result = close(fd);
+    unsigned int request_count = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (headers[i][0x0] != MARC_HEADER && 
+            headers[i][0x0] != MARC_V2_HEADER)
+        {
+            fprintf(
+                stderr,
+                "MARC header [%x] does not match!\n",
+                headers[i][0x0]
+            );
+
+            exit(EXIT_FAILURE);
+        }
+
+        infos[i].map_objects_count = headers[i][0x1];
+
+        unsigned long long directory_offset = 0;
+        if (headers[i][0x0] == MARC_V2_HEADER)
+        {
+            memcpy(map_offsets + i, headers[i] + 0x4, 0x8);
+            memcpy(&directory_offset, headers[i] + 0x6, 0x8);
+        }
+        else
+        {
+            map_offsets[i] = headers[i][0x3];
+        }
+
+        if (archive_sizes[i] >= (off_t)sizeof(*trailers))
+        {
+            requests[request_count++] = (IoRequest) {
+                IO_BATCH_READ, 
+                fds[i], 
+                trailers[i], 
+                sizeof(*trailers), 
+                archive_sizes[i] - sizeof(*trailers)
+            };
+        }
+
+        if (directory_offset)
+        {
+            requests[request_count++] = (IoRequest) {
+                IO_BATCH_READ, 
+                fds[i], 
+                directories[i], 
+                sizeof(*directories), 
+                directory_offset
+            };
+        }
+        else
+        {
+            directories[i][0x0] = MDIR_HEADER;
+            directories[i][0x1] = 1;
+        }
+
+        if (!map_level)
+        {
+            requests[request_count++] = (IoRequest) {
+                IO_BATCH_READ, 
+                fds[i], 
+                maps[i], 
+                sizeof(*maps), 
+                map_offsets[i]
+            };
+        }
+    }
+
+    result = io_batch_submit(requests, request_count);
     exit_on_error(result < 0);
+
+    request_count = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        /* Only archives ending with a trailer are checksummed */
+
+        if (trailers[i][0x3] == MCRC_TRAILER)
+        {
+            off_t seek_result = lseek(fds[i], 0, SEEK_SET);
+            exit_on_error(seek_result < 0);
+
+            validate_marc_header(fds[i]);
+        }
+
+        if (directories[i][0x0] != MDIR_HEADER || !directories[i][0x1])
+        {
+            fprintf(
+                stderr,
+                "MDIR header [%x] does not match!\n",
+                directories[i][0x0]
+            );
+
+            exit(EXIT_FAILURE);
+        }
+
+        infos[i].map_levels_count = directories[i][0x1];
+        if (map_level >= infos[i].map_levels_count)
+        {
+            fprintf(stderr, "Level [%x] does not exist!\n", map_level);
+            exit(EXIT_FAILURE);
+        }
+
+        if (map_level)
+        {
+            /* Entry of the level in the directory */
+
+            unsigned long long directory_offset;
+            memcpy(&directory_offset, headers[i] + 0x6, 0x8);
+
+            requests[request_count++] = (IoRequest) {
+                IO_BATCH_READ, 
+                fds[i], 
+                map_offsets + i, 
+                sizeof(unsigned long long), 
+                directory_offset + 0x10 + map_level * 0x10
+            };
+        }
+    }
+
+    /* The maps of the other levels need two more batches */
+
+    if (request_count)
+    {
+        result = io_batch_submit(requests, request_count);
+        exit_on_error(result < 0);
+
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            requests[i] = (IoRequest) {
+                IO_BATCH_READ, 
+                fds[i], 
+                maps[i], 
+                sizeof(*maps), 
+                map_offsets[i]
+            };
+        }
+
+        result = io_batch_submit(requests, count);
+        exit_on_error(result < 0);
+    }
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (maps[i][0x0] != MAPF_HEADER && 
+            maps[i][0x0] != MAPF_RLE_HEADER &&
+            maps[i][0x0] != MAPC_HEADER && 
+            maps[i][0x0] != MAPC_RLE_HEADER)
+        {
+            fprintf(
+                stderr,
+                "MARF header [%x] does not match!\n",
+                maps[i][0x0]
+            );
+
+            exit(EXIT_FAILURE);
+        }
+
+        infos[i].map_width = maps[i][0x1];
+        infos[i].map_height = maps[i][0x2];
+
+        result = close(fds[i]);
+        exit_on_error(result < 0);
+    }
+
+    free(archive_sizes);
+    free(requests);
+    free(map_offsets);
+    free(maps);
+    free(directories);
+    free(trailers);
+    free(headers);
+    free(fds);
 }
 
 /*************************************************************
@@ -401,149 +1288,117 @@ void get_map_info(const char* filename, MapInfo* info)
  *************************************************************/
 void set_map_width(const char* filename, unsigned int map_width)
 {
-    /* Create a backup */
+    /* Create a backup, if enabled */
 
-    char* backup_filename = backup_archive(filename);
+    char* backup_filename = (map_backups ? backup_archive(filename) : NULL);
 
     /* Open the backup file in read only mode */
 
-    int fd_backup = open(backup_filename, O_RDONLY);
+    int fd_backup = open(
+        (backup_filename ? backup_filename : filename), 
+        O_RDONLY
+    );
     exit_on_error(fd_backup < 0); 
 
     /* Validate MARC header */
 
-    validate_marc_header(fd_backup); 
+    validate_marc_header(fd_backup);
+
+    unsigned int checksums[0x3];
+    int checksummed = read_archive_checksums(fd_backup, checksums);
 
     /* Go to the MAPF file */
 
-    seek_mapf_header(fd_backup);
+    seek_mapf_header(fd_backup, map_level);
 
-    /* Validate MAPF header */
+    /* Read MAPF header */
 
-    validate_mapf_header(fd_backup);
+    MapHeader map_header;
+    read_mapf_header(fd_backup, &map_header);
 
     /* Get old width */
 
-    unsigned int backup_map_width;
-    ssize_t rw_result = read(
-        fd_backup, 
-        &backup_map_width, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
-
+    unsigned int backup_map_width = map_header.width;
     if (map_width == backup_map_width)
     {
         int result = close(fd_backup);
         exit_on_error(result < 0);
-        remove_archive(backup_filename);
+        if (backup_filename)
+        {
+            remove_archive(backup_filename);
+        }
         free(backup_filename);
         return;
     }
 
     free(backup_filename);
 
-    /* Get map height */
+    /* Raw map of a single level */
 
-    unsigned int backup_map_height;
-    rw_result = read(
-        fd_backup, 
-        &backup_map_height, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+    if (is_resizable_in_place(fd_backup, &map_header))
+    {
+        int result = close(fd_backup);
+        exit_on_error(result < 0);
 
-    /* Go to map data */
+        /* Open the file in read and write mode */
 
-    off_t seek_result = lseek(fd_backup, 0x4, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+        int fd_new = open(filename, O_RDWR, 0666);
+        exit_on_error(fd_new < 0);
 
-    /* Open the file in read and write mode */
+        seek_mapf_header(fd_new, 0);
+        read_mapf_header(fd_new, &map_header);
+        resize_map_in_place(fd_new, &map_header, map_width, map_header.height);
 
-    int fd_new = open(filename, O_RDWR, 0666);
-    exit_on_error(fd_new < 0);
+        /* Checksum trailer */
 
-    /* Go to the MAPF file */
+        if (checksummed)
+        {
+            write_archive_checksums(fd_new);
+        }
 
-    seek_mapf_header(fd_new);
+        result = close(fd_new);
+        exit_on_error(result < 0);
+        return;
+    }
 
-    /* Update map width */
+    /* Read the map data of all the levels */
 
-    seek_result = lseek(fd_new, 0x4, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    unsigned int level_count;
+    MapLevel* levels = read_map_levels(fd_backup, &level_count);
 
-    rw_result = write(fd_new, &map_width, sizeof(unsigned int));
-    exit_on_error(rw_result < 0); 
+    /* Resize */
 
-    /* Update map size */
+    resize_map_level(&levels[map_level], map_width, map_header.height);
 
-    seek_result = lseek(fd_new, 0x4, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    /* Open the file in read and write mode */
 
-    unsigned int map_size = map_width * backup_map_height;
-    rw_result = write(fd_new, &map_size, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    int fd_new = open(filename, O_RDWR, 0666);
+    exit_on_error(fd_new < 0);
 
-    char map_data;
-    if(map_width > backup_map_width)
-    {
-        /* Expand */
+    /* Go to the first MAPF file */
 
-        char map_data_none = (char)MAP_OBJECT_NONE;
-        unsigned int padding = map_width - backup_map_width;
-        for (unsigned int y = 0; y < backup_map_height; ++y)
-        {
-            for (unsigned int x = 0; x < backup_map_width; ++x)
-            {
-                rw_result = read(fd_backup, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
+    seek_mapf_header(fd_new, 0);
 
-                rw_result = write(fd_new, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
-            }
-            
-            for (unsigned int x = 0; x < padding; ++x)
-            {
-                rw_result = write(
-                    fd_new, 
-                    &map_data_none, 
-                    sizeof(char)
-                );
-                exit_on_error(rw_result < 0);
-            }
-        }
-    }
-    else
-    {
-        /* Shrink */
-        
-        for (unsigned int y = 0; y < backup_map_height; ++y)
-        {
-            for (unsigned int x = 0; x < map_width; ++x)
-            {
-                rw_result = read(fd_backup, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
+    /* Write the map data of all the levels */
 
-                rw_result = write(fd_new, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
-            }
+    write_map_levels(fd_new, levels, level_count);
 
-            seek_result = lseek(
-                fd_backup, 
-                backup_map_width - map_width, 
-                SEEK_CUR
-            );
-            exit_on_error(seek_result < 0);
-        }
+    off_t seek_result = lseek(fd_new, 0, SEEK_CUR);
+    exit_on_error(seek_result < 0);
 
-        seek_result = lseek(fd_new, 0, SEEK_CUR);
-        exit_on_error(seek_result < 0);
+    int result = ftruncate(fd_new, seek_result);
+    exit_on_error(result < 0);
 
-        int result = ftruncate(fd_new, seek_result);
-        exit_on_error(result < 0);
+    /* Checksum trailer */
+
+    if (checksummed)
+    {
+        write_archive_checksums(fd_new);
     }
 
-    int result = close(fd_backup);
+    free_map_levels(levels, level_count);
+
+    result = close(fd_backup);
     exit_on_error(result < 0);
 
     result = close(fd_new);
@@ -558,149 +1413,117 @@ void set_map_width(const char* filename, unsigned int map_width)
  *************************************************************/
 void set_map_height(const char* filename, unsigned int map_height)
 {
-    /* Create a backup */
+    /* Create a backup, if enabled */
 
-    char* backup_filename = backup_archive(filename);
+    char* backup_filename = (map_backups ? backup_archive(filename) : NULL);
 
     /* Open the backup file in read only mode */
 
-    int fd_backup = open(backup_filename, O_RDONLY);
+    int fd_backup = open(
+        (backup_filename ? backup_filename : filename), 
+        O_RDONLY
+    );
     exit_on_error(fd_backup < 0); 
 
     /* Validate MARC header */
 
-    validate_marc_header(fd_backup); 
-
-    /* Go to the MAPF file */
-
-    seek_mapf_header(fd_backup);
+    validate_marc_header(fd_backup);
 
-    /* Validate MAPF header */
+    unsigned int checksums[0x3];
+    int checksummed = read_archive_checksums(fd_backup, checksums);
 
-    validate_mapf_header(fd_backup);
+    /* Go to the MAPF file */
 
-    /* Get old width */
+    seek_mapf_header(fd_backup, map_level);
 
-    unsigned int backup_map_width;
-    ssize_t rw_result = read(
-        fd_backup, 
-        &backup_map_width, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+    /* Read MAPF header */
 
-    /* Get map height */
+    MapHeader map_header;
+    read_mapf_header(fd_backup, &map_header);
 
-    unsigned int backup_map_height;
-    rw_result = read(
-        fd_backup, 
-        &backup_map_height, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+    /* Get old height */
 
+    unsigned int backup_map_height = map_header.height;
     if (map_height == backup_map_height)
     {
         int result = close(fd_backup);
         exit_on_error(result < 0);
-        remove_archive(backup_filename);
+        if (backup_filename)
+        {
+            remove_archive(backup_filename);
+        }
         free(backup_filename);
         return;
     }
 
     free(backup_filename);
 
-    /* Go to map data */
+    /* Raw map of a single level */
 
-    off_t seek_result = lseek(fd_backup, 0x4, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    if (is_resizable_in_place(fd_backup, &map_header))
+    {
+        int result = close(fd_backup);
+        exit_on_error(result < 0);
 
-    /* Open the file in read and write mode */
+        /* Open the file in read and write mode */
 
-    int fd_new = open(filename, O_RDWR, 0666);
-    exit_on_error(fd_new < 0);
+        int fd_new = open(filename, O_RDWR, 0666);
+        exit_on_error(fd_new < 0);
 
-    /* Go to the MAPF file */
+        seek_mapf_header(fd_new, 0);
+        read_mapf_header(fd_new, &map_header);
+        resize_map_in_place(fd_new, &map_header, map_header.width, map_height);
 
-    seek_mapf_header(fd_new);
+        /* Checksum trailer */
 
-    /* Update map height */
+        if (checksummed)
+        {
+            write_archive_checksums(fd_new);
+        }
 
-    seek_result = lseek(fd_new, 0x8, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+        result = close(fd_new);
+        exit_on_error(result < 0);
+        return;
+    }
 
-    rw_result = write(fd_new, &map_height, sizeof(unsigned int));
-    exit_on_error(rw_result < 0); 
+    /* Read the map data of all the levels */
 
-    /* Update map size */
+    unsigned int level_count;
+    MapLevel* levels = read_map_levels(fd_backup, &level_count);
 
-    unsigned int map_size = backup_map_width * map_height;
-    rw_result = write(fd_new, &map_size, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    /* Resize each plane of the tiles */
 
-    char map_data;
-    if(map_height > backup_map_height)
-    {
-        /* Expand */
+    resize_map_level(&levels[map_level], map_header.width, map_height);
 
-        char map_data_none = (char)MAP_OBJECT_NONE;
-        unsigned int padding = map_height - backup_map_height;
-        for (unsigned int y = 0; y < padding; ++y)
-        {
-            for (unsigned int x = 0; x < backup_map_width; ++x)
-            {
-                rw_result = write(
-                    fd_new, 
-                    &map_data_none, 
-                    sizeof(char)
-                );
-                exit_on_error(rw_result < 0);
-            }
-        }
+    /* Open the file in read and write mode */
 
-        for (unsigned int y = 0; y < backup_map_height; ++y)
-        {
-            for (unsigned int x = 0; x < backup_map_width; ++x)
-            {
-                rw_result = read(fd_backup, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
+    int fd_new = open(filename, O_RDWR, 0666);
+    exit_on_error(fd_new < 0);
 
-                rw_result = write(fd_new, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
-            }            
-        }
-    }
-    else
-    {
-        /* Shrink */
-       
-        seek_result = lseek(
-            fd_backup, 
-            (backup_map_height - map_height) * backup_map_width, 
-            SEEK_CUR
-        );
-        exit_on_error(seek_result < 0);
+    /* Go to the first MAPF file */
 
-        for (unsigned int y = 0; y < map_height; ++y)
-        {
-            for (unsigned int x = 0; x < backup_map_width; ++x)
-            {
-                rw_result = read(fd_backup, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
+    seek_mapf_header(fd_new, 0);
 
-                rw_result = write(fd_new, &map_data, sizeof(char));
-                exit_on_error(rw_result < 0);
-            }
-        }
+    /* Write the map data of all the levels */
 
-        seek_result = lseek(fd_new, 0, SEEK_CUR);
-        exit_on_error(seek_result < 0);
+    write_map_levels(fd_new, levels, level_count);
 
-        int result = ftruncate(fd_new, seek_result);
-        exit_on_error(result < 0);
+    off_t seek_result = lseek(fd_new, 0, SEEK_CUR);
+    exit_on_error(seek_result < 0);
+
+    int result = ftruncate(fd_new, seek_result);
+    exit_on_error(result < 0);
+
+    /* Checksum trailer */
+
+    if (checksummed)
+    {
+        write_archive_checksums(fd_new);
     }
 
-    int result = close(fd_backup);
+    free_map_levels(levels, level_count);
+
+    result = close(fd_backup);
     exit_on_error(result < 0);
 
     result = close(fd_new);
@@ -718,175 +1541,269 @@ void set_map_objects(
     unsigned int properties_count
 )
 {
-    char* backup_filename = backup_archive(filename);
-
-    /* Open the backup file in read only mode */
-
-    int fd_backup = open(backup_filename, O_RDONLY);
-    exit_on_error(fd_backup < 0);
-
-    /* Validate MARC header */
+    MapEdits edits = {0};
+    edits.properties = properties;
+    edits.properties_count = properties_count;
 
-    validate_marc_header(fd_backup); 
-
-    /* Get number of tiles */
+    edit_map(filename, &edits);
+}
 
-    unsigned int tiles_count;
-    ssize_t rw_result = read(
-        fd_backup, 
-        &tiles_count, 
-        sizeof(unsigned int)
+/*************************************************************
+ *************************************************************
+ *
+ * Prune objects.
+ *
+ *************************************************************/
+void prune_objects(const char* filename)
+{
+    MapEdits edits = {0};
+    edits.prune_objects = 1;
+
+    edit_map(filename, &edits);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Edit map.
+ *
+ *************************************************************/
+void edit_map(const char* filename, const MapEdits* edits)
+{
+    /* Create a backup, if enabled */
+
+    char* backup_filename = (map_backups ? backup_archive(filename) : NULL);
+
+    /* Read the whole archive */
+
+    int fd_backup = open(
+        (backup_filename ? backup_filename : filename), 
+        O_RDONLY
     );
-    exit_on_error(rw_result < 0);
+    exit_on_error(fd_backup < 0);
 
-    if (tiles_count > properties_count)
+    validate_marc_header(fd_backup);
+    if (edits->set_width || edits->set_height)
     {
-        int result = close(fd_backup);
-        exit_on_error(result < 0);
-        remove_archive(backup_filename);
-        free(backup_filename);
-        return;
-    }
+        /* The selected level must exist */
 
-    free(backup_filename);
+        seek_mapf_header(fd_backup, map_level);
+    }
 
-    /* Go to MAPF */
+    off_t seek_result = lseek(fd_backup, 0, SEEK_SET);
+    exit_on_error(seek_result < 0);
 
-    seek_mapf_header(fd_backup);
+    MapArchive* archive;
+    exit_on_archive_error(filename, map_archive_read(fd_backup, &archive));
 
-    /* Validate MAPF header */
+    int result = close(fd_backup);
+    exit_on_error(result < 0);
 
-    validate_mapf_header(fd_backup);
+    /* Apply the edits in order */
 
+    int modified = 0;
     unsigned int map_width;
-    rw_result = read(
-        fd_backup, 
-        &map_width, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
-
-    /* Get map height */
-
     unsigned int map_height;
-    rw_result = read(
-        fd_backup, 
-        &map_height, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+    if (edits->set_width)
+    {
+        exit_on_archive_error(
+            filename, 
+            map_archive_get_width(archive, map_level, &map_width)
+        );
+        if (edits->map_width != map_width)
+        {
+            exit_on_archive_error(
+                filename,
+                map_archive_set_width(archive, map_level, edits->map_width)
+            );
+            modified = 1;
+        }
+    }
 
-    off_t seek_result = lseek(fd_backup, -0xc, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    if (edits->set_height)
+    {
+        exit_on_archive_error(
+            filename, 
+            map_archive_get_height(archive, map_level, &map_height)
+        );
+        if (edits->map_height != map_height)
+        {
+            exit_on_archive_error(
+                filename,
+                map_archive_set_height(archive, map_level, edits->map_height)
+            );
+            modified = 1;
+        }
+    }
 
-    /* Open the file in read and write mode */
+    /* Fewer tiles than the map holds are ignored */
 
-    int fd_new = open(filename, O_RDWR, 0666);
-    exit_on_error(fd_new < 0);
+    if (edits->properties && map_archive_get_objects_count(archive) <= 
+        edits->properties_count)
+    {
+        if (edits->properties_count > MAP_MAX_OBJECTS)
+        {
+            fprintf(
+                stderr,
+                "Number of tiles [%x] exceeds [%x]!\n",
+                edits->properties_count,
+                MAP_MAX_OBJECTS
+            );
 
-    /* Write tile count */
+            exit(EXIT_FAILURE);
+        }
 
-    seek_result = lseek(fd_new, 0x4, SEEK_SET);
-    exit_on_error(seek_result < 0);
+        for (unsigned int i = 0; i < edits->properties_count; ++i)
+        {
+            if (strlen(edits->properties[i]->path) > PATH_TABLE_MAX_LENGTH)
+            {
+                fprintf(
+                    stderr,
+                    "Tile path [%s] is too long!\n",
+                    edits->properties[i]->path
+                );
 
-    rw_result = write(
-        fd_new, 
-        &properties_count, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+                exit(EXIT_FAILURE);
+            }
+        }
 
-    /* Write tile paths */
+        result = map_archive_set_objects(
+            archive, 
+            edits->properties, 
+            edits->properties_count
+        );
+        exit_on_archive_error(filename, result);
+        modified = 1;
+    }
 
-    char tile_paths[0x40] = {0};
-    seek_result = lseek(fd_new, 0x8, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    if (edits->prune_objects)
+    {
+        exit_on_archive_error(filename, map_archive_prune_objects(archive));
+        modified = 1;
+    }
 
-    for (unsigned int i = 0; i < properties_count; ++i)
+    /* Nothing to rewrite */
+
+    if (!modified)
     {
-        strcpy(tile_paths, properties[i]->path);
-        rw_result = write(fd_new, tile_paths, 0x40 * sizeof(char));
-        memset(tile_paths, 0, 0x40 * sizeof(char));
+        if (backup_filename)
+        {
+            remove_archive(backup_filename);
+        }
+        free(backup_filename);
+        map_archive_free(archive);
+        return;
     }
 
-    /* Update tile properties offset */
+    free(backup_filename);
+
+    /* Rewrite the archive once, then drop what is left */
+
+    int fd_new = open(filename, O_RDWR, 0666);
+    exit_on_error(fd_new < 0);
+
+    exit_on_archive_error(filename, map_archive_write(archive, fd_new));
+    map_archive_free(archive);
 
     seek_result = lseek(fd_new, 0, SEEK_CUR);
     exit_on_error(seek_result < 0);
 
-    unsigned int object_properties_offset = (unsigned int)seek_result;
-    seek_result = lseek(fd_new, 0x8, SEEK_SET);
-    exit_on_error(seek_result < 0);
+    result = ftruncate(fd_new, seek_result);
+    exit_on_error(result < 0);
 
-    rw_result = write(
-        fd_new, 
-        &object_properties_offset, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+    result = close(fd_new);
+    exit_on_error(result < 0);
+}
 
-    seek_result = lseek(fd_new, object_properties_offset, SEEK_SET);
-    exit_on_error(seek_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Set map encoding.
+ *
+ *************************************************************/
+void set_map_encoding(const char* filename, unsigned int encoding)
+{
+    /* Create a backup */
 
-    /* Write tile properties */
-
-    unsigned int tile_properties[0x8] = {0};
-    tile_properties[0] = OBJECT_PROPERTIES_HEADER;
-    for (unsigned int i = 0; i < properties_count; ++i)
-    {
-        tile_properties[0x1] = properties[i]->frames;
-        tile_properties[0x2] = properties[i]->solidity;
-        tile_properties[0x3] = properties[i]->destructible;
-        tile_properties[0x4] = properties[i]->collectible;
-        tile_properties[0x5] = properties[i]->generator;
-        rw_result = write(
-            fd_new, 
-            tile_properties, 
-            0x8 * sizeof(unsigned int)
-        );
-        exit_on_error(rw_result < 0);
-    }
+    char* backup_filename = backup_archive(filename);
 
-    /* Update map offset */
+    /* Open the backup file in read only mode */
 
-    seek_result = lseek(fd_new, 0, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    int fd_backup = open(backup_filename, O_RDONLY);
+    exit_on_error(fd_backup < 0); 
 
-    unsigned int map_offset = (unsigned int)seek_result;
-    seek_result = lseek(fd_new, 0xc, SEEK_SET);
-    exit_on_error(seek_result < 0);
+    /* Validate MARC header */
 
-    rw_result = write(fd_new, &map_offset, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    validate_marc_header(fd_backup);
 
-    seek_result = lseek(fd_new, map_offset, SEEK_SET);
-    exit_on_error(seek_result < 0);
+    unsigned int checksums[0x3];
+    int checksummed = read_archive_checksums(fd_backup, checksums);
 
-    /* MAPF header */
-    
-    char mapf_header[0xf];
-    rw_result = read(fd_backup, mapf_header, 0xf * sizeof(char));
-    exit_on_error(rw_result < 0);
+    /* Go to the MAPF file */
 
-    rw_result = write(fd_new, mapf_header, 0xf * sizeof(char));
-    exit_on_error(rw_result < 0);
+    seek_mapf_header(fd_backup, map_level);
 
-    /* Copy map */
+    /* Read MAPF header */
 
-    char map_data;
-    for (unsigned int y = 0; y < map_height; ++y)
+    MapHeader map_header;
+    read_mapf_header(fd_backup, &map_header);
+
+    unsigned int signature = 
+        (encoding == MAP_ENCODING_RLE ? MAPF_RLE_HEADER : MAPF_HEADER);
+    if (map_header.signature == MAPC_HEADER || 
+        map_header.signature == MAPC_RLE_HEADER)
     {
-        for (unsigned int x = 0; x < map_width; ++x)
-        {
-            rw_result = read(fd_backup, &map_data, sizeof(char));
-            exit_on_error(rw_result < 0);
+        /* The layout of the map is kept */
 
-            rw_result = write(fd_new, &map_data, sizeof(char));
-            exit_on_error(rw_result < 0);
-        }
+        signature = 
+            (encoding == MAP_ENCODING_RLE ? MAPC_RLE_HEADER : MAPC_HEADER);
+    }
+    if (map_header.signature == signature)
+    {
+        int result = close(fd_backup);
+        exit_on_error(result < 0);
+        remove_archive(backup_filename);
+        free(backup_filename);
+        return;
     }
 
-    int result = close(fd_backup);
+    free(backup_filename);
+
+    /* Read the map data of all the levels */
+
+    unsigned int level_count;
+    MapLevel* levels = read_map_levels(fd_backup, &level_count);
+
+    /* Open the file in read and write mode */
+
+    int fd_new = open(filename, O_RDWR, 0666);
+    exit_on_error(fd_new < 0);
+
+    /* Go to the first MAPF file */
+
+    seek_mapf_header(fd_new, 0);
+
+    /* Write map data with the new encoding */
+
+    levels[map_level].header.signature = signature;
+    write_map_levels(fd_new, levels, level_count);
+
+    off_t seek_result = lseek(fd_new, 0, SEEK_CUR);
+    exit_on_error(seek_result < 0);
+
+    int result = ftruncate(fd_new, seek_result);
+    exit_on_error(result < 0);
+
+    /* Checksum trailer */
+
+    if (checksummed)
+    {
+        write_archive_checksums(fd_new);
+    }
+
+    free_map_levels(levels, level_count);
+
+    result = close(fd_backup);
     exit_on_error(result < 0);
 
     result = close(fd_new);
@@ -896,10 +1813,10 @@ void set_map_objects(
 /*************************************************************
  *************************************************************
  *
- * Prune objects.
+ * Set map paths.
  *
  *************************************************************/
-void prune_objects(const char* filename)
+void set_map_paths(const char* filename, unsigned int encoding)
 {
     /* Create a backup */
 
@@ -908,267 +1825,1997 @@ void prune_objects(const char* filename)
     /* Open the backup file in read only mode */
 
     int fd_backup = open(backup_filename, O_RDONLY);
-    exit_on_error(fd_backup < 0);
-    free(backup_filename);
+    exit_on_error(fd_backup < 0); 
 
     /* Validate MARC header */
 
     validate_marc_header(fd_backup);
 
-    /* Get number of tiles */
+    unsigned int checksums[0x3];
+    int checksummed = read_archive_checksums(fd_backup, checksums);
 
-    unsigned int tiles_count;
-    ssize_t rw_result = read(
-        fd_backup, 
-        &tiles_count, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);    
-    
-    int used_tiles[tiles_count];
-    memset(used_tiles, 0, tiles_count * sizeof(int));
+    /* Read tile paths */
 
-    /* Go to the MAPF file */
+    PathTable tile_paths;
+    path_table_init(&tile_paths);
 
-    seek_mapf_header(fd_backup);
+    size_t tile_paths_size;
+    char* tiles = read_tile_paths(fd_backup, &tile_paths, &tile_paths_size);
 
-    /* Validate MAPF header */
+    unsigned int paths_encoding = (encoding == MAP_PATHS_PACKED ? 
+        PATH_TABLE_PACKED : PATH_TABLE_FIXED);
+    if (path_table_encoding(tiles, tile_paths_size) == paths_encoding)
+    {
+        free(tiles);
+        path_table_free(&tile_paths);
+
+        int result = close(fd_backup);
+        exit_on_error(result < 0);
+        remove_archive(backup_filename);
+        free(backup_filename);
+        return;
+    }
 
-    validate_mapf_header(fd_backup);
+    free(tiles);
+    free(backup_filename);
 
-    /* Get old width */
+    /* Read tile properties */
 
-    unsigned int map_width;
-    rw_result = read(
+    unsigned int tiles_count = tile_paths.count;
+    tiles = (char*)malloc(tiles_count * 0x20 * sizeof(char));
+    exit_on_error(tiles_count && tiles == NULL);
+
+    ssize_t rw_result = pread(
         fd_backup, 
-        &map_width, 
-        sizeof(unsigned int)
+        tiles, 
+        tiles_count * 0x20 * sizeof(char), 
+        read_archive_offset(fd_backup, 0)
     );
-    exit_on_error(rw_result < 0);
+    exit_on_error(rw_result < (ssize_t)(tiles_count * 0x20));
 
-    /* Get map height */
+    /* Read the MAPF headers and map data of all the levels */
 
-    unsigned int map_height;
-    rw_result = read(
-        fd_backup, 
-        &map_height, 
-        sizeof(unsigned int)
+    unsigned int level_count;
+    MapLevel* levels = read_map_levels(fd_backup, &level_count);
+
+    /* Open the file in read and write mode */
+
+    int fd_new = open(filename, O_RDWR, 0666);
+    exit_on_error(fd_new < 0);
+
+    /* Write tile paths with the new encoding */
+
+    off_t seek_result = lseek(
+        fd_new, 
+        get_header_size(levels[0x0].header.version), 
+        SEEK_SET
     );
+    exit_on_error(seek_result < 0);
+
+    write_tile_paths(fd_new, &tile_paths, paths_encoding);
+    path_table_free(&tile_paths);
+
+    /* Update tile properties offset */
+
+    seek_result = lseek(fd_new, 0, SEEK_CUR);
+    exit_on_error(seek_result < 0);
+
+    write_archive_offset(fd_new, 0, seek_result);
+
+    /* Copy tile properties */
+
+    rw_result = write(fd_new, tiles, tiles_count * 0x20 * sizeof(char));
     exit_on_error(rw_result < 0);
 
-   /* Go to map data */
+    free(tiles);
+
+    /* Copy levels and update their offsets */
 
-    off_t seek_result = lseek(fd_backup, 0x4, SEEK_CUR);
+    write_map_levels(fd_new, levels, level_count);
+
+    seek_result = lseek(fd_new, 0, SEEK_CUR);
     exit_on_error(seek_result < 0);
 
-    /* Count objects */
+    int result = ftruncate(fd_new, seek_result);
+    exit_on_error(result < 0);
+
+    /* Checksum trailer */
 
-    char map_data;
-    for (unsigned int y = 0; y < map_height; ++y)
+    if (checksummed)
     {
-        for (unsigned int x = 0; x < map_width; ++x)
-        {
-            rw_result = read(fd_backup, &map_data, sizeof(char));
-            exit_on_error(rw_result < 0);
-            
-            if (map_data != (char)MAP_OBJECT_NONE)
-            {
-                used_tiles[(int)map_data]++;
-            }
-        }
+        write_archive_checksums(fd_new);
     }
 
-    /* New tiles count */
+    free_map_levels(levels, level_count);
 
-    unsigned int new_tiles_count = 0;
-    for (unsigned int i = 0; i < tiles_count; ++i)
-    {
-        if (used_tiles[i])
-        {
-            ++new_tiles_count;
-        }
-    }
+    result = close(fd_backup);
+    exit_on_error(result < 0);
 
-    /* Go back to tile paths */
+    result = close(fd_new);
+    exit_on_error(result < 0);
+}
 
-    seek_result = lseek(fd_backup, 0x10, SEEK_SET);
-    exit_on_error(seek_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Add map levels.
+ *
+ *************************************************************/
+void add_map_levels(const char* filename, const char* level_filename)
+{
+    /* Read the levels to add */
 
-    /* Open the file in read and write mode */
+    int fd_level = open(level_filename, O_RDONLY);
+    exit_on_error(fd_level < 0);
 
-    int fd_new = open(filename, O_RDWR, 0666);
-    exit_on_error(fd_new < 0);
+    validate_marc_header(fd_level);
 
-    /* Write tiles count */
+    unsigned int added_count;
+    MapLevel* added_levels = read_map_levels(fd_level, &added_count);
 
-    seek_result = lseek(fd_new, 0x4, SEEK_SET);
-    exit_on_error(fd_new < 0);
+    int result = close(fd_level);
+    exit_on_error(result < 0);
+
+    /* Create a backup */
+
+    char* backup_filename = backup_archive(filename);
+
+    /* Open the backup file in read only mode */
+
+    int fd_backup = open(backup_filename, O_RDONLY);
+    exit_on_error(fd_backup < 0);
+    free(backup_filename);
+
+    /* Validate MARC header */
+
+    validate_marc_header(fd_backup);
+
+    unsigned int checksums[0x3];
+    int checksummed = read_archive_checksums(fd_backup, checksums);
+
+    /* Get number of tiles */
+
+    unsigned int tiles_count;
+    ssize_t rw_result = read(
+        fd_backup, 
+        &tiles_count, 
+        sizeof(unsigned int)
+    );
+    exit_on_error(rw_result < 0);
+
+    /* The added levels share the tiles of the archive */
+
+    for (unsigned int l = 0; l < added_count; ++l)
+    {
+        const MapHeader* map_header = &added_levels[l].header;
+        unsigned int map_size = map_header->width * map_header->height;
+        for (unsigned int i = 0; i < map_size; ++i)
+        {
+            int object = get_map_cell(
+                added_levels[l].data, 
+                map_size, 
+                map_header->cell_size, 
+                i
+            );
+            if (object >= 0 && (unsigned int)object >= tiles_count)
+            {
+                fprintf(
+                    stderr,
+                    "Tile [%x] of level [%x] does not exist!\n",
+                    object,
+                    l
+                );
+
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    /* Read the MAPF headers and map data of all the levels */
+
+    unsigned int level_count;
+    MapLevel* levels = read_map_levels(fd_backup, &level_count);
+
+    levels = (MapLevel*)realloc(
+        levels, 
+        (level_count + added_count) * sizeof(MapLevel)
+    );
+    exit_on_error(levels == NULL);
+
+    memcpy(
+        &levels[level_count], 
+        added_levels, 
+        added_count * sizeof(MapLevel)
+    );
+    free(added_levels);
+    level_count += added_count;
+
+    for (unsigned int l = 0; l < level_count; ++l)
+    {
+        levels[l].header.version = MARC_VERSION_2;
+    }
+
+    /* Open the file in read and write mode */
+
+    int fd_new = open(filename, O_RDWR, 0666);
+    exit_on_error(fd_new < 0);
+
+    if (read_archive_version(fd_backup) == MARC_VERSION_2)
+    {
+        /* Go to the first MAPF file */
+
+        seek_mapf_header(fd_new, 0);
+    }
+    else
+    {
+        /* Only version 2 archives hold a level directory */
+
+        unsigned int arch_header[0x8] = {MARC_V2_HEADER, tiles_count};
+        rw_result = write(fd_new, arch_header, sizeof(arch_header));
+        exit_on_error(rw_result < 0);
+
+        size_t tiles_size;
+        char* tiles = read_tile_paths(fd_backup, NULL, &tiles_size);
+
+        rw_result = write(fd_new, tiles, tiles_size);
+        exit_on_error(rw_result < 0);
+
+        free(tiles);
+
+        /* Update tile properties offset */
+
+        off_t seek_result = lseek(fd_new, 0, SEEK_CUR);
+        exit_on_error(seek_result < 0);
+
+        write_archive_offset(fd_new, 0, seek_result);
+
+        tiles = (char*)malloc(tiles_count * 0x20 * sizeof(char));
+        exit_on_error(tiles_count && tiles == NULL);
+
+        rw_result = pread(
+            fd_backup, 
+            tiles, 
+            tiles_count * 0x20 * sizeof(char), 
+            read_archive_offset(fd_backup, 0)
+        );
+        exit_on_error(rw_result < (ssize_t)(tiles_count * 0x20));
+
+        rw_result = write(fd_new, tiles, tiles_count * 0x20 * sizeof(char));
+        exit_on_error(rw_result < 0);
+
+        free(tiles);
+    }
+
+    /* Write levels and level directory */
+
+    write_map_levels(fd_new, levels, level_count);
+
+    off_t seek_result = lseek(fd_new, 0, SEEK_CUR);
+    exit_on_error(seek_result < 0);
+
+    result = ftruncate(fd_new, seek_result);
+    exit_on_error(result < 0);
+
+    /* Checksum trailer */
+
+    if (checksummed)
+    {
+        write_archive_checksums(fd_new);
+    }
+
+    free_map_levels(levels, level_count);
+
+    result = close(fd_backup);
+    exit_on_error(result < 0);
+
+    result = close(fd_new);
+    exit_on_error(result < 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Render map thumbnail.
+ *
+ *************************************************************/
+void render_map_thumbnail(
+    const char* filename, const char* thumbnail_filename
+)
+{
+    /* Open the file in read only mode */
+
+    int fd = open(filename, O_RDONLY);
+    exit_on_error(fd < 0);
+
+    /* Validate MARC header */
+
+    validate_marc_header(fd);
+
+    /* Tile paths */
+
+    PathTable tile_paths;
+    path_table_init(&tile_paths);
+
+    size_t tile_paths_size;
+    free(read_tile_paths(fd, &tile_paths, &tile_paths_size));
+
+    /* Go to the MAPF file */
+
+    seek_mapf_header(fd, map_level);
+
+    /* Read MAPF header and map data */
+
+    MapHeader map_header;
+    read_mapf_header(fd, &map_header);
+
+    char* map_data = read_map_data(fd, &map_header);
+
+    int result = close(fd);
+    exit_on_error(result < 0);
+
+    /* 
+        Palette
+
+        Colors are packed in lanes of 21 bits, red, green
+        then blue, so that a single addition accumulates
+        the three channels of a tile. A lane holds the sum
+        of up to THUMBNAIL_LANE_CELLS tiles.
+     */
+
+    unsigned int background = 0;
+    read_tile_color(filename, "images/background.png", 0, &background);
+
+    unsigned int palette_size = 1u << (map_header.cell_size * 8);
+    unsigned long long* palette = (unsigned long long*)malloc(
+        palette_size * sizeof(unsigned long long)
+    );
+    exit_on_error(palette == NULL);
+
+    unsigned int* path_colors = (unsigned int*)calloc(
+        tile_paths.strings_size + 1, 
+        sizeof(unsigned int)
+    );
+    exit_on_error(path_colors == NULL);
+
+    for (unsigned int i = 0; i < palette_size; ++i)
+    {
+        unsigned int color = background;
+        if (i < tile_paths.count && i != palette_size - 1)
+        {
+            /* The color of a path is computed once */
+
+            unsigned int offset = tile_paths.offsets[i];
+            const char* tile_path = path_table_get(&tile_paths, i);
+            if (!path_colors[offset])
+            {
+                if (read_tile_color(
+                        filename, 
+                        tile_path, 
+                        background, 
+                        &color
+                    ) < 0)
+                {
+                    color = crc32c(0, tile_path, strlen(tile_path));
+                }
+
+                path_colors[offset] = 0x1000000 | (color & 0xffffff);
+            }
+
+            color = path_colors[offset];
+        }
+
+        palette[i] = (unsigned long long)((color >> 0x10) & 0xff) | 
+            (unsigned long long)((color >> 0x8) & 0xff) << 0x15 | 
+            (unsigned long long)(color & 0xff) << 0x2a;
+    }
+
+    free(path_colors);
+    path_table_free(&tile_paths);
+
+    /* Size of the thumbnail */
+
+    size_t map_w = map_header.width;
+    size_t map_h = map_header.height;
+    size_t scale = (map_w + THUMBNAIL_MAX_WIDTH - 1) / THUMBNAIL_MAX_WIDTH;
+    if (!scale)
+    {
+        scale = 1;
+    }
+
+    size_t thumbnail_w = (map_w + scale - 1) / scale;
+    size_t thumbnail_h = (map_h + scale - 1) / scale;
+
+    unsigned char* pixels = (unsigned char*)malloc(
+        (thumbnail_w * thumbnail_h * 0x3 + 1) * sizeof(unsigned char)
+    );
+    exit_on_error(pixels == NULL);
+
+    unsigned long long* sums = (unsigned long long*)calloc(
+        thumbnail_w * 0x3 + 1, 
+        sizeof(unsigned long long)
+    );
+    exit_on_error(sums == NULL);
+
+    /* Single pass over the map data, row after row */
+
+    const unsigned char* low_plane = (const unsigned char*)map_data;
+    const unsigned char* high_plane = (map_header.cell_size > 1 ? 
+        &low_plane[map_w * map_h] : NULL);
+    for (size_t y = 0; y < map_h; ++y)
+    {
+        const unsigned char* low_row = &low_plane[y * map_w];
+        const unsigned char* high_row = 
+            (high_plane ? &high_plane[y * map_w] : NULL);
+        for (size_t block = 0; block < thumbnail_w; ++block)
+        {
+            size_t x = block * scale;
+            size_t block_end = (x + scale < map_w ? x + scale : map_w);
+            while (x < block_end)
+            {
+                size_t run_end = (block_end - x > THUMBNAIL_LANE_CELLS ?
+                    x + THUMBNAIL_LANE_CELLS : block_end);
+
+                unsigned long long lanes = 0;
+                if (high_row)
+                {
+                    for (; x < run_end; ++x)
+                    {
+                        lanes += palette[low_row[x] | high_row[x] << 0x8];
+                    }
+                }
+                else
+                {
+                    for (; x < run_end; ++x)
+                    {
+                        lanes += palette[low_row[x]];
+                    }
+                }
+
+                sums[block * 0x3] += lanes & 0x1fffff;
+                sums[block * 0x3 + 0x1] += (lanes >> 0x15) & 0x1fffff;
+                sums[block * 0x3 + 0x2] += lanes >> 0x2a;
+            }
+        }
+
+        /* A row of blocks is complete */
+
+        if ((y + 1) % scale && y + 1 < map_h)
+        {
+            continue;
+        }
+
+        size_t block_y = y / scale;
+        size_t block_h = y + 1 - block_y * scale;
+        unsigned char* pixel_row = &pixels[block_y * thumbnail_w * 0x3];
+        for (size_t block = 0; block < thumbnail_w; ++block)
+        {
+            size_t block_w = (map_w - block * scale < scale ? 
+                map_w - block * scale : scale);
+            unsigned long long count = block_w * block_h;
+            for (unsigned int channel = 0; channel < 0x3; ++channel)
+            {
+                pixel_row[block * 0x3 + channel] = (unsigned char)(
+                    (sums[block * 0x3 + channel] + count / 2) / count
+                );
+                sums[block * 0x3 + channel] = 0;
+            }
+        }
+    }
+
+    free(sums);
+    free(palette);
+    free(map_data);
+
+    /* Binary PPM image */
+
+    char ppm_header[0x40];
+    int ppm_header_size = snprintf(
+        ppm_header, 
+        sizeof(ppm_header), 
+        "P6\n%zu %zu\n255\n", 
+        thumbnail_w, 
+        thumbnail_h
+    );
+
+    int fd_out = open(
+        thumbnail_filename, 
+        O_CREAT | O_WRONLY | O_TRUNC, 
+        0666
+    );
+    exit_on_error(fd_out < 0);
+
+    struct iovec sections[] = {
+        {ppm_header, (size_t)ppm_header_size},
+        {pixels, thumbnail_w * thumbnail_h * 0x3}
+    };
+    ssize_t rw_result = writev(fd_out, sections, 0x2);
+    exit_on_error(
+        rw_result < (ssize_t)(sections[0].iov_len + sections[1].iov_len)
+    );
+
+    result = close(fd_out);
+    exit_on_error(result < 0);
+
+    free(pixels);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get map stats.
+ *
+ *************************************************************/
+void get_map_stats(const char* filename, MapStats* stats)
+{
+    /* Open the file in read only mode */
+
+    int fd = open(filename, O_RDONLY);
+    exit_on_error(fd < 0);
+
+    /* Validate MARC header */
+
+    validate_marc_header(fd);
+
+    /* Tile paths and tile properties */
+
+    PathTable tile_paths;
+    path_table_init(&tile_paths);
+
+    size_t tile_paths_size;
+    free(read_tile_paths(fd, &tile_paths, &tile_paths_size));
+
+    unsigned int tiles_count = tile_paths.count;
+    size_t tile_properties_size = tiles_count * 0x20;
+    char* tile_properties = (char*)malloc(
+        (tile_properties_size + 1) * sizeof(char)
+    );
+    exit_on_error(tile_properties == NULL);
+
+    ssize_t rw_result = pread(
+        fd, 
+        tile_properties, 
+        tile_properties_size, 
+        read_archive_offset(fd, 0)
+    );
+    exit_on_error(rw_result < 0);
+
+    if ((size_t)rw_result < tile_properties_size)
+    {
+        fprintf(stderr, "Tile properties do not match!\n");
+
+        exit(EXIT_FAILURE);
+    }
+
+    /* Go to the MAPF file */
+
+    seek_mapf_header(fd, map_level);
+
+    /* Read MAPF header and map data */
+
+    MapHeader map_header;
+    read_mapf_header(fd, &map_header);
+
+    char* map_data = read_map_data(fd, &map_header);
+
+    int result = close(fd);
+    exit_on_error(result < 0);
+
+    /* Single pass over the map data, row after row */
+
+    unsigned int map_width = map_header.width;
+    unsigned int map_height = map_header.height;
+    size_t map_size = (size_t)map_width * map_height;
+    size_t table_size = (size_t)1 << (map_header.cell_size * 8);
+
+    CellStats* cells = (CellStats*)calloc(table_size, sizeof(CellStats));
+    exit_on_error(cells == NULL);
+
+    const unsigned char* low_plane = (const unsigned char*)map_data;
+    const unsigned char* high_plane = 
+        (map_header.cell_size > 1 ? &low_plane[map_size] : NULL);
+    for (unsigned int y = 0; y < map_height; ++y)
+    {
+        size_t row = (size_t)y * map_width;
+        count_row_cells(
+            &low_plane[row], 
+            (high_plane ? &high_plane[row] : NULL), 
+            map_width, 
+            y, 
+            cells
+        );
+    }
+
+    free(map_data);
+
+    /* Join the counts with the tile properties */
+
+    memset(stats, 0, sizeof(MapStats));
+    stats->map_width = map_width;
+    stats->map_height = map_height;
+    stats->empty_cells = cells[table_size - 1].cells;
+    stats->air_cells = stats->empty_cells;
+    stats->objects_count = tiles_count;
+    stats->objects = (MapObjectStats*)calloc(
+        tiles_count + 1, 
+        sizeof(MapObjectStats)
+    );
+    exit_on_error(stats->objects == NULL);
+
+    for (unsigned int i = 0; i < tiles_count; ++i)
+    {
+        unsigned int fields[0x8];
+        memcpy(fields, &tile_properties[i * 0x20], sizeof(fields));
+        if (fields[0x0] != OBJECT_PROPERTIES_HEADER)
+        {
+            fprintf(
+                stderr,
+                "Object header [%x] does not match!\n",
+                fields[0x0]
+            );
+
+            exit(EXIT_FAILURE);
+        }
+
+        MapObjectStats* object = &stats->objects[i];
+        const char* tile_path = path_table_get(&tile_paths, i);
+        size_t tile_path_size = strlen(tile_path);
+        if (tile_path_size >= sizeof(object->path))
+        {
+            tile_path_size = sizeof(object->path) - 1;
+        }
+        memcpy(object->path, tile_path, tile_path_size);
+
+        /* The last value stands for none */
+
+        if (i >= table_size - 1 || !cells[i].cells)
+        {
+            continue;
+        }
+
+        object->cells = cells[i].cells;
+        object->first_column = cells[i].first_column;
+        object->last_column = cells[i].last_column;
+        object->first_row = cells[i].first_row;
+        object->last_row = cells[i].last_row;
+
+        switch (fields[0x2])
+        {
+            case MAP_OBJECT_AIR:
+                stats->air_cells += object->cells;
+                break;
+            case MAP_OBJECT_SEMI_SOLID:
+                stats->semi_solid_cells += object->cells;
+                break;
+            case MAP_OBJECT_SOLID:
+                stats->solid_cells += object->cells;
+                break;
+        }
+
+        if (fields[0x3])
+        {
+            stats->destructible_cells += object->cells;
+        }
+
+        if (fields[0x4])
+        {
+            stats->collectible_cells += object->cells;
+        }
+    }
+
+    free(cells);
+    free(tile_properties);
+    path_table_free(&tile_paths);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Free map stats.
+ *
+ *************************************************************/
+void free_map_stats(MapStats* stats)
+{
+    free(stats->objects);
+    stats->objects = NULL;
+    stats->objects_count = 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set map level.
+ *
+ *************************************************************/
+void set_map_level(unsigned int level)
+{
+    map_level = level;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set map backups.
+ *
+ *************************************************************/
+void set_map_backups(int enabled)
+{
+    map_backups = enabled;
+}
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Validate MARC.
+ *
+ *************************************************************/
+void validate_marc_header(int fd)
+{
+    unsigned int header;
+    ssize_t rw_result = read(fd, &header, sizeof(unsigned int));
+    exit_on_error(rw_result < 0);
+
+    if (header != MARC_HEADER && header != MARC_V2_HEADER)
+    {
+        fprintf(
+            stderr,
+            "MARC header [%x] does not match!\n",
+            header
+        );
+
+        exit(EXIT_FAILURE);
+    }
+
+    /* Checksum trailer */
+
+    unsigned int checksums[0x3];
+    if (!read_archive_checksums(fd, checksums))
+    {
+        return;
+    }
+
+    off_t cursor = lseek(fd, 0, SEEK_CUR);
+    exit_on_error(cursor < 0);
+
+    unsigned int archive_checksums[0x3];
+    compute_archive_checksums(fd, archive_checksums);
+
+    static const char* const sections[0x3] = {
+        "tile paths", 
+        "tile properties", 
+        "map data"
+    };
+    for (int i = 0; i < 0x3; ++i)
+    {
+        if (archive_checksums[i] != checksums[i])
+        {
+            fprintf(
+                stderr,
+                "Checksum of the %s does not match!\n",
+                sections[i]
+            );
+
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    off_t seek_result = lseek(fd, cursor, SEEK_SET);
+    exit_on_error(seek_result < 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read checksums.
+ *
+ *************************************************************/
+int read_archive_checksums(int fd, unsigned int* checksums)
+{
+    off_t cursor = lseek(fd, 0, SEEK_CUR);
+    exit_on_error(cursor < 0);
+
+    struct stat archive_stat;
+    int result = fstat(fd, &archive_stat);
+    exit_on_error(result < 0);
+
+    /* End of the first map */
+
+    seek_mapf_header(fd, 0);
+
+    off_t map_offset = lseek(fd, 0, SEEK_CUR);
+    exit_on_error(map_offset < 0);
+
+    MapHeader map_header;
+    read_mapf_header(fd, &map_header);
+
+    off_t map_end = 
+        map_offset + get_header_size(map_header.version) + map_header.size;
+    if (map_header.signature == MAPC_HEADER || 
+        map_header.signature == MAPC_RLE_HEADER)
+    {
+        /* The last entry of the chunk table */
+
+        size_t offset_size = get_offset_size(map_header.version);
+        unsigned long long chunk_width = map_header.size;
+        unsigned long long chunk_count = (chunk_width ? 
+            (map_header.width + chunk_width - 1) / chunk_width : 0);
+
+        off_t seek_result = lseek(fd, chunk_count * offset_size, SEEK_CUR);
+        exit_on_error(seek_result < 0);
+
+        unsigned long long chunks_end = 0;
+        ssize_t rw_result = read(fd, &chunks_end, offset_size);
+        exit_on_error(rw_result < 0);
+
+        map_end = map_offset + chunks_end;
+    }
+
+    /* Trailer */
+
+    unsigned int trailer[0x4] = {0};
+    if (archive_stat.st_size >= map_end + 0x10)
+    {
+        off_t seek_result = lseek(fd, -0x10, SEEK_END);
+        exit_on_error(seek_result < 0);
+
+        ssize_t rw_result = read(fd, trailer, sizeof(trailer));
+        exit_on_error(rw_result < (ssize_t)sizeof(trailer));
+    }
+
+    off_t seek_result = lseek(fd, cursor, SEEK_SET);
+    exit_on_error(seek_result < 0);
+
+    memcpy(checksums, trailer, 0x3 * sizeof(unsigned int));
+    return (trailer[0x3] == MCRC_TRAILER);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Compute checksums.
+ *
+ *************************************************************/
+void compute_archive_checksums(int fd, unsigned int* checksums)
+{
+    off_t seek_result = lseek(fd, 0, SEEK_SET);
+    exit_on_error(seek_result < 0);
+
+    unsigned int arch_header[0x2];
+    ssize_t rw_result = read(fd, arch_header, sizeof(arch_header));
+    exit_on_error(rw_result < (ssize_t)sizeof(arch_header));
+
+    /* Tile paths and tile properties */
+
+    size_t tile_paths_size;
+    char* tiles = read_tile_paths(fd, NULL, &tile_paths_size);
+    checksums[0x0] = crc32c(0, tiles, tile_paths_size);
+
+    free(tiles);
+
+    unsigned int tiles_count = arch_header[0x1];
+    tiles = (char*)malloc(tiles_count * 0x20 * sizeof(char));
+    exit_on_error(tiles_count && tiles == NULL);
+
+    seek_result = lseek(fd, read_archive_offset(fd, 0), SEEK_SET);
+    exit_on_error(seek_result < 0);
+
+    rw_result = read(fd, tiles, tiles_count * 0x20 * sizeof(char));
+    exit_on_error(rw_result < (ssize_t)(tiles_count * 0x20 * sizeof(char)));
+    checksums[0x1] = crc32c(0, tiles, tiles_count * 0x20);
+
+    free(tiles);
+
+    /* Map data of the first level */
+
+    seek_mapf_header(fd, 0);
+
+    MapHeader map_header;
+    read_mapf_header(fd, &map_header);
+
+    char* map_data = read_map_data(fd, &map_header);
+    checksums[0x2] = crc32c(
+        0, 
+        map_data, 
+        map_header.width * map_header.height * map_header.cell_size
+    );
+
+    free(map_data);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write checksums.
+ *
+ *************************************************************/
+void write_archive_checksums(int fd)
+{
+    off_t cursor = lseek(fd, 0, SEEK_CUR);
+    exit_on_error(cursor < 0);
+
+    unsigned int trailer[0x4];
+    compute_archive_checksums(fd, trailer);
+    trailer[0x3] = MCRC_TRAILER;
+
+    ssize_t rw_result = pwrite(fd, trailer, sizeof(trailer), cursor);
+    exit_on_error(rw_result < 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Validate MAPF.
+ *
+ *************************************************************/
+void validate_mapf_header(int fd)
+{
+    unsigned int header;
+    ssize_t rw_result = read(fd, &header, sizeof(unsigned int));
+    exit_on_error(rw_result < 0);
+
+    if (header != MAPF_HEADER && header != MAPF_RLE_HEADER &&
+        header != MAPC_HEADER && header != MAPC_RLE_HEADER)
+    {
+        fprintf(
+            stderr,
+            "MARF header [%x] does not match!\n",
+            header
+        );
+
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read archive version.
+ *
+ *************************************************************/
+unsigned int read_archive_version(int fd)
+{
+    unsigned int header;
+    ssize_t rw_result = pread(fd, &header, sizeof(unsigned int), 0);
+    exit_on_error(rw_result < (ssize_t)sizeof(unsigned int));
+
+    return (header == MARC_V2_HEADER ? MARC_VERSION_2 : MARC_VERSION_1);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get header size.
+ *
+ *************************************************************/
+size_t get_header_size(unsigned int version)
+{
+    return (version == MARC_VERSION_1 ? 0x10 : 0x20);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get offset size.
+ *
+ *************************************************************/
+size_t get_offset_size(unsigned int version)
+{
+    return (version == MARC_VERSION_1 ? 
+        sizeof(unsigned int) : sizeof(unsigned long long));
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read archive offset.
+ *
+ *************************************************************/
+unsigned long long read_archive_offset(int fd, unsigned int section)
+{
+    size_t offset_size = get_offset_size(read_archive_version(fd));
+
+    unsigned long long offset = 0;
+    ssize_t rw_result = pread(
+        fd, 
+        &offset, 
+        offset_size, 
+        0x8 + section * offset_size
+    );
+    exit_on_error(rw_result < (ssize_t)offset_size);
+
+    return offset;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write archive offset.
+ *
+ *************************************************************/
+void write_archive_offset(
+    int fd, unsigned int section, unsigned long long offset
+)
+{
+    size_t offset_size = get_offset_size(read_archive_version(fd));
+
+    ssize_t rw_result = pwrite(
+        fd, 
+        &offset, 
+        offset_size, 
+        0x8 + section * offset_size
+    );
+    exit_on_error(rw_result < 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read tile paths.
+ *
+ *************************************************************/
+char* read_tile_paths(
+    int fd, PathTable* tile_paths, size_t* tile_paths_size
+)
+{
+    unsigned int tiles_count;
+    ssize_t rw_result = pread(fd, &tiles_count, sizeof(unsigned int), 0x4);
+    exit_on_error(rw_result < (ssize_t)sizeof(unsigned int));
+
+    /* The table ends where the tile properties start */
+
+    size_t header_size = get_header_size(read_archive_version(fd));
+    unsigned long long tile_properties_offset = read_archive_offset(fd, 0);
+    size_t size = (tile_properties_offset > header_size ? 
+        tile_properties_offset - header_size : tiles_count * 0x40);
+
+    char* section = (char*)malloc(size * sizeof(char));
+    exit_on_error(size && section == NULL);
+
+    rw_result = pread(fd, section, size, header_size);
+    exit_on_error(rw_result < 0);
+
+    PathTable table;
+    path_table_init(&table);
+
+    ssize_t table_size = path_table_parse(
+        (tile_paths ? tile_paths : &table), 
+        section, 
+        rw_result, 
+        tiles_count
+    );
+    path_table_free(&table);
+    if (table_size < 0)
+    {
+        fprintf(stderr, "Tile paths do not match!\n");
+
+        exit(EXIT_FAILURE);
+    }
+
+    *tile_paths_size = table_size;
+
+    return section;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write tile paths.
+ *
+ *************************************************************/
+void write_tile_paths(
+    int fd, const PathTable* tile_paths, unsigned int encoding
+)
+{
+    size_t size = path_table_size(tile_paths, encoding);
+    char* section = (char*)malloc(size * sizeof(char));
+    exit_on_error(size && section == NULL);
+
+    path_table_format(tile_paths, encoding, section);
+
+    ssize_t rw_result = write(fd, section, size);
+    exit_on_error(rw_result < 0);
+
+    free(section);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read MAPF.
+ *
+ *************************************************************/
+void read_mapf_header(int fd, MapHeader* map_header)
+{
+    validate_mapf_header(fd);
+
+    off_t seek_result = lseek(fd, -0x4, SEEK_CUR);
+    exit_on_error(seek_result < 0);
+
+    unsigned int version = read_archive_version(fd);
+    size_t header_size = get_header_size(version);
+
+    unsigned int fields[0x8];
+    ssize_t rw_result = read(fd, fields, header_size);
+    exit_on_error(rw_result < (ssize_t)header_size);
+
+    map_header->version = version;
+    map_header->signature = fields[0x0];
+    map_header->width = fields[0x1];
+    map_header->height = fields[0x2];
+    if (version == MARC_VERSION_1)
+    {
+        map_header->cell_size = 1;
+        map_header->size = fields[0x3];
+        return;
+    }
+
+    map_header->cell_size = fields[0x3];
+    memcpy(&map_header->size, &fields[0x4], sizeof(unsigned long long));
+    if (map_header->cell_size != 1 && map_header->cell_size != 2)
+    {
+        fprintf(
+            stderr,
+            "Tile size [%x] does not match!\n",
+            map_header->cell_size
+        );
+
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write MAPF.
+ *
+ *************************************************************/
+void write_mapf_header(int fd, const MapHeader* map_header)
+{
+    unsigned int fields[0x8] = {
+        map_header->signature,
+        map_header->width,
+        map_header->height,
+        (unsigned int)map_header->size
+    };
+    if (map_header->version != MARC_VERSION_1)
+    {
+        fields[0x3] = map_header->cell_size;
+        memcpy(&fields[0x4], &map_header->size, sizeof(unsigned long long));
+    }
+
+    size_t header_size = get_header_size(map_header->version);
+    ssize_t rw_result = write(fd, fields, header_size);
+    exit_on_error(rw_result < 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get map cell.
+ *
+ *************************************************************/
+int get_map_cell(
+    const char* map_data, size_t plane_size, 
+    unsigned int cell_size, size_t index
+)
+{
+    /* The high bytes are in the last plane */
+
+    unsigned int cell = 0;
+    for (unsigned int plane = cell_size; plane--; )
+    {
+        cell = (cell << 8) | 
+            (unsigned char)map_data[plane * plane_size + index];
+    }
+
+    if (cell == (1u << (cell_size * 8)) - 1)
+    {
+        return -1;
+    }
+
+    return (int)cell;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Set map cell.
+ *
+ *************************************************************/
+void set_map_cell(
+    char* map_data, size_t plane_size, 
+    unsigned int cell_size, size_t index, int object
+)
+{
+    unsigned int cell = (unsigned int)object;
+    for (unsigned int plane = 0; plane < cell_size; ++plane)
+    {
+        map_data[plane * plane_size + index] = (char)(cell & 0xff);
+        cell >>= 8;
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read map data.
+ *
+ *************************************************************/
+char* read_map_data(int fd, const MapHeader* map_header)
+{
+    unsigned int map_size = 
+        map_header->width * map_header->height * map_header->cell_size;
+    char* map_data = (char*)malloc(
+        (map_size + RLE_DECODE_PADDING) * sizeof(char)
+    );
+    exit_on_error(map_data == NULL);
+
+    if (map_header->signature == MAPC_HEADER || 
+        map_header->signature == MAPC_RLE_HEADER)
+    {
+        read_map_chunks(fd, map_header, map_data);
+        return map_data;
+    }
+
+    if (map_header->signature != MAPF_RLE_HEADER)
+    {
+        ssize_t rw_result = read(fd, map_data, map_size * sizeof(char));
+        exit_on_error(rw_result < (ssize_t)(map_size * sizeof(char)));
+
+        return map_data;
+    }
+
+    /* Run-length encoded map data */
+
+    unsigned int encoded_size = (unsigned int)map_header->size;
+    char* encoded_data = (char*)malloc(encoded_size * sizeof(char));
+    exit_on_error(encoded_size && encoded_data == NULL);
+
+    ssize_t rw_result = read(fd, encoded_data, encoded_size * sizeof(char));
+    exit_on_error(rw_result < (ssize_t)(encoded_size * sizeof(char)));
+
+    int result = rle_decode(encoded_data, encoded_size, map_data, map_size);
+    if (result < 0)
+    {
+        fprintf(stderr, "Malformed encoded map data!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(encoded_data);
+
+    return map_data;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write map data.
+ *
+ *************************************************************/
+void write_map_data(int fd, MapHeader* map_header, const char* map_data)
+{
+    if (map_header->signature == MAPC_HEADER || 
+        map_header->signature == MAPC_RLE_HEADER)
+    {
+        write_map_chunks(fd, map_header, map_data);
+        return;
+    }
+
+    unsigned int map_size = 
+        map_header->width * map_header->height * map_header->cell_size;
+    const char* stored_data = map_data;
+    char* encoded_data = NULL;
+
+    map_header->size = map_size;
+    if (map_header->signature == MAPF_RLE_HEADER)
+    {
+        encoded_data = (char*)malloc(
+            RLE_MAX_ENCODED_SIZE(map_size) * sizeof(char)
+        );
+        exit_on_error(map_size && encoded_data == NULL);
+
+        map_header->size = rle_encode(map_data, map_size, encoded_data);
+        stored_data = encoded_data;
+    }
+
+    write_mapf_header(fd, map_header);
+
+    ssize_t rw_result = write(fd, stored_data, map_header->size * sizeof(char));
+    exit_on_error(rw_result < 0);
+
+    free(encoded_data);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read map chunks.
+ *
+ *************************************************************/
+void read_map_chunks(int fd, const MapHeader* map_header, char* map_data)
+{
+    /* Planes of wide tiles are chunked as extra rows */
+
+    unsigned int map_width = map_header->width;
+    unsigned int map_height = map_header->height * map_header->cell_size;
+    unsigned int chunk_width = (unsigned int)map_header->size;
+    if (!chunk_width || chunk_width != map_header->size)
+    {
+        fprintf(stderr, "Invalid chunk width!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Chunk table */
+
+    unsigned int chunk_count = (map_width + chunk_width - 1) / chunk_width;
+    size_t offset_size = get_offset_size(map_header->version);
+    unsigned long long* chunk_offsets = (unsigned long long*)calloc(
+        chunk_count + 1,
+        sizeof(unsigned long long)
+    );
+    exit_on_error(chunk_offsets == NULL);
+
+    for (unsigned int i = 0; i <= chunk_count; ++i)
+    {
+        ssize_t rw_result = read(fd, &chunk_offsets[i], offset_size);
+        exit_on_error(rw_result < (ssize_t)offset_size);
+    }
+
+    /* Chunks */
+
+    char* chunk = (char*)malloc(
+        (chunk_width * map_height + RLE_DECODE_PADDING) * sizeof(char)
+    );
+    exit_on_error(chunk == NULL);
+
+    for (unsigned int i = 0; i < chunk_count; ++i)
+    {
+        unsigned int chunk_x = i * chunk_width;
+        unsigned int chunk_w = map_width - chunk_x;
+        if (chunk_w > chunk_width)
+        {
+            chunk_w = chunk_width;
+        }
+
+        unsigned int chunk_size = chunk_w * map_height;
+        if (chunk_offsets[i + 1] < chunk_offsets[i])
+        {
+            fprintf(stderr, "Chunk offset [%llx] does not match!\n", 
+                chunk_offsets[i + 1]);
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned int stored_size = 
+            (unsigned int)(chunk_offsets[i + 1] - chunk_offsets[i]);
+        if (map_header->signature == MAPC_RLE_HEADER)
+        {
+            char* encoded_data = (char*)malloc(stored_size * sizeof(char));
+            exit_on_error(stored_size && encoded_data == NULL);
+
+            ssize_t rw_result = 
+                read(fd, encoded_data, stored_size * sizeof(char));
+            exit_on_error(rw_result < (ssize_t)(stored_size * sizeof(char)));
+
+            int result = rle_decode(
+                encoded_data, 
+                stored_size, 
+                chunk, 
+                chunk_size
+            );
+            if (result < 0)
+            {
+                fprintf(stderr, "Malformed encoded chunk!\n");
+                exit(EXIT_FAILURE);
+            }
+
+            free(encoded_data);
+        }
+        else
+        {
+            if (stored_size != chunk_size)
+            {
+                fprintf(stderr, "Chunk size [%x] does not match!\n", 
+                    stored_size);
+                exit(EXIT_FAILURE);
+            }
+
+            ssize_t rw_result = read(fd, chunk, chunk_size * sizeof(char));
+            exit_on_error(rw_result < (ssize_t)(chunk_size * sizeof(char)));
+        }
+
+        for (unsigned int y = 0; y < map_height; ++y)
+        {
+            memcpy(
+                &map_data[y * map_width + chunk_x], 
+                &chunk[y * chunk_w], 
+                chunk_w * sizeof(char)
+            );
+        }
+    }
+
+    free(chunk);
+    free(chunk_offsets);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write map chunks.
+ *
+ *************************************************************/
+void write_map_chunks(
+    int fd, const MapHeader* map_header, const char* map_data
+)
+{
+    /* Planes of wide tiles are chunked as extra rows */
+
+    unsigned int map_width = map_header->width;
+    unsigned int map_height = map_header->height * map_header->cell_size;
+    unsigned int chunk_width = (unsigned int)map_header->size;
+    if (!chunk_width || chunk_width != map_header->size)
+    {
+        fprintf(stderr, "Invalid chunk width!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned int chunk_count = (map_width + chunk_width - 1) / chunk_width;
+    size_t header_size = get_header_size(map_header->version);
+    size_t offset_size = get_offset_size(map_header->version);
+    unsigned int table_size = (chunk_count + 1) * offset_size;
+    unsigned int map_size = map_width * map_height;
+    int encoded = (map_header->signature == MAPC_RLE_HEADER);
+
+    /* Chunk table followed by the chunks */
+
+    char* stored_data = (char*)malloc(
+        table_size + 
+        (encoded ? RLE_MAX_ENCODED_SIZE(map_size) : map_size)
+    );
+    exit_on_error(stored_data == NULL);
+
+    char* chunk = (char*)malloc(chunk_width * map_height * sizeof(char));
+    exit_on_error(chunk == NULL);
+
+    unsigned int current_offset = table_size;
+    for (unsigned int i = 0; i < chunk_count; ++i)
+    {
+        unsigned int chunk_x = i * chunk_width;
+        unsigned int chunk_w = map_width - chunk_x;
+        if (chunk_w > chunk_width)
+        {
+            chunk_w = chunk_width;
+        }
+
+        for (unsigned int y = 0; y < map_height; ++y)
+        {
+            memcpy(
+                &chunk[y * chunk_w], 
+                &map_data[y * map_width + chunk_x], 
+                chunk_w * sizeof(char)
+            );
+        }
+
+        unsigned long long chunk_offset = header_size + current_offset;
+        memcpy(&stored_data[i * offset_size], &chunk_offset, offset_size);
+        if (encoded)
+        {
+            current_offset += rle_encode(
+                chunk, 
+                chunk_w * map_height, 
+                &stored_data[current_offset]
+            );
+        }
+        else
+        {
+            memcpy(
+                &stored_data[current_offset], 
+                chunk, 
+                chunk_w * map_height * sizeof(char)
+            );
+            current_offset += chunk_w * map_height;
+        }
+    }
+
+    unsigned long long chunks_end = header_size + current_offset;
+    memcpy(
+        &stored_data[chunk_count * offset_size], 
+        &chunks_end, 
+        offset_size
+    );
+
+    write_mapf_header(fd, map_header);
+
+    ssize_t rw_result = 
+        write(fd, stored_data, current_offset * sizeof(char));
+    exit_on_error(rw_result < 0);
+
+    free(chunk);
+    free(stored_data);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Validate object header.
+ *
+ *************************************************************/
+void validate_object_properties_header(int fd)
+{
+    unsigned int header;
+    ssize_t rw_result = read(fd, &header, sizeof(unsigned int));
+    exit_on_error(rw_result < 0);
+
+    if (header != OBJECT_PROPERTIES_HEADER)
+    {
+        fprintf(
+            stderr,
+            "Object header [%x] does not match!\n",
+            header
+        );
+
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Go to MAPF.
+ *
+ *************************************************************/
+void seek_mapf_header(int fd, unsigned int level)
+{
+    if (level >= read_level_count(fd))
+    {
+        fprintf(stderr, "Level [%x] does not exist!\n", level);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long long map_offset = read_archive_offset(fd, 1);
+    if (level)
+    {
+        /* Entry of the level in the directory */
+
+        ssize_t rw_result = pread(
+            fd, 
+            &map_offset, 
+            sizeof(unsigned long long), 
+            read_archive_offset(fd, 2) + 0x10 + level * 0x10
+        );
+        exit_on_error(rw_result < (ssize_t)sizeof(unsigned long long));
+    }
+
+    off_t seek_result = lseek(fd, map_offset, SEEK_SET);
+    exit_on_error(seek_result < 0);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read level count.
+ *
+ *************************************************************/
+unsigned int read_level_count(int fd)
+{
+    if (read_archive_version(fd) == MARC_VERSION_1)
+    {
+        return 1;
+    }
+
+    unsigned long long directory_offset = read_archive_offset(fd, 2);
+    if (!directory_offset)
+    {
+        return 1;
+    }
+
+    unsigned int directory_header[0x2];
+    ssize_t rw_result = pread(
+        fd, 
+        directory_header, 
+        sizeof(directory_header), 
+        directory_offset
+    );
+    exit_on_error(rw_result < (ssize_t)sizeof(directory_header));
+
+    if (directory_header[0x0] != MDIR_HEADER || !directory_header[0x1])
+    {
+        fprintf(
+            stderr,
+            "MDIR header [%x] does not match!\n",
+            directory_header[0x0]
+        );
+
+        exit(EXIT_FAILURE);
+    }
+
+    return directory_header[0x1];
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read levels.
+ *
+ *************************************************************/
+MapLevel* read_map_levels(int fd, unsigned int* level_count)
+{
+    unsigned int checksums[0x3];
+    int checksummed = read_archive_checksums(fd, checksums);
+
+    *level_count = read_level_count(fd);
+    MapLevel* levels = (MapLevel*)malloc(*level_count * sizeof(MapLevel));
+    exit_on_error(levels == NULL);
+
+    for (unsigned int i = 0; i < *level_count; ++i)
+    {
+        seek_mapf_header(fd, i);
+        read_mapf_header(fd, &levels[i].header);
+        levels[i].data = read_map_data(fd, &levels[i].header);
+
+        if (!checksummed || *level_count == 1)
+        {
+            continue;
+        }
+
+        /* Checksum of the level in the directory */
+
+        unsigned int checksum;
+        ssize_t rw_result = pread(
+            fd, 
+            &checksum, 
+            sizeof(unsigned int), 
+            read_archive_offset(fd, 2) + 0x10 + i * 0x10 + 0x8
+        );
+        exit_on_error(rw_result < (ssize_t)sizeof(unsigned int));
+
+        const MapHeader* map_header = &levels[i].header;
+        if (crc32c(
+                0, 
+                levels[i].data, 
+                map_header->width * map_header->height * 
+                map_header->cell_size
+            ) != checksum)
+        {
+            fprintf(
+                stderr,
+                "Checksum of the map data of level [%x] does not match!\n",
+                i
+            );
+
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return levels;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Write levels.
+ *
+ *************************************************************/
+void write_map_levels(int fd, MapLevel* levels, unsigned int level_count)
+{
+    unsigned long long* level_offsets = (unsigned long long*)malloc(
+        level_count * sizeof(unsigned long long)
+    );
+    exit_on_error(level_offsets == NULL);
+
+    /* Maps */
+
+    for (unsigned int i = 0; i < level_count; ++i)
+    {
+        off_t seek_result = lseek(fd, 0, SEEK_CUR);
+        exit_on_error(seek_result < 0);
+
+        level_offsets[i] = seek_result;
+        write_map_data(fd, &levels[i].header, levels[i].data);
+    }
+
+    write_archive_offset(fd, 1, level_offsets[0x0]);
+
+    if (read_archive_version(fd) == MARC_VERSION_1)
+    {
+        free(level_offsets);
+        return;
+    }
 
-    rw_result = write(fd_new, &new_tiles_count, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    /* Level directory */
 
-    /* Go to tile paths */
+    unsigned long long directory_offset = 0;
+    if (level_count > 1)
+    {
+        off_t seek_result = lseek(fd, 0, SEEK_CUR);
+        exit_on_error(seek_result < 0);
 
-    seek_result = lseek(fd_new, 0x8, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+        directory_offset = seek_result;
 
-    /* Remove unused paths */
+        unsigned int directory_header[0x4] = {MDIR_HEADER, level_count, 0, 0};
+        ssize_t rw_result = 
+            write(fd, directory_header, sizeof(directory_header));
+        exit_on_error(rw_result < 0);
 
-    char tile_paths[0x40];
-    for (unsigned int i = 0; i < tiles_count; ++i)
-    {
-        if (used_tiles[i])
+        for (unsigned int i = 0; i < level_count; ++i)
         {
-            rw_result = read(
-                fd_backup, 
-                tile_paths, 
-                0x40 * sizeof(char)
+            const MapHeader* map_header = &levels[i].header;
+            unsigned int checksum = crc32c(
+                0, 
+                levels[i].data, 
+                map_header->width * map_header->height * 
+                map_header->cell_size
             );
-            exit_on_error(rw_result < 0);
 
-            rw_result = write(
-                fd_new, 
-                tile_paths, 
-                0x40 * sizeof(char)
-            );
+            char entry[0x10] = {0};
+            memcpy(entry, &level_offsets[i], sizeof(unsigned long long));
+            memcpy(&entry[0x8], &checksum, sizeof(unsigned int));
+
+            rw_result = write(fd, entry, sizeof(entry));
             exit_on_error(rw_result < 0);
         }
-        else
-        {
-            seek_result = lseek(fd_backup, 0x40, SEEK_CUR);
-            exit_on_error(seek_result < 0);
-        }
     }
 
-    /* Update tile properties offset */
+    write_archive_offset(fd, 2, directory_offset);
 
-    seek_result = lseek(fd_new, 0, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    free(level_offsets);
+}
 
-    unsigned int object_properties_offset = (unsigned int)seek_result;
-    seek_result = lseek(fd_new, 0x8, SEEK_SET);
-    exit_on_error(seek_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Free levels.
+ *
+ *************************************************************/
+void free_map_levels(MapLevel* levels, unsigned int level_count)
+{
+    for (unsigned int i = 0; i < level_count; ++i)
+    {
+        free(levels[i].data);
+    }
 
-    rw_result = write(
-        fd_new, 
-        &object_properties_offset, 
-        sizeof(unsigned int)
-    );
-    exit_on_error(rw_result < 0);
+    free(levels);
+}
 
-    seek_result = lseek(fd_new, object_properties_offset, SEEK_SET);
-    exit_on_error(seek_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Is resizable in place.
+ *
+ *************************************************************/
+int is_resizable_in_place(int fd, const MapHeader* map_header)
+{
+    if (map_header->signature != MAPF_HEADER)
+    {
+        return 0;
+    }
 
-    /* Remove unused objects */
+    return read_archive_version(fd) == MARC_VERSION_1 || 
+        !read_archive_offset(fd, 2);
+}
 
-    char object_properties[0x20];
-    for (unsigned int i = 0; i < tiles_count; ++i)
+/*************************************************************
+ *************************************************************
+ *
+ * Resize map in place.
+ *
+ *************************************************************/
+void resize_map_in_place(
+    int fd, MapHeader* map_header, unsigned int map_width, 
+    unsigned int map_height
+)
+{
+    off_t map_data_offset = lseek(fd, 0, SEEK_CUR);
+    exit_on_error(map_data_offset < 0);
+
+    size_t backup_map_width = map_header->width;
+    size_t backup_map_height = map_header->height;
+    unsigned int cell_size = map_header->cell_size;
+
+    /* 
+        Rows moving towards the end of the archive are 
+        moved from the last one, the others from the first
+        one. A new row y comes from the row y + shift.
+     */
+
+    int backward = 
+        (map_width > backup_map_width || map_height > backup_map_height);
+    long long shift = (long long)backup_map_height - map_height;
+
+    size_t row_size = 
+        (map_width > backup_map_width ? map_width : backup_map_width);
+    size_t batch_rows = MAP_RESIZE_BUFFER_SIZE / row_size;
+    if (!batch_rows)
     {
-        validate_object_properties_header(fd_backup);
+        batch_rows = 1;
+    }
 
-        seek_result = lseek(fd_backup, -0x4, SEEK_CUR);
-        exit_on_error(seek_result < 0);
+    char* backup_rows = 
+        (char*)malloc(batch_rows * backup_map_width * sizeof(char));
+    char* rows = (char*)malloc(batch_rows * map_width * sizeof(char));
+    exit_on_error(backup_rows == NULL || rows == NULL);
 
-        if (used_tiles[i])
+    size_t row_width = 
+        (map_width < backup_map_width ? map_width : backup_map_width);
+    size_t batch_count = (map_height + batch_rows - 1) / batch_rows;
+    for (unsigned int i = 0; i < cell_size; ++i)
+    {
+        unsigned int plane = (backward ? cell_size - 1 - i : i);
+        for (size_t j = 0; j < batch_count; ++j)
         {
-            rw_result = read(
-                fd_backup, 
-                object_properties, 
-                0x20 * sizeof(char)
-            );
-            exit_on_error(rw_result < 0);
+            size_t batch = (backward ? batch_count - 1 - j : j);
+            long long first_row = (long long)(batch * batch_rows);
+            long long last_row = first_row + (long long)batch_rows;
+            if (last_row > (long long)map_height)
+            {
+                last_row = map_height;
+            }
+
+            /* Rows of the map read by the batch */
+
+            long long first_backup_row = first_row + shift;
+            long long last_backup_row = last_row + shift;
+            if (first_backup_row < 0)
+            {
+                first_backup_row = 0;
+            }
+            if (last_backup_row > (long long)backup_map_height)
+            {
+                last_backup_row = backup_map_height;
+            }
 
-            rw_result = write(
-                fd_new, 
-                object_properties, 
-                0x20 * sizeof(char)
+            if (first_backup_row < last_backup_row)
+            {
+                size_t size = 
+                    (size_t)(last_backup_row - first_backup_row) * 
+                    backup_map_width;
+                ssize_t rw_result = pread(
+                    fd, 
+                    backup_rows, 
+                    size, 
+                    map_data_offset + 
+                        (plane * backup_map_height + first_backup_row) * 
+                        backup_map_width
+                );
+                exit_on_error(rw_result < (ssize_t)size);
+            }
+
+            /* Resized rows */
+
+            for (long long y = first_row; y < last_row; ++y)
+            {
+                char* row = &rows[(y - first_row) * map_width];
+                long long backup_y = y + shift;
+                size_t copied = 0;
+                if (backup_y >= first_backup_row && backup_y < last_backup_row)
+                {
+                    memcpy(
+                        row, 
+                        &backup_rows[
+                            (backup_y - first_backup_row) * backup_map_width
+                        ], 
+                        row_width * sizeof(char)
+                    );
+                    copied = row_width;
+                }
+
+                memset(
+                    &row[copied], 
+                    (char)MAP_OBJECT_NONE, 
+                    (map_width - copied) * sizeof(char)
+                );
+            }
+
+            size_t size = (size_t)(last_row - first_row) * map_width;
+            ssize_t rw_result = pwrite(
+                fd, 
+                rows, 
+                size, 
+                map_data_offset + 
+                    (plane * (size_t)map_height + first_row) * map_width
             );
-            exit_on_error(rw_result < 0);
-        }
-        else
-        {
-            seek_result = lseek(fd_backup, 0x20, SEEK_CUR);
-            exit_on_error(seek_result < 0);
+            exit_on_error(rw_result < (ssize_t)size);
         }
     }
 
-    /* Update map offset */
+    free(backup_rows);
+    free(rows);
 
-    seek_result = lseek(fd_new, 0, SEEK_CUR);
-    exit_on_error(seek_result < 0);
+    /* Header, then end of the archive */
 
-    unsigned int map_offset = (unsigned int)seek_result;
-    seek_result = lseek(fd_new, 0xc, SEEK_SET);
+    map_header->width = map_width;
+    map_header->height = map_height;
+    map_header->size = (unsigned long long)map_width * map_height * cell_size;
+
+    off_t seek_result = lseek(
+        fd, 
+        map_data_offset - get_header_size(map_header->version), 
+        SEEK_SET
+    );
     exit_on_error(seek_result < 0);
 
-    rw_result = write(fd_new, &map_offset, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    write_mapf_header(fd, map_header);
 
-    seek_result = lseek(fd_new, map_offset, SEEK_SET);
+    seek_result = lseek(fd, map_header->size, SEEK_CUR);
     exit_on_error(seek_result < 0);
 
-    /* MAPF header */
-    
-    char mapf_header[0xf];
-    rw_result = read(fd_backup, mapf_header, 0xf * sizeof(char));
-    exit_on_error(rw_result < 0);
+    int result = ftruncate(fd, seek_result);
+    exit_on_error(result < 0);
+}
 
-    rw_result = write(fd_new, mapf_header, 0xf * sizeof(char));
-    exit_on_error(rw_result < 0);
+/*************************************************************
+ *************************************************************
+ *
+ * Resize level.
+ *
+ *************************************************************/
+void resize_map_level(
+    MapLevel* level, unsigned int map_width, unsigned int map_height
+)
+{
+    MapHeader* map_header = &level->header;
+    unsigned int backup_map_width = map_header->width;
+    unsigned int backup_map_height = map_header->height;
+    unsigned int cell_size = map_header->cell_size;
 
-    /* Copy map */
+    char* map_data = (char*)malloc(
+        map_width * map_height * cell_size * sizeof(char)
+    );
+    exit_on_error(map_data == NULL);
 
-    char diff = (char)(tiles_count - new_tiles_count);
-    for (unsigned int y = 0; y < map_height; ++y)
+    unsigned int kept_width = 
+        (map_width < backup_map_width ? map_width : backup_map_width);
+    for (unsigned int i = 0; i < cell_size; ++i)
     {
-        for (unsigned int x = 0; x < map_width; ++x)
+        for (unsigned int y = 0; y < map_height; ++y)
         {
-            rw_result = read(fd_backup, &map_data, sizeof(char));
-            exit_on_error(rw_result < 0);
-            
-            if (map_data != (char)MAP_OBJECT_NONE &&
-                map_data > new_tiles_count)
+            char* row = &map_data[(i * map_height + y) * map_width];
+            if (y + backup_map_height < map_height)
             {
-                map_data -= diff;
+                /* Row added on the top side */
+
+                memset(row, (char)MAP_OBJECT_NONE, map_width * sizeof(char));
+                continue;
             }
 
-            rw_result = write(fd_new, &map_data, sizeof(char));
-            exit_on_error(rw_result < 0);
+            const char* backup_row = &level->data[
+                (i * backup_map_height + y + backup_map_height - map_height) * 
+                backup_map_width
+            ];
+            memcpy(row, backup_row, kept_width * sizeof(char));
+            memset(
+                &row[kept_width], 
+                (char)MAP_OBJECT_NONE, 
+                (map_width - kept_width) * sizeof(char)
+            );
         }
     }
 
-    seek_result = lseek(fd_new, 0, SEEK_CUR);
-    exit_on_error(seek_result < 0);
-
-    int result = ftruncate(fd_new, seek_result);
-    exit_on_error(result < 0);
-
-    result = close(fd_backup);
-    exit_on_error(result < 0);
-
-    result = close(fd_new);
-    exit_on_error(result < 0);
+    free(level->data);
+    level->data = map_data;
+    map_header->width = map_width;
+    map_header->height = map_height;
 }
 
-
 /*************************************************************
  *************************************************************
  *
- * Validate MARC.
+ * Exit on archive error.
  *
  *************************************************************/
-void validate_marc_header(int fd)
+void exit_on_archive_error(const char* filename, int result)
 {
-    unsigned int header;
-    ssize_t rw_result = read(fd, &header, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    if (result == MAP_ARCHIVE_ERROR_IO)
+    {
+        exit_on_error(1);
+    }
 
-    if (header != MARC_HEADER)
+    if (result < 0)
     {
         fprintf(
             stderr,
-            "MARC header [%x] does not match!\n",
-            header
+            "%s: %s!\n",
+            filename,
+            map_archive_strerror(result)
         );
 
         exit(EXIT_FAILURE);
@@ -1178,68 +3825,193 @@ void validate_marc_header(int fd)
 /*************************************************************
  *************************************************************
  *
- * Validate MAPF.
+ * Count cells.
  *
  *************************************************************/
-void validate_mapf_header(int fd)
+void count_cells(
+    CellStats* stats, unsigned int first_column, 
+    unsigned int last_column, unsigned int row, unsigned int count
+)
 {
-    unsigned int header;
-    ssize_t rw_result = read(fd, &header, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
-
-    if (header != MAPF_HEADER)
+    if (!stats->cells)
     {
-        fprintf(
-            stderr,
-            "MARF header [%x] does not match!\n",
-            header
-        );
+        stats->first_column = first_column;
+        stats->first_row = row;
+    }
+    else if (first_column < stats->first_column)
+    {
+        stats->first_column = first_column;
+    }
 
-        exit(EXIT_FAILURE);
+    if (last_column > stats->last_column)
+    {
+        stats->last_column = last_column;
     }
+
+    stats->last_row = row;
+    stats->cells += count;
 }
 
 /*************************************************************
  *************************************************************
  *
- * Validate object header.
+ * Count row cells.
  *
  *************************************************************/
-void validate_object_properties_header(int fd)
+void count_row_cells(
+    const unsigned char* low_plane, const unsigned char* high_plane,
+    unsigned int map_width, unsigned int row, CellStats* stats
+)
 {
-    unsigned int header;
-    ssize_t rw_result = read(fd, &header, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    unsigned int x = 0;
 
-    if (header != OBJECT_PROPERTIES_HEADER)
+#ifdef __SSE2__
+    for (; x + 0x10 <= map_width; x += 0x10)
     {
-        fprintf(
-            stderr,
-            "Object header [%x] does not match!\n",
-            header
+        /* Cells holding the same value as the first one */
+
+        __m128i block = _mm_loadu_si128((const __m128i*)&low_plane[x]);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(block, _mm_set1_epi8((char)low_plane[x]))
         );
+        if (high_plane)
+        {
+            block = _mm_loadu_si128((const __m128i*)&high_plane[x]);
+            mask &= (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(block, _mm_set1_epi8((char)high_plane[x]))
+            );
+        }
 
-        exit(EXIT_FAILURE);
+        if (mask == 0xffff)
+        {
+            unsigned int value = low_plane[x] | 
+                (high_plane ? high_plane[x] << 8 : 0);
+            count_cells(&stats[value], x, x + 0xf, row, 0x10);
+            continue;
+        }
+
+        for (unsigned int i = x; i < x + 0x10; ++i)
+        {
+            unsigned int value = low_plane[i] | 
+                (high_plane ? high_plane[i] << 8 : 0);
+            count_cells(&stats[value], i, i, row, 1);
+        }
+    }
+#endif
+
+    for (; x < map_width; ++x)
+    {
+        unsigned int value = low_plane[x] | 
+            (high_plane ? high_plane[x] << 8 : 0);
+        count_cells(&stats[value], x, x, row, 1);
     }
 }
 
 /*************************************************************
  *************************************************************
  *
- * Go to MAPF.
+ * Read tile color.
  *
  *************************************************************/
-void seek_mapf_header(int fd)
+int read_tile_color(
+    const char* filename, const char* tile_path, 
+    unsigned int background, unsigned int* color
+)
 {
-    off_t seek_result = lseek(fd, 0xc, SEEK_SET);
-    exit_on_error(seek_result < 0);
+    if (!read_png_color(tile_path, background, color))
+    {
+        return 0;
+    }
 
-    unsigned int map_offset;
-    ssize_t rw_result = read(fd, &map_offset, sizeof(unsigned int));
-    exit_on_error(rw_result < 0);
+    if (tile_path[0] == '/')
+    {
+        return -1;
+    }
 
-    seek_result = lseek(fd, map_offset, SEEK_SET);
-    exit_on_error(seek_result < 0);
+    /* Tile paths are relative to the root of the game */
+
+    const char* separator = strrchr(filename, '/');
+    size_t directory_size = (separator ? separator - filename + 1 : 0);
+    size_t size = directory_size + strlen(tile_path) + 0x4;
+    char* png_filename = (char*)malloc(size * sizeof(char));
+    exit_on_error(png_filename == NULL);
+
+    snprintf(
+        png_filename, 
+        size, 
+        "%.*s../%s", 
+        (int)directory_size, 
+        filename, 
+        tile_path
+    );
+
+    int result = read_png_color(png_filename, background, color);
+
+    free(png_filename);
+
+    return result;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Read PNG color.
+ *
+ *************************************************************/
+int read_png_color(
+    const char* png_filename, unsigned int background, 
+    unsigned int* color
+)
+{
+    png_image image;
+    memset(&image, 0, sizeof(png_image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, png_filename))
+    {
+        png_image_free(&image);
+        return -1;
+    }
+
+    image.format = PNG_FORMAT_RGBA;
+    size_t pixel_count = (size_t)image.width * image.height;
+    unsigned char* pixels = 
+        (unsigned char*)malloc(PNG_IMAGE_SIZE(image) * sizeof(char));
+    if (pixels == NULL || 
+        !png_image_finish_read(&image, NULL, pixels, 0, NULL) ||
+        !pixel_count)
+    {
+        png_image_free(&image);
+        free(pixels);
+        return -1;
+    }
+
+    /* Channels weighted by the opacity, then the background */
+
+    unsigned long long sums[0x3] = {0};
+    unsigned long long opacity = 0;
+    for (size_t i = 0; i < pixel_count; ++i)
+    {
+        const unsigned char* pixel = &pixels[i * 0x4];
+        sums[0x0] += (unsigned long long)pixel[0x0] * pixel[0x3];
+        sums[0x1] += (unsigned long long)pixel[0x1] * pixel[0x3];
+        sums[0x2] += (unsigned long long)pixel[0x2] * pixel[0x3];
+        opacity += pixel[0x3];
+    }
+
+    free(pixels);
+
+    unsigned long long total = (unsigned long long)pixel_count * 0xff;
+    *color = 0;
+    for (unsigned int channel = 0; channel < 0x3; ++channel)
+    {
+        unsigned long long background_channel = 
+            (background >> (0x10 - channel * 0x8)) & 0xff;
+        unsigned long long value = (sums[channel] + 
+            background_channel * (total - opacity) + total / 2) / total;
+        *color |= (unsigned int)value << (0x10 - channel * 0x8);
+    }
+
+    return 0;
 }
 
 /*************************************************************
@@ -1273,45 +4045,79 @@ char* backup_archive(const char* filename)
     strcat(backup_filename, time_str_buffer);
     strcat(backup_filename, backup_suffix);
 
-    pid_t child_pid = fork();
-    if (!child_pid)
-    {
-        int fd_null = open("/dev/null", O_WRONLY, 0600);
-        exit_on_error(fd_null < 0);
-
-        int result = dup2(fd_null, STDERR_FILENO);
-        exit_on_error(result < 0);
-
-        result = close(fd_null);
-        exit_on_error(result < 0);
+    /* Permissions of the archive are kept */
 
-        result = execlp(
-            "cp",
-            "cp", 
-            filename,
+    int fd_in = open(filename, O_RDONLY);
+    struct stat stat_in;
+    int result = (fd_in < 0 ? -1 : fstat(fd_in, &stat_in));
+    int fd_out = -1;
+    if (!result)
+    {
+        fd_out = open(
             backup_filename, 
-            NULL
+            O_CREAT | O_WRONLY | O_TRUNC, 
+            stat_in.st_mode & 0777
         );
-        exit(EXIT_FAILURE);
+        result = (fd_out < 0 ? -1 : 0);
     }
 
-    int status;
-    int result = wait(&status);
-    exit_on_error(result < 0);
-    
-    if (WIFEXITED(status))
+    /* 
+        Copy
+
+        A reflink shares the extents of the archive on 
+        file systems supporting it, otherwise the data is
+        copied by the kernel, without going through user
+        space.
+     */
+
+    if (!result && ioctl(fd_out, FICLONE, fd_in) < 0)
     {
-        if (WEXITSTATUS(status))
+        off_t remaining = stat_in.st_size;
+        int copy_range = 1;
+        while (!result && remaining > 0)
         {
-            fprintf(
-                stderr, 
-                "Failed to backup %s\n!", 
-                filename
-            );
-            exit(EXIT_FAILURE);
-        }    
+            ssize_t copied = -1;
+            if (copy_range)
+            {
+                copied = copy_file_range(
+                    fd_in, 
+                    NULL, 
+                    fd_out, 
+                    NULL, 
+                    remaining, 
+                    0
+                );
+                if (copied < 0 && (errno == EXDEV || errno == ENOSYS || 
+                                   errno == EINVAL || errno == EOPNOTSUPP))
+                {
+                    copy_range = 0;
+                    continue;
+                }
+            }
+            else
+            {
+                copied = sendfile(fd_out, fd_in, NULL, remaining);
+            }
+
+            if (copied <= 0)
+            {
+                result = -1;
+            }
+            remaining -= copied;
+        }
     }
-    else
+
+    if (fd_in >= 0 && close(fd_in) < 0)
+    {
+        result = -1;
+    }
+
+    if (fd_out >= 0 && close(fd_out) < 0)
+    {
+        result = -1;
+    }
+
+    if (result < 0)
     {
         fprintf(
             stderr, 
@@ -1332,48 +4138,11 @@ char* backup_archive(const char* filename)
  *************************************************************/
 void remove_archive(const char* filename)
 {
-    pid_t child_pid = fork();
-    if (!child_pid)
-    {
-        int fd_null = open("/dev/null", O_WRONLY, 0600);
-        exit_on_error(fd_null < 0);
-
-        int result = dup2(fd_null, STDERR_FILENO);
-        exit_on_error(result < 0);
-
-        result = close(fd_null);
-        exit_on_error(result < 0);
-
-        result = execlp(
-            "rm",
-            "rm", 
-            filename, 
-            NULL
-        );
-        exit(EXIT_FAILURE);
-    }
-
-    int status;
-    int result = wait(&status);
-    exit_on_error(result < 0);
-    
-    if (WIFEXITED(status))
-    {
-        if (WEXITSTATUS(status))
-        {
-            fprintf(
-                stderr, 
-                "Failed to remove %s\n!", 
-                filename
-            );
-            exit(EXIT_FAILURE);
-        }    
-    }
-    else
+    if (unlink(filename) < 0)
     {
         fprintf(
             stderr, 
-            "Failed to backup %s\n!", 
+            "Failed to remove %s\n!", 
             filename
         );
         exit(EXIT_FAILURE);
@@ -0,0 +1,440 @@
+/*!
+ * \ingroup util_group
+ * \file pathtable.c
+ * \brief Implementation of functions related to the
+ *        tables of tile paths of map archives.
+ *
+ * Implementation of the functions declared in the \ref
+ * pathtable.h header.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#define _GNU_SOURCE
+
+#include "pathtable.h"
+#include "crc32c.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/*!
+ * \brief The find_path() function looks for a path in
+ *        the pool of a table.
+ *
+ * \param table Table of tile paths.
+ * \param path Path of a tile.
+ * \param length Length of the path.
+ *
+ * \return The index of the bucket holding the path, or
+ *         of the empty bucket where it belongs.
+ */
+static unsigned int find_path(
+    const PathTable* table, const char* path, size_t length
+);
+
+/*!
+ * \brief The rehash_paths() function resizes the hash
+ *        table of the distinct paths of a table.
+ *
+ * \param table Table of tile paths.
+ * \param bucket_count Number of buckets, a power of `2`.
+ *
+ * \return \p **0** if the hash table is resized, \p **-1**
+ *         otherwise.
+ */
+static int rehash_paths(PathTable* table, unsigned int bucket_count);
+
+/*!
+ * \brief The intern_path() function adds a path to the
+ *        pool of a table, unless it is already there.
+ *
+ * \param table Table of tile paths.
+ * \param path Path of a tile, not necessarily terminated.
+ * \param length Length of the path.
+ *
+ * \return The offset of the path in the pool, or \p **-1**
+ *         if the pool cannot grow.
+ */
+static long long intern_path(
+    PathTable* table, const char* path, size_t length
+);
+
+/*!
+ * \brief The append_tile() function appends a tile
+ *        referencing an interned path to a table.
+ *
+ * \param table Table of tile paths.
+ * \param offset Offset of the path in the pool.
+ *
+ * \return \p **0** if the tile is appended, \p **-1** if
+ *         the table cannot grow.
+ */
+static int append_tile(PathTable* table, unsigned int offset);
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Initialize.
+ *
+ *************************************************************/
+void path_table_init(PathTable* table)
+{
+    memset(table, 0, sizeof(PathTable));
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Free.
+ *
+ *************************************************************/
+void path_table_free(PathTable* table)
+{
+    free(table->offsets);
+    free(table->strings);
+    free(table->buckets);
+
+    path_table_init(table);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Add.
+ *
+ *************************************************************/
+int path_table_add(PathTable* table, const char* path)
+{
+    size_t length = strlen(path);
+    if (length > PATH_TABLE_MAX_LENGTH)
+    {
+        return -1;
+    }
+
+    long long offset = intern_path(table, path, length);
+    if (offset < 0)
+    {
+        return -1;
+    }
+
+    return append_tile(table, (unsigned int)offset);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Get.
+ *
+ *************************************************************/
+const char* path_table_get(const PathTable* table, unsigned int index)
+{
+    return &table->strings[table->offsets[index]];
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Encoding.
+ *
+ *************************************************************/
+unsigned int path_table_encoding(const char* section, size_t size)
+{
+    unsigned int signature = 0;
+    if (size >= sizeof(unsigned int))
+    {
+        memcpy(&signature, section, sizeof(unsigned int));
+    }
+
+    return (signature == MSTR_HEADER ? PATH_TABLE_PACKED : PATH_TABLE_FIXED);
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Parse.
+ *
+ *************************************************************/
+ssize_t path_table_parse(
+    PathTable* table, const char* section, size_t size,
+    unsigned int count
+)
+{
+    if (path_table_encoding(section, size) == PATH_TABLE_FIXED)
+    {
+        if (size < (size_t)count * 0x40)
+        {
+            return -1;
+        }
+
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            const char* path = &section[(size_t)i * 0x40];
+            long long offset = intern_path(
+                table,
+                path,
+                strnlen(path, PATH_TABLE_MAX_LENGTH)
+            );
+            if (offset < 0 || append_tile(table, (unsigned int)offset) < 0)
+            {
+                return -1;
+            }
+        }
+
+        return (ssize_t)count * 0x40;
+    }
+
+    /* Header, offsets and pool */
+
+    unsigned int header[0x4];
+    if (size < sizeof(header))
+    {
+        return -1;
+    }
+    memcpy(header, section, sizeof(header));
+
+    size_t offsets_size = (size_t)count * sizeof(unsigned int);
+    size_t pool_size = header[0x2];
+    size_t table_size =
+        (sizeof(header) + offsets_size + pool_size + 0x3) & ~(size_t)0x3;
+    if (table_size > size || (pool_size && section[
+            sizeof(header) + offsets_size + pool_size - 1
+        ] != '\0'))
+    {
+        return -1;
+    }
+
+    const char* pool = &section[sizeof(header) + offsets_size];
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        unsigned int path_offset;
+        memcpy(
+            &path_offset,
+            &section[sizeof(header) + i * sizeof(unsigned int)],
+            sizeof(unsigned int)
+        );
+        if (path_offset >= pool_size)
+        {
+            return -1;
+        }
+
+        const char* path = &pool[path_offset];
+        size_t length = strlen(path);
+        if (length > PATH_TABLE_MAX_LENGTH)
+        {
+            return -1;
+        }
+
+        long long offset = intern_path(table, path, length);
+        if (offset < 0 || append_tile(table, (unsigned int)offset) < 0)
+        {
+            return -1;
+        }
+    }
+
+    return (ssize_t)table_size;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Size.
+ *
+ *************************************************************/
+size_t path_table_size(const PathTable* table, unsigned int encoding)
+{
+    if (encoding == PATH_TABLE_FIXED)
+    {
+        return (size_t)table->count * 0x40;
+    }
+
+    return (0x10 + (size_t)table->count * sizeof(unsigned int) +
+        table->strings_size + 0x3) & ~(size_t)0x3;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Format.
+ *
+ *************************************************************/
+void path_table_format(
+    const PathTable* table, unsigned int encoding, char* section
+)
+{
+    memset(section, 0, path_table_size(table, encoding));
+
+    if (encoding == PATH_TABLE_FIXED)
+    {
+        for (unsigned int i = 0; i < table->count; ++i)
+        {
+            strcpy(&section[(size_t)i * 0x40], path_table_get(table, i));
+        }
+
+        return;
+    }
+
+    unsigned int header[0x4] = {
+        MSTR_HEADER,
+        table->string_count,
+        (unsigned int)table->strings_size
+    };
+    memcpy(section, header, sizeof(header));
+
+    size_t offsets_size = (size_t)table->count * sizeof(unsigned int);
+    memcpy(&section[sizeof(header)], table->offsets, offsets_size);
+    memcpy(
+        &section[sizeof(header) + offsets_size],
+        table->strings,
+        table->strings_size
+    );
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Find path.
+ *
+ *************************************************************/
+unsigned int find_path(
+    const PathTable* table, const char* path, size_t length
+)
+{
+    unsigned int mask = table->bucket_count - 1;
+    unsigned int bucket = crc32c(0, path, length) & mask;
+    while (table->buckets[bucket])
+    {
+        const char* interned = &table->strings[table->buckets[bucket] - 1];
+        if (!strncmp(interned, path, length) && interned[length] == '\0')
+        {
+            break;
+        }
+
+        bucket = (bucket + 1) & mask;
+    }
+
+    return bucket;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Rehash paths.
+ *
+ *************************************************************/
+int rehash_paths(PathTable* table, unsigned int bucket_count)
+{
+    unsigned int* buckets =
+        (unsigned int*)calloc(bucket_count, sizeof(unsigned int));
+    if (buckets == NULL)
+    {
+        return -1;
+    }
+
+    unsigned int* previous_buckets = table->buckets;
+    unsigned int previous_count = table->bucket_count;
+    table->buckets = buckets;
+    table->bucket_count = bucket_count;
+
+    for (unsigned int i = 0; i < previous_count; ++i)
+    {
+        if (previous_buckets[i])
+        {
+            const char* path = &table->strings[previous_buckets[i] - 1];
+            buckets[find_path(table, path, strlen(path))] =
+                previous_buckets[i];
+        }
+    }
+
+    free(previous_buckets);
+
+    return 0;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Intern path.
+ *
+ *************************************************************/
+long long intern_path(PathTable* table, const char* path, size_t length)
+{
+    /* The hash table is kept at most half full */
+
+    if (2 * (table->string_count + 1) > table->bucket_count &&
+        rehash_paths(
+            table,
+            table->bucket_count ? 2 * table->bucket_count : 0x40
+        ) < 0)
+    {
+        return -1;
+    }
+
+    unsigned int bucket = find_path(table, path, length);
+    if (table->buckets[bucket])
+    {
+        return table->buckets[bucket] - 1;
+    }
+
+    if (table->strings_size + length + 1 > table->strings_capacity)
+    {
+        size_t capacity =
+            (table->strings_capacity ? 2 * table->strings_capacity : 0x400);
+        while (table->strings_size + length + 1 > capacity)
+        {
+            capacity *= 2;
+        }
+
+        char* strings = (char*)realloc(table->strings, capacity);
+        if (strings == NULL)
+        {
+            return -1;
+        }
+
+        table->strings = strings;
+        table->strings_capacity = capacity;
+    }
+
+    size_t offset = table->strings_size;
+    memcpy(&table->strings[offset], path, length);
+    table->strings[offset + length] = '\0';
+    table->strings_size += length + 1;
+    table->string_count++;
+
+    table->buckets[bucket] = (unsigned int)offset + 1;
+
+    return (long long)offset;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Append tile.
+ *
+ *************************************************************/
+int append_tile(PathTable* table, unsigned int offset)
+{
+    if (table->count == table->capacity)
+    {
+        unsigned int capacity =
+            (table->capacity ? 2 * table->capacity : 0x40);
+        unsigned int* offsets = (unsigned int*)realloc(
+            table->offsets,
+            capacity * sizeof(unsigned int)
+        );
+        if (offsets == NULL)
+        {
+            return -1;
+        }
+
+        table->offsets = offsets;
+        table->capacity = capacity;
+    }
+
+    table->offsets[table->count++] = offset;
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*!
+ * \ingroup util_group
+ * \file rle.c
+ * \brief Implementation of functions related to the
+ *        run-length encoding of map data.
+ *
+ * Implementation of the functions declared in the \ref
+ * rle.h header.
+ *
+ * \author H.Decoudras
+ * \version 1
+ */
+
+#include "rle.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+/*!
+ * \brief Maximum length of a run.
+ */
+#define RLE_MAX_RUN 0xff
+
+
+/*************************************************************
+ *************************************************************
+ *
+ * Encode.
+ *
+ *************************************************************/
+size_t rle_encode(const char* data, size_t size, char* encoded)
+{
+    size_t encoded_size = 0;
+    size_t i = 0;
+    while (i < size)
+    {
+        char value = data[i];
+        size_t run = 1;
+        while (i + run < size && 
+               run < RLE_MAX_RUN && 
+               data[i + run] == value)
+        {
+            ++run;
+        }
+
+        encoded[encoded_size++] = (char)run;
+        encoded[encoded_size++] = value;
+        i += run;
+    }
+
+    return encoded_size;
+}
+
+/*************************************************************
+ *************************************************************
+ *
+ * Decode.
+ *
+ *************************************************************/
+int rle_decode(
+    const char* encoded, size_t encoded_size, char* data, size_t size
+)
+{
+    if (encoded_size % 2)
+    {
+        return -1;
+    }
+
+    size_t position = 0;
+    for (size_t i = 0; i < encoded_size; i += 2)
+    {
+        size_t run = (unsigned char)encoded[i];
+        if (!run || run > size - position)
+        {
+            return -1;
+        }
+
+        /* Expand the run */
+
+#ifdef __SSE2__
+        __m128i value = _mm_set1_epi8(encoded[i + 1]);
+        for (size_t j = 0; j < run; j += 0x10)
+        {
+            _mm_storeu_si128((__m128i*)&data[position + j], value);
+        }
+#else
+        memset(&data[position], encoded[i + 1], run);
+#endif
+
+        position += run;
+    }
+
+    return (position == size ? 0 : -1);
+}